@@ -5,6 +5,61 @@
 #include <queue>   
 #include <exception>
 #include <map>
+#include <set>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <memory>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <unordered_map>
+#include <unordered_set>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <csignal>
+#include <deque>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Build with -DLIBRARY_METRICS=0 to compile the instrumentation out entirely.
+#ifndef LIBRARY_METRICS
+#define LIBRARY_METRICS 1
+#endif
+// Latency is timed on one call in every LIBRARY_METRICS_SAMPLE_EVERY (a power of
+// two) per thread; call and failure counts are always exact.
+#ifndef LIBRARY_METRICS_SAMPLE_EVERY
+#define LIBRARY_METRICS_SAMPLE_EVERY 16
+#endif
+// Fine charged per day a loan is kept past its due date.
+#ifndef LIBRARY_FINE_PER_DAY
+#define LIBRARY_FINE_PER_DAY 10
+#endif
 
 using namespace std;
 
@@ -16,11 +71,395 @@ class Transaction;
 class LibraryException;
 class Library;
 
+enum LibraryErrorKind {
+    ERR_GENERIC,
+    ERR_BOOK_NOT_FOUND,
+    ERR_MEMBER_NOT_FOUND,
+    ERR_BOOK_NOT_AVAILABLE,
+    ERR_MAX_ISSUE_LIMIT,
+    ERR_PENDING_FINE,
+    ERR_INVALID_OPERATION,
+    ERR_INVALID_CREDENTIALS,
+    ERR_KIND_COUNT
+};
+
+enum LibraryOperation {
+    OP_ISSUE,
+    OP_RETURN,
+    OP_RESERVE,
+    OP_REPORT,
+    OP_PAY_FINE,
+    OP_COUNT
+};
+
+inline uint64_t metricsTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Measured once; converts raw tick deltas into nanoseconds when reporting.
+inline double metricsTicksPerNanosecond() {
+#if defined(__x86_64__) || defined(__i386__)
+    static const double ratio = [] {
+        auto wall_start = chrono::steady_clock::now();
+        uint64_t tick_start = __rdtsc();
+        this_thread::sleep_for(chrono::milliseconds(20));
+        uint64_t tick_end = __rdtsc();
+        auto wall_end = chrono::steady_clock::now();
+        double ns = chrono::duration<double, nano>(wall_end - wall_start).count();
+        return ns > 0 ? (tick_end - tick_start) / ns : 1.0;
+    }();
+    return ratio;
+#else
+    return 1.0;
+#endif
+}
+
+// Log-linear (HDR-style) histogram: values below 16 are exact, above that every
+// power of two is split into 16 sub-buckets, giving ~6% relative precision over
+// the full 64-bit range. Buckets are atomics so readers never block writers;
+// a histogram owned by one thread can use the cheaper recordSingleWriter().
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int BUCKET_COUNT = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    atomic<uint64_t> buckets[BUCKET_COUNT];
+    atomic<uint64_t> total_sum;
+    atomic<uint64_t> max_value;
+
+    LatencyHistogram() {
+        reset();
+    }
+
+    static int bucketFor(uint64_t value) {
+        if (value < (uint64_t)SUB_BUCKETS) {
+            return (int)value;
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + (int)((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t bucketUpperBound(int index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        int shift = index / SUB_BUCKETS - 1;
+        uint64_t sub = index % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << shift) - 1;
+    }
+
+    void record(uint64_t value) {
+        buckets[bucketFor(value)].fetch_add(1, memory_order_relaxed);
+        total_sum.fetch_add(value, memory_order_relaxed);
+        uint64_t seen = max_value.load(memory_order_relaxed);
+        while (value > seen && !max_value.compare_exchange_weak(seen, value, memory_order_relaxed)) {
+        }
+    }
+
+    // Plain load/store instead of locked read-modify-write; only valid while a
+    // single thread records into this histogram.
+    void recordSingleWriter(uint64_t value) {
+        atomic<uint64_t>& bucket = buckets[bucketFor(value)];
+        bucket.store(bucket.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        total_sum.store(total_sum.load(memory_order_relaxed) + value, memory_order_relaxed);
+        if (value > max_value.load(memory_order_relaxed)) {
+            max_value.store(value, memory_order_relaxed);
+        }
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < BUCKET_COUNT; i++) {
+            uint64_t n = other.buckets[i].load(memory_order_relaxed);
+            if (n) {
+                buckets[i].fetch_add(n, memory_order_relaxed);
+            }
+        }
+        total_sum.fetch_add(other.total_sum.load(memory_order_relaxed), memory_order_relaxed);
+        uint64_t other_max = other.max_value.load(memory_order_relaxed);
+        uint64_t seen = max_value.load(memory_order_relaxed);
+        while (other_max > seen && !max_value.compare_exchange_weak(seen, other_max, memory_order_relaxed)) {
+        }
+    }
+
+    void reset() {
+        for (auto& bucket : buckets) {
+            bucket.store(0, memory_order_relaxed);
+        }
+        total_sum.store(0, memory_order_relaxed);
+        max_value.store(0, memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (const auto& bucket : buckets) {
+            n += bucket.load(memory_order_relaxed);
+        }
+        return n;
+    }
+
+    double mean() const {
+        uint64_t n = count();
+        return n ? (double)total_sum.load(memory_order_relaxed) / n : 0.0;
+    }
+
+    // Upper bound of the bucket holding the given quantile (0.0 - 1.0).
+    uint64_t percentile(double quantile) const {
+        uint64_t n = count();
+        if (n == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(quantile * n);
+        if (rank >= n) {
+            rank = n - 1;
+        }
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKET_COUNT; i++) {
+            seen += buckets[i].load(memory_order_relaxed);
+            if (seen > rank) {
+                return min(bucketUpperBound(i), max_value.load(memory_order_relaxed));
+            }
+        }
+        return max_value.load(memory_order_relaxed);
+    }
+
+    // Number of recorded values that are at most the given bound.
+    uint64_t countAtOrBelow(uint64_t bound) const {
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKET_COUNT && bucketUpperBound(i) <= bound; i++) {
+            seen += buckets[i].load(memory_order_relaxed);
+        }
+        return seen;
+    }
+};
+
+// Per-thread slice of the operation metrics. Each thread only ever writes its
+// own shard, so the hot path needs no locked instructions; readers sum shards.
+class ThreadMetricsShard {
+public:
+    LatencyHistogram latency[OP_COUNT];   // sampled, in metricsTicks() units
+    atomic<uint64_t> calls[OP_COUNT];
+    atomic<uint64_t> failures[OP_COUNT];
+
+    ThreadMetricsShard() {
+        reset();
+    }
+
+    void reset() {
+        for (int op = 0; op < OP_COUNT; op++) {
+            latency[op].reset();
+            calls[op].store(0, memory_order_relaxed);
+            failures[op].store(0, memory_order_relaxed);
+        }
+    }
+};
+
+class LibraryMetrics {
+public:
+    mutex registry_mutex;
+    vector<ThreadMetricsShard*> shards;   // shards outlive their threads so counts are never lost
+    atomic<uint64_t> exceptions[ERR_KIND_COUNT];
+
+    LibraryMetrics() {
+        for (auto& counter : exceptions) {
+            counter.store(0, memory_order_relaxed);
+        }
+    }
+
+    static LibraryMetrics& instance() {
+        static LibraryMetrics metrics;
+        return metrics;
+    }
+
+    static ThreadMetricsShard& localShard() {
+        thread_local ThreadMetricsShard* shard = nullptr;
+        if (!shard) {
+            shard = new ThreadMetricsShard();
+            LibraryMetrics& metrics = instance();
+            lock_guard<mutex> lock(metrics.registry_mutex);
+            metrics.shards.push_back(shard);
+        }
+        return *shard;
+    }
+
+    static const char* operationName(int op) {
+        static const char* names[OP_COUNT] = {"issue", "return", "reserve", "report", "pay_fine"};
+        return names[op];
+    }
+
+    static const char* exceptionName(int kind) {
+        static const char* names[ERR_KIND_COUNT] = {
+            "LibraryException", "BookNotFoundException", "MemberNotFoundException",
+            "BookNotAvailableException", "MaxIssueLimitException", "PendingFineException",
+            "InvalidOperationException", "InvalidCredentialsException"
+        };
+        return names[kind];
+    }
+
+    static void recordException(LibraryErrorKind kind) {
+#if LIBRARY_METRICS
+        instance().exceptions[kind].fetch_add(1, memory_order_relaxed);
+#else
+        (void)kind;
+#endif
+    }
+
+    void collect(int op, LatencyHistogram& latency, uint64_t& calls, uint64_t& failures) {
+        lock_guard<mutex> lock(registry_mutex);
+        calls = 0;
+        failures = 0;
+        for (auto shard : shards) {
+            latency.merge(shard->latency[op]);
+            calls += shard->calls[op].load(memory_order_relaxed);
+            failures += shard->failures[op].load(memory_order_relaxed);
+        }
+    }
+
+    void reset() {
+        lock_guard<mutex> lock(registry_mutex);
+        for (auto shard : shards) {
+            shard->reset();
+        }
+        for (auto& counter : exceptions) {
+            counter.store(0, memory_order_relaxed);
+        }
+    }
+
+    void dump(ostream& out) {
+        double ticks_per_ns = metricsTicksPerNanosecond();
+        out << "\n======= PERFORMANCE METRICS =======" << endl;
+        out << left << setw(10) << "Operation" << right << setw(10) << "Calls" << setw(10) << "Failed"
+            << setw(12) << "Mean(ns)" << setw(12) << "p50(ns)" << setw(12) << "p99(ns)"
+            << setw(12) << "p999(ns)" << setw(12) << "Max(ns)" << endl;
+        for (int op = 0; op < OP_COUNT; op++) {
+            LatencyHistogram h;
+            uint64_t calls, failures;
+            collect(op, h, calls, failures);
+            out << left << setw(10) << operationName(op) << right
+                << setw(10) << calls
+                << setw(10) << failures
+                << setw(12) << (uint64_t)(h.mean() / ticks_per_ns)
+                << setw(12) << (uint64_t)(h.percentile(0.50) / ticks_per_ns)
+                << setw(12) << (uint64_t)(h.percentile(0.99) / ticks_per_ns)
+                << setw(12) << (uint64_t)(h.percentile(0.999) / ticks_per_ns)
+                << setw(12) << (uint64_t)(h.max_value.load(memory_order_relaxed) / ticks_per_ns) << endl;
+        }
+        out << "\nExceptions raised:" << endl;
+        for (int kind = 0; kind < ERR_KIND_COUNT; kind++) {
+            out << "  " << left << setw(30) << exceptionName(kind) << right
+                << exceptions[kind].load(memory_order_relaxed) << endl;
+        }
+        out << "===================================" << endl;
+    }
+
+    // Prometheus text exposition format (version 0.0.4).
+    void writePrometheus(ostream& out) {
+        static const double bounds_ns[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+                                           100000, 250000, 500000, 1e6, 2.5e6, 5e6, 1e7, 1e8, 1e9};
+        double ticks_per_ns = metricsTicksPerNanosecond();
+        LatencyHistogram latency[OP_COUNT];
+        uint64_t calls[OP_COUNT], failures[OP_COUNT];
+        for (int op = 0; op < OP_COUNT; op++) {
+            collect(op, latency[op], calls[op], failures[op]);
+        }
+
+        out << "# HELP library_operations_total Library operations executed." << endl;
+        out << "# TYPE library_operations_total counter" << endl;
+        for (int op = 0; op < OP_COUNT; op++) {
+            out << "library_operations_total{operation=\"" << operationName(op) << "\"} "
+                << calls[op] << endl;
+        }
+        out << "# HELP library_operation_failures_total Library operations that ended in an exception." << endl;
+        out << "# TYPE library_operation_failures_total counter" << endl;
+        for (int op = 0; op < OP_COUNT; op++) {
+            out << "library_operation_failures_total{operation=\"" << operationName(op) << "\"} "
+                << failures[op] << endl;
+        }
+        out << "# HELP library_operation_latency_seconds Library operation latency (sampled 1 in "
+            << LIBRARY_METRICS_SAMPLE_EVERY << " calls)." << endl;
+        out << "# TYPE library_operation_latency_seconds histogram" << endl;
+        for (int op = 0; op < OP_COUNT; op++) {
+            const LatencyHistogram& h = latency[op];
+            string label = string("operation=\"") + operationName(op) + "\"";
+            for (double bound : bounds_ns) {
+                out << "library_operation_latency_seconds_bucket{" << label << ",le=\"" << bound / 1e9 << "\"} "
+                    << h.countAtOrBelow((uint64_t)(bound * ticks_per_ns)) << endl;
+            }
+            out << "library_operation_latency_seconds_bucket{" << label << ",le=\"+Inf\"} " << h.count() << endl;
+            out << "library_operation_latency_seconds_sum{" << label << "} "
+                << h.total_sum.load(memory_order_relaxed) / ticks_per_ns / 1e9 << endl;
+            out << "library_operation_latency_seconds_count{" << label << "} " << h.count() << endl;
+        }
+        out << "# HELP library_exceptions_total Library exceptions raised, by type." << endl;
+        out << "# TYPE library_exceptions_total counter" << endl;
+        for (int kind = 0; kind < ERR_KIND_COUNT; kind++) {
+            out << "library_exceptions_total{type=\"" << exceptionName(kind) << "\"} "
+                << exceptions[kind].load(memory_order_relaxed) << endl;
+        }
+    }
+};
+
+// Counts one operation into the calling thread's shard. Reading the cycle
+// counter dominates the cost, so only every LIBRARY_METRICS_SAMPLE_EVERY-th
+// call (starting with the first) is timed. Failures are flagged explicitly from
+// the operation's catch block via LIBRARY_OPERATION_FAILED().
+class ScopedOperationTimer {
+public:
+    ThreadMetricsShard& shard;
+    int op;
+    uint64_t start;
+
+    ScopedOperationTimer(ThreadMetricsShard& s, int operation) : shard(s), op(operation), start(0) {
+        uint64_t n = shard.calls[op].load(memory_order_relaxed) + 1;
+        shard.calls[op].store(n, memory_order_relaxed);
+        if ((n & (LIBRARY_METRICS_SAMPLE_EVERY - 1)) == 1 % LIBRARY_METRICS_SAMPLE_EVERY) {
+            start = metricsTicks();
+        }
+    }
+
+    ~ScopedOperationTimer() {
+        if (start) {
+            shard.latency[op].recordSingleWriter(metricsTicks() - start);
+        }
+    }
+    
+    void failed() {
+        shard.failures[op].store(shard.failures[op].load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+};
+
+#if LIBRARY_METRICS
+#define LIBRARY_TIME_OPERATION(op) ScopedOperationTimer operation_timer_(LibraryMetrics::localShard(), op)
+#define LIBRARY_OPERATION_FAILED() operation_timer_.failed()
+#else
+#define LIBRARY_TIME_OPERATION(op) ((void)0)
+#define LIBRARY_OPERATION_FAILED() ((void)0)
+#endif
+
+// Cost of one ScopedOperationTimer around an empty body, in nanoseconds.
+inline double measureMetricsOverhead(int iterations = 1000000) {
+    ThreadMetricsShard scratch;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        ScopedOperationTimer timer(scratch, OP_ISSUE);
+    }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / iterations;
+}
+
 class LibraryException : public exception {
 public:
     string message;
+    LibraryErrorKind kind;
     
-    LibraryException(string msg) : message(msg) {}
+    LibraryException(string msg, LibraryErrorKind k = ERR_GENERIC) : message(msg), kind(k) {
+        LibraryMetrics::recordException(k);
+    }
     const char* what() const throw() {
         return message.c_str();
     }
@@ -28,37 +467,37 @@ public:
 
 class BookNotFoundException : public LibraryException {
 public:
-    BookNotFoundException() : LibraryException("Book not found in the library database!") {}
+    BookNotFoundException() : LibraryException("Book not found in the library database!", ERR_BOOK_NOT_FOUND) {}
 };
 
 class MemberNotFoundException : public LibraryException {
 public:
-    MemberNotFoundException() : LibraryException("Member ID not found in the library database!") {}
+    MemberNotFoundException() : LibraryException("Member ID not found in the library database!", ERR_MEMBER_NOT_FOUND) {}
 };
 
 class BookNotAvailableException : public LibraryException {
 public:
-    BookNotAvailableException() : LibraryException("Book is not available for issue at the moment!") {}
+    BookNotAvailableException() : LibraryException("Book is not available for issue at the moment!", ERR_BOOK_NOT_AVAILABLE) {}
 };
 
 class MaxIssueLimitException : public LibraryException {
 public:
-    MaxIssueLimitException(int limit) : LibraryException("Maximum issue limit of " + to_string(limit) + " books reached!") {}
+    MaxIssueLimitException(int limit) : LibraryException("Maximum issue limit of " + to_string(limit) + " books reached!", ERR_MAX_ISSUE_LIMIT) {}
 };
 
 class PendingFineException : public LibraryException {
 public:
-    PendingFineException(int amount) : LibraryException("Member has pending fine of Rs. " + to_string(amount) + ". Please clear before issuing new books!") {}
+    PendingFineException(int amount) : LibraryException("Member has pending fine of Rs. " + to_string(amount) + ". Please clear before issuing new books!", ERR_PENDING_FINE) {}
 };
 
 class InvalidOperationException : public LibraryException {
 public:
-    InvalidOperationException(string operation) : LibraryException("Invalid operation: " + operation) {}
+    InvalidOperationException(string operation) : LibraryException("Invalid operation: " + operation, ERR_INVALID_OPERATION) {}
 };
 
 class InvalidCredentialsException : public LibraryException {
 public:
-    InvalidCredentialsException() : LibraryException("Invalid librarian credentials!") {}
+    InvalidCredentialsException() : LibraryException("Invalid librarian credentials!", ERR_INVALID_CREDENTIALS) {}
 };
 
 class Library {
@@ -70,6 +509,27 @@ public:
     Library(string bName, int bId) : book_name(bName), book_Id(bId) {}
 };
 
+// Simulated library calendar shared by every LibrarySystem in the process.
+class LibraryClock {
+public:
+    static atomic<int>& current() {
+        static atomic<int> day(1);
+        return day;
+    }
+    
+    static int today() {
+        return current().load(memory_order_relaxed);
+    }
+    
+    static void advance(int days) {
+        current().fetch_add(days, memory_order_relaxed);
+    }
+    
+    static void set(int day) {
+        current().store(day, memory_order_relaxed);
+    }
+};
+
 class Transaction {
 public:
     int transaction_Id;
@@ -92,8 +552,7 @@ public:
     }
     
     int getCurrentDay() {
-        int day_counter = 1;
-        return day_counter++;
+        return LibraryClock::today();
     }
     
     void completeReturn() {
@@ -107,10 +566,10 @@ public:
     }
     
     int calculateFine() const {
-        return calculateLateDays() * 10;
+        return calculateLateDays() * LIBRARY_FINE_PER_DAY;
     }
     
-    void display() {
+    void display() const {
         cout << "\n------ Transaction Details ------" << endl;
         cout << "Transaction ID: " << transaction_Id << endl;
         cout << "Book ID: " << book_Id << endl;
@@ -135,7 +594,17 @@ public:
     }
 };
 
-class Books : public virtual Library {
+// A returned copy set aside for a member who had reserved the title.
+class PickupHold {
+public:
+    int deadline;       // last day the copy is held
+    uint64_t hold_id;
+    
+    PickupHold() : deadline(0), hold_id(0) {}
+    PickupHold(int d, uint64_t id) : deadline(d), hold_id(id) {}
+};
+
+class Books : public Library {
 public:
     string author_name;
     string publisher;
@@ -144,9 +613,14 @@ public:
     int no_of_copies_issued;
     bool availability;
     vector<string> reserved_by;
+    map<string, PickupHold> pickup_holds;
+    int snapshot_slot = -1;        // position in the published catalog snapshot, -1 until first published
+    bool snapshot_stale = false;   // changed since the last published snapshot
 
     Books() : ISBN_no(0), no_of_copies(0), no_of_copies_issued(0), availability(true) {}
     
+    virtual ~Books() {}
+    
     Books(string bName, int bId, string author, string pub, int isbn, int copies) { 
         book_name = bName;
         book_Id = bId;
@@ -176,28 +650,54 @@ public:
         cin >> no_of_copies;
     }
 
-    virtual void display() {
-        cout << "\n------ Book Details ------" << endl;
-        cout << "Book Name: " << book_name << endl;
-        cout << "Book Id: " << book_Id << endl;
-        cout << "Author Name: " << author_name << endl;
-        cout << "Publisher: " << publisher << endl;
-        cout << "ISBN No: " << ISBN_no << endl;
-        cout << "Copies Available: " << (no_of_copies - no_of_copies_issued) << "/" << no_of_copies << endl;
-        cout << "Status: " << (availability ? "Available" : "Not Available") << endl;
+    // Common catalog fields; the concrete type appends its own after these.
+    void writeCommonFields(ostream& out) const {
+        out << "\n------ Book Details ------" << endl;
+        out << "Book Name: " << book_name << endl;
+        out << "Book Id: " << book_Id << endl;
+        out << "Author Name: " << author_name << endl;
+        out << "Publisher: " << publisher << endl;
+        out << "ISBN No: " << ISBN_no << endl;
+        out << "Copies Available: " << freeCopies() << "/" << no_of_copies << endl;
+        out << "Status: " << (availability ? "Available" : "Not Available") << endl;
         
         if (!reserved_by.empty()) {
-            cout << "Reserved by: ";
+            out << "Reserved by: ";
             for (const auto& member_id : reserved_by) {
-                cout << member_id << " ";
+                out << member_id << " ";
             }
-            cout << endl;
+            out << endl;
         }
-        cout << "--------------------------" << endl;
+        
+        if (!pickup_holds.empty()) {
+            out << "Ready for pickup: ";
+            for (const auto& hold : pickup_holds) {
+                out << hold.first << " (until Day " << hold.second.deadline << ") ";
+            }
+            out << endl;
+        }
+        out << "--------------------------" << endl;
+    }
+
+    virtual void writeDetails(ostream& out) const {
+        writeCommonFields(out);
+    }
+    
+    // Type name as written to catalog exports.
+    virtual const char* typeName() const {
+        return "Book";
+    }
+    
+    void display() const {
+        writeDetails(cout);
+    }
+
+    int freeCopies() const {
+        return no_of_copies - no_of_copies_issued - (int)pickup_holds.size();
     }
 
     void update_availability() {
-        if (no_of_copies_issued >= no_of_copies) {
+        if (freeCopies() <= 0) {
             availability = false;
         } else {
             availability = true;
@@ -205,7 +705,7 @@ public:
     }
 
     bool issueBook() {
-        if (no_of_copies_issued < no_of_copies) {
+        if (freeCopies() > 0) {
             no_of_copies_issued++;
             update_availability();
             return true;
@@ -213,6 +713,33 @@ public:
         return false;
     }
     
+    // Catalog record with the same bibliographic data but its own copy count
+    // and no circulation state; used when a copy moves between branches.
+    virtual Books* cloneRecord(int copies) const {
+        return new Books(book_name, book_Id, author_name, publisher, ISBN_no, copies);
+    }
+    
+    // Full copy, circulation state included, frozen into a catalog snapshot.
+    virtual Books* snapshotCopy() const {
+        return new Books(*this);
+    }
+    
+    bool hasPickupHold(const string& member_id) const {
+        return pickup_holds.count(member_id) > 0;
+    }
+    
+    // Issues the copy held for this member.
+    bool collectHold(const string& member_id) {
+        auto it = pickup_holds.find(member_id);
+        if (it == pickup_holds.end()) {
+            return false;
+        }
+        pickup_holds.erase(it);
+        no_of_copies_issued++;
+        update_availability();
+        return true;
+    }
+    
     bool returnBook() {
         if (no_of_copies_issued > 0) {
             no_of_copies_issued--;
@@ -254,8 +781,49 @@ public:
     }
 };
 
-class EBook : public virtual Books {
+// CRTP layer between Books and a concrete material type. It implements the
+// virtual interface once in terms of Derived, whose static TYPE_NAME and
+// writeExtraFields() supply everything type-specific, and offers the same
+// work non-virtually through render(): a loop over one material type calls
+// it directly and the compiler inlines the whole record.
+template <class Derived>
+class MaterialRecord : public Books {
+public:
+    const Derived& self() const {
+        return static_cast<const Derived&>(*this);
+    }
+    
+    void render(ostream& out) const {
+        writeCommonFields(out);
+        self().writeExtraFields(out);
+    }
+    
+    void writeDetails(ostream& out) const override {
+        render(out);
+    }
+    
+    const char* typeName() const override {
+        return Derived::TYPE_NAME;
+    }
+    
+    Books* snapshotCopy() const override {
+        return new Derived(self());
+    }
+};
+
+// Renders every record of one material type. With the element type known,
+// none of the calls below goes through the vtable.
+template <class Record>
+void renderAll(ostream& out, const vector<Record*>& records) {
+    for (const Record* record : records) {
+        record->render(out);
+    }
+}
+
+class EBook final : public MaterialRecord<EBook> {
 public:
+    static constexpr const char* TYPE_NAME = "EBook";
+    
     string format;
     string download_link;
 
@@ -282,15 +850,20 @@ public:
         cin >> download_link;
     }
     
-    void display() override {
-        Books::display();
-        cout << "E-Book Format: " << format << endl;
-        cout << "Download Link: " << download_link << endl;
+    Books* cloneRecord(int copies) const override {
+        return new EBook(book_name, book_Id, author_name, publisher, ISBN_no, copies, format, download_link);
+    }
+    
+    void writeExtraFields(ostream& out) const {
+        out << "E-Book Format: " << format << endl;
+        out << "Download Link: " << download_link << endl;
     }
 };
 
-class ResearchJournal : public virtual Books {
+class ResearchJournal final : public MaterialRecord<ResearchJournal> {
 public:
+    static constexpr const char* TYPE_NAME = "Journal";
+    
     string journal_name;
     int volume;
     int issue;
@@ -323,35 +896,150 @@ public:
         cin >> issue;
     }
     
-    void display() override {
-        Books::display();
-        cout << "Journal Name: " << journal_name << endl;
-        cout << "Volume: " << volume << endl;
-        cout << "Issue: " << issue << endl;
+    Books* cloneRecord(int copies) const override {
+        return new ResearchJournal(book_name, book_Id, author_name, publisher, ISBN_no, copies, journal_name, volume, issue);
+    }
+    
+    void writeExtraFields(ostream& out) const {
+        out << "Journal Name: " << journal_name << endl;
+        out << "Volume: " << volume << endl;
+        out << "Issue: " << issue << endl;
+    }
+};
+
+// A member's running fine totals. Posted charges and payments are kept as
+// two sums; fines still accruing on overdue loans are derived from the due
+// dates whenever a balance is read, so nothing has to be rewritten as days
+// pass. The ledger journal in LibrarySystem holds the individual entries.
+class FineAccount {
+public:
+    static const int NEVER = INT32_MAX;
+    static const int ALWAYS = INT32_MIN;
+    
+    int charged;
+    int paid;                           // may exceed charged when accruing fines are paid early
+    vector<pair<int, int>> open_loans;  // (transaction ID, due day) of loans on issue
+    int blocked_from;                   // first day the balance exceeds the block threshold
+    
+    FineAccount() : charged(0), paid(0), blocked_from(NEVER) {}
+    
+    int accrued(int day) const {
+        int total = 0;
+        for (const auto& loan : open_loans) {
+            if (day > loan.second) {
+                total += (day - loan.second) * LIBRARY_FINE_PER_DAY;
+            }
+        }
+        return total;
+    }
+    
+    int balance(int day) const {
+        return max(0, charged - paid + accrued(day));
+    }
+    
+    // First day on which the balance exceeds threshold if nothing else is
+    // posted: ALWAYS if it already does, NEVER if no overdue loan can take it there.
+    int crossingDay(int threshold) const {
+        int posted = charged - paid;
+        if (posted > threshold) {
+            return ALWAYS;
+        }
+        if (open_loans.empty()) {
+            return NEVER;
+        }
+        int earliest_due = NEVER;
+        for (const auto& loan : open_loans) {
+            earliest_due = min(earliest_due, loan.second);
+        }
+        // From the earliest due date on, the balance grows by at least the
+        // daily rate, so the crossing lies within this range.
+        int low = earliest_due + 1;
+        int high = earliest_due + (threshold - posted) / LIBRARY_FINE_PER_DAY + 1;
+        while (low < high) {
+            int middle = low + (high - low) / 2;
+            if (posted + accrued(middle) > threshold) {
+                high = middle;
+            } else {
+                low = middle + 1;
+            }
+        }
+        return low;
+    }
+};
+
+// A phone number as its digits, with a leading '+' kept for international
+// numbers. Spaces, dashes, dots and brackets are dropped when parsing, so
+// "(876) 543-2109" and "876.543.2109" are the same number.
+class PhoneNumber {
+public:
+    static const size_t MAX_DIGITS = 15;   // E.164
+    
+    string digits;
+    bool international;
+    
+    PhoneNumber() : international(false) {}
+    
+    PhoneNumber(const string& text) : international(false) {
+        for (char c : text) {
+            if (isdigit((unsigned char)c)) {
+                digits += c;
+            } else if (c == '+' && digits.empty()) {
+                international = true;
+            }
+        }
+    }
+    
+    PhoneNumber(const char* text) : PhoneNumber(string(text)) {}
+    
+    // Accepts only digits and the usual separators, with 4 to 15 digits.
+    static bool valid(const string& text) {
+        PhoneNumber number(text);
+        if (number.digits.size() < 4 || number.digits.size() > MAX_DIGITS) {
+            return false;
+        }
+        for (char c : text) {
+            if (!isdigit((unsigned char)c) && !strchr("+-.() ", c)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    bool empty() const {
+        return digits.empty();
+    }
+    
+    string str() const {
+        return international ? "+" + digits : digits;
     }
 };
 
+inline ostream& operator<<(ostream& out, const PhoneNumber& number) {
+    return out << (number.empty() ? string("-") : number.str());
+}
+
 class Member {
 public:
     string name;
     string member_id;
-    double contact;
+    PhoneNumber contact;
     string email;
     string address;
-    bool fine;
-    int fine_amount;
+    FineAccount fines;
     vector<int> issued_book_ids;
+    int snapshot_slot = -1;        // see Books::snapshot_slot
+    bool snapshot_stale = false;
 
-    Member() : contact(0), fine(false), fine_amount(0) {}
+    Member() {}
+    
+    virtual ~Member() {}
     
-    Member(string n, string id, double c, string e, string addr) {
+    Member(string n, string id, PhoneNumber c, string e, string addr) {
         name = n;
         member_id = id;
         contact = c;
         email = e;
         address = addr;
-        fine = false;
-        fine_amount = 0;
     }
     
     virtual void inputDetails() {
@@ -360,38 +1048,55 @@ public:
         getline(cin, name);
         cout << "Enter Member ID: ";
         cin >> member_id;
-        cout << "Enter Phone no: ";
-        cin >> contact;
         cin.ignore();
+        string phone;
+        cout << "Enter Phone no: ";
+        getline(cin, phone);
+        while (!PhoneNumber::valid(phone) && cin) {
+            cout << "Invalid phone number! Enter 4-15 digits: ";
+            getline(cin, phone);
+        }
+        contact = PhoneNumber(phone);
         cout << "Enter Email Id: ";
         getline(cin, email);
         cout << "Enter Address: ";
         getline(cin, address);
     }
 
-    virtual void display() {
-        cout << "\n------ Member Details ------" << endl;
-        cout << "Name: " << name << endl;
-        cout << "Member ID: " << member_id << endl;
-        cout << "Contact: " << contact << endl;
-        cout << "Email: " << email << endl;
-        cout << "Address: " << address << endl;
-        if (fine) {
-            cout << "Fine Amount: $" << fine_amount << endl;
+    void writeCommonFields(ostream& out) const {
+        out << "\n------ Member Details ------" << endl;
+        out << "Name: " << name << endl;
+        out << "Member ID: " << member_id << endl;
+        out << "Contact: " << contact << endl;
+        out << "Email: " << email << endl;
+        out << "Address: " << address << endl;
+        int fine_balance = fines.balance(LibraryClock::today());
+        if (fine_balance > 0) {
+            out << "Fine Amount: $" << fine_balance << endl;
         }
         
         if (!issued_book_ids.empty()) {
-            cout << "Issued Books: ";
+            out << "Issued Books: ";
             for (const auto& book_id : issued_book_ids) {
-                cout << book_id << " ";
+                out << book_id << " ";
             }
-            cout << endl;
+            out << endl;
         }
-        cout << "--------------------------" << endl;
+        out << "--------------------------" << endl;
+    }
+    
+    virtual void writeDetails(ostream& out) const = 0;
+    
+    virtual const char* typeName() const = 0;
+    
+    void display() const {
+        writeDetails(cout);
     }
     
     virtual int getMaxBooks() const = 0;
     
+    virtual Member* snapshotCopy() const = 0;
+    
     void addIssuedBook(int book_id) {
         issued_book_ids.push_back(book_id);
     }
@@ -414,25 +1119,58 @@ public:
         return false;
     }
     
-    void addFine(int amount) {
-        fine = true;
-        fine_amount += amount;
+    int fineBalance(int day) const {
+        return fines.balance(day);
+    }
+};
+
+// CRTP layer for member types, the counterpart of MaterialRecord. The loan
+// limit is Derived::MAX_BOOKS, a compile-time constant: withinLoanLimit()
+// on a concrete member type needs no call at all.
+template <class Derived>
+class MemberRecord : public Member {
+public:
+    const Derived& self() const {
+        return static_cast<const Derived&>(*this);
+    }
+    
+    bool withinLoanLimit() const {
+        return (int)issued_book_ids.size() < Derived::MAX_BOOKS;
+    }
+    
+    void render(ostream& out) const {
+        writeCommonFields(out);
+        self().writeExtraFields(out);
+    }
+    
+    void writeDetails(ostream& out) const override {
+        render(out);
+    }
+    
+    const char* typeName() const override {
+        return Derived::TYPE_NAME;
     }
     
-    void clearFine() {
-        fine = false;
-        fine_amount = 0;
+    int getMaxBooks() const override {
+        return Derived::MAX_BOOKS;
+    }
+    
+    Member* snapshotCopy() const override {
+        return new Derived(self());
     }
 };
 
-class Student : public virtual Member {
+class Student final : public MemberRecord<Student> {
 public:
+    static constexpr const char* TYPE_NAME = "Student";
+    static constexpr int MAX_BOOKS = 3;
+    
     string department;
     string year;
     
     Student() {}
     
-    Student(string n, string id, double c, string e, string a, string d, string y) {
+    Student(string n, string id, PhoneNumber c, string e, string a, string d, string y) {
         name = n;
         member_id = id;
         contact = c;
@@ -440,8 +1178,6 @@ public:
         address = a;
         department = d;
         year = y;
-        fine = false;
-        fine_amount = 0;
     }
     
     void inputDetails() override {
@@ -453,25 +1189,23 @@ public:
         getline(cin, year);
     }
 
-    void display() override {
-        Member::display();
-        cout << "Department: " << department << endl;
-        cout << "Year: " << year << endl;
-    }
-    
-    int getMaxBooks() const override {
-        return 3;
+    void writeExtraFields(ostream& out) const {
+        out << "Department: " << department << endl;
+        out << "Year: " << year << endl;
     }
 };
 
-class Faculty : public virtual Member {
+class Faculty final : public MemberRecord<Faculty> {
 public:
+    static constexpr const char* TYPE_NAME = "Faculty";
+    static constexpr int MAX_BOOKS = 5;
+    
     string department;
     string designation;
     
     Faculty() {}
     
-    Faculty(string n, string id, double c, string e, string a, string d, string des) {
+    Faculty(string n, string id, PhoneNumber c, string e, string a, string d, string des) {
         name = n;
         member_id = id;
         contact = c;
@@ -479,8 +1213,6 @@ public:
         address = a;
         department = d;
         designation = des;
-        fine = false;
-        fine_amount = 0;
     }
     
     void inputDetails() override {
@@ -492,34 +1224,299 @@ public:
         getline(cin, designation);
     }
 
-    void display() override {
-        Member::display();
-        cout << "Department: " << department << endl;
-        cout << "Designation: " << designation << endl;
-    }
-    
-    int getMaxBooks() const override {
-        return 5;
+    void writeExtraFields(ostream& out) const {
+        out << "Department: " << department << endl;
+        out << "Designation: " << designation << endl;
     }
 };
 
-class Librarian {
+#ifndef LIBRARY_PBKDF2_ITERATIONS
+#define LIBRARY_PBKDF2_ITERATIONS 20000
+#endif
+
+// SHA-256 (FIPS 180-4), used for password hashing.
+class Sha256 {
 public:
-    string name;
-    int staff_id;
-    string email;
-    string password;
+    uint32_t state[8];
+    uint8_t block[64];
+    size_t block_used;
+    uint64_t total_bytes;
     
-    Librarian() : staff_id(0) {}
+    Sha256() {
+        reset();
+    }
     
-    Librarian(string n, int id, string e, string p) {
-        name = n;
-        staff_id = id;
-        email = e;
-        password = p;
+    void reset() {
+        static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(state, initial, sizeof(state));
+        block_used = 0;
+        total_bytes = 0;
     }
     
-    void display() {
+    static uint32_t rotr(uint32_t x, int n) {
+        return (x >> n) | (x << (32 - n));
+    }
+    
+    void compress(const uint8_t* data) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16 |
+                   (uint32_t)data[i * 4 + 2] << 8 | (uint32_t)data[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+    
+    void update(const uint8_t* data, size_t length) {
+        total_bytes += length;
+        while (length > 0) {
+            if (block_used == 0 && length >= 64) {
+                compress(data);
+                data += 64;
+                length -= 64;
+                continue;
+            }
+            size_t take = min(length, 64 - block_used);
+            memcpy(block + block_used, data, take);
+            block_used += take;
+            data += take;
+            length -= take;
+            if (block_used == 64) {
+                compress(block);
+                block_used = 0;
+            }
+        }
+    }
+    
+    void update(const string& text) {
+        update((const uint8_t*)text.data(), text.size());
+    }
+    
+    void finish(uint8_t digest[32]) {
+        uint64_t bits = total_bytes * 8;
+        uint8_t pad = 0x80;
+        update(&pad, 1);
+        uint8_t zero = 0;
+        while (block_used != 56) {
+            update(&zero, 1);
+        }
+        uint8_t length[8];
+        for (int i = 0; i < 8; i++) {
+            length[i] = (uint8_t)(bits >> (56 - 8 * i));
+        }
+        update(length, 8);
+        for (int i = 0; i < 8; i++) {
+            digest[i * 4] = (uint8_t)(state[i] >> 24);
+            digest[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+            digest[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+            digest[i * 4 + 3] = (uint8_t)state[i];
+        }
+    }
+};
+
+// Compares in time that depends only on the length, not on where the first
+// difference is.
+inline bool constantTimeEquals(const uint8_t* a, const uint8_t* b, size_t length) {
+    uint8_t difference = 0;
+    for (size_t i = 0; i < length; i++) {
+        difference |= a[i] ^ b[i];
+    }
+    return difference == 0;
+}
+
+inline string toHex(const uint8_t* data, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    string hex;
+    for (size_t i = 0; i < length; i++) {
+        hex += digits[data[i] >> 4];
+        hex += digits[data[i] & 15];
+    }
+    return hex;
+}
+
+// Reverses toHex; false if text is not exactly length bytes of hex.
+inline bool fromHex(const string& text, uint8_t* out, size_t length) {
+    if (text.size() != length * 2) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        unsigned value;
+        if (!isxdigit((unsigned char)text[i * 2]) || !isxdigit((unsigned char)text[i * 2 + 1]) ||
+            sscanf(text.c_str() + i * 2, "%2x", &value) != 1) {
+            return false;
+        }
+        out[i] = value;
+    }
+    return true;
+}
+
+// Fills the buffer from the operating system's random source.
+inline void secureRandomBytes(uint8_t* out, size_t length) {
+    random_device source;
+    for (size_t i = 0; i < length; i += 4) {
+        uint32_t value = source();
+        for (size_t j = 0; j < 4 && i + j < length; j++) {
+            out[i + j] = (uint8_t)(value >> (8 * j));
+        }
+    }
+}
+
+// Salted PBKDF2-HMAC-SHA256 password hash (RFC 8018), one 32-byte block.
+class PasswordHash {
+public:
+    static const size_t SALT_BYTES = 16;
+    static const size_t HASH_BYTES = 32;
+    
+    uint8_t salt[SALT_BYTES];
+    uint8_t hash[HASH_BYTES];
+    int iterations;
+    
+    PasswordHash() : iterations(0) {
+        memset(salt, 0, sizeof(salt));
+        memset(hash, 0, sizeof(hash));
+    }
+    
+    static PasswordHash create(const string& password, int iterations = LIBRARY_PBKDF2_ITERATIONS) {
+        PasswordHash result;
+        result.iterations = iterations;
+        secureRandomBytes(result.salt, SALT_BYTES);
+        derive(password, result.salt, SALT_BYTES, iterations, result.hash);
+        return result;
+    }
+    
+    bool empty() const {
+        return iterations == 0;
+    }
+    
+    bool verify(const string& password) const {
+        uint8_t candidate[HASH_BYTES];
+        derive(password, salt, SALT_BYTES, max(iterations, 1), candidate);
+        return !empty() && constantTimeEquals(candidate, hash, HASH_BYTES);
+    }
+    
+    // pbkdf2-sha256$<iterations>$<salt hex>$<hash hex>
+    string encode() const {
+        return "pbkdf2-sha256$" + to_string(iterations) + "$" + toHex(salt, SALT_BYTES) + "$" + toHex(hash, HASH_BYTES);
+    }
+    
+    // Parses the form written by encode().
+    static bool decode(const string& text, PasswordHash& out) {
+        size_t first = text.find('$');
+        size_t second = text.find('$', first + 1);
+        size_t third = text.find('$', second + 1);
+        if (text.compare(0, first, "pbkdf2-sha256") != 0 || third == string::npos) {
+            return false;
+        }
+        out.iterations = atoi(text.c_str() + first + 1);
+        return out.iterations > 0 && fromHex(text.substr(second + 1, third - second - 1), out.salt, SALT_BYTES) &&
+               fromHex(text.substr(third + 1), out.hash, HASH_BYTES);
+    }
+    
+    static void derive(const string& password, const uint8_t* salt, size_t salt_length, int iterations,
+                       uint8_t out[HASH_BYTES]) {
+        // HMAC key pads are hashed once; each iteration then resumes from the
+        // saved inner and outer states.
+        uint8_t key[64];
+        memset(key, 0, sizeof(key));
+        if (password.size() > 64) {
+            Sha256 key_hash;
+            key_hash.update(password);
+            key_hash.finish(key);
+        } else {
+            memcpy(key, password.data(), password.size());
+        }
+        uint8_t pad[64];
+        Sha256 inner_start, outer_start;
+        for (int i = 0; i < 64; i++) {
+            pad[i] = key[i] ^ 0x36;
+        }
+        inner_start.update(pad, 64);
+        for (int i = 0; i < 64; i++) {
+            pad[i] = key[i] ^ 0x5c;
+        }
+        outer_start.update(pad, 64);
+        
+        auto hmac = [&](const uint8_t* message, size_t length, const uint8_t* suffix, size_t suffix_length,
+                        uint8_t digest[HASH_BYTES]) {
+            Sha256 inner = inner_start;
+            inner.update(message, length);
+            inner.update(suffix, suffix_length);
+            uint8_t inner_digest[HASH_BYTES];
+            inner.finish(inner_digest);
+            Sha256 outer = outer_start;
+            outer.update(inner_digest, HASH_BYTES);
+            outer.finish(digest);
+        };
+        
+        static const uint8_t block_index[4] = {0, 0, 0, 1};
+        uint8_t u[HASH_BYTES];
+        hmac(salt, salt_length, block_index, 4, u);
+        memcpy(out, u, HASH_BYTES);
+        for (int i = 1; i < iterations; i++) {
+            hmac(u, HASH_BYTES, nullptr, 0, u);
+            for (size_t j = 0; j < HASH_BYTES; j++) {
+                out[j] ^= u[j];
+            }
+        }
+    }
+};
+
+class Librarian {
+public:
+    string name;
+    int staff_id;
+    string email;
+    PasswordHash password_hash;
+    
+    Librarian() : staff_id(0) {}
+    
+    Librarian(string n, int id, string e, string p) {
+        name = n;
+        staff_id = id;
+        email = e;
+        setPassword(p);
+    }
+    
+    void setPassword(const string& password) {
+        password_hash = PasswordHash::create(password);
+    }
+    
+    void display() {
         cout << "\n------ Librarian Details ------" << endl;
         cout << "Name: " << name << endl;
         cout << "Staff ID: " << staff_id << endl;
@@ -528,406 +1525,5952 @@ public:
     }
     
     bool authenticate(string inputPassword) {
-        return password == inputPassword;
+        return password_hash.verify(inputPassword);
     }
 };
 
-class LibrarySystem {
+class LibrarianSession {
 public:
-    list<Books*> book_collection;
-    list<Member*> members;
-    list<Librarian*> librarians;
-    list<Transaction*> transactions;
-    stack<Transaction*> recent_transactions;
-    queue<pair<int, string>> reservation_queue;
-    int transaction_counter;
-    bool isLibrarianLoggedIn;
-    string librarian_password;
+    int staff_id;
+    string name;
+    chrono::steady_clock::time_point expires;
     
-    LibrarySystem() {
-        transaction_counter = 1000;
-        isLibrarianLoggedIn = false;
-        librarian_password = "library123";
+    LibrarianSession() : staff_id(0) {}
+    LibrarianSession(int id, string n, chrono::steady_clock::time_point e) : staff_id(id), name(n), expires(e) {}
+};
+
+class alignas(64) SessionShard {
+public:
+    mutable shared_mutex lock;
+    unordered_map<string, LibrarianSession> sessions;
+};
+
+// Open staff sessions keyed by a random 256-bit bearer token. Tokens are
+// spread over independently locked shards and validation takes only a shared
+// lock on one shard, so many desks can check their sessions on every request
+// without waiting on each other.
+class SessionTable {
+public:
+    static const size_t TOKEN_BYTES = 32;
+    
+    vector<unique_ptr<SessionShard>> shards;
+    chrono::seconds lifetime;
+    
+    SessionTable(size_t shard_count = 64, chrono::seconds session_lifetime = chrono::hours(8))
+        : lifetime(session_lifetime) {
+        for (size_t i = 0; i < max(shard_count, (size_t)1); i++) {
+            shards.emplace_back(new SessionShard());
+        }
     }
     
-    bool librarianLogin() {
-        if (isLibrarianLoggedIn) {
-            cout << "A librarian is already logged in!" << endl;
-            return true;
+    SessionShard& shardFor(const string& token) const {
+        return *shards[hash<string>()(token) % shards.size()];
+    }
+    
+    string open(int staff_id, const string& name) {
+        uint8_t bytes[TOKEN_BYTES];
+        secureRandomBytes(bytes, TOKEN_BYTES);
+        string token = toHex(bytes, TOKEN_BYTES);
+        auto now = chrono::steady_clock::now();
+        SessionShard& shard = shardFor(token);
+        unique_lock<shared_mutex> lock(shard.lock);
+        for (auto it = shard.sessions.begin(); it != shard.sessions.end();) {
+            it = it->second.expires <= now ? shard.sessions.erase(it) : next(it);
         }
-        
-        string password;
-        cout << "Enter librarian password: ";
-        cin >> password;
-        
-        if (password == librarian_password) {
-            isLibrarianLoggedIn = true;
-            cout << "Login successful!" << endl;
-            return true;
-        } else {
-            cout << "Invalid password!" << endl;
+        shard.sessions[token] = LibrarianSession(staff_id, name, now + lifetime);
+        return token;
+    }
+    
+    // True if the token names a live session; its staff ID is stored in staff_id.
+    bool validate(const string& token, int* staff_id = nullptr) const {
+        if (token.size() != TOKEN_BYTES * 2) {
+            return false;
+        }
+        SessionShard& shard = shardFor(token);
+        shared_lock<shared_mutex> lock(shard.lock);
+        auto it = shard.sessions.find(token);
+        if (it == shard.sessions.end() || it->second.expires <= chrono::steady_clock::now()) {
             return false;
         }
+        if (staff_id) {
+            *staff_id = it->second.staff_id;
+        }
+        return true;
     }
     
-    void librarianLogout() {
-        if (isLibrarianLoggedIn) {
-            isLibrarianLoggedIn = false;
-            cout << "Librarian logged out successfully!" << endl;
-        } else {
-            cout << "No librarian is currently logged in!" << endl;
+    bool revoke(const string& token) {
+        SessionShard& shard = shardFor(token);
+        unique_lock<shared_mutex> lock(shard.lock);
+        return shard.sessions.erase(token) > 0;
+    }
+    
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& shard : shards) {
+            shared_lock<shared_mutex> lock(shard->lock);
+            total += shard->sessions.size();
         }
+        return total;
     }
+};
+
+// An e-book file opened for serving. Every reader shares the descriptor:
+// sendfile takes its own offset and never moves the file position.
+class ContentFile {
+public:
+    int fd;
+    off_t size;
+    string content_type;
     
-    bool checkLibrarianAccess() {
-        return isLibrarianLoggedIn;
+    ContentFile(int f, off_t s, const string& type) : fd(f), size(s), content_type(type) {}
+    
+    ~ContentFile() {
+        close(fd);
     }
+};
+
+// E-book files kept under one directory as <book_id>.<format>, e.g.
+// library_content/103.pdf. Opened files stay cached until replaced, so a
+// title read by hundreds of members at once costs one descriptor.
+class ContentStore {
+public:
+    string directory;
+    mutex files_mutex;
+    unordered_map<int, shared_ptr<ContentFile>> open_files;
     
-    void addBook(Books* book) {
-        for (auto existing_book : book_collection) {
-            if (existing_book->book_Id == book->book_Id) {
-                throw InvalidOperationException("Book with ID " + to_string(book->book_Id) + " already exists!");
+    ContentStore(const string& dir = "library_content") : directory(dir) {}
+    
+    static string extensionFor(const string& format) {
+        string extension;
+        for (char c : format) {
+            if (isalnum((unsigned char)c)) {
+                extension += tolower(c);
             }
         }
-        book_collection.push_back(book);
-        cout << "Book added successfully!" << endl;
+        return extension.empty() ? "bin" : extension;
     }
     
-    void addMember(Member* member) {
-        members.push_back(member);
-        cout << "Member added successfully!" << endl;
+    static const char* contentTypeFor(const string& extension) {
+        if (extension == "pdf") {
+            return "application/pdf";
+        } else if (extension == "epub") {
+            return "application/epub+zip";
+        } else if (extension == "txt") {
+            return "text/plain";
+        }
+        return "application/octet-stream";
     }
     
-    void addLibrarian(Librarian* librarian) {
-        librarians.push_back(librarian);
-        cout << "Librarian added successfully!" << endl;
+    string pathFor(int book_id, const string& format) const {
+        return directory + "/" + to_string(book_id) + "." + extensionFor(format);
     }
     
-    void displayBooks() {
-        cout << "\n======= BOOKS CATALOG =======" << endl;
-        if (book_collection.empty()) {
-            cout << "No books available in the library." << endl;
-            return;
+    // The title's file, or null if the store has none.
+    shared_ptr<ContentFile> open(int book_id, const string& format) {
+        lock_guard<mutex> lock(files_mutex);
+        auto it = open_files.find(book_id);
+        if (it != open_files.end()) {
+            return it->second;
         }
-        
-        for (const auto& book : book_collection) {
-            book->display();
+        int fd = ::open(pathFor(book_id, format).c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        if (fd < 0) {
+            return nullptr;
+        }
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+            close(fd);
+            return nullptr;
         }
+        shared_ptr<ContentFile> file = make_shared<ContentFile>(fd, info.st_size, contentTypeFor(extensionFor(format)));
+        open_files[book_id] = file;
+        return file;
     }
     
-    void displayMembers() {
-        cout << "\n======= LIBRARY MEMBERS =======" << endl;
-        if (members.empty()) {
-            cout << "No members registered in the library." << endl;
-            return;
+    // Copies source into the store in the kernel and replaces the title's file;
+    // readers already streaming the old file finish from their descriptor.
+    // Returns the number of bytes stored, or -1 with errno set.
+    long long import(int book_id, const string& format, const string& source) {
+        int in = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) {
+            return -1;
         }
-        
-        for (const auto& member : members) {
-            member->display();
+        mkdir(directory.c_str(), 0755);
+        string path = pathFor(book_id, format);
+        string staging = path + ".part";
+        int out = ::open(staging.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) {
+            close(in);
+            return -1;
+        }
+        long long copied = 0;
+        while (true) {
+            ssize_t moved = sendfile(out, in, nullptr, 1 << 30);
+            if (moved > 0) {
+                copied += moved;
+            } else if (moved == 0) {
+                break;
+            } else if (errno != EINTR) {
+                copied = -1;
+                break;
+            }
         }
+        int saved_errno = errno;
+        close(in);
+        if (close(out) != 0 || copied < 0 || rename(staging.c_str(), path.c_str()) != 0) {
+            saved_errno = copied < 0 ? saved_errno : errno;
+            unlink(staging.c_str());
+            errno = saved_errno;
+            return -1;
+        }
+        lock_guard<mutex> lock(files_mutex);
+        open_files.erase(book_id);
+        return copied;
     }
+};
+
+// What an e-book access token lets its holder read, and until when.
+class EBookAccess {
+public:
+    int book_id;
+    string member_id;
+    string format;
+    int expires_day;   // due day of the loan; the token is dead after it
     
-    void displayTransactions() {
-        cout << "\n======= TRANSACTION HISTORY =======" << endl;
-        if (transactions.empty()) {
-            cout << "No transactions recorded." << endl;
-            return;
+    EBookAccess() : book_id(0), expires_day(0) {}
+    EBookAccess(int b, const string& m, const string& f, int e) : book_id(b), member_id(m), format(f), expires_day(e) {}
+};
+
+// Access tokens of e-book loans, one per open loan: granting a new token for
+// a loan revokes its previous one and returning the e-book revokes it, so
+// the readers of a title never outnumber its copies on issue.
+class EBookAccessTable {
+public:
+    static const size_t TOKEN_BYTES = 16;
+    
+    mutable shared_mutex lock;
+    unordered_map<string, EBookAccess> grants;
+    map<pair<int, string>, string> token_by_loan;
+    
+    string grant(int book_id, const string& member_id, const string& format, int expires_day) {
+        uint8_t bytes[TOKEN_BYTES];
+        secureRandomBytes(bytes, TOKEN_BYTES);
+        string token = toHex(bytes, TOKEN_BYTES);
+        unique_lock<shared_mutex> guard(lock);
+        string& current = token_by_loan[make_pair(book_id, member_id)];
+        if (!current.empty()) {
+            grants.erase(current);
         }
-        
-        for (const auto& transaction : transactions) {
-            transaction->display();
+        current = token;
+        grants[token] = EBookAccess(book_id, member_id, format, expires_day);
+        return token;
+    }
+    
+    // True if the token is live on the given day; what it grants is stored in access.
+    bool validate(const string& token, int day, EBookAccess& access) const {
+        if (token.size() != TOKEN_BYTES * 2) {
+            return false;
+        }
+        shared_lock<shared_mutex> guard(lock);
+        auto it = grants.find(token);
+        if (it == grants.end() || day > it->second.expires_day) {
+            return false;
         }
+        access = it->second;
+        return true;
     }
     
-    Books* findBook(int book_id) {
-        for (auto& book : book_collection) {
-            if (book->book_Id == book_id) {
-                return book;
-            }
+    void revoke(int book_id, const string& member_id) {
+        unique_lock<shared_mutex> guard(lock);
+        auto it = token_by_loan.find(make_pair(book_id, member_id));
+        if (it != token_by_loan.end()) {
+            grants.erase(it->second);
+            token_by_loan.erase(it);
         }
-        return nullptr;
     }
     
-    Member* findMember(string member_id) {
-        for (auto& member : members) {
-            if (member->member_id == member_id) {
-                return member;
-            }
+    size_t size() const {
+        shared_lock<shared_mutex> guard(lock);
+        return grants.size();
+    }
+};
+
+class Notification {
+public:
+    string member_id;
+    int book_id;
+    string message;
+    uint64_t enqueued_ns;
+    
+    Notification() : book_id(0), enqueued_ns(0) {}
+    
+    Notification(string m_id, int b_id, string msg) : member_id(m_id), book_id(b_id), message(msg) {
+        enqueued_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+// Destination for notifications. deliver() runs on the dispatcher thread, so
+// a slow integration (email, SMS) never blocks the circulation desk.
+class NotificationSink {
+public:
+    virtual ~NotificationSink() {}
+    virtual void deliver(const vector<Notification>& batch) = 0;
+};
+
+class ConsoleNotificationSink : public NotificationSink {
+public:
+    void deliver(const vector<Notification>& batch) override {
+        for (const auto& notification : batch) {
+            cout << "Notification: " << notification.message << endl;
         }
-        return nullptr;
+    }
+};
+
+// Keeps every delivered notification so a test run can account for them.
+class InMemoryNotificationSink : public NotificationSink {
+public:
+    mutex delivered_mutex;
+    vector<Notification> delivered;
+    
+    void deliver(const vector<Notification>& batch) override {
+        lock_guard<mutex> lock(delivered_mutex);
+        delivered.insert(delivered.end(), batch.begin(), batch.end());
     }
     
-    void sortBooksById() {
-        book_collection.sort([](Books* a, Books* b) { return a->book_Id < b->book_Id; });
+    size_t count() {
+        lock_guard<mutex> lock(delivered_mutex);
+        return delivered.size();
     }
+};
+
+class DiscardNotificationSink : public NotificationSink {
+public:
+    void deliver(const vector<Notification>&) override {}
+};
+
+// Bounded multi-producer/multi-consumer ring (Vyukov). Each cell carries a
+// sequence number telling producers and consumers whose turn it is, so
+// enqueue and dequeue are a single CAS on the fast path and never block.
+class NotificationQueue {
+public:
+    struct Cell {
+        atomic<size_t> sequence;
+        Notification data;
+    };
     
-    void sortBooksByTitle() {
-        book_collection.sort([](Books* a, Books* b) { return a->book_name < b->book_name; });
+    unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) atomic<size_t> enqueue_pos;
+    alignas(64) atomic<size_t> dequeue_pos;
+    
+    NotificationQueue(size_t capacity) : enqueue_pos(0), dequeue_pos(0) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, memory_order_relaxed);
+        }
     }
     
-    void sortMembersById() {
-        members.sort([](Member* a, Member* b) { return a->member_id < b->member_id; });
+    size_t capacity() const {
+        return mask + 1;
     }
     
-    void issueBook(int book_id, string member_id) {
-        Books* book = findBook(book_id);
-        Member* member = findMember(member_id);
-        
-        try {
-            if (!book) {
-                throw BookNotFoundException();
-            }
-            
-            if (!member) {
-                throw MemberNotFoundException();
-            }
-            
-            if (!book->availability) {
-                if (book->isReservedBy(member_id)) {
-                    book->removeReservation(member_id);
-                    
-                    queue<pair<int, string>> temp_queue;
-                    while (!reservation_queue.empty()) {
-                        auto reservation = reservation_queue.front();
-                        reservation_queue.pop();
-                        
-                        if (!(reservation.first == book_id && reservation.second == member_id)) {
-                            temp_queue.push(reservation);
-                        }
-                    }
-                    
-                    reservation_queue = temp_queue;
-                } else {
-                    throw BookNotAvailableException();
+    size_t approximateSize() const {
+        size_t head = dequeue_pos.load(memory_order_relaxed);
+        size_t tail = enqueue_pos.load(memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+    
+    bool tryEnqueue(Notification&& notification) {
+        size_t pos = enqueue_pos.load(memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t sequence = cell->sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    break;
                 }
-            }
-            
-            if (member->issued_book_ids.size() >= member->getMaxBooks()) {
-                throw MaxIssueLimitException(member->getMaxBooks());
-            }
-            
-            if (member->fine) {
-                throw PendingFineException(member->fine_amount);
-            }
-            
-            if (book->issueBook()) {
-                member->addIssuedBook(book_id);
-                
-                Transaction* transaction = new Transaction(transaction_counter++, book_id, member_id, book->book_name);
-                transactions.push_back(transaction);
-                
-                recent_transactions.push(transaction);
-                
-                cout << "Book issued successfully! Transaction ID: " << transaction->transaction_Id << endl;
-                cout << "Due Date: Day " << transaction->due_date << endl;
+            } else if (diff < 0) {
+                return false;   // full
             } else {
-                throw InvalidOperationException("Failed to issue book due to unknown error!");
+                pos = enqueue_pos.load(memory_order_relaxed);
             }
         }
-        catch (const LibraryException& e) {
-            cout << "Exception during book issue process: " << e.what() << endl;
-            throw;
-        }
+        cell->data = move(notification);
+        cell->sequence.store(pos + 1, memory_order_release);
+        return true;
     }
     
-    void returnBook(int book_id, string member_id) {
-        try {
-            Books* book = findBook(book_id);
-            Member* member = findMember(member_id);
-            
-            if (!book) {
-                throw BookNotFoundException();
-            }
-            
-            if (!member) {
-                throw MemberNotFoundException();
-            }
-            
-            if (!member->hasIssuedBook(book_id)) {
-                throw InvalidOperationException("This book was not issued to this member!");
-            }
-            
-            if (book->returnBook()) {
-                member->removeIssuedBook(book_id);
-                
-                Transaction* transaction = nullptr;
-                for (auto& t : transactions) {
-                    if (t->book_Id == book_id && t->member_Id == member_id && !t->is_returned) {
-                        transaction = t;
-                        break;
-                    }
-                }
-                
-                if (transaction) {
-                    transaction->completeReturn();
-                    
-                    recent_transactions.push(transaction);
-                    
-                    int late_days = transaction->calculateLateDays();
-                    if (late_days > 0) {
-                        int fine_amount = transaction->calculateFine();
-                        member->addFine(fine_amount);
-                        
-                        cout << "Book returned late by " << late_days << " days!" << endl;
-                        cout << "Fine imposed: Rs. " << fine_amount << endl;
-                    } else {
-                        cout << "Book returned successfully and on time!" << endl;
-                    }
-                    
-                    bool reservation_processed = false;
-                    queue<pair<int, string>> temp_queue;
-                    
-                    while (!reservation_queue.empty() && !reservation_processed) {
-                        auto reservation = reservation_queue.front();
-                        reservation_queue.pop();
-                        
-                        if (reservation.first == book_id) {
-                            cout << "Notification: Book is now available for member " << reservation.second << " who had reserved it." << endl;
-                            reservation_processed = true;
-                        } else {
-                            temp_queue.push(reservation);
-                        }
-                    }
-                    
-                    while (!reservation_queue.empty()) {
-                        temp_queue.push(reservation_queue.front());
-                        reservation_queue.pop();
-                    }
-                    reservation_queue = temp_queue;
-                    
-                } else {
-                    cout << "Book returned successfully, but transaction record not found!" << endl;
+    bool tryDequeue(Notification& notification) {
+        size_t pos = dequeue_pos.load(memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t sequence = cell->sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    break;
                 }
+            } else if (diff < 0) {
+                return false;   // empty
             } else {
-                throw InvalidOperationException("Failed to return book due to system error!");
+                pos = dequeue_pos.load(memory_order_relaxed);
             }
-        } 
-        catch (const LibraryException& e) {
-            cout << "Exception during book return process: " << e.what() << endl;
-            throw;
         }
+        notification = move(cell->data);
+        cell->sequence.store(pos + mask + 1, memory_order_release);
+        return true;
+    }
+};
+
+// Drains the notification queue in batches on a background thread. When the
+// ring is full the notification is rejected rather than blocking the caller,
+// and the rejection is counted as backpressure.
+class NotificationDispatcher {
+public:
+    NotificationQueue queue;
+    size_t batch_size;
+    unique_ptr<NotificationSink> sink;
+    mutex sink_mutex;
+    mutex wake_mutex;
+    condition_variable wake;
+    atomic<bool> idle;
+    atomic<bool> stopping;
+    thread worker;
+    
+    atomic<uint64_t> enqueued;
+    atomic<uint64_t> rejected;       // queue full
+    atomic<uint64_t> delivered;
+    atomic<uint64_t> batches;
+    atomic<uint64_t> max_depth;
+    LatencyHistogram delivery_latency;   // enqueue to delivery, nanoseconds
+    
+    NotificationDispatcher(size_t capacity = 4096, size_t batch = 64)
+        : queue(capacity), batch_size(batch), sink(new ConsoleNotificationSink()), idle(false), stopping(false),
+          enqueued(0), rejected(0), delivered(0), batches(0), max_depth(0) {
+        worker = thread([this] { dispatchLoop(); });
     }
     
-    void reserveBook(int book_id) {
-        try {
-            string member_id;
-            cout << "Enter Member ID who wants to reserve: ";
-            cin >> member_id;
-            
-            Books* book = findBook(book_id);
-            Member* member = findMember(member_id);
-            
-            if (!book) {
-                throw BookNotFoundException();
+    ~NotificationDispatcher() {
+        stop();
+    }
+    
+    void stop() {
+        if (stopping.exchange(true)) {
+            return;
+        }
+        {
+            lock_guard<mutex> lock(wake_mutex);
+        }
+        wake.notify_one();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    
+    void setSink(unique_ptr<NotificationSink> new_sink) {
+        lock_guard<mutex> lock(sink_mutex);
+        sink = move(new_sink);
+    }
+    
+    bool enqueue(const string& member_id, int book_id, const string& message) {
+        if (!queue.tryEnqueue(Notification(member_id, book_id, message))) {
+            rejected.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+        enqueued.fetch_add(1, memory_order_relaxed);
+        uint64_t depth = queue.approximateSize();
+        uint64_t seen = max_depth.load(memory_order_relaxed);
+        while (depth > seen && !max_depth.compare_exchange_weak(seen, depth, memory_order_relaxed)) {
+        }
+        if (idle.load(memory_order_seq_cst)) {
+            // Taking the mutex closes the gap between the dispatcher's empty check and its wait.
+            {
+                lock_guard<mutex> lock(wake_mutex);
             }
-            
-            if (!member) {
-                throw MemberNotFoundException();
+            wake.notify_one();
+        }
+        return true;
+    }
+    
+    void dispatchLoop() {
+        vector<Notification> batch;
+        batch.reserve(batch_size);
+        while (true) {
+            Notification notification;
+            while (batch.size() < batch_size && queue.tryDequeue(notification)) {
+                batch.push_back(move(notification));
             }
-            
-            if (book->availability) {
-                cout << "Book is currently available! No need to reserve." << endl;
-                return;
+            if (!batch.empty()) {
+                deliverBatch(batch);
+                continue;
             }
-            
-            if (book->reserveBook(member_id)) {
-                reservation_queue.push(make_pair(book_id, member_id));
-                cout << "Book reserved successfully!" << endl;
-                cout << "You are position " << book->reserved_by.size() << " in the queue." << endl;
-            } else {
-                cout << "Book already reserved by this member or cannot be reserved!" << endl;
+            if (stopping.load()) {
+                break;
             }
+            unique_lock<mutex> lock(wake_mutex);
+            idle.store(true, memory_order_seq_cst);
+            if (queue.approximateSize() == 0 && !stopping.load()) {
+                wake.wait_for(lock, chrono::milliseconds(50));
+            }
+            idle.store(false, memory_order_relaxed);
         }
-        catch (const LibraryException& e) {
-            cout << "Exception during book reservation process: " << e.what() << endl;
+    }
+    
+    void deliverBatch(vector<Notification>& batch) {
+        {
+            lock_guard<mutex> lock(sink_mutex);
+            sink->deliver(batch);
+        }
+        uint64_t now = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+        for (const auto& notification : batch) {
+            delivery_latency.record(now - notification.enqueued_ns);
         }
+        delivered.fetch_add(batch.size(), memory_order_relaxed);
+        batches.fetch_add(1, memory_order_relaxed);
+        batch.clear();
     }
     
-    void clearFine(string member_id) {
-        try {
-            Member* member = findMember(member_id);
-            
-            if (!member) {
-                throw MemberNotFoundException();
-            }
-            
-            if (!member->fine) {
-                cout << "No fines pending for this member!" << endl;
+    // Blocks until everything accepted so far has reached the sink.
+    void flush() {
+        while (delivered.load() < enqueued.load() && !stopping.load()) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+    
+    void displayStats() {
+        cout << "\n======= NOTIFICATION DISPATCH =======" << endl;
+        cout << "Queue Capacity: " << queue.capacity() << endl;
+        cout << "Queue Depth: " << queue.approximateSize() << " (max " << max_depth.load() << ")" << endl;
+        cout << "Enqueued: " << enqueued.load() << endl;
+        cout << "Rejected (queue full): " << rejected.load() << endl;
+        cout << "Delivered: " << delivered.load() << " in " << batches.load() << " batches" << endl;
+        cout << "Delivery latency p50/p99: " << delivery_latency.percentile(0.50) / 1000 << " / "
+             << delivery_latency.percentile(0.99) / 1000 << " us" << endl;
+        cout << "=====================================" << endl;
+    }
+    
+    void writePrometheus(ostream& out) {
+        out << "# HELP library_notifications_total Notifications by outcome." << endl;
+        out << "# TYPE library_notifications_total counter" << endl;
+        out << "library_notifications_total{outcome=\"enqueued\"} " << enqueued.load() << endl;
+        out << "library_notifications_total{outcome=\"rejected\"} " << rejected.load() << endl;
+        out << "library_notifications_total{outcome=\"delivered\"} " << delivered.load() << endl;
+        out << "# HELP library_notification_queue_depth Notifications waiting for dispatch." << endl;
+        out << "# TYPE library_notification_queue_depth gauge" << endl;
+        out << "library_notification_queue_depth " << queue.approximateSize() << endl;
+        out << "# HELP library_notification_queue_max_depth Highest observed queue depth." << endl;
+        out << "# TYPE library_notification_queue_max_depth gauge" << endl;
+        out << "library_notification_queue_max_depth " << max_depth.load() << endl;
+    }
+};
+
+class HoldTimer {
+public:
+    uint64_t expires;    // first day on which the hold is no longer valid
+    uint64_t hold_id;
+    int book_id;
+    string member_id;
+};
+
+// Hierarchical timing wheel over simulated days. Level L has 64 slots of
+// 64^L days each; timers start in the coarsest level that covers them and are
+// cascaded one level down whenever the level below wraps, so scheduling and
+// expiring a hold are O(1) however many holds are active. Cancelled timers are
+// left in place and ignored when they fire.
+class HoldTimerWheel {
+public:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    
+    vector<HoldTimer> slots[LEVELS][SLOTS];
+    vector<HoldTimer> overflow;   // beyond the range of the top level
+    vector<HoldTimer> due;        // scheduled at or before the current day
+    uint64_t current;
+    size_t pending;
+    
+    HoldTimerWheel(uint64_t start) : current(start), pending(0) {}
+    
+    void schedule(const HoldTimer& timer) {
+        pending++;
+        place(timer);
+    }
+    
+    void place(const HoldTimer& timer) {
+        if (timer.expires <= current) {
+            due.push_back(timer);
+            return;
+        }
+        uint64_t delta = timer.expires - current;
+        for (int level = 0; level < LEVELS; level++) {
+            if (delta < (1ULL << (SLOT_BITS * (level + 1)))) {
+                slots[level][(timer.expires >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(timer);
                 return;
             }
-            
-            cout << "Fine amount to be paid: Rs. " << member->fine_amount << endl;
-            cout << "Confirm payment (Y/N): ";
-            char choice;
-            cin >> choice;
-            
-            if (toupper(choice) == 'Y') {
-                member->clearFine();
-                cout << "Fine cleared successfully!" << endl;
-            } else {
-                cout << "Payment canceled!" << endl;
+        }
+        overflow.push_back(timer);
+    }
+    
+    void cascade(int level) {
+        vector<HoldTimer> moving;
+        moving.swap(slots[level][(current >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+        for (const auto& timer : moving) {
+            place(timer);
+        }
+    }
+    
+    template <class Callback>
+    void fire(vector<HoldTimer>& timers, Callback& on_expire) {
+        vector<HoldTimer> fired;
+        fired.swap(timers);
+        for (const auto& timer : fired) {
+            pending--;
+            on_expire(timer);
+        }
+    }
+    
+    // Moves the wheel to the given day, invoking on_expire for every timer
+    // whose expiry has been reached. on_expire may schedule new timers.
+    template <class Callback>
+    void advance(uint64_t to, Callback on_expire) {
+        fire(due, on_expire);
+        while (current < to) {
+            if (pending == 0) {
+                current = to;
+                break;
             }
+            current++;
+            if ((current & (SLOTS - 1)) == 0) {
+                int top = 1;
+                while (top < LEVELS - 1 && ((current >> (SLOT_BITS * top)) & (SLOTS - 1)) == 0) {
+                    top++;
+                }
+                if (top == LEVELS - 1 && ((current >> (SLOT_BITS * top)) & (SLOTS - 1)) == 0) {
+                    vector<HoldTimer> far;
+                    far.swap(overflow);
+                    for (const auto& timer : far) {
+                        place(timer);
+                    }
+                }
+                for (int level = top; level >= 1; level--) {
+                    cascade(level);
+                }
+            }
+            fire(slots[0][current & (SLOTS - 1)], on_expire);
+            fire(due, on_expire);
         }
-        catch (const LibraryException& e) {
-            cout << "Exception during fine clearance process: " << e.what() << endl;
+    }
+};
+
+// Every open reservation across titles, in the order it was made. Each entry
+// carries a sequence number, so filling or cancelling one reservation removes
+// just that entry instead of rebuilding the queue.
+class ReservationQueue {
+public:
+    map<uint64_t, pair<int, string>> order;          // sequence -> (book, member)
+    map<pair<int, string>, uint64_t> sequence_of;    // (book, member) -> sequence
+    uint64_t next_sequence;
+    
+    ReservationQueue() : next_sequence(1) {}
+    
+    void push(const pair<int, string>& reservation) {
+        if (sequence_of.emplace(reservation, next_sequence).second) {
+            order.emplace(next_sequence++, reservation);
         }
     }
     
-    void generateReport() {
-        int total_books = book_collection.size();
-        int books_issued = 0;
-        int total_members = members.size();
-        int total_transactions = transactions.size();
-        int active_transactions = 0;
-        int completed_transactions = 0;
-        int total_fines = 0;
-        int total_reservations = reservation_queue.size();
-        
-        for (const auto& book : book_collection) {
-            books_issued += book->no_of_copies_issued;
+    bool remove(int book_id, const string& member_id) {
+        auto found = sequence_of.find(make_pair(book_id, member_id));
+        if (found == sequence_of.end()) {
+            return false;
         }
-        
-        for (const auto& transaction : transactions) {
-            if (transaction->is_returned) {
-                completed_transactions++;
-            } else {
-                active_transactions++;
+        order.erase(found->second);
+        sequence_of.erase(found);
+        return true;
+    }
+    
+    void pop() {
+        if (!order.empty()) {
+            sequence_of.erase(order.begin()->second);
+            order.erase(order.begin());
+        }
+    }
+    
+    size_t size() const {
+        return order.size();
+    }
+    
+    bool empty() const {
+        return order.empty();
+    }
+};
+
+inline void appendVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+inline bool readVarint(const char*& in, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        uint8_t byte = *in++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Summary of one immutable archive segment, kept in memory so queries can
+// skip segments whose date or ID ranges cannot match.
+class SegmentInfo {
+public:
+    string path;
+    uint32_t count;
+    int32_t min_issue_day, max_issue_day;
+    int32_t min_transaction_id, max_transaction_id;
+    int32_t min_book_id, max_book_id;
+    uint32_t dictionary_size;
+    uint64_t file_bytes;
+    uint64_t raw_bytes;     // size of the same rows as in-memory fields
+    string member_bloom;    // Bloom filter over the segment's member IDs
+    
+    static const int BLOOM_HASHES = 4;
+    static const size_t BLOOM_BITS_PER_KEY = 10;   // about 1% false positives
+    
+    // Bit positions of member_id, by double hashing one 64-bit FNV-1a hash.
+    void bloomPositions(const string& member_id, size_t positions[BLOOM_HASHES]) const {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : member_id) {
+            hash = (hash ^ c) * 1099511628211ull;
+        }
+        uint64_t step = (hash >> 32) | 1;
+        size_t bits = member_bloom.size() * 8;
+        for (int i = 0; i < BLOOM_HASHES; i++) {
+            positions[i] = (hash + i * step) % bits;
+        }
+    }
+    
+    void addMember(const string& member_id) {
+        size_t positions[BLOOM_HASHES];
+        bloomPositions(member_id, positions);
+        for (size_t position : positions) {
+            member_bloom[position / 8] |= (char)(1 << (position % 8));
+        }
+    }
+    
+    bool mayContainMember(const string& member_id) const {
+        if (member_bloom.empty()) {
+            return true;
+        }
+        size_t positions[BLOOM_HASHES];
+        bloomPositions(member_id, positions);
+        for (size_t position : positions) {
+            if (!(member_bloom[position / 8] & (1 << (position % 8)))) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+class ArchiveFilter {
+public:
+    string member_id;   // empty = any
+    int book_id;        // -1 = any
+    int from_day;
+    int to_day;
+    
+    ArchiveFilter() : book_id(-1), from_day(0), to_day(INT32_MAX) {}
+    
+    bool mayMatch(const SegmentInfo& segment) const {
+        if (segment.max_issue_day < from_day || segment.min_issue_day > to_day) {
+            return false;
+        }
+        if (!member_id.empty() && !segment.mayContainMember(member_id)) {
+            return false;
+        }
+        return book_id < 0 || (book_id >= segment.min_book_id && book_id <= segment.max_book_id);
+    }
+    
+    bool matches(const Transaction& t) const {
+        return t.issue_date >= from_day && t.issue_date <= to_day && (book_id < 0 || t.book_Id == book_id) &&
+               (member_id.empty() || t.member_Id == member_id);
+    }
+};
+
+// Cold tier for closed transactions. Each segment is written once, sorted by
+// issue date, and never modified: member IDs and titles go into a per-segment
+// dictionary and the numeric fields are delta/zigzag varint encoded.
+//
+// Layout: "LMSSEG02" | header (uint32 count, 6 x int32 ranges, uint32
+// dictionary size, uint64 raw bytes, uint32 payload checksum, uint32 Bloom
+// filter bytes, member Bloom filter) | payload.
+//
+// Each compaction writes its own segment, so once MERGE_FANIN segments under
+// MERGE_BELOW rows have piled up they are rewritten as full ones.
+class TransactionArchive {
+public:
+    static const size_t ROWS_PER_SEGMENT = 65536;
+    static const size_t MERGE_BELOW = ROWS_PER_SEGMENT / 4;
+    static const size_t MERGE_FANIN = 8;
+    
+    string directory;
+    vector<SegmentInfo> segments;
+    uint64_t archived_rows;
+    int next_segment;
+    
+    // The archive only holds rows moved out of this process's history, so
+    // segments left by an earlier run are deleted rather than reloaded.
+    TransactionArchive(const string& dir) : directory(dir), archived_rows(0), next_segment(1) {
+        mkdir(directory.c_str(), 0755);
+        removeSegments(directory);
+    }
+    
+    static uint32_t checksum(const string& data) {
+        uint32_t hash = 2166136261u;
+        for (unsigned char c : data) {
+            hash = (hash ^ c) * 16777619u;
+        }
+        return hash;
+    }
+    
+    static void removeSegments(const string& dir) {
+        DIR* listing = opendir(dir.c_str());
+        if (!listing) {
+            return;
+        }
+        while (dirent* entry = readdir(listing)) {
+            string name = entry->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".seg") == 0) {
+                unlink((dir + "/" + name).c_str());
+            }
+        }
+        closedir(listing);
+    }
+    
+    uint64_t fileBytes() const {
+        uint64_t total = 0;
+        for (const auto& segment : segments) {
+            total += segment.file_bytes;
+        }
+        return total;
+    }
+    
+    uint64_t rawBytes() const {
+        uint64_t total = 0;
+        for (const auto& segment : segments) {
+            total += segment.raw_bytes;
+        }
+        return total;
+    }
+    
+    // Writes the given closed transactions (any order) as one or more segments.
+    bool write(vector<Transaction*> rows) {
+        sort(rows.begin(), rows.end(), [](const Transaction* a, const Transaction* b) {
+            return a->issue_date != b->issue_date ? a->issue_date < b->issue_date : a->transaction_Id < b->transaction_Id;
+        });
+        for (size_t start = 0; start < rows.size(); start += ROWS_PER_SEGMENT) {
+            size_t stop = min(rows.size(), start + ROWS_PER_SEGMENT);
+            if (!writeSegment(vector<Transaction*>(rows.begin() + start, rows.begin() + stop))) {
+                return false;
             }
         }
+        return true;
+    }
+    
+    bool writeSegment(const vector<Transaction*>& rows) {
+        SegmentInfo info;
+        info.count = rows.size();
+        info.min_issue_day = info.min_transaction_id = info.min_book_id = INT32_MAX;
+        info.max_issue_day = info.max_transaction_id = info.max_book_id = INT32_MIN;
+        info.raw_bytes = 0;
         
-        for (const auto& member : members) {
-            if (member->fine) {
-                total_fines += member->fine_amount;
+        map<string, uint32_t> dictionary;
+        vector<const string*> dictionary_order;
+        for (const auto t : rows) {
+            for (const string* text : {&t->member_Id, &t->book_name}) {
+                if (dictionary.emplace(*text, dictionary.size()).second) {
+                    dictionary_order.push_back(text);
+                }
             }
+            info.min_issue_day = min(info.min_issue_day, (int32_t)t->issue_date);
+            info.max_issue_day = max(info.max_issue_day, (int32_t)t->issue_date);
+            info.min_transaction_id = min(info.min_transaction_id, (int32_t)t->transaction_Id);
+            info.max_transaction_id = max(info.max_transaction_id, (int32_t)t->transaction_Id);
+            info.min_book_id = min(info.min_book_id, (int32_t)t->book_Id);
+            info.max_book_id = max(info.max_book_id, (int32_t)t->book_Id);
+            info.raw_bytes += sizeof(int) * 5 + sizeof(bool) + t->member_Id.size() + t->book_name.size();
+        }
+        // The dictionary also holds titles, so this over-sizes the filter a little.
+        info.member_bloom.assign(max<size_t>(64, dictionary_order.size() * SegmentInfo::BLOOM_BITS_PER_KEY / 8), '\0');
+        for (const auto t : rows) {
+            info.addMember(t->member_Id);
         }
         
-        cout << "\n======= LIBRARY SYSTEM REPORT =======" << endl;
-        cout << "Total Books in Library: " << total_books << endl;
-        cout << "Books Currently Issued: " << books_issued << endl;
-        cout << "Total Members: " << total_members << endl;
-        cout << "Total Transactions: " << total_transactions << endl;
-        cout << "Active Issues: " << active_transactions << endl;
-        cout << "Completed Returns: " << completed_transactions << endl;
-        cout << "Total Pending Fines: Rs. " << total_fines << endl;
-        cout << "Current Reservations: " << total_reservations << endl;
-        cout << "=======================================\n" << endl;
-    }
-            
-    void addSampleData() {
-        Books* book1 = new Books();
-        book1->book_name = "Introduction to C++";
-        book1->book_Id = 101;
-        book1->author_name = "Bjarne Stroustrup";
-        book1->publisher = "Addison-Wesley";
-        book1->ISBN_no = 1234567890;
-        book1->no_of_copies = 5;
-        book1->no_of_copies_issued = 0;
-        book1->availability = true;
-        addBook(book1);
+        string payload;
+        for (const string* text : dictionary_order) {
+            appendVarint(payload, text->size());
+            payload += *text;
+        }
+        int64_t previous_day = 0, previous_id = 0, previous_book = 0;
+        for (const auto t : rows) {
+            appendVarint(payload, zigzag(t->issue_date - previous_day));
+            appendVarint(payload, zigzag(t->transaction_Id - previous_id));
+            appendVarint(payload, zigzag(t->book_Id - previous_book));
+            appendVarint(payload, dictionary[t->member_Id]);
+            appendVarint(payload, dictionary[t->book_name]);
+            appendVarint(payload, zigzag(t->due_date - t->issue_date));
+            appendVarint(payload, zigzag(t->return_date - t->issue_date));
+            previous_day = t->issue_date;
+            previous_id = t->transaction_Id;
+            previous_book = t->book_Id;
+        }
         
-        Books* book2 = new Books();
-        book2->book_name = "Data Structures and Algorithms";
-        book2->book_Id = 102;
+        string header = "LMSSEG02";
+        auto put32 = [&header](uint32_t value) { header.append((const char*)&value, sizeof(value)); };
+        put32(info.count);
+        put32(info.min_issue_day);
+        put32(info.max_issue_day);
+        put32(info.min_transaction_id);
+        put32(info.max_transaction_id);
+        put32(info.min_book_id);
+        put32(info.max_book_id);
+        info.dictionary_size = dictionary_order.size();
+        put32(info.dictionary_size);
+        header.append((const char*)&info.raw_bytes, sizeof(info.raw_bytes));
+        put32(checksum(payload));
+        put32(info.member_bloom.size());
+        header += info.member_bloom;
+        
+        char name[32];
+        snprintf(name, sizeof(name), "segment_%06d.seg", next_segment);
+        info.path = directory + "/" + name;
+        string temp_path = info.path + ".tmp";
+        {
+            ofstream file(temp_path, ios::binary | ios::trunc);
+            if (!file) {
+                return false;
+            }
+            file << header << payload;
+            if (!file.flush()) {
+                return false;
+            }
+        }
+        if (rename(temp_path.c_str(), info.path.c_str()) != 0) {
+            return false;
+        }
+        next_segment++;
+        info.file_bytes = header.size() + payload.size();
+        segments.push_back(info);
+        archived_rows += info.count;
+        return true;
+    }
+    
+    // Rewrites the small segments as full ones once there are MERGE_FANIN of
+    // them, so a query opens a few large files rather than one per day the
+    // clock advanced. Returns the number of segments merged, or -1 if the
+    // rewrite failed, in which case the old segments are kept. No reader may
+    // hold a segment list while this runs.
+    int mergeSmallSegments() {
+        vector<SegmentInfo> kept, small;
+        for (const auto& segment : segments) {
+            (segment.count < MERGE_BELOW ? small : kept).push_back(segment);
+        }
+        if (small.size() < MERGE_FANIN) {
+            return 0;
+        }
+        vector<Transaction> rows;
+        for (const auto& segment : small) {
+            if (!decode(segment, ArchiveFilter(), rows)) {
+                return -1;
+            }
+        }
+        vector<Transaction*> pointers;
+        pointers.reserve(rows.size());
+        for (auto& row : rows) {
+            pointers.push_back(&row);
+        }
+        vector<SegmentInfo> before = segments;
+        uint64_t rows_before = archived_rows;
+        segments = kept;
+        archived_rows -= rows.size();
+        if (!write(pointers)) {
+            for (size_t i = kept.size(); i < segments.size(); i++) {
+                unlink(segments[i].path.c_str());
+            }
+            segments = before;
+            archived_rows = rows_before;
+            return -1;
+        }
+        for (const auto& segment : small) {
+            unlink(segment.path.c_str());
+        }
+        return small.size();
+    }
+    
+    static bool readSegment(const string& path, SegmentInfo& info, string& payload) {
+        ifstream file(path, ios::binary);
+        if (!file) {
+            return false;
+        }
+        string data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        size_t header_size = 8 + 8 * 4 + 8 + 4 + 4;
+        if (data.size() < header_size || data.compare(0, 8, "LMSSEG02") != 0) {
+            return false;
+        }
+        const char* p = data.data() + 8;
+        auto get32 = [&p]() { uint32_t value; memcpy(&value, p, sizeof(value)); p += sizeof(value); return value; };
+        info.path = path;
+        info.count = get32();
+        info.min_issue_day = get32();
+        info.max_issue_day = get32();
+        info.min_transaction_id = get32();
+        info.max_transaction_id = get32();
+        info.min_book_id = get32();
+        info.max_book_id = get32();
+        info.dictionary_size = get32();
+        memcpy(&info.raw_bytes, p, sizeof(info.raw_bytes));
+        p += sizeof(info.raw_bytes);
+        uint32_t expected_checksum = get32();
+        uint32_t bloom_bytes = get32();
+        if (data.size() - header_size < bloom_bytes) {
+            return false;
+        }
+        info.member_bloom.assign(p, bloom_bytes);
+        header_size += bloom_bytes;
+        info.file_bytes = data.size();
+        payload = data.substr(header_size);
+        return checksum(payload) == expected_checksum;
+    }
+    
+    // Decodes the rows of one segment that pass the filter.
+    static bool decode(const SegmentInfo& segment, const ArchiveFilter& filter, vector<Transaction>& out) {
+        SegmentInfo info;
+        string payload;
+        if (!readSegment(segment.path, info, payload)) {
+            return false;
+        }
+        const char* p = payload.data();
+        const char* end = p + payload.size();
+        uint64_t value;
+        
+        vector<string> dictionary;
+        dictionary.reserve(info.dictionary_size);
+        for (uint32_t i = 0; i < info.dictionary_size; i++) {
+            if (!readVarint(p, end, value) || (uint64_t)(end - p) < value) {
+                return false;
+            }
+            dictionary.emplace_back(p, value);
+            p += value;
+        }
+        
+        int64_t day = 0, id = 0, book = 0;
+        for (uint32_t row = 0; row < info.count; row++) {
+            uint64_t fields[7];
+            for (auto& field : fields) {
+                if (!readVarint(p, end, field)) {
+                    return false;
+                }
+            }
+            day += unzigzag(fields[0]);
+            id += unzigzag(fields[1]);
+            book += unzigzag(fields[2]);
+            if (fields[3] >= dictionary.size() || fields[4] >= dictionary.size()) {
+                return false;
+            }
+            Transaction t(id, book, dictionary[fields[3]], dictionary[fields[4]]);
+            t.issue_date = day;
+            t.due_date = day + unzigzag(fields[5]);
+            t.return_date = day + unzigzag(fields[6]);
+            t.is_returned = true;
+            if (filter.matches(t)) {
+                out.push_back(t);
+            }
+        }
+        return true;
+    }
+};
+
+class TransactionEvent {
+public:
+    char type;            // 'I' issue, 'R' return
+    int day;
+    int transaction_id;
+    int book_id;
+    string member_id;
+};
+
+// Fixed-capacity ring of the most recent circulation events; the oldest
+// event is overwritten once the ring is full.
+class RecentEventRing {
+public:
+    vector<TransactionEvent> events;
+    size_t next;
+    size_t stored;
+    
+    RecentEventRing(size_t capacity) : events(capacity), next(0), stored(0) {}
+    
+    void push(char type, const Transaction* transaction) {
+        TransactionEvent& event = events[next];
+        event.type = type;
+        event.day = type == 'R' ? transaction->return_date : transaction->issue_date;
+        event.transaction_id = transaction->transaction_Id;
+        event.book_id = transaction->book_Id;
+        event.member_id = transaction->member_Id;
+        next = (next + 1) % events.size();
+        stored = min(stored + 1, events.size());
+    }
+    
+    size_t size() const {
+        return stored;
+    }
+    
+    // i = 0 is the newest event.
+    const TransactionEvent& newest(size_t i) const {
+        return events[(next + events.size() - 1 - i) % events.size()];
+    }
+};
+
+// Forward-only cursor over one secondary index of the ledger. Archived
+// matches come first, decoded one segment at a time; in-memory matches are
+// then copied a batch at a time under the circulation lock, so a long scan
+// never holds the lock between batches and never reads a live transaction
+// that a return may be updating. A returned match is valid until the next
+// call. While a cursor is open the archiver leaves the live ledger alone.
+class TransactionCursor {
+public:
+    static const size_t BATCH = 64;
+    
+    mutex* lock_source;
+    const vector<Transaction*>* source;   // sorted by issue date
+    size_t position;
+    size_t end;
+    vector<Transaction> buffer;         // copies of the current batch
+    size_t buffered;
+    atomic<int>* open_cursors;
+    vector<SegmentInfo> archived_segments;
+    size_t next_segment;
+    ArchiveFilter archive_filter;
+    vector<Transaction> decoded;        // matches of the segment being read
+    size_t decoded_next;
+    
+    TransactionCursor(mutex* m, const vector<Transaction*>* index, size_t from, size_t to, atomic<int>* counter)
+        : lock_source(m), source(index), position(from), end(to), buffered(0), open_cursors(counter),
+          next_segment(0), decoded_next(0) {
+        if (open_cursors) {
+            open_cursors->fetch_add(1);
+        }
+    }
+    
+    TransactionCursor(TransactionCursor&& other)
+        : lock_source(other.lock_source), source(other.source), position(other.position), end(other.end),
+          buffer(move(other.buffer)), buffered(other.buffered), open_cursors(other.open_cursors),
+          archived_segments(move(other.archived_segments)), next_segment(other.next_segment),
+          archive_filter(other.archive_filter), decoded(move(other.decoded)), decoded_next(other.decoded_next) {
+        other.open_cursors = nullptr;
+    }
+    
+    void addArchivedSegments(const vector<SegmentInfo>& segments, const ArchiveFilter& filter) {
+        archive_filter = filter;
+        for (const auto& segment : segments) {
+            if (filter.mayMatch(segment)) {
+                archived_segments.push_back(segment);
+            }
+        }
+    }
+    
+    ~TransactionCursor() {
+        if (open_cursors) {
+            open_cursors->fetch_sub(1);
+        }
+    }
+    
+    // Returns the next match, or nullptr when the range is exhausted.
+    const Transaction* next() {
+        while (decoded_next == decoded.size() && next_segment < archived_segments.size()) {
+            decoded.clear();
+            decoded_next = 0;
+            TransactionArchive::decode(archived_segments[next_segment++], archive_filter, decoded);
+        }
+        if (decoded_next < decoded.size()) {
+            return &decoded[decoded_next++];
+        }
+        
+        if (buffered == buffer.size()) {
+            buffer.clear();
+            buffered = 0;
+            if (!source || position >= end) {
+                return nullptr;
+            }
+            lock_guard<mutex> lock(*lock_source);
+            size_t stop = min(end, position + BATCH);
+            for (; position < stop; position++) {
+                buffer.push_back(*(*source)[position]);
+            }
+        }
+        return &buffer[buffered++];
+    }
+};
+
+// Immutable versioned array of frozen records, shared structurally between
+// versions: publishing copies only the 64-record chunks that hold a changed
+// record plus the chunk table, so a new version costs O(changes + n/64).
+// Frozen records are never modified once published.
+template <class Record>
+class SnapshotArray {
+public:
+    static const size_t CHUNK_SIZE = 64;
+    typedef vector<shared_ptr<Record>> Chunk;
+    
+    vector<shared_ptr<const Chunk>> chunks;
+    size_t count;
+    
+    SnapshotArray() : count(0) {}
+    
+    size_t size() const {
+        return count;
+    }
+    
+    Record* operator[](size_t index) const {
+        return (*chunks[index / CHUNK_SIZE])[index % CHUNK_SIZE].get();
+    }
+    
+    // Returns the next version with every stale record frozen into its slot;
+    // records seen for the first time are appended. Called with the owning
+    // system's lock held, since it reads the live records.
+    SnapshotArray publish(const vector<Record*>& stale) const {
+        SnapshotArray next(*this);
+        unordered_map<size_t, shared_ptr<Chunk>> copied;
+        for (Record* record : stale) {
+            if (record->snapshot_slot < 0) {
+                record->snapshot_slot = next.count++;
+            }
+            size_t chunk_index = record->snapshot_slot / CHUNK_SIZE;
+            shared_ptr<Chunk>& chunk = copied[chunk_index];
+            if (!chunk) {
+                if (chunk_index < next.chunks.size()) {
+                    chunk = make_shared<Chunk>(*next.chunks[chunk_index]);
+                } else {
+                    chunk = make_shared<Chunk>();
+                    chunk->reserve(CHUNK_SIZE);
+                    next.chunks.resize(chunk_index + 1);
+                }
+            }
+            size_t offset = record->snapshot_slot % CHUNK_SIZE;
+            if (chunk->size() <= offset) {
+                chunk->resize(offset + 1);
+            }
+            (*chunk)[offset] = shared_ptr<Record>(record->snapshotCopy());
+            record->snapshot_stale = false;
+        }
+        for (auto& entry : copied) {
+            next.chunks[entry.first] = entry.second;
+        }
+        return next;
+    }
+};
+
+// Consistent point-in-time view of the catalog, members and circulation
+// totals. Reports, listings and exports walk a snapshot instead of the live
+// containers, so they never hold the circulation lock while they run.
+class CatalogSnapshot {
+public:
+    uint64_t version;
+    int day;
+    SnapshotArray<Books> books;
+    SnapshotArray<Member> members;
+    size_t transactions;       // in memory and archived
+    size_t active_loans;
+    size_t reservations;
+    
+    CatalogSnapshot() : version(0), day(0), transactions(0), active_loans(0), reservations(0) {}
+};
+
+// Split-block Bloom filter: a key picks one 256-bit block and sets one bit
+// in each of its eight 32-bit words, so a lookup reads a single cache line
+// and tests all eight bits without branching. A "no" is definite; a "maybe"
+// has to be confirmed against the exact index, which reports back through
+// confirm() so the observed false-positive rate can be shown. The owner
+// rebuilds the filter larger once it holds more keys than it was sized for.
+class BloomFilter {
+public:
+    static const size_t BLOCK_WORDS = 8;
+    static const size_t BLOCK_BITS = BLOCK_WORDS * 32;
+    
+    vector<uint32_t> words;
+    size_t block_count;
+    size_t capacity;
+    size_t inserted;
+    double target_rate;
+    uint64_t definite_negatives;
+    uint64_t false_positives;
+    uint64_t true_positives;
+    
+    BloomFilter(size_t expected = 1024, double rate = 0.01) {
+        reset(expected, rate);
+    }
+    
+    // Sizes for the expected key count at the classic -ln(p)/ln(2)^2 bits per
+    // key; one bit per word puts the measured rate a little above target.
+    void reset(size_t expected, double rate) {
+        capacity = max(expected, (size_t)64);
+        target_rate = rate;
+        double bits = -(double)capacity * log(rate) / (log(2.0) * log(2.0));
+        block_count = max((size_t)1, (size_t)ceil(bits / BLOCK_BITS));
+        words.assign(block_count * BLOCK_WORDS, 0);
+        inserted = 0;
+        definite_negatives = false_positives = true_positives = 0;
+    }
+    
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+    
+    static uint64_t keyHash(long long value) {
+        return mix((uint64_t)value);
+    }
+    
+    static uint64_t keyHash(const string& value) {
+        return mix(hash<string>()(value));
+    }
+    
+    // High half picks the block, low half the bit within each word.
+    uint32_t* blockFor(uint64_t key) {
+        return &words[(size_t)(((key >> 32) * block_count) >> 32) * BLOCK_WORDS];
+    }
+    
+    static uint32_t bitInWord(uint32_t key, size_t word) {
+        static const uint32_t SALT[BLOCK_WORDS] = {
+            0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+            0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+        };
+        return 1U << ((key * SALT[word]) >> 27);
+    }
+    
+    void add(uint64_t key) {
+        uint32_t* block = blockFor(key);
+        for (size_t i = 0; i < BLOCK_WORDS; i++) {
+            block[i] |= bitInWord((uint32_t)key, i);
+        }
+        inserted++;
+    }
+    
+    bool mayContain(uint64_t key) {
+        const uint32_t* block = blockFor(key);
+        uint32_t missing = 0;
+        for (size_t i = 0; i < BLOCK_WORDS; i++) {
+            missing |= ~block[i] & bitInWord((uint32_t)key, i);
+        }
+        if (missing) {
+            definite_negatives++;
+            return false;
+        }
+        return true;
+    }
+    
+    // Records the exact answer for a key the filter passed and returns it.
+    bool confirm(bool present) {
+        if (present) {
+            true_positives++;
+        } else {
+            false_positives++;
+        }
+        return present;
+    }
+    
+    bool full() const {
+        return inserted >= capacity;
+    }
+    
+    // Share of absent keys the filter failed to rule out.
+    double observedFalsePositiveRate() const {
+        uint64_t absent = definite_negatives + false_positives;
+        return absent ? (double)false_positives / absent : 0;
+    }
+    
+    size_t memoryBytes() const {
+        return words.size() * sizeof(uint32_t);
+    }
+};
+
+class IngestResult {
+public:
+    size_t added_books;
+    size_t duplicate_books;    // same book ID or ISBN as a record already held
+    size_t added_members;
+    size_t duplicate_members;
+    size_t exact_lookups;      // authoritative index probes that were needed
+    
+    IngestResult() : added_books(0), duplicate_books(0), added_members(0), duplicate_members(0), exact_lookups(0) {}
+};
+
+class SerialCheckIn {
+public:
+    size_t checked_in;
+    size_t duplicates;         // book ID or ISBN taken, or that volume and issue already held
+    uint64_t holds_placed;     // new issues set aside for subscribers
+    uint64_t queue_places;     // subscribers queued because no copy was left
+    
+    SerialCheckIn() : checked_in(0), duplicates(0), holds_placed(0), queue_places(0) {}
+};
+
+// Runs work(0) .. work(threads - 1), on the calling thread and threads - 1
+// others, and returns when all have finished.
+static void runOnWorkers(int threads, const function<void(int)>& work) {
+    vector<thread> workers;
+    for (int t = 1; t < threads; t++) {
+        workers.emplace_back(work, t);
+    }
+    work(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Space-Saving heavy hitters (Metwally et al.): tracks at most K keys; an
+// untracked key takes over the smallest counter and inherits its count as
+// the error bound. Counters sit in a min-heap so that takeover is O(log K).
+class SpaceSavingTopK {
+public:
+    class Counter {
+    public:
+        int key;
+        long long count;
+        long long error;    // count may overstate the true frequency by up to this much
+    };
+    
+    size_t capacity;
+    vector<Counter> heap;
+    unordered_map<int, size_t> position;   // key -> index in heap
+    long long total;
+    
+    SpaceSavingTopK(size_t k = 32) : capacity(k), total(0) {}
+    
+    void offer(int key) {
+        total++;
+        auto it = position.find(key);
+        if (it != position.end()) {
+            heap[it->second].count++;
+            siftDown(it->second);
+        } else if (heap.size() < capacity) {
+            heap.push_back(Counter{key, 1, 0});
+            position[key] = heap.size() - 1;
+            siftUp(heap.size() - 1);
+        } else {
+            Counter& smallest = heap[0];
+            position.erase(smallest.key);
+            smallest.error = smallest.count;
+            smallest.count++;
+            smallest.key = key;
+            position[key] = 0;
+            siftDown(0);
+        }
+    }
+    
+    // Tracked keys, most frequent first.
+    vector<Counter> top() const {
+        vector<Counter> result = heap;
+        sort(result.begin(), result.end(), [](const Counter& a, const Counter& b) {
+            return a.count > b.count;
+        });
+        return result;
+    }
+    
+    void swapAt(size_t a, size_t b) {
+        swap(heap[a], heap[b]);
+        position[heap[a].key] = a;
+        position[heap[b].key] = b;
+    }
+    
+    void siftUp(size_t i) {
+        while (i > 0 && heap[(i - 1) / 2].count > heap[i].count) {
+            swapAt(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+    
+    void siftDown(size_t i) {
+        while (true) {
+            size_t smallest = i;
+            size_t left = 2 * i + 1, right = 2 * i + 2;
+            if (left < heap.size() && heap[left].count < heap[smallest].count) {
+                smallest = left;
+            }
+            if (right < heap.size() && heap[right].count < heap[smallest].count) {
+                smallest = right;
+            }
+            if (smallest == i) {
+                return;
+            }
+            swapAt(i, smallest);
+            i = smallest;
+        }
+    }
+};
+
+class DemandWindow {
+public:
+    int window;            // day / TitleDemand::WINDOW_DAYS; -1 while unused
+    int issues;
+    int unmet;             // issue attempts refused because no copy was free
+    int holds_filled;      // reservations that became pickup holds
+    int peak_queue;
+    long long queue_days;  // reservation queue length summed over the window's days
+    
+    DemandWindow() : window(-1), issues(0), unmet(0), holds_filled(0), peak_queue(0), queue_days(0) {}
+};
+
+// Demand counters of one title in fixed windows of WINDOW_DAYS days. The
+// last WINDOWS windows are kept in a ring; a slot is cleared when a new
+// window first lands on it, so nothing has to run at day boundaries.
+class TitleDemand {
+public:
+    static const int WINDOW_DAYS = 7;
+    static const int WINDOWS = 13;
+    
+    DemandWindow ring[WINDOWS];
+    int queue_length;
+    int queue_since;       // day the current queue length was reached
+    
+    TitleDemand() : queue_length(0), queue_since(LibraryClock::today()) {}
+    
+    DemandWindow& at(int day) {
+        int window = day / WINDOW_DAYS;
+        DemandWindow& slot = ring[window % WINDOWS];
+        if (slot.window != window) {
+            slot = DemandWindow();
+            slot.window = window;
+        }
+        return slot;
+    }
+    
+    // Credits the current queue length to the windows up to day.
+    void settleQueue(int day) {
+        int oldest = max(queue_since, (day / WINDOW_DAYS - WINDOWS + 1) * WINDOW_DAYS);
+        for (int d = oldest; d < day;) {
+            int until = min(day, (d / WINDOW_DAYS + 1) * WINDOW_DAYS);
+            DemandWindow& slot = at(d);
+            slot.queue_days += (long long)queue_length * (until - d);
+            slot.peak_queue = max(slot.peak_queue, queue_length);
+            d = until;
+        }
+        queue_since = max(queue_since, day);
+    }
+    
+    void setQueue(int length, int day) {
+        settleQueue(day);
+        queue_length = length;
+        DemandWindow& slot = at(day);
+        slot.peak_queue = max(slot.peak_queue, length);
+    }
+    
+    // Sums the kept windows that overlap [from_day, to_day].
+    DemandWindow totals(int from_day, int to_day) const {
+        DemandWindow sum;
+        for (const DemandWindow& slot : ring) {
+            if (slot.window >= 0 && (slot.window + 1) * WINDOW_DAYS > from_day && slot.window * WINDOW_DAYS <= to_day) {
+                sum.issues += slot.issues;
+                sum.unmet += slot.unmet;
+                sum.holds_filled += slot.holds_filled;
+                sum.peak_queue = max(sum.peak_queue, slot.peak_queue);
+                sum.queue_days += slot.queue_days;
+            }
+        }
+        return sum;
+    }
+};
+
+// Streaming demand aggregates kept by the circulation calls, with the lock held.
+class DemandTracker {
+public:
+    unordered_map<int, TitleDemand> titles;
+    SpaceSavingTopK top_demand;      // issues plus refused issues
+    
+    DemandTracker() : top_demand(32) {}
+    
+    void recordIssue(int book_id, int day) {
+        titles[book_id].at(day).issues++;
+        top_demand.offer(book_id);
+    }
+    
+    void recordUnmet(int book_id, int day) {
+        titles[book_id].at(day).unmet++;
+        top_demand.offer(book_id);
+    }
+    
+    void recordHoldFilled(int book_id, int day) {
+        titles[book_id].at(day).holds_filled++;
+    }
+    
+    void recordQueue(int book_id, int length, int day) {
+        auto it = titles.find(book_id);
+        if (it == titles.end()) {
+            if (length == 0) {
+                return;
+            }
+            it = titles.emplace(book_id, TitleDemand()).first;
+        }
+        if (it->second.queue_length != length) {
+            it->second.setQueue(length, day);
+        }
+    }
+};
+
+class TitleForecast {
+public:
+    int book_id;
+    string title;
+    int copies;
+    long long issues;          // in the forecast window, from the transaction history
+    long long unmet;           // refused issues in the window
+    double mean_loan_days;
+    double mean_queue;         // average reservation queue length
+    int peak_queue;
+    int copies_needed;
+    int shortfall;             // copies_needed - copies
+};
+
+// Per-title loan totals gathered by one forecast worker.
+class LoanTotals {
+public:
+    long long issues;
+    long long returned;
+    long long loan_days;       // of returned loans
+    
+    LoanTotals() : issues(0), returned(0), loan_days(0) {}
+};
+
+// Open-addressing counter table for nonzero 64-bit keys: linear probing in
+// one flat array kept at most half full, so a lookup usually reads one
+// cache line and an increment never allocates.
+class PairCountTable {
+public:
+    class Slot {
+    public:
+        uint64_t key;     // 0 = empty
+        int count;
+    };
+    
+    vector<Slot> slots;
+    size_t used;
+    
+    PairCountTable() : slots(16, Slot{0, 0}), used(0) {}
+    
+    int increment(uint64_t key, int by = 1) {
+        if ((used + 1) * 2 > slots.size()) {
+            grow(slots.size() * 2);
+        }
+        Slot& slot = find(key);
+        if (slot.key == 0) {
+            slot.key = key;
+            used++;
+        }
+        return slot.count += by;
+    }
+    
+    int get(uint64_t key) const {
+        const Slot& slot = const_cast<PairCountTable*>(this)->find(key);
+        return slot.key ? slot.count : 0;
+    }
+    
+    size_t size() const {
+        return used;
+    }
+    
+    void swap(PairCountTable& other) {
+        slots.swap(other.slots);
+        std::swap(used, other.used);
+    }
+    
+    void reserve(size_t keys) {
+        size_t capacity = slots.size();
+        while (capacity < keys * 2) {
+            capacity *= 2;
+        }
+        if (capacity > slots.size()) {
+            grow(capacity);
+        }
+    }
+    
+    Slot& find(uint64_t key) {
+        size_t mask = slots.size() - 1;
+        size_t i = BloomFilter::mix(key) & mask;
+        while (slots[i].key != 0 && slots[i].key != key) {
+            i = (i + 1) & mask;
+        }
+        return slots[i];
+    }
+    
+    void grow(size_t capacity) {
+        vector<Slot> old(capacity, Slot{0, 0});
+        old.swap(slots);
+        for (const Slot& slot : old) {
+            if (slot.key) {
+                find(slot.key) = slot;
+            }
+        }
+    }
+};
+
+class Neighbor {
+public:
+    int book_id;
+    int together;      // members who borrowed both titles
+};
+
+// Item-item co-borrowing model: two titles are related when the same member
+// borrowed both. Each issue of a title the member has not borrowed before
+// pairs it with the member's last HISTORY distinct titles and moves the
+// pair up in the top-N neighbour lists of both sides, so a lookup is a copy
+// of a short vector. Neighbours are ranked by the co-borrowing count, which
+// only grows, so a title missing from a list can only get in by being
+// counted again: the incremental lists stay exact and the batch rebuild
+// gives the same result. Has its own lock so catalog views can read it
+// without the circulation lock.
+class CoBorrowModel {
+public:
+    static const int HISTORY = 20;
+    static const int TOP_N = 10;
+    static const int SHARDS = 64;
+    
+    mutable shared_mutex model_mutex;
+    unordered_map<string, vector<int>> member_titles;       // distinct titles in first-borrow order
+    PairCountTable together[SHARDS];                        // pairKey(a, b), a < b -> members who borrowed both
+    unordered_map<int, vector<Neighbor>> neighbors;         // best TOP_N, most co-borrowed first
+    bool rebuilding;
+    vector<pair<string, int>> pending;                      // issues seen while a rebuild runs
+    
+    // Marks a rebuild as running for its lifetime, so issues made meanwhile
+    // are kept for replay, and clears the mark however the rebuild ends.
+    // Throws if another rebuild is running.
+    class RebuildGuard {
+    public:
+        CoBorrowModel& model;
+        
+        RebuildGuard(CoBorrowModel& m) : model(m) {
+            model.beginRebuild();
+        }
+        
+        ~RebuildGuard() {
+            model.endRebuild();
+        }
+    };
+    
+    CoBorrowModel() : rebuilding(false) {}
+    
+    void beginRebuild() {
+        unique_lock<shared_mutex> lock(model_mutex);
+        if (rebuilding) {
+            throw InvalidOperationException("A recommendation rebuild is already running!");
+        }
+        rebuilding = true;
+    }
+    
+    void endRebuild() {
+        unique_lock<shared_mutex> lock(model_mutex);
+        pending.clear();
+        rebuilding = false;
+    }
+    
+    static uint64_t pairKey(int a, int b) {
+        return (uint64_t)(uint32_t)min(a, b) << 32 | (uint32_t)max(a, b);
+    }
+    
+    static int shardOf(uint64_t key) {
+        return (int)(BloomFilter::mix(key >> 32) % SHARDS);
+    }
+    
+    void recordIssue(const string& member_id, int book_id) {
+        unique_lock<shared_mutex> lock(model_mutex);
+        apply(member_id, book_id);
+        if (rebuilding) {
+            pending.push_back(make_pair(member_id, book_id));
+        }
+    }
+    
+    vector<Neighbor> lookup(int book_id, size_t limit = TOP_N) const {
+        shared_lock<shared_mutex> lock(model_mutex);
+        auto it = neighbors.find(book_id);
+        if (it == neighbors.end()) {
+            return vector<Neighbor>();
+        }
+        return vector<Neighbor>(it->second.begin(), it->second.begin() + min(limit, it->second.size()));
+    }
+    
+    void apply(const string& member_id, int book_id) {
+        vector<int>& titles = member_titles[member_id];
+        if (find(titles.begin(), titles.end(), book_id) != titles.end()) {
+            return;   // borrowing a title again adds no new pairs
+        }
+        for (size_t i = titles.size() > HISTORY ? titles.size() - HISTORY : 0; i < titles.size(); i++) {
+            int other = titles[i];
+            uint64_t key = pairKey(other, book_id);
+            int count = together[shardOf(key)].increment(key);
+            offer(neighbors[other], Neighbor{book_id, count});
+            offer(neighbors[book_id], Neighbor{other, count});
+        }
+        titles.push_back(book_id);
+    }
+    
+    static bool ranksBefore(const Neighbor& a, const Neighbor& b) {
+        return a.together != b.together ? a.together > b.together : a.book_id < b.book_id;
+    }
+    
+    // Inserts or updates candidate in a list kept sorted and capped at TOP_N.
+    // Counts only grow, so a candidate that does not beat the last entry of a
+    // full list is not in it, and one that is in it can only move up.
+    static void offer(vector<Neighbor>& list, const Neighbor& candidate) {
+        if (list.size() >= TOP_N && !ranksBefore(candidate, list.back())) {
+            return;
+        }
+        size_t i = 0;
+        while (i < list.size() && list[i].book_id != candidate.book_id) {
+            i++;
+        }
+        if (i == list.size()) {
+            if (list.size() < TOP_N) {
+                list.push_back(candidate);
+            } else {
+                list.back() = candidate;
+            }
+            i = list.size() - 1;
+        } else {
+            list[i] = candidate;
+        }
+        for (; i > 0 && ranksBefore(list[i], list[i - 1]); i--) {
+            swap(list[i], list[i - 1]);
+        }
+    }
+    
+    // Rebuilds counts and neighbour lists from each member's titles (in
+    // first-borrow order) on threads workers, under a RebuildGuard, in three passes:
+    //   1. members are split across workers, which emit a key per pair into
+    //      one buffer per shard;
+    //   2. each worker sorts and counts the keys of the shards it owns;
+    //   3. each worker ranks the neighbours of the titles it owns.
+    // Returns the number of distinct title pairs.
+    size_t rebuild(const vector<string>& member_ids, const vector<vector<int>>& histories, int threads) {
+        threads = max(threads, 1);
+        vector<vector<vector<uint64_t>>> emitted(threads, vector<vector<uint64_t>>(SHARDS));
+        runOnWorkers(threads, [&](int t) {
+            for (size_t m = histories.size() * t / threads; m < histories.size() * (t + 1) / threads; m++) {
+                const vector<int>& titles = histories[m];
+                for (size_t i = 1; i < titles.size(); i++) {
+                    for (size_t j = i > HISTORY ? i - HISTORY : 0; j < i; j++) {
+                        uint64_t key = pairKey(titles[j], titles[i]);
+                        emitted[t][shardOf(key)].push_back(key);
+                    }
+                }
+            }
+        });
+        
+        vector<vector<pair<uint64_t, int>>> counted(SHARDS);
+        vector<PairCountTable> new_together(SHARDS);
+        runOnWorkers(threads, [&](int t) {
+            for (int shard = t; shard < SHARDS; shard += threads) {
+                vector<uint64_t> keys;
+                for (int producer = 0; producer < threads; producer++) {
+                    keys.insert(keys.end(), emitted[producer][shard].begin(), emitted[producer][shard].end());
+                    vector<uint64_t>().swap(emitted[producer][shard]);
+                }
+                sort(keys.begin(), keys.end());
+                for (size_t i = 0; i < keys.size();) {
+                    size_t run = i;
+                    while (run < keys.size() && keys[run] == keys[i]) {
+                        run++;
+                    }
+                    counted[shard].push_back(make_pair(keys[i], (int)(run - i)));
+                    i = run;
+                }
+                new_together[shard].reserve(counted[shard].size());
+                for (const auto& entry : counted[shard]) {
+                    new_together[shard].increment(entry.first, entry.second);
+                }
+            }
+        });
+        
+        vector<unordered_map<int, vector<Neighbor>>> owned(threads);
+        runOnWorkers(threads, [&](int t) {
+            auto owns = [&](int book_id) {
+                return (int)(BloomFilter::mix((uint64_t)book_id) % threads) == t;
+            };
+            for (const auto& shard : counted) {
+                for (const auto& entry : shard) {
+                    int a = (int)(entry.first >> 32), b = (int)(uint32_t)entry.first;
+                    if (owns(a)) {
+                        offer(owned[t][a], Neighbor{b, entry.second});
+                    }
+                    if (owns(b)) {
+                        offer(owned[t][b], Neighbor{a, entry.second});
+                    }
+                }
+            }
+        });
+        
+        size_t pairs = 0;
+        for (const auto& shard : counted) {
+            pairs += shard.size();
+        }
+        unordered_map<string, vector<int>> new_member_titles;
+        for (size_t m = 0; m < member_ids.size(); m++) {
+            new_member_titles[member_ids[m]] = histories[m];
+        }
+        unordered_map<int, vector<Neighbor>> new_neighbors;
+        for (auto& part : owned) {
+            for (auto& entry : part) {
+                new_neighbors[entry.first] = move(entry.second);
+            }
+        }
+        
+        unique_lock<shared_mutex> lock(model_mutex);
+        member_titles.swap(new_member_titles);
+        for (int shard = 0; shard < SHARDS; shard++) {
+            together[shard].swap(new_together[shard]);
+        }
+        neighbors.swap(new_neighbors);
+        for (const auto& issue : pending) {
+            apply(issue.first, issue.second);
+        }
+        pending.clear();
+        return pairs;
+    }
+};
+
+class FineEntry {
+public:
+    int day;
+    int transaction_id;   // loan the charge is for; 0 for payments
+    int amount;
+    char kind;            // 'C' charge, 'P' payment
+    
+    FineEntry(int d, int t_id, int amt, char k) : day(d), transaction_id(t_id), amount(amt), kind(k) {}
+};
+
+// Append-only record of fine charges and payments. Each member's totals
+// live in Member::fines and are updated as entries are posted. Members are
+// also indexed by the day their balance first exceeds the block threshold,
+// so the blocked list for any day is a range scan. All calls are made with
+// the circulation lock held.
+class FineLedger {
+public:
+    vector<FineEntry> journal;
+    unordered_map<string, vector<size_t>> entries_by_member;   // positions in journal
+    set<pair<int, string>> block_index;                        // (blocked_from, member ID)
+    int block_threshold;       // balances above this block new issues
+    
+    FineLedger() : block_threshold(0) {}
+    
+    void openLoan(Member* member, const Transaction* transaction) {
+        member->fines.open_loans.push_back(make_pair(transaction->transaction_Id, transaction->due_date));
+        reindex(member);
+    }
+    
+    // Turns a returned loan's late days into a posted charge; returns it.
+    int closeLoan(Member* member, const Transaction* transaction) {
+        vector<pair<int, int>>& loans = member->fines.open_loans;
+        for (auto it = loans.begin(); it != loans.end(); ++it) {
+            if (it->first == transaction->transaction_Id) {
+                loans.erase(it);
+                break;
+            }
+        }
+        int amount = transaction->calculateFine();
+        if (amount > 0) {
+            post(member, FineEntry(transaction->return_date, transaction->transaction_Id, amount, 'C'));
+            member->fines.charged += amount;
+        }
+        reindex(member);
+        return amount;
+    }
+    
+    // Applies up to amount against the balance due on day; returns what was taken.
+    int pay(Member* member, int amount, int day) {
+        amount = min(amount, member->fines.balance(day));
+        if (amount <= 0) {
+            return 0;
+        }
+        post(member, FineEntry(day, 0, amount, 'P'));
+        member->fines.paid += amount;
+        reindex(member);
+        return amount;
+    }
+    
+    bool isBlocked(const Member* member, int day) const {
+        return member->fines.blocked_from <= day;
+    }
+    
+    // IDs of members whose balance exceeds the threshold on day.
+    vector<string> blockedMembers(int day) const {
+        vector<string> blocked;
+        for (auto it = block_index.begin(); it != block_index.end() && it->first <= day; ++it) {
+            blocked.push_back(it->second);
+        }
+        return blocked;
+    }
+    
+    vector<FineEntry> statement(const string& member_id) const {
+        vector<FineEntry> entries;
+        auto it = entries_by_member.find(member_id);
+        if (it != entries_by_member.end()) {
+            for (size_t position : it->second) {
+                entries.push_back(journal[position]);
+            }
+        }
+        return entries;
+    }
+    
+    void post(Member* member, const FineEntry& entry) {
+        entries_by_member[member->member_id].push_back(journal.size());
+        journal.push_back(entry);
+    }
+    
+    void reindex(Member* member) {
+        FineAccount& account = member->fines;
+        int blocked_from = account.crossingDay(block_threshold);
+        if (blocked_from == account.blocked_from) {
+            return;
+        }
+        if (account.blocked_from != FineAccount::NEVER) {
+            block_index.erase(make_pair(account.blocked_from, member->member_id));
+        }
+        account.blocked_from = blocked_from;
+        if (blocked_from != FineAccount::NEVER) {
+            block_index.insert(make_pair(blocked_from, member->member_id));
+        }
+    }
+};
+
+// Radix trie from normalized keys to member slots, for type-ahead search.
+// Nodes sit in one vector and their edge labels point into a shared byte
+// arena, so splitting an edge moves no key bytes. Siblings are kept in byte
+// order, which makes a walk of any subtree produce its keys sorted; a
+// prefix query costs the prefix length plus the matches it returns.
+class PrefixIndex {
+public:
+    static const uint32_t NONE = UINT32_MAX;
+    
+    class Node {
+    public:
+        uint32_t label_start;
+        uint32_t label_length;
+        uint32_t first_child;
+        uint32_t next_sibling;
+        uint32_t first_value;    // into values, NONE if no key ends here
+        
+        Node(uint32_t start, uint32_t length)
+            : label_start(start), label_length(length), first_child(NONE), next_sibling(NONE), first_value(NONE) {}
+    };
+    
+    vector<Node> nodes;                      // nodes[0] is the root, with an empty label
+    string arena;
+    vector<pair<uint32_t, uint32_t>> values; // (slot, next value of the same key)
+    size_t keys;
+    
+    PrefixIndex() : keys(0) {
+        nodes.push_back(Node(0, 0));
+    }
+    
+    unsigned char labelByte(uint32_t node, size_t i) const {
+        return arena[nodes[node].label_start + i];
+    }
+    
+    void insert(const string& key, uint32_t slot) {
+        uint32_t node = 0;
+        size_t at = 0;
+        while (at < key.size()) {
+            unsigned char next = key[at];
+            uint32_t previous = NONE;
+            uint32_t child = nodes[node].first_child;
+            while (child != NONE && labelByte(child, 0) < next) {
+                previous = child;
+                child = nodes[child].next_sibling;
+            }
+            if (child == NONE || labelByte(child, 0) != next) {
+                uint32_t leaf = nodes.size();
+                nodes.push_back(Node(arena.size(), key.size() - at));
+                arena.append(key, at, string::npos);
+                nodes[leaf].next_sibling = child;
+                link(node, previous, leaf);
+                node = leaf;
+                break;
+            }
+            uint32_t common = 1;
+            while (common < nodes[child].label_length && at + common < key.size() &&
+                   labelByte(child, common) == (unsigned char)key[at + common]) {
+                common++;
+            }
+            if (common < nodes[child].label_length) {
+                // The key leaves this edge part way: split it at the divergence.
+                uint32_t middle = nodes.size();
+                nodes.push_back(Node(nodes[child].label_start, common));
+                nodes[middle].first_child = child;
+                nodes[middle].next_sibling = nodes[child].next_sibling;
+                nodes[child].label_start += common;
+                nodes[child].label_length -= common;
+                nodes[child].next_sibling = NONE;
+                link(node, previous, middle);
+                child = middle;
+            }
+            node = child;
+            at += common;
+        }
+        values.push_back(make_pair(slot, nodes[node].first_value));
+        nodes[node].first_value = values.size() - 1;
+        keys++;
+    }
+    
+    void link(uint32_t parent, uint32_t previous, uint32_t node) {
+        if (previous == NONE) {
+            nodes[parent].first_child = node;
+        } else {
+            nodes[previous].next_sibling = node;
+        }
+    }
+    
+    // Appends to out, in key order, the slots of keys starting with prefix
+    // until out holds limit slots. Slots already in out are skipped, so
+    // several keys of one member yield it once.
+    void collect(const string& prefix, size_t limit, vector<uint32_t>& out) const {
+        uint32_t node = 0;
+        size_t at = 0;
+        while (at < prefix.size()) {
+            uint32_t child = nodes[node].first_child;
+            while (child != NONE && labelByte(child, 0) < (unsigned char)prefix[at]) {
+                child = nodes[child].next_sibling;
+            }
+            if (child == NONE || labelByte(child, 0) != (unsigned char)prefix[at]) {
+                return;
+            }
+            size_t length = min((size_t)nodes[child].label_length, prefix.size() - at);
+            if (arena.compare(nodes[child].label_start, length, prefix, at, length) != 0) {
+                return;
+            }
+            node = child;
+            at += length;
+        }
+        // Depth-first walk; a node's own keys come before its children's.
+        vector<uint32_t> pending(1, node);
+        while (!pending.empty() && out.size() < limit) {
+            uint32_t current = pending.back();
+            pending.pop_back();
+            for (uint32_t v = nodes[current].first_value; v != NONE && out.size() < limit; v = values[v].second) {
+                if (find(out.begin(), out.end(), values[v].first) == out.end()) {
+                    out.push_back(values[v].first);
+                }
+            }
+            size_t first_pushed = pending.size();
+            for (uint32_t child = nodes[current].first_child; child != NONE; child = nodes[child].next_sibling) {
+                pending.push_back(child);
+            }
+            reverse(pending.begin() + first_pushed, pending.end());
+        }
+    }
+    
+    size_t memoryBytes() const {
+        return nodes.capacity() * sizeof(Node) + arena.capacity() + values.capacity() * sizeof(values[0]);
+    }
+};
+
+// Type-ahead member lookup by name, email or phone. Each member gets a slot;
+// names are indexed from every word, so "smi" finds "John Smith", emails
+// from the start, and phones by their digits. Kept up to date by
+// LibrarySystem::insertMember under the circulation lock.
+class MemberDirectory {
+public:
+    enum Field { BY_NAME, BY_EMAIL, BY_PHONE, BY_ANY };
+    
+    vector<Member*> slots;
+    PrefixIndex names;
+    PrefixIndex emails;
+    PrefixIndex phones;
+    
+    // Lowercase letters and digits, other characters as single spaces.
+    static string normalizeText(const string& text) {
+        string normalized;
+        for (char c : text) {
+            if (isalnum((unsigned char)c)) {
+                normalized += tolower(c);
+            } else if (!normalized.empty() && normalized.back() != ' ') {
+                normalized += ' ';
+            }
+        }
+        if (!normalized.empty() && normalized.back() == ' ') {
+            normalized.pop_back();
+        }
+        return normalized;
+    }
+    
+    static string normalizeEmail(const string& email) {
+        string normalized;
+        for (char c : email) {
+            if (!isspace((unsigned char)c)) {
+                normalized += tolower(c);
+            }
+        }
+        return normalized;
+    }
+    
+    void add(Member* member) {
+        uint32_t slot = slots.size();
+        slots.push_back(member);
+        string name = normalizeText(member->name);
+        size_t start = 0;
+        while (start < name.size()) {
+            names.insert(name.substr(start), slot);
+            size_t space = name.find(' ', start);
+            if (space == string::npos) {
+                break;
+            }
+            start = space + 1;
+        }
+        string email = normalizeEmail(member->email);
+        if (!email.empty()) {
+            emails.insert(email, slot);
+        }
+        if (!member->contact.empty()) {
+            phones.insert(member->contact.digits, slot);
+        }
+    }
+    
+    // The field a desk query most likely means: a phone number if it is all
+    // digits and separators, an email if it has an '@', otherwise a name.
+    static Field guessField(const string& query) {
+        if (query.find('@') != string::npos) {
+            return BY_EMAIL;
+        }
+        bool has_digit = false;
+        for (char c : query) {
+            if (isdigit((unsigned char)c)) {
+                has_digit = true;
+            } else if (!strchr("+-.() ", c)) {
+                return BY_NAME;
+            }
+        }
+        return has_digit ? BY_PHONE : BY_NAME;
+    }
+    
+    // Up to limit members whose field starts with the query, in key order.
+    // BY_ANY picks the field with guessField; a name query that fills less
+    // than the limit is topped up from emails.
+    vector<Member*> search(const string& query, Field field, size_t limit) const {
+        if (field == BY_ANY) {
+            field = guessField(query);
+            if (field == BY_NAME) {
+                vector<Member*> found = search(query, BY_NAME, limit);
+                string prefix = normalizeEmail(query);
+                if (found.size() < limit && !prefix.empty()) {
+                    vector<uint32_t> more;
+                    emails.collect(prefix, limit, more);
+                    for (size_t i = 0; i < more.size() && found.size() < limit; i++) {
+                        if (find(found.begin(), found.end(), slots[more[i]]) == found.end()) {
+                            found.push_back(slots[more[i]]);
+                        }
+                    }
+                }
+                return found;
+            }
+        }
+        vector<uint32_t> matched;
+        if (field == BY_NAME) {
+            string prefix = normalizeText(query);
+            if (!prefix.empty()) {
+                names.collect(prefix, limit, matched);
+            }
+        } else if (field == BY_EMAIL) {
+            string prefix = normalizeEmail(query);
+            if (!prefix.empty()) {
+                emails.collect(prefix, limit, matched);
+            }
+        } else {
+            PhoneNumber prefix(query);
+            if (!prefix.empty()) {
+                phones.collect(prefix.digits, limit, matched);
+            }
+        }
+        vector<Member*> found;
+        for (uint32_t slot : matched) {
+            found.push_back(slots[slot]);
+        }
+        return found;
+    }
+    
+    size_t memoryBytes() const {
+        return slots.capacity() * sizeof(Member*) + names.memoryBytes() + emails.memoryBytes() + phones.memoryBytes();
+    }
+};
+
+// Bit-parallel edit distance (Myers 1999, as formulated by Hyyrö) for
+// patterns of up to 64 bytes. One column of the dynamic-programming matrix
+// is kept as two bit-vectors of vertical deltas, so each text byte costs a
+// fixed dozen word operations however long the pattern is.
+class EditDistanceMatcher {
+public:
+    static const int MAX_PATTERN = 64;
+    
+    uint64_t peq[256];   // bit i set where pattern[i] is the byte
+    int length;
+    
+    explicit EditDistanceMatcher(const string& pattern) {
+        length = min((int)pattern.size(), MAX_PATTERN);
+        memset(peq, 0, sizeof(peq));
+        for (int i = 0; i < length; i++) {
+            peq[(uint8_t)pattern[i]] |= 1ULL << i;
+        }
+    }
+    
+    // Edit distance from the pattern to the whole text (global), or to the
+    // best-matching substring of the text. Once the result is sure to
+    // exceed max_distance, returns max_distance + 1 without finishing.
+    int distance(const char* text, size_t n, bool global, int max_distance) const {
+        if (length == 0) {
+            return global ? (int)n : 0;
+        }
+        uint64_t pv = ~0ULL, mv = 0, high = 1ULL << (length - 1);
+        int score = length, best = length;
+        for (size_t j = 0; j < n; j++) {
+            uint64_t eq = peq[(uint8_t)text[j]];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            score += (ph & high) ? 1 : (mh & high) ? -1 : 0;
+            // Row 0 is 0, 1, 2... for a global match and all zeros for a substring match.
+            ph = (ph << 1) | (global ? 1 : 0);
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+            if (global) {
+                if (score - (int)(n - j - 1) > max_distance) {
+                    return max_distance + 1;
+                }
+            } else {
+                best = min(best, score);
+            }
+        }
+        return min(global ? score : best, max_distance + 1);
+    }
+};
+
+// Typo-tolerant lookup over titles and authors. Every distinct word of the
+// catalog is indexed once by its trigrams (padded with a space at each end);
+// a query word gathers the vocabulary words that share enough trigrams to be
+// within its error budget, and EditDistanceMatcher confirms them. A book must
+// match every query word; books rank by total edits, then shorter title and
+// author, then catalog order. Each word's books are bucketed by text length,
+// so the rarest query word's books come out in rank order and the search
+// stops once no later book can enter the top results. The other query words
+// are checked against each candidate's own word list. The index has its own
+// lock, so searches run beside circulation and each other; only add() is
+// exclusive.
+class FuzzyTitleIndex {
+public:
+    class LengthBucket {
+    public:
+        uint16_t length;
+        vector<uint32_t> slots;   // ascending
+        
+        LengthBucket(uint16_t l) : length(l) {}
+    };
+    
+    vector<Books*> slots;
+    vector<uint16_t> text_length;              // normalized title and author, per slot
+    vector<uint32_t> slot_words;               // words of each slot, from word_start[slot]
+    vector<uint32_t> word_start;
+    unordered_map<string, uint32_t> word_ids;
+    vector<string> words;
+    vector<vector<LengthBucket>> postings;     // word -> its books, by ascending text length
+    vector<uint32_t> posting_count;
+    unordered_map<uint32_t, vector<uint32_t>> trigram_words;
+    mutable shared_mutex index_mutex;
+    
+    FuzzyTitleIndex() : word_start(1, 0) {}
+    
+    static uint32_t trigram(const string& padded, size_t at) {
+        return (uint8_t)padded[at] << 16 | (uint8_t)padded[at + 1] << 8 | (uint8_t)padded[at + 2];
+    }
+    
+    // Edits allowed for a query word of this length. Kept low enough that a
+    // match must share at least one of the word's trigrams (m - 3k > 0).
+    static int maxErrors(size_t length) {
+        return length < 4 ? 0 : length < 9 ? 1 : length < 13 ? 2 : 3;
+    }
+    
+    static vector<string> splitWords(const string& normalized) {
+        vector<string> split;
+        size_t start = 0;
+        while (start < normalized.size()) {
+            size_t space = normalized.find(' ', start);
+            if (space == string::npos) {
+                space = normalized.size();
+            }
+            split.push_back(normalized.substr(start, min(space - start, (size_t)EditDistanceMatcher::MAX_PATTERN)));
+            start = space + 1;
+        }
+        return split;
+    }
+    
+    uint32_t wordId(const string& word) {
+        auto found = word_ids.find(word);
+        if (found != word_ids.end()) {
+            return found->second;
+        }
+        uint32_t id = words.size();
+        word_ids.emplace(word, id);
+        words.push_back(word);
+        postings.emplace_back();
+        posting_count.push_back(0);
+        string padded = " " + word + " ";
+        for (size_t i = 0; i + 3 <= padded.size(); i++) {
+            vector<uint32_t>& list = trigram_words[trigram(padded, i)];
+            if (list.empty() || list.back() != id) {
+                list.push_back(id);
+            }
+        }
+        return id;
+    }
+    
+    void add(Books* book) {
+        string text = MemberDirectory::normalizeText(book->book_name + " " + book->author_name);
+        uint16_t length = min(text.size(), (size_t)UINT16_MAX);
+        unique_lock<shared_mutex> lock(index_mutex);
+        uint32_t slot = slots.size();
+        slots.push_back(book);
+        text_length.push_back(length);
+        for (const string& word : splitWords(text)) {
+            uint32_t id = wordId(word);
+            if (find(slot_words.begin() + word_start.back(), slot_words.end(), id) != slot_words.end()) {
+                continue;
+            }
+            slot_words.push_back(id);
+            vector<LengthBucket>& buckets = postings[id];
+            auto bucket = lower_bound(buckets.begin(), buckets.end(), length,
+                                      [](const LengthBucket& b, uint16_t l) { return b.length < l; });
+            if (bucket == buckets.end() || bucket->length != length) {
+                bucket = buckets.insert(bucket, LengthBucket(length));
+            }
+            bucket->slots.push_back(slot);
+            posting_count[id]++;
+        }
+        word_start.push_back(slot_words.size());
+    }
+    
+    // Vocabulary words within the query word's error budget, with their distances.
+    void matchWord(const string& word, vector<pair<uint32_t, int>>& matched) const {
+        int budget = maxErrors(word.size());
+        if (budget == 0) {
+            auto found = word_ids.find(word);
+            if (found != word_ids.end()) {
+                matched.push_back(make_pair(found->second, 0));
+            }
+            return;
+        }
+        // Each edit destroys at most three of the word's padded trigrams.
+        int needed = (int)word.size() - 3 * budget;
+        string padded = " " + word + " ";
+        static thread_local vector<uint8_t> trigram_hits;   // per word, zero between calls
+        trigram_hits.resize(max(trigram_hits.size(), words.size()));
+        vector<uint32_t> touched;
+        for (size_t i = 0; i + 3 <= padded.size(); i++) {
+            auto list = trigram_words.find(trigram(padded, i));
+            if (list == trigram_words.end()) {
+                continue;
+            }
+            for (uint32_t id : list->second) {
+                if (trigram_hits[id]++ == 0) {
+                    touched.push_back(id);
+                }
+            }
+        }
+        EditDistanceMatcher matcher(word);
+        for (uint32_t id : touched) {
+            const string& candidate = words[id];
+            if (trigram_hits[id] >= needed && abs((int)candidate.size() - (int)word.size()) <= budget) {
+                int distance = matcher.distance(candidate.data(), candidate.size(), true, budget);
+                if (distance <= budget) {
+                    matched.push_back(make_pair(id, distance));
+                }
+            }
+            trigram_hits[id] = 0;
+        }
+    }
+    
+    // Up to limit books matching every word of the query, best first, each
+    // with its total number of edits. The books are the live records; read
+    // their fields under the owner's lock.
+    vector<pair<Books*, int>> search(const string& query, size_t limit) const {
+        vector<string> query_words = splitWords(MemberDirectory::normalizeText(query));
+        sort(query_words.begin(), query_words.end());
+        query_words.erase(unique(query_words.begin(), query_words.end()), query_words.end());
+        if (query_words.empty() || limit == 0) {
+            return {};
+        }
+        shared_lock<shared_mutex> lock(index_mutex);
+        vector<vector<pair<uint32_t, int>>> matched(query_words.size());
+        size_t driving = 0;
+        vector<size_t> total(query_words.size(), 0);
+        int least_edits = 0;   // of the words other than the driving one
+        for (size_t i = 0; i < query_words.size(); i++) {
+            matchWord(query_words[i], matched[i]);
+            if (matched[i].empty()) {
+                return {};
+            }
+            sort(matched[i].begin(), matched[i].end(),
+                 [](const pair<uint32_t, int>& a, const pair<uint32_t, int>& b) { return a.second < b.second; });
+            for (const auto& word : matched[i]) {
+                total[i] += posting_count[word.first];
+            }
+            least_edits += matched[i][0].second;
+            if (total[i] < total[driving]) {
+                driving = i;
+            }
+        }
+        least_edits -= matched[driving][0].second;
+        
+        // Rank key (edits, text length, slot); a max-heap keeps the best limit.
+        typedef tuple<int, uint16_t, uint32_t> Key;
+        vector<Key> best;
+        unordered_set<uint32_t> seen;
+        const auto& variants = matched[driving];
+        for (size_t level_start = 0; level_start < variants.size();) {
+            int level = variants[level_start].second;
+            size_t level_end = level_start;
+            while (level_end < variants.size() && variants[level_end].second == level) {
+                level_end++;
+            }
+            // Merge the variants of this edit level in (length, slot) order.
+            vector<tuple<uint16_t, uint32_t, size_t, size_t, size_t>> cursors;   // key, variant, bucket, position
+            auto push = [&](size_t v, size_t bucket, size_t position) {
+                const vector<LengthBucket>& buckets = postings[variants[v].first];
+                while (bucket < buckets.size() && position >= buckets[bucket].slots.size()) {
+                    bucket++;
+                    position = 0;
+                }
+                if (bucket < buckets.size()) {
+                    cursors.emplace_back(buckets[bucket].length, buckets[bucket].slots[position], v, bucket, position);
+                    push_heap(cursors.begin(), cursors.end(), greater<tuple<uint16_t, uint32_t, size_t, size_t, size_t>>());
+                }
+            };
+            for (size_t v = level_start; v < level_end; v++) {
+                push(v, 0, 0);
+            }
+            while (!cursors.empty()) {
+                pop_heap(cursors.begin(), cursors.end(), greater<tuple<uint16_t, uint32_t, size_t, size_t, size_t>>());
+                uint16_t length;
+                uint32_t slot;
+                size_t v, bucket, position;
+                tie(length, slot, v, bucket, position) = cursors.back();
+                cursors.pop_back();
+                push(v, bucket, position + 1);
+                // Keys never fall below this bound from here on.
+                if (best.size() == limit && !(Key(level + least_edits, length, slot) < best.front())) {
+                    cursors.clear();
+                    level_end = variants.size();
+                    break;
+                }
+                if (!seen.insert(slot).second) {
+                    continue;
+                }
+                int edits = level;
+                for (size_t i = 0; i < query_words.size() && edits >= 0; i++) {
+                    if (i == driving) {
+                        continue;
+                    }
+                    int word_edits = -1;
+                    for (uint32_t w = word_start[slot]; w < word_start[slot + 1] && word_edits != 0; w++) {
+                        for (const auto& variant : matched[i]) {
+                            if (variant.first == slot_words[w] && (word_edits < 0 || variant.second < word_edits)) {
+                                word_edits = variant.second;
+                            }
+                        }
+                    }
+                    edits = word_edits < 0 ? -1 : edits + word_edits;
+                }
+                if (edits < 0) {
+                    continue;
+                }
+                Key key(edits, length, slot);
+                if (best.size() < limit) {
+                    best.push_back(key);
+                    push_heap(best.begin(), best.end());
+                } else if (key < best.front()) {
+                    pop_heap(best.begin(), best.end());
+                    best.back() = key;
+                    push_heap(best.begin(), best.end());
+                }
+            }
+            level_start = level_end;
+        }
+        sort_heap(best.begin(), best.end());
+        vector<pair<Books*, int>> results;
+        for (const Key& key : best) {
+            results.push_back(make_pair(slots[get<2>(key)], get<0>(key)));
+        }
+        return results;
+    }
+    
+    size_t memoryBytes() const {
+        size_t bytes = slots.capacity() * sizeof(Books*) + text_length.capacity() * sizeof(uint16_t) +
+                       (slot_words.capacity() + word_start.capacity() + posting_count.capacity()) * sizeof(uint32_t) +
+                       postings.capacity() * sizeof(vector<LengthBucket>);
+        for (size_t i = 0; i < words.size(); i++) {
+            bytes += words[i].capacity() + sizeof(string) + 32 + postings[i].capacity() * sizeof(LengthBucket);
+            for (const auto& bucket : postings[i]) {
+                bytes += bucket.slots.capacity() * sizeof(uint32_t);
+            }
+        }
+        for (const auto& entry : trigram_words) {
+            bytes += entry.second.capacity() * sizeof(uint32_t) + sizeof(entry) + 16;
+        }
+        return bytes;
+    }
+};
+
+// One journal's issues in (volume, issue) order, and the members who are
+// given each new issue as it is checked in.
+class Serial {
+public:
+    string journal_name;                                  // as first checked in
+    map<tuple<int, int, int>, ResearchJournal*> issues;   // (volume, issue, book ID)
+    vector<string> subscribers;                           // in subscription order
+    
+    bool has(int volume, int issue) const {
+        auto at = issues.lower_bound(make_tuple(volume, issue, INT32_MIN));
+        return at != issues.end() && get<0>(at->first) == volume && get<1>(at->first) == issue;
+    }
+    
+    // Up to limit issues of volumes from..to, in order.
+    vector<ResearchJournal*> volumes(int from, int to, size_t limit = SIZE_MAX) const {
+        vector<ResearchJournal*> found;
+        auto end = issues.upper_bound(make_tuple(to, INT32_MAX, INT32_MAX));
+        for (auto at = issues.lower_bound(make_tuple(from, INT32_MIN, INT32_MIN)); at != end && found.size() < limit; ++at) {
+            found.push_back(at->second);
+        }
+        return found;
+    }
+};
+
+// Every journal's issues, keyed by the normalized journal name so spelling
+// variants in case and punctuation file under one serial. Ordered, so a
+// name prefix lists the journals next to it. Changes are made under the
+// owner's lock and also take index_mutex exclusively, so range reads can
+// take index_mutex shared instead of the owner's lock.
+class SerialsIndex {
+public:
+    map<string, Serial> serials;
+    mutable shared_mutex index_mutex;
+    uint64_t holds_placed = 0;   // new issues set aside for a subscriber
+    uint64_t queue_places = 0;   // subscribers queued because no copy was left
+    
+    static string key(const string& journal_name) {
+        return MemberDirectory::normalizeText(journal_name);
+    }
+    
+    // Files the issue under its serial and returns the serial, or nullptr
+    // for a journal without a name. newest tells whether the issue comes
+    // after every issue the serial already had.
+    Serial* add(ResearchJournal* journal, bool& newest) {
+        string name = key(journal->journal_name);
+        if (name.empty()) {
+            return nullptr;
+        }
+        unique_lock<shared_mutex> lock(index_mutex);
+        Serial& serial = serials[name];
+        if (serial.journal_name.empty()) {
+            serial.journal_name = journal->journal_name;
+        }
+        auto at = serial.issues.emplace(make_tuple(journal->volume, journal->issue, journal->book_Id), journal).first;
+        newest = next(at) == serial.issues.end() &&
+                 (at == serial.issues.begin() ||
+                  make_pair(get<0>(prev(at)->first), get<1>(prev(at)->first)) < make_pair(journal->volume, journal->issue));
+        return &serial;
+    }
+    
+    Serial* find(const string& journal_name) {
+        auto found = serials.find(key(journal_name));
+        return found == serials.end() ? nullptr : &found->second;
+    }
+    
+    const Serial* find(const string& journal_name) const {
+        auto found = serials.find(key(journal_name));
+        return found == serials.end() ? nullptr : &found->second;
+    }
+    
+    vector<const Serial*> withPrefix(const string& prefix, size_t limit) const {
+        string normalized = key(prefix);
+        vector<const Serial*> found;
+        for (auto at = serials.lower_bound(normalized);
+             at != serials.end() && found.size() < limit && at->first.compare(0, normalized.size(), normalized) == 0; ++at) {
+            found.push_back(&at->second);
+        }
+        return found;
+    }
+};
+
+// The primary's mutation log: one line per successful add, issue, return,
+// reservation, fine payment, day change, branch transfer and serial
+// subscription change, in the order the circulation lock admitted them, plus
+// hold expiry, which happens lazily and also on calls that are otherwise
+// rejected, and integrity repairs. A line is
+//   <sequence> TAB <kind> TAB <day> TAB <commit time, ns> TAB <fields...>
+// with tabs, newlines and backslashes in fields escaped. Replicas replay the
+// same calls in the same order on the same day, which rebuilds the same
+// state, so derived data (holds, fines, demand) needs no events of its own.
+// Every line is also written to segment files of SEGMENT_ENTRIES lines, so
+// memory holds only the lines a connected replica may still need, and a
+// replica that starts late reads the older ones back from disk.
+class ReplicationLog {
+public:
+    static const char ADD_BOOK = 'B';
+    static const char ADD_MEMBER = 'M';
+    static const char ADD_LIBRARIAN = 'L';
+    static const char ISSUE = 'I';
+    static const char RETURN = 'R';
+    static const char RESERVE = 'V';
+    static const char PAY_FINE = 'F';
+    static const char ADVANCE_DAY = 'D';
+    static const char RELEASE_COPY = 'O';
+    static const char RECEIVE_COPY = 'N';
+    static const char EXPIRE_HOLDS = 'X';
+    static const char SUBSCRIBE = 'S';
+    
+    static const uint64_t SEGMENT_ENTRIES = 65536;
+    static const size_t MEMORY_ENTRIES = 65536;   // kept even when no replica is connected
+    static constexpr chrono::seconds SPILL_RETRY{1};
+    
+    mutex log_mutex;
+    condition_variable appended;
+    string directory;          // segment files, readable by the owner only
+    ofstream segment;          // the segment being appended to
+    atomic<bool> spilling;     // false from a failed write until a retry rewrites the lines since flushed
+    uint64_t flushed;          // every line up to this sequence is on disk
+    chrono::steady_clock::time_point retry_at;
+    atomic<uint64_t> spill_failures;
+    atomic<uint64_t> lost_through;   // lines up to here were dropped without reaching disk; 0 if none
+    deque<string> entries;     // entries[i] holds sequence first + i
+    uint64_t first;
+    uint64_t last;
+    atomic<uint64_t> bytes;    // written since the log started
+    uint64_t run_id;           // names this log; a restarted primary starts a new one
+    
+    // Starts an empty log in dir, removing the segments of an earlier run.
+    ReplicationLog(const string& dir)
+        : directory(dir), spilling(true), flushed(0), spill_failures(0), lost_through(0), first(1), last(0), bytes(0) {
+        random_device entropy;
+        run_id = (((uint64_t)entropy() << 32) | entropy()) ^ (uint64_t)nowNanos();
+        mkdir(directory.c_str(), 0700);
+        removeSegments();
+    }
+    
+    void removeSegments() {
+        DIR* listing = opendir(directory.c_str());
+        if (!listing) {
+            return;
+        }
+        while (dirent* entry = readdir(listing)) {
+            string name = entry->d_name;
+            if (name.compare(0, 4, "log-") == 0) {
+                unlink((directory + "/" + name).c_str());
+            }
+        }
+        closedir(listing);
+    }
+    
+    string segmentPath(uint64_t sequence) const {
+        char name[32];
+        snprintf(name, sizeof(name), "/log-%08llu.txt", (unsigned long long)((sequence - 1) / SEGMENT_ENTRIES));
+        return directory + name;
+    }
+    
+    static int64_t nowNanos() {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+    static void appendField(string& line, const string& field) {
+        line += '\t';
+        for (char c : field) {
+            if (c == '\t') {
+                line += "\\t";
+            } else if (c == '\n') {
+                line += "\\n";
+            } else if (c == '\\') {
+                line += "\\\\";
+            } else {
+                line += c;
+            }
+        }
+    }
+    
+    // Splits a line (without its newline) into unescaped fields.
+    static vector<string> split(const string& line) {
+        vector<string> fields(1);
+        for (size_t i = 0; i < line.size(); i++) {
+            if (line[i] == '\t') {
+                fields.emplace_back();
+            } else if (line[i] == '\\' && i + 1 < line.size()) {
+                char c = line[++i];
+                fields.back() += c == 't' ? '\t' : c == 'n' ? '\n' : c;
+            } else {
+                fields.back() += line[i];
+            }
+        }
+        return fields;
+    }
+    
+    uint64_t append(char kind, const vector<string>& fields) {
+        string body(1, kind);
+        appendField(body, to_string(LibraryClock::today()));
+        appendField(body, to_string(nowNanos()));
+        for (const auto& field : fields) {
+            appendField(body, field);
+        }
+        uint64_t sequence;
+        {
+            lock_guard<mutex> lock(log_mutex);
+            sequence = ++last;
+            entries.push_back(to_string(sequence) + '\t' + body + '\n');
+            bytes += entries.back().size();
+            if (spilling) {
+                if (!spillLine(sequence, entries.back())) {
+                    spillFailed();
+                }
+            } else if (chrono::steady_clock::now() >= retry_at) {
+                if (resumeSpill()) {
+                    spilling = true;
+                } else {
+                    spillFailed();
+                }
+            }
+            if (entries.size() > MEMORY_ENTRIES * 2) {
+                dropThrough(last - MEMORY_ENTRIES);
+                if (entries.size() > MEMORY_ENTRIES * 2) {
+                    // Not on disk, but memory stays capped: replicas that still
+                    // need these lines are told to resync instead.
+                    lost_through = last - MEMORY_ENTRIES;
+                    while (first <= lost_through) {
+                        entries.pop_front();
+                        first++;
+                    }
+                }
+            }
+        }
+        appended.notify_all();
+        return sequence;
+    }
+    
+    // Writes one line to its segment; false if the write failed. A segment
+    // is closed, and so on disk, after its last line. Called with log_mutex held.
+    bool spillLine(uint64_t sequence, const string& line) {
+        if (!segment.is_open()) {
+            // A retry may find a partly written segment; one started afresh is truncated.
+            segment.open(segmentPath(sequence), (sequence - 1) % SEGMENT_ENTRIES == 0 ? ios::trunc : ios::app);
+        }
+        segment << line;
+        if (!segment.good()) {
+            return false;
+        }
+        if (sequence % SEGMENT_ENTRIES == 0) {
+            segment.close();
+            if (segment.fail()) {
+                return false;
+            }
+            flushed = sequence;
+        }
+        return true;
+    }
+    
+    void spillFailed() {
+        segment.close();
+        segment.clear();
+        spilling = false;
+        spill_failures++;
+        retry_at = chrono::steady_clock::now() + SPILL_RETRY;
+    }
+    
+    // Rewrites the segment holding flushed + 1 with its lines that reached
+    // disk, then spills every later line again. Lines lost meanwhile get a
+    // placeholder so each line keeps its position. Called with log_mutex held.
+    bool resumeSpill() {
+        uint64_t next = flushed + 1;
+        string path = segmentPath(next);
+        string kept, line;
+        ifstream in(path);
+        for (uint64_t keep = (next - 1) % SEGMENT_ENTRIES; keep > 0; keep--) {
+            if (!getline(in, line)) {
+                return false;
+            }
+            kept += line + '\n';
+        }
+        in.close();
+        {
+            ofstream rewritten(path + ".tmp", ios::trunc);
+            rewritten << kept;
+            rewritten.close();
+            if (rewritten.fail() || rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+                return false;
+            }
+        }
+        for (uint64_t sequence = next; sequence <= last; sequence++) {
+            if (!spillLine(sequence, sequence < first ? to_string(sequence) + "\tlost\n" : entries[sequence - first])) {
+                return false;
+            }
+        }
+        if (segment.is_open() && !segment.flush()) {
+            return false;
+        }
+        flushed = last;
+        return true;
+    }
+    
+    // Frees the in-memory lines up to and including sequence that are on
+    // disk. Called with log_mutex held.
+    void dropThrough(uint64_t sequence) {
+        if (spilling && segment.is_open()) {
+            if (segment.flush()) {
+                flushed = last;
+            } else {
+                spillFailed();
+            }
+        }
+        while (first <= min(sequence, flushed) && !entries.empty()) {
+            entries.pop_front();
+            first++;
+        }
+    }
+    
+    // Called by the shipper with the lowest sequence every connected replica
+    // has applied.
+    void release(uint64_t applied) {
+        lock_guard<mutex> lock(log_mutex);
+        dropThrough(min(applied, last));
+    }
+    
+    uint64_t head() {
+        lock_guard<mutex> lock(log_mutex);
+        return last;
+    }
+    
+    // Appends the lines from sequence from on to out, at most limit of them,
+    // waiting up to wait for one if there are none yet. Returns the sequence
+    // after the last line copied, or 0 if from was dropped without reaching
+    // disk. Lines no longer in memory are read from their segment without the
+    // lock; they were flushed before being dropped.
+    uint64_t copyFrom(uint64_t from, size_t limit, chrono::milliseconds wait, string& out) {
+        unique_lock<mutex> lock(log_mutex);
+        if (from <= lost_through) {
+            return 0;
+        }
+        if (from < first) {
+            uint64_t in_memory = first;
+            lock.unlock();
+            return copyFromSegment(from, min<uint64_t>(limit, in_memory - from), out);
+        }
+        if (last < from) {
+            appended.wait_for(lock, wait, [&] { return last >= from; });
+        }
+        uint64_t next = from;
+        while (next <= last && next - from < limit) {
+            out += entries[next - first];
+            next++;
+        }
+        return next;
+    }
+    
+    uint64_t copyFromSegment(uint64_t from, uint64_t limit, string& out) {
+        ifstream in(segmentPath(from));
+        string line;
+        for (uint64_t skip = (from - 1) % SEGMENT_ENTRIES; skip > 0 && getline(in, line); skip--) {
+        }
+        uint64_t next = from;
+        while (next - from < limit && getline(in, line)) {
+            out += line + '\n';
+            next++;
+        }
+        return next;
+    }
+    
+    size_t memoryEntries() {
+        lock_guard<mutex> lock(log_mutex);
+        return entries.size();
+    }
+    
+    static void encodeBook(const Books* book, vector<string>& fields) {
+        fields.insert(fields.end(), {book->typeName(), to_string(book->book_Id), book->book_name, book->author_name,
+                                     book->publisher, to_string(book->ISBN_no), to_string(book->no_of_copies)});
+        if (const EBook* ebook = dynamic_cast<const EBook*>(book)) {
+            fields.insert(fields.end(), {ebook->format, ebook->download_link});
+        } else if (const ResearchJournal* journal = dynamic_cast<const ResearchJournal*>(book)) {
+            fields.insert(fields.end(), {journal->journal_name, to_string(journal->volume), to_string(journal->issue)});
+        }
+    }
+    
+    // The book encoded at fields[at], or nullptr if the fields are short.
+    static Books* decodeBook(const vector<string>& f, size_t at) {
+        if (f.size() < at + 7) {
+            return nullptr;
+        }
+        int id = atoi(f[at + 1].c_str()), isbn = atoi(f[at + 5].c_str()), copies = atoi(f[at + 6].c_str());
+        if (f[at] == EBook::TYPE_NAME && f.size() >= at + 9) {
+            return new EBook(f[at + 2], id, f[at + 3], f[at + 4], isbn, copies, f[at + 7], f[at + 8]);
+        } else if (f[at] == ResearchJournal::TYPE_NAME && f.size() >= at + 10) {
+            return new ResearchJournal(f[at + 2], id, f[at + 3], f[at + 4], isbn, copies, f[at + 7],
+                                       atoi(f[at + 8].c_str()), atoi(f[at + 9].c_str()));
+        }
+        return new Books(f[at + 2], id, f[at + 3], f[at + 4], isbn, copies);
+    }
+    
+    static void encodeMember(const Member* member, vector<string>& fields) {
+        fields.insert(fields.end(), {member->typeName(), member->name, member->member_id, member->contact.str(),
+                                     member->email, member->address});
+        if (const Student* student = dynamic_cast<const Student*>(member)) {
+            fields.insert(fields.end(), {student->department, student->year});
+        } else if (const Faculty* faculty = dynamic_cast<const Faculty*>(member)) {
+            fields.insert(fields.end(), {faculty->department, faculty->designation});
+        }
+    }
+    
+    static Member* decodeMember(const vector<string>& f, size_t at) {
+        if (f.size() < at + 8) {
+            return nullptr;
+        }
+        if (f[at] == Faculty::TYPE_NAME) {
+            return new Faculty(f[at + 1], f[at + 2], f[at + 3], f[at + 4], f[at + 5], f[at + 6], f[at + 7]);
+        }
+        return new Student(f[at + 1], f[at + 2], f[at + 3], f[at + 4], f[at + 5], f[at + 6], f[at + 7]);
+    }
+};
+
+// A replica connected to a LogShipper.
+class ReplicaLink {
+public:
+    int fd;
+    uint64_t next;                      // next sequence to send
+    bool started;                       // the replica has said where to start
+    atomic<uint64_t> acked;             // last sequence the replica reported applied
+    atomic<int64_t> acked_at;           // when that ack arrived, ns
+    atomic<bool> closed;
+    thread sender;
+    
+    ReplicaLink(int f) : fd(f), next(1), started(false), acked(0), acked_at(0), closed(false) {}
+};
+
+// Streams a ReplicationLog to replica processes over a Unix socket. A
+// replica sends "FROM <sequence>" and its own thread answers "E <run id>"
+// naming the log, then sends the log from there and follows it, with a
+// heartbeat line "H <head> <time>" when idle so the replica can measure its
+// lag. Replicas answer with "A <sequence>" acks, which is the lag the
+// primary reports.
+class LogShipper {
+public:
+    static const size_t BATCH = 4096;
+    
+    ReplicationLog& log;
+    string path;
+    int listen_fd;
+    atomic<bool> stopping;
+    thread acceptor;
+    mutex links_mutex;
+    vector<unique_ptr<ReplicaLink>> links;
+    
+    LogShipper(ReplicationLog& l) : log(l), listen_fd(-1), stopping(false) {}
+    
+    ~LogShipper() {
+        stop();
+    }
+    
+    bool start(const string& socket_path) {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(address.sun_path)) {
+            cout << "Socket path too long: " << socket_path << endl;
+            return false;
+        }
+        strcpy(address.sun_path, socket_path.c_str());
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        unlink(socket_path.c_str());
+        if (listen_fd < 0 || ::bind(listen_fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listen_fd, 16) != 0) {
+            cout << "Could not listen on " << socket_path << ": " << strerror(errno) << endl;
+            if (listen_fd >= 0) {
+                close(listen_fd);
+                listen_fd = -1;
+            }
+            return false;
+        }
+        path = socket_path;
+        acceptor = thread([this] { acceptLoop(); });
+        return true;
+    }
+    
+    void stop() {
+        if (listen_fd < 0 || stopping.exchange(true)) {
+            return;
+        }
+        log.appended.notify_all();
+        acceptor.join();
+        lock_guard<mutex> lock(links_mutex);
+        for (auto& link : links) {
+            shutdown(link->fd, SHUT_RDWR);
+            link->sender.join();
+            close(link->fd);
+        }
+        links.clear();
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(path.c_str());
+    }
+    
+    void acceptLoop() {
+        pollfd listening = {listen_fd, POLLIN, 0};
+        while (!stopping.load()) {
+            if (poll(&listening, 1, 100) <= 0) {
+                releaseApplied();
+                continue;
+            }
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                continue;
+            }
+            lock_guard<mutex> lock(links_mutex);
+            links.emplace_back(new ReplicaLink(fd));
+            ReplicaLink* link = links.back().get();
+            link->sender = thread([this, link] { ship(*link); });
+        }
+    }
+    
+    // Lets the log free the lines every connected replica has applied.
+    void releaseApplied() {
+        uint64_t lowest = UINT64_MAX;
+        {
+            lock_guard<mutex> lock(links_mutex);
+            for (const auto& link : links) {
+                if (!link->closed.load()) {
+                    lowest = min(lowest, link->acked.load());
+                }
+            }
+        }
+        if (lowest != UINT64_MAX) {
+            log.release(lowest);
+        }
+    }
+    
+    static bool sendAll(int fd, const string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n > 0) {
+                sent += n;
+            } else if (!(n < 0 && errno == EINTR)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    // Reads whatever acks have arrived without blocking; false once the replica is gone.
+    bool readAcks(ReplicaLink& link, string& pending) {
+        char chunk[4096];
+        while (true) {
+            ssize_t n = recv(link.fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (n > 0) {
+                pending.append(chunk, n);
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                break;
+            } else {
+                return false;
+            }
+        }
+        size_t line_end;
+        while ((line_end = pending.find('\n')) != string::npos) {
+            if (pending.compare(0, 5, "FROM ") == 0) {
+                link.next = max<uint64_t>(strtoull(pending.c_str() + 5, nullptr, 10), 1);
+                link.started = true;
+            } else if (pending.compare(0, 2, "A ") == 0) {
+                link.acked.store(strtoull(pending.c_str() + 2, nullptr, 10));
+                link.acked_at.store(ReplicationLog::nowNanos());
+            }
+            pending.erase(0, line_end + 1);
+        }
+        return true;
+    }
+    
+    void ship(ReplicaLink& link) {
+        string pending_input;
+        // The replica names its starting point before anything is sent.
+        pollfd hello = {link.fd, POLLIN, 0};
+        while (!stopping.load() && !link.started) {
+            if (poll(&hello, 1, 100) > 0 && !readAcks(link, pending_input)) {
+                link.closed.store(true);
+                return;
+            }
+        }
+        if (!sendAll(link.fd, "E\t" + to_string(log.run_id) + "\n")) {
+            link.closed.store(true);
+            return;
+        }
+        auto last_send = chrono::steady_clock::now();
+        while (!stopping.load()) {
+            string batch;
+            uint64_t next = log.copyFrom(link.next, BATCH, chrono::milliseconds(50), batch);
+            if (next == 0) {
+                // The replica needs lines the log could not keep.
+                sendAll(link.fd, "G\t" + to_string(log.lost_through.load()) + "\n");
+                break;
+            }
+            auto now = chrono::steady_clock::now();
+            if (batch.empty() && now - last_send >= chrono::milliseconds(100)) {
+                batch = "H\t" + to_string(next - 1) + "\t" + to_string(ReplicationLog::nowNanos()) + "\n";
+            }
+            if (!batch.empty()) {
+                if (!sendAll(link.fd, batch)) {
+                    break;
+                }
+                link.next = next;
+                last_send = now;
+            }
+            if (!readAcks(link, pending_input)) {
+                break;
+            }
+        }
+        link.closed.store(true);
+    }
+    
+    void writePrometheus(ostream& out) {
+        uint64_t head = log.head();
+        out << "# HELP library_replication_head Sequence of the newest logged mutation." << endl;
+        out << "# TYPE library_replication_head gauge" << endl;
+        out << "library_replication_head " << head << endl;
+        out << "# HELP library_replication_spilling Whether new log lines reach the segment files (0 after a failed write)." << endl;
+        out << "# TYPE library_replication_spilling gauge" << endl;
+        out << "library_replication_spilling " << (log.spilling.load() ? 1 : 0) << endl;
+        out << "# HELP library_replication_spill_failures_total Segment writes that failed and were retried." << endl;
+        out << "# TYPE library_replication_spill_failures_total counter" << endl;
+        out << "library_replication_spill_failures_total " << log.spill_failures.load() << endl;
+        out << "# HELP library_replication_lost_through Newest sequence dropped without reaching disk; 0 if none." << endl;
+        out << "# TYPE library_replication_lost_through gauge" << endl;
+        out << "library_replication_lost_through " << log.lost_through.load() << endl;
+        out << "# HELP library_replication_lag_events Logged mutations a connected replica has not applied yet." << endl;
+        out << "# TYPE library_replication_lag_events gauge" << endl;
+        lock_guard<mutex> lock(links_mutex);
+        for (size_t i = 0; i < links.size(); i++) {
+            if (!links[i]->closed.load()) {
+                out << "library_replication_lag_events{replica=\"" << i << "\"} " << head - min(head, links[i]->acked.load())
+                    << endl;
+            }
+        }
+    }
+    
+    void displayStatus() {
+        uint64_t head = log.head();
+        cout << "Shipping on " << path << ", log head " << head << " (" << log.bytes.load() / 1024 << " KB, "
+             << log.memoryEntries() << " line(s) in memory, the rest in " << log.directory << ")" << endl;
+        if (!log.spilling.load() || log.lost_through.load() > 0) {
+            cout << "  Segment writes failing: " << log.spill_failures.load() << " failure(s)"
+                 << (log.spilling.load() ? ", recovered" : ", retrying every second");
+            if (log.lost_through.load() > 0) {
+                cout << "; lines up to " << log.lost_through.load() << " were dropped and replicas behind them must resync";
+            }
+            cout << endl;
+        }
+        lock_guard<mutex> lock(links_mutex);
+        for (size_t i = 0; i < links.size(); i++) {
+            ReplicaLink& link = *links[i];
+            uint64_t acked = link.acked.load();
+            cout << "  Replica " << i << ": " << (link.closed.load() ? "disconnected" : "connected") << ", applied "
+                 << acked << ", lag " << head - min(head, acked) << " event(s)" << endl;
+        }
+        if (links.empty()) {
+            cout << "  No replica connected yet." << endl;
+        }
+    }
+};
+
+// One broken invariant found by LibrarySystem::checkIntegrity().
+class IntegrityViolation {
+public:
+    const char* check;   // name of the invariant
+    string record;       // e.g. "book 101", "member S001", "transaction 1004"
+    string detail;
+    bool repaired;
+    
+    IntegrityViolation(const char* c, const string& r, const string& d, bool fixed)
+        : check(c), record(r), detail(d), repaired(fixed) {}
+};
+
+class IntegrityReport {
+public:
+    vector<IntegrityViolation> violations;
+    size_t books_checked = 0;
+    size_t members_checked = 0;
+    size_t transactions_checked = 0;
+    size_t open_loans = 0;
+    double seconds = 0;
+    
+    size_t repairedCount() const {
+        size_t n = 0;
+        for (const auto& violation : violations) {
+            n += violation.repaired;
+        }
+        return n;
+    }
+    
+    void display(size_t examples) const {
+        cout << "Checked " << books_checked << " books, " << members_checked << " members, " << transactions_checked
+             << " transactions (" << open_loans << " open) in " << fixed << setprecision(3) << seconds << " s" << endl;
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+        if (violations.empty()) {
+            cout << "No violations found." << endl;
+            return;
+        }
+        map<string, pair<size_t, size_t>> by_check;   // check -> (found, repaired)
+        for (const auto& violation : violations) {
+            by_check[violation.check].first++;
+            by_check[violation.check].second += violation.repaired;
+        }
+        cout << violations.size() << " violation(s), " << repairedCount() << " repaired:" << endl;
+        for (const auto& entry : by_check) {
+            cout << "  " << left << setw(24) << entry.first << right << setw(10) << entry.second.first
+                 << " found" << setw(10) << entry.second.second << " repaired" << endl;
+        }
+        for (size_t i = 0; i < violations.size() && i < examples; i++) {
+            const IntegrityViolation& violation = violations[i];
+            cout << "  [" << violation.check << "] " << violation.record << ": " << violation.detail
+                 << (violation.repaired ? " (repaired)" : "") << endl;
+        }
+        if (violations.size() > examples) {
+            cout << "  ... and " << violations.size() - examples << " more" << endl;
+        }
+    }
+};
+
+class LibrarySystem {
+public:
+    list<Books*> book_collection;
+    list<Member*> members;
+    list<Librarian*> librarians;
+    list<Transaction*> transactions;
+    RecentEventRing recent_transactions;
+    unordered_map<string, vector<Transaction*>> transactions_by_member;   // each sorted by issue date
+    unordered_map<int, vector<Transaction*>> transactions_by_book;
+    vector<Transaction*> transactions_by_date;
+    atomic<int> open_cursors;
+    unique_ptr<TransactionArchive> archive;   // cold tier; null when archiving is disabled
+    int archive_after_days;
+    shared_ptr<const CatalogSnapshot> published_snapshot;   // swapped with atomic_store
+    vector<Books*> stale_books;                             // changed since the last snapshot
+    vector<Member*> stale_members;
+    thread snapshot_publisher;                              // publishes stale records while a service runs
+    mutex publisher_mutex;
+    condition_variable publisher_wake;
+    bool publisher_stopping;
+    ReservationQueue reservation_queue;
+    unordered_map<int, Books*> book_index;
+    unordered_map<string, Member*> member_index;
+    MemberDirectory directory;                              // name, email and phone prefixes
+    FuzzyTitleIndex title_index;                            // typo-tolerant title and author words
+    SerialsIndex serials;                                   // journal -> volume -> issue, with subscribers
+    unordered_map<int, Books*> isbn_index;                  // books with a nonzero ISBN
+    BloomFilter book_id_filter;                             // prefilters in front of the three indexes
+    BloomFilter isbn_filter;
+    BloomFilter member_id_filter;
+    bool use_prefilter;        // off only to measure ingest without the filters
+    uint64_t exact_lookups;    // index probes made by the duplicate checks
+    multimap<pair<int, string>, Transaction*> open_loans;   // (book_id, member_id) -> unreturned transaction
+    mutex circulation_mutex;   // guards all collections above for concurrent callers
+    NotificationDispatcher notifications;
+    HoldTimerWheel hold_timers;
+    int pickup_window_days;
+    uint64_t next_hold_id;
+    ostream console;           // status messages of the circulation calls; silenced by setQuiet()
+    int transaction_counter;
+    unordered_map<int, Librarian*> librarian_index;
+    FineLedger fine_ledger;
+    DemandTracker demand;
+    CoBorrowModel recommendations;
+    SessionTable sessions;
+    string desk_session;       // token of the librarian logged in at this console
+    ContentStore ebook_content;
+    EBookAccessTable ebook_access;
+    unique_ptr<ReplicationLog> replication_log;   // mutations for read replicas; null unless enabled
+    unique_ptr<LogShipper> log_shipper;
+    
+    LibrarySystem()
+        : recent_transactions(256), open_cursors(0), publisher_stopping(false), hold_timers(LibraryClock::today()),
+          console(cout.rdbuf()) {
+        pickup_window_days = 3;
+        next_hold_id = 1;
+        archive_after_days = 90;
+        transaction_counter = 1000;
+        use_prefilter = true;
+        exact_lookups = 0;
+    }
+    
+    ~LibrarySystem() {
+        stopSnapshotPublisher();
+        notifications.stop();
+        for (auto book : book_collection) {
+            delete book;
+        }
+        for (auto member : members) {
+            delete member;
+        }
+        for (auto librarian : librarians) {
+            delete librarian;
+        }
+        for (auto transaction : transactions) {
+            delete transaction;
+        }
+    }
+    
+    // Silences status messages and notifications, e.g. for benchmark targets.
+    void setQuiet(bool quiet) {
+        console.rdbuf(quiet ? nullptr : cout.rdbuf());
+        if (quiet) {
+            notifications.setSink(unique_ptr<NotificationSink>(new DiscardNotificationSink()));
+        } else {
+            notifications.setSink(unique_ptr<NotificationSink>(new ConsoleNotificationSink()));
+        }
+    }
+    
+    // Checks a librarian's password and opens a session; returns its token.
+    // Throws InvalidCredentialsException for a wrong staff ID or password.
+    string authenticate(int staff_id, const string& password) {
+        Librarian* librarian = nullptr;
+        {
+            lock_guard<mutex> lock(circulation_mutex);
+            auto it = librarian_index.find(staff_id);
+            if (it != librarian_index.end()) {
+                librarian = it->second;
+            }
+        }
+        // Unknown IDs still cost one hash, so timing does not reveal which IDs exist.
+        static const PasswordHash decoy = PasswordHash::create("");
+        bool valid = librarian ? librarian->authenticate(password) : (decoy.verify(password) && false);
+        if (!valid) {
+            throw InvalidCredentialsException();
+        }
+        return sessions.open(staff_id, librarian->name);
+    }
+    
+    bool librarianLogin() {
+        if (checkLibrarianAccess()) {
+            cout << "A librarian is already logged in!" << endl;
+            return true;
+        }
+        
+        int staff_id;
+        string password;
+        cout << "Enter staff ID: ";
+        cin >> staff_id;
+        cout << "Enter librarian password: ";
+        cin >> password;
+        
+        try {
+            desk_session = authenticate(staff_id, password);
+            cout << "Login successful!" << endl;
+            return true;
+        }
+        catch (const InvalidCredentialsException& e) {
+            cout << "Invalid staff ID or password!" << endl;
+            return false;
+        }
+    }
+    
+    void librarianLogout() {
+        if (!desk_session.empty() && sessions.revoke(desk_session)) {
+            cout << "Librarian logged out successfully!" << endl;
+        } else {
+            cout << "No librarian is currently logged in!" << endl;
+        }
+        desk_session.clear();
+    }
+    
+    bool checkLibrarianAccess() {
+        return sessions.validate(desk_session);
+    }
+    
+    void addBook(Books* book) {
+        lock_guard<mutex> lock(circulation_mutex);
+        if (bookIdTaken(book->book_Id)) {
+            throw InvalidOperationException("Book with ID " + to_string(book->book_Id) + " already exists!");
+        }
+        if (isbnTaken(book->ISBN_no)) {
+            throw InvalidOperationException("A book with ISBN " + to_string(book->ISBN_no) + " already exists!");
+        }
+        insertBook(book);
+        console << "Book added successfully!" << endl;
+    }
+    
+    void addMember(Member* member) {
+        lock_guard<mutex> lock(circulation_mutex);
+        if (memberIdTaken(member->member_id)) {
+            throw InvalidOperationException("Member with ID " + member->member_id + " already exists!");
+        }
+        insertMember(member);
+        console << "Member added successfully!" << endl;
+    }
+    
+    // Duplicate checks for inserts. Called with the lock held. Most new IDs
+    // are rejected by the filter, so only a "maybe" costs an index probe.
+    bool bookIdTaken(int book_id) {
+        if (use_prefilter && !book_id_filter.mayContain(BloomFilter::keyHash(book_id))) {
+            return false;
+        }
+        exact_lookups++;
+        bool present = book_index.count(book_id) > 0;
+        return use_prefilter ? book_id_filter.confirm(present) : present;
+    }
+    
+    bool isbnTaken(int isbn) {
+        if (isbn == 0) {
+            return false;
+        }
+        if (use_prefilter && !isbn_filter.mayContain(BloomFilter::keyHash(isbn))) {
+            return false;
+        }
+        exact_lookups++;
+        bool present = isbn_index.count(isbn) > 0;
+        return use_prefilter ? isbn_filter.confirm(present) : present;
+    }
+    
+    bool memberIdTaken(const string& member_id) {
+        if (use_prefilter && !member_id_filter.mayContain(BloomFilter::keyHash(member_id))) {
+            return false;
+        }
+        exact_lookups++;
+        bool present = member_index.count(member_id) > 0;
+        return use_prefilter ? member_id_filter.confirm(present) : present;
+    }
+    
+    // Adds an already checked book to the collection and every index. A
+    // transferred record is not logged as an add, since its RECEIVE_COPY
+    // event carries it, and its issue is not routed to serial subscribers
+    // again: that happened where the issue was first stocked.
+    void insertBook(Books* book, bool transferred = false) {
+        book_collection.push_back(book);
+        book_index[book->book_Id] = book;
+        if (book->ISBN_no != 0) {
+            isbn_index.emplace(book->ISBN_no, book);
+        }
+        if (book_id_filter.full() || isbn_filter.full()) {
+            rebuildBookFilters(book_index.size() * 2);
+        } else {
+            book_id_filter.add(BloomFilter::keyHash(book->book_Id));
+            if (book->ISBN_no != 0) {
+                isbn_filter.add(BloomFilter::keyHash(book->ISBN_no));
+            }
+        }
+        title_index.add(book);
+        markStale(book);
+        if (replication_log && !transferred) {
+            vector<string> fields;
+            ReplicationLog::encodeBook(book, fields);
+            replication_log->append(ReplicationLog::ADD_BOOK, fields);
+        }
+        if (ResearchJournal* journal = dynamic_cast<ResearchJournal*>(book)) {
+            bool newest = false;
+            Serial* serial = serials.add(journal, newest);
+            if (serial && newest && !transferred) {
+                routeIssue(*serial, journal);
+            }
+        }
+    }
+    
+    void insertMember(Member* member) {
+        members.push_back(member);
+        member_index.emplace(member->member_id, member);
+        directory.add(member);
+        if (member_id_filter.full()) {
+            rebuildMemberFilter(member_index.size() * 2);
+        } else {
+            member_id_filter.add(BloomFilter::keyHash(member->member_id));
+        }
+        markStale(member);
+        if (replication_log) {
+            vector<string> fields;
+            ReplicationLog::encodeMember(member, fields);
+            replication_log->append(ReplicationLog::ADD_MEMBER, fields);
+        }
+    }
+    
+    // Resizes the filters from the exact indexes. Called with the lock held.
+    void rebuildBookFilters(size_t expected) {
+        book_id_filter.reset(expected, book_id_filter.target_rate);
+        for (auto& entry : book_index) {
+            book_id_filter.add(BloomFilter::keyHash(entry.first));
+        }
+        isbn_filter.reset(expected, isbn_filter.target_rate);
+        for (auto& entry : isbn_index) {
+            isbn_filter.add(BloomFilter::keyHash(entry.first));
+        }
+    }
+    
+    void rebuildMemberFilter(size_t expected) {
+        member_id_filter.reset(expected, member_id_filter.target_rate);
+        for (auto& entry : member_index) {
+            member_id_filter.add(BloomFilter::keyHash(entry.first));
+        }
+    }
+    
+    // Adds a batch of books and members, skipping (and deleting) any whose
+    // book ID, ISBN or member ID is already held or repeats earlier in the
+    // batch. Takes ownership of every record passed in. The lock is taken
+    // per chunk so circulation is not stalled for the whole import.
+    IngestResult mergeCatalog(const vector<Books*>& incoming_books, const vector<Member*>& incoming_members) {
+        const size_t CHUNK = 1024;
+        IngestResult result;
+        if (incoming_books.size() + incoming_members.size() > 0) {
+            lock_guard<mutex> lock(circulation_mutex);
+            // Size once for the whole batch rather than doubling mid-import.
+            size_t books_needed = book_index.size() + incoming_books.size();
+            if (books_needed > book_id_filter.capacity) {
+                rebuildBookFilters(books_needed);
+            }
+            size_t members_needed = member_index.size() + incoming_members.size();
+            if (members_needed > member_id_filter.capacity) {
+                rebuildMemberFilter(members_needed);
+            }
+            book_index.reserve(books_needed);
+            member_index.reserve(members_needed);
+        }
+        for (size_t start = 0; start < incoming_books.size(); start += CHUNK) {
+            lock_guard<mutex> lock(circulation_mutex);
+            uint64_t lookups_before = exact_lookups;
+            for (size_t i = start; i < min(start + CHUNK, incoming_books.size()); i++) {
+                Books* book = incoming_books[i];
+                bool duplicate = bookIdTaken(book->book_Id) || isbnTaken(book->ISBN_no);
+                if (duplicate) {
+                    delete book;
+                    result.duplicate_books++;
+                } else {
+                    insertBook(book);
+                    result.added_books++;
+                }
+            }
+            result.exact_lookups += exact_lookups - lookups_before;
+        }
+        for (size_t start = 0; start < incoming_members.size(); start += CHUNK) {
+            lock_guard<mutex> lock(circulation_mutex);
+            uint64_t lookups_before = exact_lookups;
+            for (size_t i = start; i < min(start + CHUNK, incoming_members.size()); i++) {
+                Member* member = incoming_members[i];
+                bool duplicate = memberIdTaken(member->member_id);
+                if (duplicate) {
+                    delete member;
+                    result.duplicate_members++;
+                } else {
+                    insertMember(member);
+                    result.added_members++;
+                }
+            }
+            result.exact_lookups += exact_lookups - lookups_before;
+        }
+        console << "Imported " << result.added_books << " books and " << result.added_members << " members ("
+                << result.duplicate_books + result.duplicate_members << " duplicates skipped)" << endl;
+        return result;
+    }
+    
+    void displayPrefilterStats() {
+        lock_guard<mutex> lock(circulation_mutex);
+        const BloomFilter* filters[] = { &book_id_filter, &isbn_filter, &member_id_filter };
+        const char* names[] = { "Book IDs", "ISBNs", "Member IDs" };
+        cout << left << setw(12) << "Filter" << right << setw(10) << "Keys" << setw(10) << "KiB"
+             << setw(12) << "Rejected" << setw(10) << "FP" << setw(10) << "FP rate" << endl;
+        for (int i = 0; i < 3; i++) {
+            const BloomFilter* f = filters[i];
+            cout << left << setw(12) << names[i] << right << setw(10) << f->inserted
+                 << setw(10) << f->memoryBytes() / 1024
+                 << setw(12) << f->definite_negatives << setw(10) << f->false_positives
+                 << setw(9) << fixed << setprecision(3) << f->observedFalsePositiveRate() * 100 << "%" << endl;
+        }
+    }
+    
+    void addLibrarian(Librarian* librarian) {
+        lock_guard<mutex> lock(circulation_mutex);
+        librarians.push_back(librarian);
+        librarian_index[librarian->staff_id] = librarian;
+        logMutation(ReplicationLog::ADD_LIBRARIAN, {librarian->name, to_string(librarian->staff_id), librarian->email,
+                                                    librarian->password_hash.encode()});
+        console << "Librarian added successfully!" << endl;
+    }
+    
+    // Starts recording mutations for replicas, spilling them to directory.
+    // Called before any data is added so the log holds the whole history.
+    void enableReplicationLog(const string& directory) {
+        lock_guard<mutex> lock(circulation_mutex);
+        if (!replication_log) {
+            replication_log.reset(new ReplicationLog(directory));
+        }
+    }
+    
+    // Appends one event when the log is enabled. Called with the lock held, so
+    // the log order is the order the mutations were applied.
+    void logMutation(char kind, const vector<string>& fields) {
+        if (replication_log) {
+            replication_log->append(kind, fields);
+        }
+    }
+    
+    bool startLogShipping(const string& socket_path) {
+        enableReplicationLog(socket_path + ".log");
+        if (log_shipper) {
+            cout << "Already shipping on " << log_shipper->path << endl;
+            return false;
+        }
+        unique_ptr<LogShipper> shipper(new LogShipper(*replication_log));
+        if (!shipper->start(socket_path)) {
+            return false;
+        }
+        log_shipper = move(shipper);
+        return true;
+    }
+    
+    // Shows how far each replica is. Replicas rebuild the library by replaying
+    // its whole history, so only a library started with --primary ships a log.
+    void displayReplicationStatus() {
+        if (log_shipper) {
+            log_shipper->displayStatus();
+            return;
+        }
+        cout << "This library does not keep a change log, so replicas could not rebuild its earlier changes. "
+             << "Start the service with --primary <socket> [port] to serve replicas." << endl;
+    }
+    
+    // Replays one event from a primary's log (the fields of one line). The
+    // clock is set to the event's day first so due dates, fines and hold
+    // expiry come out as they did on the primary. Throws what the call throws.
+    void applyReplicated(const vector<string>& fields) {
+        if (fields.size() < 4 || fields[1].size() != 1) {
+            throw InvalidOperationException("Malformed replication event");
+        }
+        char kind = fields[1][0];
+        LibraryClock::set(atoi(fields[2].c_str()));
+        const vector<string> f(fields.begin() + 4, fields.end());
+        auto need = [&](size_t count) {
+            if (f.size() < count) {
+                throw InvalidOperationException("Malformed replication event");
+            }
+        };
+        if (kind == ReplicationLog::ADD_BOOK) {
+            Books* book = ReplicationLog::decodeBook(f, 0);
+            need(book ? 0 : 7);
+            try {
+                addBook(book);
+            } catch (const LibraryException& e) {
+                delete book;
+                throw;
+            }
+        } else if (kind == ReplicationLog::ADD_MEMBER) {
+            Member* member = ReplicationLog::decodeMember(f, 0);
+            need(member ? 0 : 8);
+            try {
+                addMember(member);
+            } catch (const LibraryException& e) {
+                delete member;
+                throw;
+            }
+        } else if (kind == ReplicationLog::ADD_LIBRARIAN) {
+            need(4);
+            Librarian* librarian = new Librarian();
+            librarian->name = f[0];
+            librarian->staff_id = atoi(f[1].c_str());
+            librarian->email = f[2];
+            if (!PasswordHash::decode(f[3], librarian->password_hash)) {
+                delete librarian;
+                throw InvalidOperationException("Malformed password hash for librarian " + f[1]);
+            }
+            addLibrarian(librarian);
+        } else if (kind == ReplicationLog::ISSUE) {
+            need(2);
+            if (f.size() > 2) {
+                // The primary's counter may have started above the replica's, e.g. after its archive.
+                lock_guard<mutex> lock(circulation_mutex);
+                transaction_counter = atoi(f[2].c_str());
+            }
+            issueBook(atoi(f[0].c_str()), f[1]);
+        } else if (kind == ReplicationLog::RETURN) {
+            need(2);
+            returnBook(atoi(f[0].c_str()), f[1]);
+        } else if (kind == ReplicationLog::RESERVE) {
+            need(3);
+            reserveBook(atoi(f[0].c_str()), f[1], f[2] == "1");
+        } else if (kind == ReplicationLog::PAY_FINE) {
+            need(2);
+            payFine(f[0], atoi(f[1].c_str()));
+        } else if (kind == ReplicationLog::EXPIRE_HOLDS) {
+            lock_guard<mutex> lock(circulation_mutex);
+            expireHolds();
+        } else if (kind == ReplicationLog::ADVANCE_DAY) {
+            advanceDays(0);
+        } else if (kind == ReplicationLog::SUBSCRIBE) {
+            need(3);
+            subscribeToSerial(f[0], f[1], f[2] == "1");
+        } else if (kind == ReplicationLog::RELEASE_COPY) {
+            need(2);
+            delete releaseCopy(atoi(f[0].c_str()), f[1]);
+        } else if (kind == ReplicationLog::RECEIVE_COPY) {
+            need(3);
+            int book_id = atoi(f[0].c_str());
+            Books* incoming;
+            if (lookupBook(book_id)) {
+                incoming = new Books("", book_id, "", "", 0, 0);
+            } else if (!(incoming = ReplicationLog::decodeBook(f, 3))) {
+                throw BookNotFoundException();
+            }
+            incoming->no_of_copies = atoi(f[1].c_str());
+            receiveCopy(incoming, f[2]);
+        } else {
+            throw InvalidOperationException(string("Unknown replication event ") + kind);
+        }
+    }
+    
+    // Hash of the circulation state a replica must reproduce: stock, loans,
+    // queues, holds, fines, serial subscriptions, transaction numbering and the day.
+    uint64_t stateDigest() {
+        lock_guard<mutex> lock(circulation_mutex);
+        uint64_t digest = 1469598103934665603ULL;
+        auto mix = [&](const string& text) {
+            for (unsigned char c : text) {
+                digest = (digest ^ c) * 1099511628211ULL;
+            }
+            digest = (digest ^ 0xff) * 1099511628211ULL;
+        };
+        int today = LibraryClock::today();
+        for (const Books* book : book_collection) {
+            mix(to_string(book->book_Id) + ":" + to_string(book->no_of_copies) + ":" +
+                to_string(book->no_of_copies_issued) + ":" + to_string(book->availability));
+            for (const auto& member_id : book->reserved_by) {
+                mix(member_id);
+            }
+            for (const auto& hold : book->pickup_holds) {
+                mix(hold.first + "@" + to_string(hold.second.deadline));
+            }
+        }
+        for (const Member* member : members) {
+            string loans;
+            for (int book_id : member->issued_book_ids) {
+                loans += to_string(book_id) + ",";
+            }
+            mix(member->member_id + ":" + loans + ":" + to_string(member->fineBalance(today)));
+        }
+        for (const auto& serial : serials.serials) {
+            for (const auto& member_id : serial.second.subscribers) {
+                mix(serial.first + "<" + member_id);
+            }
+        }
+        mix(to_string(librarians.size()) + ":" + to_string(transaction_counter) + ":" + to_string(today));
+        return digest;
+    }
+    
+    // Records that a book changed so the next snapshot refreshes it. Called
+    // with the lock held; costs a flag test and at most one push.
+    void markStale(Books* book) {
+        if (!book->snapshot_stale) {
+            book->snapshot_stale = true;
+            stale_books.push_back(book);
+        }
+    }
+    
+    void markStale(Member* member) {
+        if (!member->snapshot_stale) {
+            member->snapshot_stale = true;
+            stale_members.push_back(member);
+        }
+    }
+    
+    // Publishes the changes made since the last snapshot and returns the
+    // current one. The lock is held only while changed records are copied.
+    // Called by the snapshot publisher, and by the desk so that its views
+    // include its own changes.
+    shared_ptr<const CatalogSnapshot> publishSnapshot() {
+        lock_guard<mutex> lock(circulation_mutex);
+        shared_ptr<const CatalogSnapshot> current = atomic_load(&published_snapshot);
+        size_t total_transactions = transactions.size() + (archive ? archive->archived_rows : 0);
+        if (current && stale_books.empty() && stale_members.empty() && current->day == LibraryClock::today() &&
+            current->transactions == total_transactions && current->active_loans == open_loans.size() &&
+            current->reservations == reservation_queue.size()) {
+            return current;
+        }
+        
+        shared_ptr<CatalogSnapshot> next = make_shared<CatalogSnapshot>();
+        if (current) {
+            next->version = current->version;
+            next->books = current->books;
+            next->members = current->members;
+        }
+        next->version++;
+        next->day = LibraryClock::today();
+        next->books = next->books.publish(stale_books);
+        next->members = next->members.publish(stale_members);
+        next->transactions = total_transactions;
+        next->active_loans = open_loans.size();
+        next->reservations = reservation_queue.size();
+        stale_books.clear();
+        stale_members.clear();
+        
+        shared_ptr<const CatalogSnapshot> published = next;
+        atomic_store(&published_snapshot, published);
+        return published;
+    }
+    
+    // Copies of single records for callers that work outside the lock.
+    unique_ptr<Books> lookupBook(int book_id) {
+        lock_guard<mutex> lock(circulation_mutex);
+        Books* book = findBook(book_id);
+        return unique_ptr<Books>(book ? book->snapshotCopy() : nullptr);
+    }
+    
+    // Type-ahead search over names, emails and phone numbers; returns copies
+    // of up to limit members in key order.
+    vector<unique_ptr<Member>> searchMembers(const string& query, MemberDirectory::Field field, size_t limit) {
+        lock_guard<mutex> lock(circulation_mutex);
+        vector<unique_ptr<Member>> found;
+        for (Member* member : directory.search(query, field, limit)) {
+            found.emplace_back(member->snapshotCopy());
+        }
+        return found;
+    }
+    
+    // Books whose title and author match every word of the query allowing
+    // for typos, best first, as copies with their number of edits.
+    // The search itself runs under the index's own lock; the circulation lock
+    // is taken only to copy the matches.
+    vector<pair<unique_ptr<Books>, int>> searchBooksFuzzy(const string& query, size_t limit) {
+        vector<pair<Books*, int>> matches = title_index.search(query, limit);
+        lock_guard<mutex> lock(circulation_mutex);
+        vector<pair<unique_ptr<Books>, int>> found;
+        for (const auto& match : matches) {
+            found.emplace_back(unique_ptr<Books>(match.first->snapshotCopy()), match.second);
+        }
+        return found;
+    }
+    
+    unique_ptr<Member> lookupMember(const string& member_id) {
+        lock_guard<mutex> lock(circulation_mutex);
+        Member* member = findMember(member_id);
+        return unique_ptr<Member>(member ? member->snapshotCopy() : nullptr);
+    }
+    
+    // Last published snapshot, read without the lock. While the publisher
+    // runs it trails the live state by at most one publish interval.
+    shared_ptr<const CatalogSnapshot> snapshot() {
+        shared_ptr<const CatalogSnapshot> current = atomic_load(&published_snapshot);
+        return current ? current : publishSnapshot();
+    }
+    
+    // Publishes every interval_ms on a background thread, so that readers of
+    // snapshot() never take the circulation lock. Started by the HTTP service.
+    void startSnapshotPublisher(int interval_ms) {
+        if (snapshot_publisher.joinable()) {
+            return;
+        }
+        publisher_stopping = false;
+        snapshot_publisher = thread([this, interval_ms] {
+            unique_lock<mutex> lock(publisher_mutex);
+            while (!publisher_stopping) {
+                lock.unlock();
+                publishSnapshot();
+                lock.lock();
+                publisher_wake.wait_for(lock, chrono::milliseconds(interval_ms), [this] { return publisher_stopping; });
+            }
+        });
+    }
+    
+    void stopSnapshotPublisher() {
+        if (!snapshot_publisher.joinable()) {
+            return;
+        }
+        {
+            lock_guard<mutex> lock(publisher_mutex);
+            publisher_stopping = true;
+        }
+        publisher_wake.notify_one();
+        snapshot_publisher.join();
+    }
+    
+    void displayBooks() {
+        shared_ptr<const CatalogSnapshot> view = publishSnapshot();
+        cout << "\n======= BOOKS CATALOG =======" << endl;
+        if (view->books.size() == 0) {
+            cout << "No books available in the library." << endl;
+            return;
+        }
+        
+        unordered_map<int, string> titles = titlesById(*view);
+        for (size_t i = 0; i < view->books.size(); i++) {
+            view->books[i]->display();
+            showRecommendations(view->books[i]->book_Id, titles);
+        }
+    }
+    
+    void displayMembers() {
+        shared_ptr<const CatalogSnapshot> view = publishSnapshot();
+        cout << "\n======= LIBRARY MEMBERS =======" << endl;
+        if (view->members.size() == 0) {
+            cout << "No members registered in the library." << endl;
+            return;
+        }
+        
+        for (size_t i = 0; i < view->members.size(); i++) {
+            view->members[i]->display();
+        }
+    }
+    
+    static string csvField(const string& value) {
+        if (value.find_first_of(",\"\n") == string::npos) {
+            return value;
+        }
+        string quoted = "\"";
+        for (char c : value) {
+            if (c == '"') {
+                quoted += '"';
+            }
+            quoted += c;
+        }
+        return quoted + "\"";
+    }
+    
+    static void writeCatalogRow(ostream& out, const Books* book) {
+        const char* type = book->typeName();
+        out << book->book_Id << ',' << csvField(book->book_name) << ',' << csvField(book->author_name) << ','
+            << csvField(book->publisher) << ',' << book->ISBN_no << ',' << type << ',' << book->no_of_copies << ','
+            << book->no_of_copies_issued << ',' << book->pickup_holds.size() << ',' << book->reserved_by.size() << ','
+            << (book->availability ? "Available" : "Not Available") << '\n';
+    }
+    
+    // Writes the whole catalog as CSV from one snapshot and returns the row count.
+    static size_t exportCatalog(ostream& out, const CatalogSnapshot& view) {
+        out << "book_id,title,author,publisher,isbn,type,copies,issued,on_hold,reserved,status\n";
+        for (size_t i = 0; i < view.books.size(); i++) {
+            writeCatalogRow(out, view.books[i]);
+        }
+        return view.books.size();
+    }
+    
+    void findMemberByPrefix() {
+        string query;
+        cout << "Name, email or phone (the first few characters will do): ";
+        cin.ignore();
+        getline(cin, query);
+        vector<unique_ptr<Member>> found = searchMembers(query, MemberDirectory::BY_ANY, 10);
+        if (found.empty()) {
+            cout << "No member matches \"" << query << "\"." << endl;
+            return;
+        }
+        for (const auto& member : found) {
+            cout << left << setw(10) << member->member_id << setw(28) << member->name << setw(32) << member->email
+                 << member->contact << right << endl;
+        }
+    }
+    
+    void findBookFuzzy() {
+        string query;
+        cout << "Title or author (spelling mistakes are fine): ";
+        cin.ignore();
+        getline(cin, query);
+        vector<pair<unique_ptr<Books>, int>> found = searchBooksFuzzy(query, 10);
+        if (found.empty()) {
+            cout << "No book matches \"" << query << "\"." << endl;
+            return;
+        }
+        for (const auto& match : found) {
+            cout << left << setw(8) << match.first->book_Id << setw(40) << match.first->book_name << setw(24)
+                 << match.first->author_name << right << match.second << " edit(s)" << endl;
+        }
+    }
+    
+    void serialsDesk() {
+        int sub_choice;
+        cout << "\n1. Browse Issues by Volume" << endl;
+        cout << "2. Check In New Issues" << endl;
+        cout << "3. Subscribe Member to Serial" << endl;
+        cout << "4. Unsubscribe Member from Serial" << endl;
+        cout << "5. List Serials" << endl;
+        cout << "Enter choice: ";
+        cin >> sub_choice;
+        cin.ignore();
+        
+        try {
+            if (sub_choice >= 1 && sub_choice <= 4) {
+                string journal_name;
+                cout << "Journal Name: ";
+                getline(cin, journal_name);
+                if (sub_choice == 1) {
+                    int from_volume, to_volume;
+                    cout << "From Volume: ";
+                    cin >> from_volume;
+                    cout << "To Volume (0 for latest): ";
+                    cin >> to_volume;
+                    string name;
+                    bool more = false;
+                    vector<unique_ptr<Books>> found = serialIssues(journal_name, from_volume,
+                                                                   to_volume > 0 ? to_volume : INT32_MAX, 1000, name, more);
+                    cout << "\n" << name << ": " << found.size() << " issue(s)"
+                         << (more ? " shown; narrow the volume range to see the rest" : "") << endl;
+                    for (const auto& book : found) {
+                        const ResearchJournal* journal = static_cast<const ResearchJournal*>(book.get());
+                        cout << "Vol. " << left << setw(6) << journal->volume << "No. " << setw(6) << journal->issue
+                             << "Book " << setw(8) << journal->book_Id << right << journal->freeCopies() << " of "
+                             << journal->no_of_copies << " free, " << journal->reserved_by.size() << " waiting" << endl;
+                    }
+                } else if (sub_choice == 2) {
+                    string publisher;
+                    int volume, first_issue, last_issue, copies, first_id;
+                    cout << "Publisher: ";
+                    getline(cin, publisher);
+                    cout << "Volume: ";
+                    cin >> volume;
+                    cout << "First Issue: ";
+                    cin >> first_issue;
+                    cout << "Last Issue: ";
+                    cin >> last_issue;
+                    cout << "Copies of each issue: ";
+                    cin >> copies;
+                    cout << "Book ID of the first issue (the rest follow in order): ";
+                    cin >> first_id;
+                    if (last_issue < first_issue || copies <= 0) {
+                        cout << "Invalid issue range or copy count!" << endl;
+                        return;
+                    }
+                    vector<ResearchJournal*> delivery;
+                    for (int issue = first_issue; issue <= last_issue; issue++) {
+                        delivery.push_back(new ResearchJournal(journal_name + " Vol. " + to_string(volume) + " No. " + to_string(issue),
+                                                               first_id + issue - first_issue, "Various", publisher, 0, copies,
+                                                               journal_name, volume, issue));
+                    }
+                    checkInIssues(delivery);
+                } else {
+                    string member_id;
+                    cout << "Member ID: ";
+                    cin >> member_id;
+                    bool subscribe = sub_choice == 3;
+                    if (subscribeToSerial(journal_name, member_id, subscribe)) {
+                        cout << "Member " << member_id << (subscribe ? " now receives each new issue." : " no longer receives new issues.") << endl;
+                    } else {
+                        cout << "Member " << member_id << (subscribe ? " is already subscribed." : " was not subscribed.") << endl;
+                    }
+                }
+            } else if (sub_choice == 5) {
+                string prefix;
+                cout << "Journal name or its beginning (empty for all): ";
+                getline(cin, prefix);
+                lock_guard<mutex> lock(circulation_mutex);
+                vector<const Serial*> found = serials.withPrefix(prefix, 50);
+                if (found.empty()) {
+                    cout << "No serials found." << endl;
+                }
+                for (const Serial* serial : found) {
+                    const auto& last = serial->issues.rbegin()->first;
+                    cout << left << setw(48) << serial->journal_name << right << setw(6) << serial->issues.size()
+                         << " issue(s), latest Vol. " << get<0>(last) << " No. " << get<1>(last) << ", "
+                         << serial->subscribers.size() << " subscriber(s)" << endl;
+                }
+            } else {
+                cout << "Invalid choice!" << endl;
+            }
+        }
+        catch (const LibraryException& e) {
+            cout << "Error: " << e.what() << endl;
+        }
+    }
+    
+    void importEBookContent() {
+        int book_id;
+        string source;
+        cout << "Enter E-Book ID: ";
+        cin >> book_id;
+        cout << "Enter path of the file to import: ";
+        cin >> source;
+        string format;
+        {
+            lock_guard<mutex> lock(circulation_mutex);
+            EBook* ebook = dynamic_cast<EBook*>(findBook(book_id));
+            if (!ebook) {
+                cout << "Book " << book_id << " is not an e-book!" << endl;
+                return;
+            }
+            format = ebook->format;
+        }
+        long long bytes = ebook_content.import(book_id, format, source);
+        if (bytes < 0) {
+            cout << "Could not import " << source << ": " << strerror(errno) << endl;
+            return;
+        }
+        cout << "Stored " << bytes << " bytes as " << ebook_content.pathFor(book_id, format) << endl;
+    }
+    
+    void exportCatalogToFile() {
+        string path = "library_catalog.csv";
+        ofstream out(path);
+        if (!out) {
+            cout << "Could not open " << path << " for writing!" << endl;
+            return;
+        }
+        shared_ptr<const CatalogSnapshot> view = publishSnapshot();
+        size_t rows = exportCatalog(out, *view);
+        cout << "Exported " << rows << " book(s) to " << path << " (snapshot version " << view->version
+             << ", Day " << view->day << ")." << endl;
+    }
+    
+    void displayTransactions() {
+        cout << "\n======= TRANSACTION HISTORY =======" << endl;
+        {
+            lock_guard<mutex> lock(circulation_mutex);
+            if (transactions.empty() && (!archive || archive->archived_rows == 0)) {
+                cout << "No transactions recorded." << endl;
+                return;
+            }
+        }
+        
+        TransactionCursor cursor = queryByDate(0, INT32_MAX - 1);
+        while (const Transaction* transaction = cursor.next()) {
+            transaction->display();
+        }
+    }
+    
+    static bool issuedBefore(const Transaction* t, int day) {
+        return t->issue_date < day;
+    }
+    
+    // Appends to a date-sorted index; only a clock moved backwards needs a real insert.
+    static void appendByDate(vector<Transaction*>& index, Transaction* transaction) {
+        if (index.empty() || index.back()->issue_date <= transaction->issue_date) {
+            index.push_back(transaction);
+        } else {
+            index.insert(upper_bound(index.begin(), index.end(), transaction,
+                                     [](const Transaction* a, const Transaction* b) { return a->issue_date < b->issue_date; }),
+                         transaction);
+        }
+    }
+    
+    void indexTransaction(Transaction* transaction) {
+        appendByDate(transactions_by_member[transaction->member_Id], transaction);
+        appendByDate(transactions_by_book[transaction->book_Id], transaction);
+        appendByDate(transactions_by_date, transaction);
+    }
+    
+    // Cursor over the transactions of one index issued within the filter's
+    // day range, preceded by the archived matches. Called with the lock held.
+    TransactionCursor cursorOver(const vector<Transaction*>* index, const ArchiveFilter& filter) {
+        size_t from = 0, to = 0;
+        if (index) {
+            from = lower_bound(index->begin(), index->end(), filter.from_day, issuedBefore) - index->begin();
+            to = lower_bound(index->begin(), index->end(), filter.to_day + 1, issuedBefore) - index->begin();
+        }
+        TransactionCursor cursor(&circulation_mutex, index, from, to, &open_cursors);
+        if (archive) {
+            cursor.addArchivedSegments(archive->segments, filter);
+        }
+        return cursor;
+    }
+    
+    TransactionCursor queryByMember(const string& member_id, int from_day = 0, int to_day = INT32_MAX - 1) {
+        lock_guard<mutex> lock(circulation_mutex);
+        ArchiveFilter filter;
+        filter.member_id = member_id;
+        filter.from_day = from_day;
+        filter.to_day = to_day;
+        auto it = transactions_by_member.find(member_id);
+        return cursorOver(it == transactions_by_member.end() ? nullptr : &it->second, filter);
+    }
+    
+    TransactionCursor queryByBook(int book_id, int from_day = 0, int to_day = INT32_MAX - 1) {
+        lock_guard<mutex> lock(circulation_mutex);
+        ArchiveFilter filter;
+        filter.book_id = book_id;
+        filter.from_day = from_day;
+        filter.to_day = to_day;
+        auto it = transactions_by_book.find(book_id);
+        return cursorOver(it == transactions_by_book.end() ? nullptr : &it->second, filter);
+    }
+    
+    TransactionCursor queryByDate(int from_day, int to_day) {
+        lock_guard<mutex> lock(circulation_mutex);
+        ArchiveFilter filter;
+        filter.from_day = from_day;
+        filter.to_day = to_day;
+        return cursorOver(&transactions_by_date, filter);
+    }
+    
+    void enableArchive(const string& directory, int after_days) {
+        lock_guard<mutex> lock(circulation_mutex);
+        archive.reset(new TransactionArchive(directory));
+        archive_after_days = after_days;
+    }
+    
+    // Moves closed transactions returned more than archive_after_days ago into
+    // a new archive segment and frees them. Returns the number archived, or -1
+    // if archiving is disabled, a cursor is open, or the segment write failed.
+    // Called with the lock held.
+    int compactColdHistory() {
+        if (!archive || open_cursors.load() > 0) {
+            return -1;
+        }
+        int cutoff = LibraryClock::today() - archive_after_days;
+        vector<Transaction*> cold;
+        for (auto transaction : transactions) {
+            if (transaction->is_returned && transaction->return_date < cutoff) {
+                cold.push_back(transaction);
+            }
+        }
+        if (cold.empty()) {
+            return 0;
+        }
+        if (!archive->write(cold)) {
+            return -1;
+        }
+        archive->mergeSmallSegments();   // a failed merge keeps the small segments
+        
+        // Each affected index is filtered once, however many of its rows went cold.
+        unordered_set<Transaction*> archived(cold.begin(), cold.end());
+        unordered_set<string> members;
+        unordered_set<int> books;
+        for (auto transaction : cold) {
+            members.insert(transaction->member_Id);
+            books.insert(transaction->book_Id);
+        }
+        auto is_archived = [&archived](Transaction* t) { return archived.count(t) > 0; };
+        for (const auto& member_id : members) {
+            auto member = transactions_by_member.find(member_id);
+            if (member != transactions_by_member.end()) {
+                auto& index = member->second;
+                index.erase(remove_if(index.begin(), index.end(), is_archived), index.end());
+                if (index.empty()) {
+                    transactions_by_member.erase(member);
+                }
+            }
+        }
+        for (int book_id : books) {
+            auto book = transactions_by_book.find(book_id);
+            if (book != transactions_by_book.end()) {
+                auto& index = book->second;
+                index.erase(remove_if(index.begin(), index.end(), is_archived), index.end());
+                if (index.empty()) {
+                    transactions_by_book.erase(book);
+                }
+            }
+        }
+        transactions_by_date.erase(remove_if(transactions_by_date.begin(), transactions_by_date.end(), is_archived),
+                                   transactions_by_date.end());
+        transactions_by_date.shrink_to_fit();
+        transactions.remove_if(is_archived);
+        for (auto transaction : cold) {
+            delete transaction;
+        }
+        return cold.size();
+    }
+    
+    void archiveColdHistory() {
+        lock_guard<mutex> lock(circulation_mutex);
+        if (!archive) {
+            cout << "Archiving is disabled." << endl;
+            return;
+        }
+        int archived = compactColdHistory();
+        if (archived < 0) {
+            cout << "Archiving skipped: history queries are in progress or the segment could not be written." << endl;
+        } else {
+            cout << archived << " transaction(s) archived." << endl;
+        }
+        cout << "\n======= HISTORY TIERS =======" << endl;
+        cout << "In-memory transactions: " << transactions.size() << endl;
+        cout << "Archived transactions: " << archive->archived_rows << " in " << archive->segments.size() << " segment(s)" << endl;
+        cout << "Archive size on disk: " << archive->fileBytes() << " bytes (" << archive->rawBytes() << " bytes uncompressed)" << endl;
+        if (archive->fileBytes() > 0) {
+            cout << "Compression ratio: " << fixed << setprecision(2)
+                 << (double)archive->rawBytes() / archive->fileBytes() << "x" << endl;
+            cout.unsetf(ios::floatfield);
+            cout << setprecision(6);
+        }
+        cout << "Archive after: " << archive_after_days << " days" << endl;
+        cout << "=============================" << endl;
+    }
+    
+    void displayQueryResults(TransactionCursor cursor) {
+        int matches = 0;
+        while (const Transaction* transaction = cursor.next()) {
+            transaction->display();
+            matches++;
+        }
+        cout << matches << " transaction(s) found." << endl;
+    }
+    
+    void displayRecentActivity() {
+        lock_guard<mutex> lock(circulation_mutex);
+        cout << "\n======= RECENT ACTIVITY =======" << endl;
+        if (recent_transactions.size() == 0) {
+            cout << "No recent activity." << endl;
+            return;
+        }
+        for (size_t i = 0; i < recent_transactions.size(); i++) {
+            const TransactionEvent& event = recent_transactions.newest(i);
+            cout << "Day " << event.day << ": " << (event.type == 'I' ? "Issued" : "Returned")
+                 << " book " << event.book_id << " - member " << event.member_id
+                 << " (Transaction " << event.transaction_id << ")" << endl;
+        }
+    }
+    
+    void transactionHistory() {
+        int sub_choice;
+        cout << "\n1. All Transactions" << endl;
+        cout << "2. Loans of a Member" << endl;
+        cout << "3. Borrowers of a Book" << endl;
+        cout << "4. Loans Issued in a Date Range" << endl;
+        cout << "5. Recent Activity" << endl;
+        cout << "Enter choice: ";
+        cin >> sub_choice;
+        
+        int from_day = 0, to_day = INT32_MAX - 1;
+        if (sub_choice >= 2 && sub_choice <= 4) {
+            cout << "From Day (0 for earliest): ";
+            cin >> from_day;
+            cout << "To Day (0 for latest): ";
+            cin >> to_day;
+            if (to_day <= 0) {
+                to_day = INT32_MAX - 1;
+            }
+        }
+        
+        switch (sub_choice) {
+            case 1:
+                displayTransactions();
+                break;
+            case 2: {
+                string member_id;
+                cout << "Enter Member ID: ";
+                cin >> member_id;
+                displayQueryResults(queryByMember(member_id, from_day, to_day));
+                break;
+            }
+            case 3: {
+                int book_id;
+                cout << "Enter Book ID: ";
+                cin >> book_id;
+                displayQueryResults(queryByBook(book_id, from_day, to_day));
+                break;
+            }
+            case 4:
+                displayQueryResults(queryByDate(from_day, to_day));
+                break;
+            case 5:
+                displayRecentActivity();
+                break;
+            default:
+                cout << "Invalid choice!" << endl;
+        }
+    }
+    
+    Books* findBook(int book_id) {
+        auto it = book_index.find(book_id);
+        return it == book_index.end() ? nullptr : it->second;
+    }
+    
+    Member* findMember(const string& member_id) {
+        auto it = member_index.find(member_id);
+        return it == member_index.end() ? nullptr : it->second;
+    }
+    
+    void sortBooksById() {
+        book_collection.sort([](Books* a, Books* b) { return a->book_Id < b->book_Id; });
+    }
+    
+    void sortBooksByTitle() {
+        book_collection.sort([](Books* a, Books* b) { return a->book_name < b->book_name; });
+    }
+    
+    void sortMembersById() {
+        members.sort([](Member* a, Member* b) { return a->member_id < b->member_id; });
+    }
+    
+    // Returns the access token of an e-book loan, empty for other material.
+    string issueBook(int book_id, string member_id) {
+        LIBRARY_TIME_OPERATION(OP_ISSUE);
+        lock_guard<mutex> lock(circulation_mutex);
+        expireHolds();
+        Books* book = findBook(book_id);
+        Member* member = findMember(member_id);
+        
+        try {
+            if (!book) {
+                throw BookNotFoundException();
+            }
+            
+            if (!member) {
+                throw MemberNotFoundException();
+            }
+            
+            bool collecting_hold = book->hasPickupHold(member_id);
+            if (!collecting_hold && !book->availability) {
+                demand.recordUnmet(book_id, LibraryClock::today());
+                throw BookNotAvailableException();
+            }
+            
+            if (member->issued_book_ids.size() >= member->getMaxBooks()) {
+                throw MaxIssueLimitException(member->getMaxBooks());
+            }
+            
+            if (fine_ledger.isBlocked(member, LibraryClock::today())) {
+                throw PendingFineException(member->fineBalance(LibraryClock::today()));
+            }
+            
+            if (collecting_hold ? book->collectHold(member_id) : book->issueBook()) {
+                if (book->isReservedBy(member_id)) {
+                    book->removeReservation(member_id);
+                    reservation_queue.remove(book_id, member_id);
+                    demand.recordQueue(book_id, book->reserved_by.size(), LibraryClock::today());
+                }
+                demand.recordIssue(book_id, LibraryClock::today());
+                recommendations.recordIssue(member_id, book_id);
+                member->addIssuedBook(book_id);
+                markStale(book);
+                markStale(member);
+                
+                Transaction* transaction = new Transaction(transaction_counter++, book_id, member_id, book->book_name);
+                transactions.push_back(transaction);
+                open_loans.emplace(make_pair(book_id, member_id), transaction);
+                indexTransaction(transaction);
+                fine_ledger.openLoan(member, transaction);
+                
+                recent_transactions.push('I', transaction);
+                logMutation(ReplicationLog::ISSUE, {to_string(book_id), member_id, to_string(transaction->transaction_Id)});
+                
+                console << "Book issued successfully! Transaction ID: " << transaction->transaction_Id << endl;
+                console << "Due Date: Day " << transaction->due_date << endl;
+                
+                EBook* ebook = dynamic_cast<EBook*>(book);
+                if (ebook) {
+                    string token = ebook_access.grant(book_id, member_id, ebook->format, transaction->due_date);
+                    console << "E-book access token: " << token << " (valid through Day " << transaction->due_date
+                            << ")" << endl;
+                    return token;
+                }
+                return string();
+            } else {
+                throw InvalidOperationException("Failed to issue book due to unknown error!");
+            }
+        }
+        catch (const LibraryException& e) {
+            LIBRARY_OPERATION_FAILED();
+            console << "Exception during book issue process: " << e.what() << endl;
+            throw;
+        }
+    }
+    
+    void returnBook(int book_id, string member_id) {
+        LIBRARY_TIME_OPERATION(OP_RETURN);
+        lock_guard<mutex> lock(circulation_mutex);
+        expireHolds();
+        try {
+            Books* book = findBook(book_id);
+            Member* member = findMember(member_id);
+            
+            if (!book) {
+                throw BookNotFoundException();
+            }
+            
+            if (!member) {
+                throw MemberNotFoundException();
+            }
+            
+            if (!member->hasIssuedBook(book_id)) {
+                throw InvalidOperationException("This book was not issued to this member!");
+            }
+            
+            if (book->returnBook()) {
+                member->removeIssuedBook(book_id);
+                markStale(book);
+                markStale(member);
+                
+                Transaction* transaction = nullptr;
+                auto loan = open_loans.find(make_pair(book_id, member_id));
+                if (loan != open_loans.end()) {
+                    transaction = loan->second;
+                    open_loans.erase(loan);
+                }
+                
+                ebook_access.revoke(book_id, member_id);
+                if (transaction) {
+                    transaction->completeReturn();
+                    
+                    recent_transactions.push('R', transaction);
+                    
+                    int late_days = transaction->calculateLateDays();
+                    int fine_amount = fine_ledger.closeLoan(member, transaction);
+                    if (late_days > 0) {
+                        
+                        console << "Book returned late by " << late_days << " days!" << endl;
+                        console << "Fine imposed: Rs. " << fine_amount << endl;
+                    } else {
+                        console << "Book returned successfully and on time!" << endl;
+                    }
+                } else {
+                    console << "Book returned successfully, but transaction record not found!" << endl;
+                }
+                
+                promoteReservations(book);
+                logMutation(ReplicationLog::RETURN, {to_string(book_id), member_id});
+            } else {
+                throw InvalidOperationException("Failed to return book due to system error!");
+            }
+        } 
+        catch (const LibraryException& e) {
+            LIBRARY_OPERATION_FAILED();
+            console << "Exception during book return process: " << e.what() << endl;
+            throw;
+        }
+    }
+    
+    // New access token for an e-book already on loan to the member, e.g. when
+    // the first one was lost; the previous token stops working.
+    string grantEBookAccess(int book_id, const string& member_id) {
+        lock_guard<mutex> lock(circulation_mutex);
+        EBook* ebook = dynamic_cast<EBook*>(findBook(book_id));
+        if (!ebook) {
+            throw InvalidOperationException("Book " + to_string(book_id) + " is not an e-book!");
+        }
+        auto loan = open_loans.find(make_pair(book_id, member_id));
+        if (loan == open_loans.end()) {
+            throw InvalidOperationException("This e-book is not on loan to this member!");
+        }
+        return ebook_access.grant(book_id, member_id, ebook->format, loan->second->due_date);
+    }
+    
+    void reserveBook(int book_id) {
+        string member_id;
+        cout << "Enter Member ID who wants to reserve: ";
+        cin >> member_id;
+        
+        try {
+            reserveBook(book_id, member_id);
+        }
+        catch (const LibraryException& e) {
+            cout << "Exception during book reservation process: " << e.what() << endl;
+        }
+    }
+    
+    // remote_member: the member belongs to another branch of a consortium and
+    // is not in this branch's member list.
+    bool reserveBook(int book_id, string member_id, bool remote_member = false) {
+        LIBRARY_TIME_OPERATION(OP_RESERVE);
+        lock_guard<mutex> lock(circulation_mutex);
+        expireHolds();
+        Books* book = findBook(book_id);
+        Member* member = findMember(member_id);
+        
+        if (!book) {
+            LIBRARY_OPERATION_FAILED();
+            throw BookNotFoundException();
+        }
+        
+        if (!member && !remote_member) {
+            LIBRARY_OPERATION_FAILED();
+            throw MemberNotFoundException();
+        }
+        
+        if (book->availability) {
+            console << "Book is currently available! No need to reserve." << endl;
+            return false;
+        }
+        
+        if (book->hasPickupHold(member_id)) {
+            console << "A copy is already waiting for this member until Day " << book->pickup_holds[member_id].deadline << "!" << endl;
+            return false;
+        }
+        
+        if (book->reserveBook(member_id)) {
+            markStale(book);
+            reservation_queue.push(make_pair(book_id, member_id));
+            demand.recordQueue(book_id, book->reserved_by.size(), LibraryClock::today());
+            logMutation(ReplicationLog::RESERVE, {to_string(book_id), member_id, remote_member ? "1" : "0"});
+            console << "Book reserved successfully!" << endl;
+            console << "You are position " << book->reserved_by.size() << " in the queue." << endl;
+            return true;
+        }
+        console << "Book already reserved by this member or cannot be reserved!" << endl;
+        return false;
+    }
+    
+    // Sets a free copy aside for the member and starts the pickup window.
+    void placePickupHold(Books* book, const string& member_id) {
+        int deadline = LibraryClock::today() + pickup_window_days;
+        uint64_t hold_id = next_hold_id++;
+        book->pickup_holds[member_id] = PickupHold(deadline, hold_id);
+        book->update_availability();
+        markStale(book);
+        hold_timers.schedule(HoldTimer{(uint64_t)deadline + 1, hold_id, book->book_Id, member_id});
+        notifications.enqueue(member_id, book->book_Id, "Book is now available for member " + member_id +
+                              " who had reserved it. Please collect it by Day " + to_string(deadline) + ".");
+    }
+    
+    // Hands free copies to the members waiting for the title, in reservation order.
+    void promoteReservations(Books* book) {
+        bool promoted = false;
+        while (book->freeCopies() > 0 && !book->reserved_by.empty()) {
+            string member_id = book->reserved_by.front();
+            book->reserved_by.erase(book->reserved_by.begin());
+            reservation_queue.remove(book->book_Id, member_id);
+            placePickupHold(book, member_id);
+            demand.recordHoldFilled(book->book_Id, LibraryClock::today());
+            promoted = true;
+        }
+        if (promoted) {
+            demand.recordQueue(book->book_Id, book->reserved_by.size(), LibraryClock::today());
+        }
+    }
+    
+    // Gives each subscriber of the serial a pickup hold on the new issue while
+    // copies last and a queue place after that. Back issues filled in later
+    // are not routed. Called with the lock held, from insertBook, so replicas
+    // route the issues they replay in the same way.
+    void routeIssue(const Serial& serial, ResearchJournal* journal) {
+        bool queued = false;
+        for (const string& member_id : serial.subscribers) {
+            if (!findMember(member_id)) {
+                continue;
+            }
+            if (journal->freeCopies() > 0) {
+                placePickupHold(journal, member_id);
+                serials.holds_placed++;
+            } else if (journal->reserveBook(member_id)) {
+                reservation_queue.push(make_pair(journal->book_Id, member_id));
+                serials.queue_places++;
+                queued = true;
+                notifications.enqueue(member_id, journal->book_Id, "New issue " + journal->book_name + " is on order for member " +
+                                      member_id + ", position " + to_string(journal->reserved_by.size()) + " in the queue.");
+            }
+        }
+        if (queued) {
+            demand.recordQueue(journal->book_Id, journal->reserved_by.size(), LibraryClock::today());
+        }
+        markStale(journal);
+    }
+    
+    // Checks in a delivery of new issues under one lock. Issues are taken in
+    // (volume, issue) order so every new one in the delivery is routed. Skips
+    // (and deletes) issues whose book ID or ISBN is taken or whose serial
+    // already holds that volume and issue. Takes ownership of every record.
+    SerialCheckIn checkInIssues(vector<ResearchJournal*> issues) {
+        stable_sort(issues.begin(), issues.end(), [](const ResearchJournal* a, const ResearchJournal* b) {
+            return make_pair(a->volume, a->issue) < make_pair(b->volume, b->issue);
+        });
+        SerialCheckIn result;
+        lock_guard<mutex> lock(circulation_mutex);
+        uint64_t holds_before = serials.holds_placed, queued_before = serials.queue_places;
+        for (ResearchJournal* journal : issues) {
+            Serial* serial = serials.find(journal->journal_name);
+            if (bookIdTaken(journal->book_Id) || isbnTaken(journal->ISBN_no) ||
+                (serial && serial->has(journal->volume, journal->issue))) {
+                delete journal;
+                result.duplicates++;
+            } else {
+                insertBook(journal);
+                result.checked_in++;
+            }
+        }
+        result.holds_placed = serials.holds_placed - holds_before;
+        result.queue_places = serials.queue_places - queued_before;
+        console << "Checked in " << result.checked_in << " issue(s) (" << result.duplicates << " duplicates skipped); "
+                << result.holds_placed << " set aside for subscribers, " << result.queue_places << " queued" << endl;
+        return result;
+    }
+    
+    // Adds or removes a subscriber. Returns false when the member already was
+    // (or was not) subscribed. Throws for an unknown serial or member.
+    bool subscribeToSerial(const string& journal_name, const string& member_id, bool subscribe) {
+        lock_guard<mutex> lock(circulation_mutex);
+        Serial* serial = serials.find(journal_name);
+        if (!serial) {
+            throw InvalidOperationException("No serial named \"" + journal_name + "\"!");
+        }
+        if (!findMember(member_id)) {
+            throw MemberNotFoundException();
+        }
+        auto at = find(serial->subscribers.begin(), serial->subscribers.end(), member_id);
+        if (subscribe == (at != serial->subscribers.end())) {
+            return false;
+        }
+        {
+            unique_lock<shared_mutex> index_lock(serials.index_mutex);
+            if (subscribe) {
+                serial->subscribers.push_back(member_id);
+            } else {
+                serial->subscribers.erase(at);
+            }
+        }
+        logMutation(ReplicationLog::SUBSCRIBE, {journal_name, member_id, subscribe ? "1" : "0"});
+        return true;
+    }
+    
+    // Copies of up to limit of a serial's issues in volumes from..to, in
+    // order, and the serial's name as first checked in; more tells whether
+    // the range held further issues. The range is walked under the index's
+    // own lock; the circulation lock is taken only to copy what is returned.
+    // Throws for an unknown serial.
+    vector<unique_ptr<Books>> serialIssues(const string& journal_name, int from_volume, int to_volume, size_t limit,
+                                           string& name, bool& more) {
+        vector<ResearchJournal*> issues;
+        {
+            shared_lock<shared_mutex> lock(serials.index_mutex);
+            const Serial* serial = static_cast<const SerialsIndex&>(serials).find(journal_name);
+            if (!serial) {
+                throw InvalidOperationException("No serial named \"" + journal_name + "\"!");
+            }
+            name = serial->journal_name;
+            issues = serial->volumes(from_volume, to_volume, limit < SIZE_MAX ? limit + 1 : limit);
+        }
+        more = issues.size() > limit;
+        issues.resize(min(issues.size(), limit));
+        lock_guard<mutex> lock(circulation_mutex);
+        vector<unique_ptr<Books>> found;
+        for (ResearchJournal* journal : issues) {
+            found.emplace_back(journal->snapshotCopy());
+        }
+        return found;
+    }
+    
+    // Releases holds whose pickup window has passed and moves each copy on to
+    // the next member in line. Called with circulation_mutex held.
+    int expireHolds() {
+        int expired = 0;
+        hold_timers.advance(LibraryClock::today(), [&](const HoldTimer& timer) {
+            Books* book = findBook(timer.book_id);
+            if (!book) {
+                return;
+            }
+            auto hold = book->pickup_holds.find(timer.member_id);
+            if (hold == book->pickup_holds.end() || hold->second.hold_id != timer.hold_id) {
+                return;   // collected or replaced before the window closed
+            }
+            book->pickup_holds.erase(hold);
+            book->update_availability();
+            markStale(book);
+            expired++;
+            notifications.enqueue(timer.member_id, book->book_Id, "Hold on book " + to_string(book->book_Id) +
+                                  " for member " + timer.member_id + " expired on Day " + to_string(timer.expires - 1) + ".");
+            promoteReservations(book);
+        });
+        if (expired > 0) {
+            logMutation(ReplicationLog::EXPIRE_HOLDS, {});
+        }
+        return expired;
+    }
+    
+    void advanceDays(int days) {
+        lock_guard<mutex> lock(circulation_mutex);
+        LibraryClock::advance(days);
+        int expired = expireHolds();
+        compactColdHistory();
+        logMutation(ReplicationLog::ADVANCE_DAY, {to_string(days)});
+        console << "Today is Day " << LibraryClock::today() << ". " << expired << " hold(s) expired." << endl;
+    }
+    
+    // Throws if the member could not borrow another book right now.
+    void checkBorrower(const string& member_id) {
+        lock_guard<mutex> lock(circulation_mutex);
+        Member* member = findMember(member_id);
+        if (!member) {
+            throw MemberNotFoundException();
+        }
+        if ((int)member->issued_book_ids.size() >= member->getMaxBooks()) {
+            throw MaxIssueLimitException(member->getMaxBooks());
+        }
+        if (fine_ledger.isBlocked(member, LibraryClock::today())) {
+            throw PendingFineException(member->fineBalance(LibraryClock::today()));
+        }
+    }
+    
+    bool hasCopyFor(int book_id, const string& member_id) {
+        lock_guard<mutex> lock(circulation_mutex);
+        expireHolds();
+        Books* book = findBook(book_id);
+        return book && (book->freeCopies() > 0 || book->hasPickupHold(member_id));
+    }
+    
+    // Takes one copy out of this branch's stock for transfer: the copy held for
+    // the member if there is one, otherwise a free copy. Returns a one-copy
+    // record for the receiving branch, or nullptr if no copy can be spared.
+    Books* releaseCopy(int book_id, const string& member_id) {
+        lock_guard<mutex> lock(circulation_mutex);
+        expireHolds();
+        Books* book = findBook(book_id);
+        if (!book) {
+            return nullptr;
+        }
+        if (book->hasPickupHold(member_id)) {
+            book->pickup_holds.erase(member_id);
+        } else if (book->freeCopies() <= 0) {
+            return nullptr;
+        }
+        book->no_of_copies--;
+        book->update_availability();
+        markStale(book);
+        logMutation(ReplicationLog::RELEASE_COPY, {to_string(book_id), member_id});
+        return book->cloneRecord(1);
+    }
+    
+    // Adds a transferred copy to this branch's stock. With held_for set, the
+    // copy goes on a pickup hold for that member before the queue is served,
+    // so no other reserver or serial subscriber can take it first.
+    void receiveCopy(Books* incoming, const string& held_for = "") {
+        lock_guard<mutex> lock(circulation_mutex);
+        expireHolds();
+        Books* book = findBook(incoming->book_Id);
+        vector<string> fields = {to_string(incoming->book_Id), to_string(incoming->no_of_copies), held_for};
+        if (!book) {
+            book = incoming->cloneRecord(0);
+            insertBook(book, true);
+            ReplicationLog::encodeBook(book, fields);   // the replica creates the title the same way
+        }
+        logMutation(ReplicationLog::RECEIVE_COPY, fields);
+        book->no_of_copies += incoming->no_of_copies;
+        book->update_availability();
+        delete incoming;
+        if (!held_for.empty() && findMember(held_for) && !book->hasPickupHold(held_for)) {
+            placePickupHold(book, held_for);
+        }
+        markStale(book);
+        promoteReservations(book);
+    }
+    
+    // Balance due today, including fines still accruing on overdue loans.
+    int pendingFine(const string& member_id) {
+        lock_guard<mutex> lock(circulation_mutex);
+        Member* member = findMember(member_id);
+        if (!member) {
+            throw MemberNotFoundException();
+        }
+        return member->fineBalance(LibraryClock::today());
+    }
+    
+    // Pays up to amount (by default the whole balance) and returns the amount taken.
+    int payFine(const string& member_id, int amount = INT32_MAX) {
+        LIBRARY_TIME_OPERATION(OP_PAY_FINE);
+        lock_guard<mutex> lock(circulation_mutex);
+        Member* member = findMember(member_id);
+        if (!member) {
+            LIBRARY_OPERATION_FAILED();
+            throw MemberNotFoundException();
+        }
+        int paid = fine_ledger.pay(member, amount, LibraryClock::today());
+        markStale(member);
+        if (paid > 0) {
+            logMutation(ReplicationLog::PAY_FINE, {member_id, to_string(paid)});
+        }
+        return paid;
+    }
+    
+    vector<FineEntry> fineStatement(const string& member_id) {
+        lock_guard<mutex> lock(circulation_mutex);
+        if (!findMember(member_id)) {
+            throw MemberNotFoundException();
+        }
+        return fine_ledger.statement(member_id);
+    }
+    
+    void clearFine(string member_id) {
+        try {
+            vector<FineEntry> entries = fineStatement(member_id);
+            int amount = pendingFine(member_id);
+            
+            for (const auto& entry : entries) {
+                cout << "Day " << entry.day << ": ";
+                if (entry.kind == 'C') {
+                    cout << "late return charge Rs. " << entry.amount << " (Transaction " << entry.transaction_id << ")" << endl;
+                } else {
+                    cout << "payment Rs. " << entry.amount << endl;
+                }
+            }
+            
+            if (amount == 0) {
+                cout << "No fines pending for this member!" << endl;
+                return;
+            }
+            
+            cout << "Fine amount to be paid: Rs. " << amount << endl;
+            cout << "Enter amount to pay (0 to cancel): ";
+            int payment;
+            cin >> payment;
+            
+            if (payment > 0) {
+                int paid = payFine(member_id, payment);
+                int remaining = pendingFine(member_id);
+                if (remaining == 0) {
+                    cout << "Fine cleared successfully!" << endl;
+                } else {
+                    cout << "Paid Rs. " << paid << ". Remaining fine: Rs. " << remaining << endl;
+                }
+            } else {
+                cout << "Payment canceled!" << endl;
+            }
+        }
+        catch (const LibraryException& e) {
+            cout << "Exception during fine clearance process: " << e.what() << endl;
+        }
+    }
+    
+    void displayBlockedMembers() {
+        lock_guard<mutex> lock(circulation_mutex);
+        int today = LibraryClock::today();
+        vector<string> blocked = fine_ledger.blockedMembers(today);
+        cout << "Members with fines above Rs. " << fine_ledger.block_threshold << " on Day " << today << ": "
+             << blocked.size() << endl;
+        for (const auto& member_id : blocked) {
+            cout << "  " << member_id << ": Rs. " << findMember(member_id)->fineBalance(today) << endl;
+        }
+    }
+    
+    // Cross-checks the places that record the same facts: each book's issued
+    // count and availability and each member's loan list against the open
+    // transactions, the open-loan index against the transactions, and each
+    // title's reservation list against its pickup holds and the global queue.
+    // Open transactions are the truth for loans and a title's reservation list
+    // the truth for queue order; with repair, the other copies are rewritten
+    // to match. Transactions are scanned in ranges and books and members in
+    // hash shards, one per thread, each thread fixing only its own records;
+    // the shared indexes are rebuilt afterwards. Holds the circulation lock.
+    IntegrityReport checkIntegrity(int threads, bool repair) {
+        threads = max(threads, 1);
+        auto start = chrono::steady_clock::now();
+        IntegrityReport report;
+        lock_guard<mutex> lock(circulation_mutex);
+        const vector<Transaction*>& history = transactions_by_date;
+        vector<Books*> book_list(book_collection.begin(), book_collection.end());
+        vector<Member*> member_list(members.begin(), members.end());
+        unordered_map<int, vector<string>> queued;   // book -> members, in global queue order
+        for (const auto& entry : reservation_queue.order) {
+            queued[entry.second.first].push_back(entry.second.second);
+        }
+        vector<vector<IntegrityViolation>> found(threads);
+        
+        // Pass 1 also files each open loan, transaction, book and member under
+        // the shard that checks it in pass 2, so each pass 2 worker reads only
+        // its own.
+        typedef vector<vector<const Transaction*>> LoanShards;
+        vector<vector<Transaction*>> open_parts(threads);
+        vector<LoanShards> loans_by_book(threads, LoanShards(threads)), loans_by_member(threads, LoanShards(threads));
+        vector<LoanShards> history_by_book(threads, LoanShards(threads)), history_by_member(threads, LoanShards(threads));
+        vector<vector<vector<Books*>>> books_by_shard(threads, vector<vector<Books*>>(threads));
+        vector<vector<vector<Member*>>> members_by_shard(threads, vector<vector<Member*>>(threads));
+        runOnWorkers(threads, [&](int t) {
+            hash<string> member_hash;
+            for (size_t i = book_list.size() * t / threads; i < book_list.size() * (t + 1) / threads; i++) {
+                books_by_shard[t][(unsigned)book_list[i]->book_Id % threads].push_back(book_list[i]);
+            }
+            for (size_t i = member_list.size() * t / threads; i < member_list.size() * (t + 1) / threads; i++) {
+                members_by_shard[t][member_hash(member_list[i]->member_id) % threads].push_back(member_list[i]);
+            }
+            for (size_t i = history.size() * t / threads; i < history.size() * (t + 1) / threads; i++) {
+                Transaction* transaction = history[i];
+                size_t member_shard = member_hash(transaction->member_Id) % threads;
+                history_by_book[t][(unsigned)transaction->book_Id % threads].push_back(transaction);
+                history_by_member[t][member_shard].push_back(transaction);
+                if (transaction->is_returned) {
+                    continue;
+                }
+                open_parts[t].push_back(transaction);
+                loans_by_book[t][(unsigned)transaction->book_Id % threads].push_back(transaction);
+                loans_by_member[t][member_shard].push_back(transaction);
+                auto loans = open_loans.equal_range(make_pair(transaction->book_Id, transaction->member_Id));
+                bool indexed = false;
+                for (auto it = loans.first; it != loans.second && !indexed; ++it) {
+                    indexed = it->second == transaction;
+                }
+                string record = "transaction " + to_string(transaction->transaction_Id);
+                if (!indexed) {
+                    found[t].emplace_back("open-loan-index", record, "open but missing from the open-loan index", repair);
+                }
+                if (!book_index.count(transaction->book_Id)) {
+                    found[t].emplace_back("unknown-book", record, "book " + to_string(transaction->book_Id) +
+                                          " does not exist", false);
+                }
+                if (!member_index.count(transaction->member_Id)) {
+                    found[t].emplace_back("unknown-member", record, "member " + transaction->member_Id +
+                                          " does not exist", false);
+                }
+            }
+        });
+        vector<Transaction*> open;
+        for (auto& part : open_parts) {
+            open.insert(open.end(), part.begin(), part.end());
+        }
+        
+        vector<vector<Books*>> changed_books(threads), idle_books(threads);
+        vector<vector<Member*>> changed_members(threads), refined_members(threads);
+        vector<vector<pair<const string*, const vector<Transaction*>*>>> member_histories(threads);
+        vector<vector<pair<int, const vector<Transaction*>*>>> book_histories(threads);
+        {
+            hash<string> member_hash;
+            for (const auto& entry : transactions_by_member) {
+                member_histories[member_hash(entry.first) % threads].emplace_back(&entry.first, &entry.second);
+            }
+            for (const auto& entry : transactions_by_book) {
+                book_histories[(unsigned)entry.first % threads].emplace_back(entry.first, &entry.second);
+            }
+        }
+        runOnWorkers(threads, [&](int t) {
+            unordered_map<int, int> loans_of_book;
+            unordered_map<string, vector<const Transaction*>> loans_of_member;   // in issue order: ranges are taken in order
+            vector<Books*> books;
+            vector<Member*> shard_members;
+            for (int from = 0; from < threads; from++) {
+                for (const Transaction* transaction : loans_by_book[from][t]) {
+                    loans_of_book[transaction->book_Id]++;
+                }
+                for (const Transaction* transaction : loans_by_member[from][t]) {
+                    loans_of_member[transaction->member_Id].push_back(transaction);
+                }
+                books.insert(books.end(), books_by_shard[from][t].begin(), books_by_shard[from][t].end());
+                shard_members.insert(shard_members.end(), members_by_shard[from][t].begin(), members_by_shard[from][t].end());
+            }
+            for (Books* book : books) {
+                auto in_queue = queued.find(book->book_Id);
+                auto loans = loans_of_book.find(book->book_Id);
+                if (checkBookIntegrity(book, loans == loans_of_book.end() ? 0 : loans->second,
+                                       in_queue == queued.end() ? nullptr : &in_queue->second, repair, found[t])) {
+                    changed_books[t].push_back(book);
+                }
+                if (book->freeCopies() > 0 && !book->reserved_by.empty()) {
+                    found[t].emplace_back("idle-reservation", "book " + to_string(book->book_Id),
+                                          to_string(book->freeCopies()) + " free copies while " +
+                                          to_string(book->reserved_by.size()) + " member(s) wait", repair);
+                    idle_books[t].push_back(book);
+                }
+            }
+            static const vector<const Transaction*> no_loans;
+            for (Member* member : shard_members) {
+                auto loans = loans_of_member.find(member->member_id);
+                bool fines_changed = false;
+                if (checkMemberIntegrity(member, loans == loans_of_member.end() ? no_loans : loans->second, repair,
+                                         found[t], fines_changed)) {
+                    changed_members[t].push_back(member);
+                }
+                if (fines_changed) {
+                    refined_members[t].push_back(member);
+                }
+            }
+            
+            // Both history indexes are kept in issue-date order, ties in
+            // insertion order, like the date index, so each list must equal
+            // the date index filtered to its key. Only pointers are compared;
+            // an entry that is not in the history is never read.
+            unordered_map<string, vector<const Transaction*>> history_of_member;
+            unordered_map<int, vector<const Transaction*>> history_of_book;
+            for (int from = 0; from < threads; from++) {
+                for (const Transaction* transaction : history_by_member[from][t]) {
+                    history_of_member[transaction->member_Id].push_back(transaction);
+                }
+                for (const Transaction* transaction : history_by_book[from][t]) {
+                    history_of_book[transaction->book_Id].push_back(transaction);
+                }
+            }
+            for (const auto& entry : member_histories[t]) {
+                auto expected = history_of_member.find(*entry.first);
+                if (!sameHistory(*entry.second, expected == history_of_member.end() ? nullptr : &expected->second)) {
+                    found[t].emplace_back("history-index", "member " + *entry.first,
+                                          "history list does not match the member's transactions", repair);
+                }
+            }
+            for (const auto& entry : history_of_member) {
+                if (!transactions_by_member.count(entry.first)) {
+                    found[t].emplace_back("history-index", "member " + entry.first, "transactions missing from the history index",
+                                          repair);
+                }
+            }
+            for (const auto& entry : book_histories[t]) {
+                auto expected = history_of_book.find(entry.first);
+                if (!sameHistory(*entry.second, expected == history_of_book.end() ? nullptr : &expected->second)) {
+                    found[t].emplace_back("history-index", "book " + to_string(entry.first),
+                                          "history list does not match the book's transactions", repair);
+                }
+            }
+            for (const auto& entry : history_of_book) {
+                if (!transactions_by_book.count(entry.first)) {
+                    found[t].emplace_back("history-index", "book " + to_string(entry.first),
+                                          "transactions missing from the history index", repair);
+                }
+            }
+        });
+        
+        vector<IntegrityViolation> shared_found;
+        bool rebuild_open_loans = false, rebuild_queue = false, rebuild_history = false;
+        unordered_set<Transaction*> open_set(open.begin(), open.end());
+        unordered_set<Transaction*> indexed;
+        for (const auto& entry : open_loans) {
+            Transaction* transaction = entry.second;
+            if (!open_set.count(transaction) || !indexed.insert(transaction).second ||
+                transaction->book_Id != entry.first.first || transaction->member_Id != entry.first.second) {
+                shared_found.emplace_back("open-loan-index", "loan of book " + to_string(entry.first.first) + " to " +
+                                          entry.first.second, "index entry does not match an open transaction", repair);
+            }
+        }
+        for (const auto& entry : queued) {
+            if (!book_index.count(entry.first)) {
+                shared_found.emplace_back("queue-mismatch", "book " + to_string(entry.first),
+                                          to_string(entry.second.size()) + " queued reservation(s) for a book that does not exist",
+                                          repair);
+            }
+        }
+        for (int t = 0; t < threads; t++) {
+            report.violations.insert(report.violations.end(), found[t].begin(), found[t].end());
+        }
+        report.violations.insert(report.violations.end(), shared_found.begin(), shared_found.end());
+        for (const auto& violation : report.violations) {
+            rebuild_open_loans |= strcmp(violation.check, "open-loan-index") == 0;
+            rebuild_queue |= strcmp(violation.check, "queue-mismatch") == 0;
+            rebuild_history |= strcmp(violation.check, "history-index") == 0;
+        }
+        
+        // Not logged: a replica's records come from replaying the same calls,
+        // so it never shares the primary's drift and can run its own check.
+        if (repair && !report.violations.empty()) {
+            if (rebuild_open_loans) {
+                open_loans.clear();
+                for (Transaction* transaction : open) {
+                    open_loans.emplace(make_pair(transaction->book_Id, transaction->member_Id), transaction);
+                }
+            }
+            if (rebuild_queue) {
+                rebuildReservationQueue();
+            }
+            if (rebuild_history) {
+                // The date index is sorted, so appending keeps each list in date order.
+                transactions_by_member.clear();
+                transactions_by_book.clear();
+                for (Transaction* transaction : history) {
+                    transactions_by_member[transaction->member_Id].push_back(transaction);
+                    transactions_by_book[transaction->book_Id].push_back(transaction);
+                }
+            }
+            for (int t = 0; t < threads; t++) {
+                for (Member* member : refined_members[t]) {
+                    fine_ledger.reindex(member);
+                }
+                for (Books* book : changed_books[t]) {
+                    markStale(book);
+                }
+                for (Member* member : changed_members[t]) {
+                    markStale(member);
+                }
+                for (Books* book : idle_books[t]) {
+                    promoteReservations(book);
+                }
+            }
+        }
+        report.books_checked = book_list.size();
+        report.members_checked = member_list.size();
+        report.transactions_checked = history.size();
+        report.open_loans = open.size();
+        report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return report;
+    }
+    
+    static bool sameHistory(const vector<Transaction*>& filed, const vector<const Transaction*>* expected) {
+        if (!expected) {
+            return filed.empty();
+        }
+        return filed.size() == expected->size() && equal(filed.begin(), filed.end(), expected->begin());
+    }
+    
+    static string joinIds(vector<int> ids) {
+        sort(ids.begin(), ids.end());
+        string text = "[";
+        for (size_t i = 0; i < ids.size(); i++) {
+            text += (i ? "," : "") + to_string(ids[i]);
+        }
+        return text + "]";
+    }
+    
+    // Book part of checkIntegrity(); returns whether the record was changed.
+    bool checkBookIntegrity(Books* book, int open_count, const vector<string>* queued, bool repair,
+                            vector<IntegrityViolation>& found) {
+        string record = "book " + to_string(book->book_Id);
+        bool changed = false;
+        if (book->availability != (book->freeCopies() > 0)) {
+            found.emplace_back("availability", record, string("marked ") + (book->availability ? "available" : "unavailable") +
+                               " with " + to_string(book->freeCopies()) + " free cop" + (book->freeCopies() == 1 ? "y" : "ies"), repair);
+            changed = true;
+        }
+        if (book->no_of_copies_issued != open_count) {
+            found.emplace_back("loan-count", record, "issued count " + to_string(book->no_of_copies_issued) +
+                               ", open transactions " + to_string(open_count), repair);
+            if (repair) {
+                book->no_of_copies_issued = open_count;
+                changed = true;
+            }
+        }
+        if (open_count + (int)book->pickup_holds.size() > book->no_of_copies) {
+            found.emplace_back("over-issued", record, to_string(open_count) + " on loan and " +
+                               to_string(book->pickup_holds.size()) + " on hold of " + to_string(book->no_of_copies) +
+                               " copies", false);
+        }
+        
+        vector<string> waiting;
+        unordered_set<string> seen;
+        for (const auto& member_id : book->reserved_by) {
+            if (!seen.insert(member_id).second) {
+                found.emplace_back("duplicate-reservation", record, "member " + member_id + " is queued twice", repair);
+            } else if (book->hasPickupHold(member_id)) {
+                found.emplace_back("reserved-and-held", record, "member " + member_id +
+                                   " is queued and already has a copy on hold", repair);
+            } else {
+                waiting.push_back(member_id);
+            }
+        }
+        if (repair && waiting.size() != book->reserved_by.size()) {
+            book->reserved_by = waiting;
+            changed = true;
+        }
+        // Compared after dropping the entries reported above, so each fault is reported once.
+        size_t queued_count = queued ? queued->size() : 0;
+        if (queued_count != waiting.size() || (queued && *queued != waiting)) {
+            found.emplace_back("queue-mismatch", record, to_string(waiting.size()) +
+                               " reservation(s) on the title, " + to_string(queued_count) + " in the global queue",
+                               repair);
+        }
+        if (repair && changed) {
+            book->update_availability();
+        }
+        return repair && changed;
+    }
+    
+    // Member part of checkIntegrity(); open holds the member's open
+    // transactions in issue order. Returns whether the record was changed and
+    // sets fines_changed when the fine account's loans were rewritten, which
+    // the caller must reindex under the ledger.
+    bool checkMemberIntegrity(Member* member, const vector<const Transaction*>& open, bool repair,
+                              vector<IntegrityViolation>& found, bool& fines_changed) {
+        string record = "member " + member->member_id;
+        bool changed = false;
+        vector<int> open_books;
+        vector<pair<int, int>> open_fines;   // as FineAccount::open_loans, in issue order
+        for (const Transaction* transaction : open) {
+            open_books.push_back(transaction->book_Id);
+            open_fines.push_back(make_pair(transaction->transaction_Id, transaction->due_date));
+        }
+        vector<pair<int, int>> accrued = member->fines.open_loans, expected_fines = open_fines;
+        sort(accrued.begin(), accrued.end());
+        sort(expected_fines.begin(), expected_fines.end());
+        if (accrued != expected_fines) {
+            found.emplace_back("fine-loans", record, "fine account accrues on " + to_string(accrued.size()) +
+                               " loan(s), " + to_string(expected_fines.size()) + " open", repair);
+            if (repair) {
+                member->fines.open_loans = open_fines;
+                fines_changed = true;
+                changed = true;
+            }
+        }
+        vector<int> listed = member->issued_book_ids, expected = open_books;
+        sort(listed.begin(), listed.end());
+        sort(expected.begin(), expected.end());
+        if (listed != expected) {
+            found.emplace_back("member-loans", record, "lists " + joinIds(listed) + ", open transactions " +
+                               joinIds(expected), repair);
+            if (repair) {
+                member->issued_book_ids = open_books;
+                changed = true;
+            }
+        }
+        if ((int)open_books.size() > member->getMaxBooks()) {
+            found.emplace_back("over-limit", record, to_string(open_books.size()) + " open loans, limit " +
+                               to_string(member->getMaxBooks()), false);
+        }
+        return changed;
+    }
+    
+    // Rewrites the global queue from the titles' reservation lists. Each
+    // title keeps its queue slots, refilled in reservation-list order, so the
+    // interleaving between titles survives; extra reservations go at the end.
+    void rebuildReservationQueue() {
+        unordered_map<int, size_t> placed;
+        ReservationQueue rebuilt;
+        for (const auto& entry : reservation_queue.order) {
+            Books* book = findBook(entry.second.first);
+            size_t& next = placed[entry.second.first];
+            if (book && next < book->reserved_by.size()) {
+                rebuilt.push(make_pair(book->book_Id, book->reserved_by[next++]));
+            }
+        }
+        for (Books* book : book_collection) {
+            for (size_t next = placed[book->book_Id]; next < book->reserved_by.size(); next++) {
+                rebuilt.push(make_pair(book->book_Id, book->reserved_by[next]));
+            }
+        }
+        reservation_queue = move(rebuilt);
+    }
+    
+    void checkDataIntegrity() {
+        int threads;
+        char repair;
+        cout << "Worker threads: ";
+        cin >> threads;
+        cout << "Repair violations (y/n): ";
+        cin >> repair;
+        IntegrityReport report = checkIntegrity(threads, repair == 'y' || repair == 'Y');
+        report.display(20);
+    }
+    
+    // Recomputes the co-borrowing model from the whole transaction history,
+    // archived segments included, on threads workers. Issues made while it
+    // runs are replayed into the new model. Returns the number of title pairs.
+    size_t rebuildRecommendations(int threads) {
+        threads = max(threads, 1);
+        unordered_map<string, vector<pair<pair<int, int>, int>>> borrowed;   // member -> ((day, transaction), book)
+        vector<SegmentInfo> segments;
+        // Pinned like a cursor, so no merge deletes the segments decoded below.
+        TransactionCursor pin(&circulation_mutex, nullptr, 0, 0, &open_cursors);
+        // Issues between here and the copy below are both copied and kept for
+        // replay; replaying a title a member already has adds nothing.
+        CoBorrowModel::RebuildGuard rebuilding(recommendations);
+        {
+            lock_guard<mutex> lock(circulation_mutex);
+            for (const auto& entry : transactions_by_member) {
+                auto& rows = borrowed[entry.first];
+                for (const Transaction* transaction : entry.second) {
+                    rows.push_back(make_pair(make_pair(transaction->issue_date, transaction->transaction_Id), transaction->book_Id));
+                }
+            }
+            if (archive) {
+                segments = archive->segments;
+            }
+        }
+        
+        vector<vector<Transaction>> archived(segments.size());
+        atomic<size_t> next_segment(0);
+        runOnWorkers(threads, [&](int) {
+            for (size_t i = next_segment++; i < segments.size(); i = next_segment++) {
+                TransactionArchive::decode(segments[i], ArchiveFilter(), archived[i]);
+            }
+        });
+        for (auto& rows : archived) {
+            for (const auto& row : rows) {
+                borrowed[row.member_Id].push_back(make_pair(make_pair(row.issue_date, row.transaction_Id), row.book_Id));
+            }
+            vector<Transaction>().swap(rows);
+        }
+        
+        vector<string> member_ids;
+        vector<vector<pair<pair<int, int>, int>>*> rows_of;
+        for (auto& entry : borrowed) {
+            member_ids.push_back(entry.first);
+            rows_of.push_back(&entry.second);
+        }
+        vector<vector<int>> histories(member_ids.size());
+        runOnWorkers(threads, [&](int t) {
+            for (size_t m = member_ids.size() * t / threads; m < member_ids.size() * (t + 1) / threads; m++) {
+                vector<pair<pair<int, int>, int>>& rows = *rows_of[m];
+                sort(rows.begin(), rows.end());
+                unordered_set<int> seen;
+                for (const auto& row : rows) {
+                    if (seen.insert(row.second).second) {
+                        histories[m].push_back(row.second);
+                    }
+                }
+            }
+        });
+        return recommendations.rebuild(member_ids, histories, threads);
+    }
+    
+    static unordered_map<int, string> titlesById(const CatalogSnapshot& view) {
+        unordered_map<int, string> titles;
+        for (size_t i = 0; i < view.books.size(); i++) {
+            titles[view.books[i]->book_Id] = view.books[i]->book_name;
+        }
+        return titles;
+    }
+    
+    // Suggestions after a checkout: only the neighbours' titles are looked
+    // up, under the lock, rather than mapping the whole catalog.
+    void showRecommendations(int book_id) {
+        unordered_map<int, string> titles;
+        {
+            lock_guard<mutex> lock(circulation_mutex);
+            for (const Neighbor& neighbor : recommendations.lookup(book_id, 5)) {
+                if (Books* book = findBook(neighbor.book_id)) {
+                    titles[neighbor.book_id] = book->book_name;
+                }
+            }
+        }
+        showRecommendations(book_id, titles);
+    }
+    
+    // Prints the "also borrowed" suggestions for a title, if there are any.
+    void showRecommendations(int book_id, const unordered_map<int, string>& titles) {
+        vector<Neighbor> neighbors = recommendations.lookup(book_id, 5);
+        if (neighbors.empty()) {
+            return;
+        }
+        cout << "Members who borrowed this also borrowed: ";
+        for (size_t i = 0; i < neighbors.size(); i++) {
+            auto title = titles.find(neighbors[i].book_id);
+            cout << (i ? "; " : "") << (title != titles.end() ? title->second : "Book") << " (" << neighbors[i].book_id << ")";
+        }
+        cout << endl;
+    }
+    
+    // Ranks titles by the copies their demand over the last window_days
+    // calls for. By Little's law a title needs about (issues + refused issues
+    // per day) x (mean loan length) copies. Loan history is aggregated on
+    // threads workers without the lock: the in-memory rows of the window are
+    // pinned and their pointers copied, archived segments are decoded from
+    // disk. Refused issues and queue lengths come from the streaming
+    // counters, which keep the last 13 weeks.
+    vector<TitleForecast> forecastCopiesNeeded(int window_days, int threads, long long* rows_scanned = nullptr) {
+        window_days = max(window_days, 1);
+        threads = max(threads, 1);
+        int today = LibraryClock::today();
+        ArchiveFilter filter;
+        filter.from_day = today - window_days + 1;
+        filter.to_day = today;
+        
+        vector<unordered_map<int, LoanTotals>> partial(threads);
+        auto addLoan = [&](unordered_map<int, LoanTotals>& totals, const Transaction& transaction) {
+            LoanTotals& loans = totals[transaction.book_Id];
+            loans.issues++;
+            if (transaction.is_returned) {
+                loans.returned++;
+                loans.loan_days += max(transaction.return_date - transaction.issue_date, 1);
+            }
+        };
+        
+        // The window's rows are pinned like a cursor's, so the archiver
+        // leaves them alone, and only their pointers are copied under the lock.
+        TransactionCursor pin(&circulation_mutex, nullptr, 0, 0, &open_cursors);
+        vector<const Transaction*> recent;
+        vector<SegmentInfo> segments;
+        {
+            lock_guard<mutex> lock(circulation_mutex);
+            size_t from = lower_bound(transactions_by_date.begin(), transactions_by_date.end(), filter.from_day,
+                                      issuedBefore) - transactions_by_date.begin();
+            recent.assign(transactions_by_date.begin() + from, transactions_by_date.end());
+            if (archive) {
+                for (const auto& segment : archive->segments) {
+                    if (filter.mayMatch(segment)) {
+                        segments.push_back(segment);
+                    }
+                }
+            }
+        }
+        runOnWorkers(threads, [&](int t) {
+            size_t begin = recent.size() * t / threads;
+            size_t end = recent.size() * (t + 1) / threads;
+            for (size_t i = begin; i < end; i++) {
+                addLoan(partial[t], *recent[i]);
+            }
+        });
+        long long scanned = recent.size();
+        
+        atomic<size_t> next_segment(0);
+        atomic<long long> archived_rows(0);
+        runOnWorkers(threads, [&](int t) {
+            vector<Transaction> rows;
+            for (size_t i = next_segment++; i < segments.size(); i = next_segment++) {
+                rows.clear();
+                TransactionArchive::decode(segments[i], filter, rows);
+                for (const auto& row : rows) {
+                    addLoan(partial[t], row);
+                }
+                archived_rows += rows.size();
+            }
+        });
+        scanned += archived_rows.load();
+        if (rows_scanned) {
+            *rows_scanned = scanned;
+        }
+        
+        unordered_map<int, LoanTotals>& totals = partial[0];
+        for (int t = 1; t < threads; t++) {
+            for (const auto& entry : partial[t]) {
+                LoanTotals& merged = totals[entry.first];
+                merged.issues += entry.second.issues;
+                merged.returned += entry.second.returned;
+                merged.loan_days += entry.second.loan_days;
+            }
+        }
+        
+        lock_guard<mutex> lock(circulation_mutex);
+        for (auto& entry : demand.titles) {
+            entry.second.settleQueue(today);
+            DemandWindow window = entry.second.totals(filter.from_day, today);
+            if (window.unmet > 0 || window.queue_days > 0) {
+                totals[entry.first];
+            }
+        }
+        vector<TitleForecast> forecasts;
+        for (const auto& entry : totals) {
+            Books* book = findBook(entry.first);
+            if (!book) {
+                continue;
+            }
+            auto tracked = demand.titles.find(entry.first);
+            DemandWindow window = tracked == demand.titles.end() ? DemandWindow() : tracked->second.totals(filter.from_day, today);
+            TitleForecast forecast;
+            forecast.book_id = book->book_Id;
+            forecast.title = book->book_name;
+            forecast.copies = book->no_of_copies;
+            forecast.issues = entry.second.issues;
+            forecast.unmet = window.unmet;
+            forecast.mean_loan_days = entry.second.returned ? (double)entry.second.loan_days / entry.second.returned : 14;
+            forecast.mean_queue = (double)window.queue_days / window_days;
+            forecast.peak_queue = window.peak_queue;
+            double daily_demand = (double)(forecast.issues + forecast.unmet) / window_days;
+            forecast.copies_needed = max(1, (int)ceil(daily_demand * forecast.mean_loan_days));
+            forecast.shortfall = forecast.copies_needed - forecast.copies;
+            forecasts.push_back(forecast);
+        }
+        sort(forecasts.begin(), forecasts.end(), [](const TitleForecast& a, const TitleForecast& b) {
+            if (a.shortfall != b.shortfall) {
+                return a.shortfall > b.shortfall;
+            }
+            if (a.unmet != b.unmet) {
+                return a.unmet > b.unmet;
+            }
+            return a.book_id < b.book_id;
+        });
+        return forecasts;
+    }
+    
+    void displayDemandForecast() {
+        int window_days, threads, limit;
+        cout << "History window (days): ";
+        cin >> window_days;
+        cout << "Worker threads: ";
+        cin >> threads;
+        cout << "Titles to list: ";
+        cin >> limit;
+        
+        long long rows = 0;
+        auto start = chrono::steady_clock::now();
+        vector<TitleForecast> forecasts = forecastCopiesNeeded(window_days, threads, &rows);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        cout << fixed << setprecision(1);
+        cout << left << setw(8) << "Book" << setw(28) << "Title" << right << setw(8) << "Copies" << setw(8) << "Issues"
+             << setw(8) << "Unmet" << setw(10) << "Loan d" << setw(10) << "Avg queue" << setw(8) << "Needed"
+             << setw(8) << "Buy" << endl;
+        for (int i = 0; i < (int)forecasts.size() && i < limit; i++) {
+            const TitleForecast& f = forecasts[i];
+            cout << left << setw(8) << f.book_id << setw(28) << f.title.substr(0, 27) << right << setw(8) << f.copies
+                 << setw(8) << f.issues << setw(8) << f.unmet << setw(10) << f.mean_loan_days << setw(10) << f.mean_queue
+                 << setw(8) << f.copies_needed << setw(8) << max(f.shortfall, 0) << endl;
+        }
+        cout << "Scanned " << rows << " transactions in " << setprecision(3) << seconds << " s on "
+             << max(threads, 1) << " thread(s)" << endl;
+        
+        lock_guard<mutex> lock(circulation_mutex);
+        cout << "\nMost demanded titles (issues and refused issues since start, Space-Saving estimate):" << endl;
+        int rank = 0;
+        for (const auto& counter : demand.top_demand.top()) {
+            if (++rank > limit) {
+                break;
+            }
+            cout << "  " << counter.key << ": " << counter.count;
+            if (counter.error > 0) {
+                cout << " (at most " << counter.error << " too high)";
+            }
+            cout << endl;
+        }
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+    }
+    
+    void displayTitleDemand(int book_id) {
+        lock_guard<mutex> lock(circulation_mutex);
+        auto it = demand.titles.find(book_id);
+        if (it == demand.titles.end()) {
+            cout << "No demand recorded for this book." << endl;
+            return;
+        }
+        TitleDemand& title = it->second;
+        title.settleQueue(LibraryClock::today());
+        vector<DemandWindow> windows;
+        for (const auto& slot : title.ring) {
+            if (slot.window >= 0) {
+                windows.push_back(slot);
+            }
+        }
+        sort(windows.begin(), windows.end(), [](const DemandWindow& a, const DemandWindow& b) {
+            return a.window < b.window;
+        });
+        cout << fixed << setprecision(1);
+        cout << left << setw(14) << "Days" << right << setw(8) << "Issues" << setw(8) << "Unmet" << setw(8) << "Filled"
+             << setw(12) << "Avg queue" << setw(12) << "Peak queue" << endl;
+        for (const auto& w : windows) {
+            int first = w.window * TitleDemand::WINDOW_DAYS;
+            int elapsed = max(1, min(TitleDemand::WINDOW_DAYS, LibraryClock::today() - first));
+            cout << left << setw(14) << (to_string(first) + "-" + to_string(first + TitleDemand::WINDOW_DAYS - 1)) << right
+                 << setw(8) << w.issues << setw(8) << w.unmet << setw(8) << w.holds_filled
+                 << setw(12) << (double)w.queue_days / elapsed << setw(12) << w.peak_queue << endl;
+        }
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+    }
+    
+    void generateReport() {
+        LIBRARY_TIME_OPERATION(OP_REPORT);
+        shared_ptr<const CatalogSnapshot> view = publishSnapshot();
+        int total_books = view->books.size();
+        int books_issued = 0;
+        int total_members = view->members.size();
+        int total_transactions = view->transactions;
+        int active_transactions = view->active_loans;
+        int completed_transactions = total_transactions - active_transactions;
+        int total_fines = 0;
+        int members_blocked = 0;
+        int total_reservations = view->reservations;
+        int holds_awaiting_pickup = 0;
+        
+        for (size_t i = 0; i < view->books.size(); i++) {
+            const Books* book = view->books[i];
+            books_issued += book->no_of_copies_issued;
+            holds_awaiting_pickup += book->pickup_holds.size();
+        }
+        
+        for (size_t i = 0; i < view->members.size(); i++) {
+            const Member* member = view->members[i];
+            total_fines += member->fineBalance(view->day);
+            members_blocked += member->fines.blocked_from <= view->day;
+        }
+        
+        cout << "\n======= LIBRARY SYSTEM REPORT =======" << endl;
+        cout << "As of Day " << view->day << " (snapshot version " << view->version << ")" << endl;
+        cout << "Total Books in Library: " << total_books << endl;
+        cout << "Books Currently Issued: " << books_issued << endl;
+        cout << "Total Members: " << total_members << endl;
+        cout << "Total Transactions: " << total_transactions << endl;
+        cout << "Active Issues: " << active_transactions << endl;
+        cout << "Completed Returns: " << completed_transactions << endl;
+        cout << "Total Pending Fines: Rs. " << total_fines << endl;
+        cout << "Members Blocked by Fines: " << members_blocked << endl;
+        cout << "Current Reservations: " << total_reservations << endl;
+        cout << "Holds Awaiting Pickup: " << holds_awaiting_pickup << endl;
+        cout << "=======================================\n" << endl;
+    }
+            
+    void showMetrics() {
+#if LIBRARY_METRICS
+        LibraryMetrics::instance().dump(cout);
+        ofstream prometheus("library_metrics.prom");
+        if (prometheus) {
+            LibraryMetrics::instance().writePrometheus(prometheus);
+            notifications.writePrometheus(prometheus);
+            if (log_shipper) {
+                log_shipper->writePrometheus(prometheus);
+            }
+            cout << "Metrics written to library_metrics.prom" << endl;
+        } else {
+            cout << "Could not write library_metrics.prom" << endl;
+        }
+        cout << "Instrumentation overhead: " << fixed << setprecision(2)
+             << measureMetricsOverhead() << " ns per operation" << endl;
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+#else
+        cout << "Metrics were compiled out (LIBRARY_METRICS=0)." << endl;
+#endif
+    }
+    
+    void runLoadTest();
+    void findSaturationPoint();
+    void runShardScalingBenchmark();
+    void runSnapshotExportBenchmark();
+    void runServiceLoadTest();
+    void runSessionBenchmark();
+    void runIngestBenchmark();
+    void runDemandForecastBenchmark();
+    void runRecommendationRebuild();
+    void runDispatchBenchmark();
+    void runEBookDeliveryBenchmark();
+    void runMemberSearchBenchmark();
+    void runReplicationSelfTest();
+    void runIntegrityBenchmark();
+    void runFuzzySearchBenchmark();
+    void runSerialsBenchmark();
+    int serve(uint16_t port, const sigset_t& stop_signals, const string& replica_socket = "");
+    static const int REPLICA_RESYNC = 2;
+    int serveReplica(const string& primary_socket, uint16_t port, const sigset_t& stop_signals);
+    
+    void systemTools() {
+        int sub_choice;
+        cout << "\n1. Show Performance Metrics" << endl;
+        cout << "2. Run Load Test" << endl;
+        cout << "3. Find Saturation Point" << endl;
+        cout << "4. Notification Dispatch Status" << endl;
+        cout << "5. Advance Day" << endl;
+        cout << "6. Branch Sharding Scalability Benchmark" << endl;
+        cout << "7. Archive Cold History" << endl;
+        cout << "8. Export Catalog (CSV)" << endl;
+        cout << "9. Snapshot Export Benchmark" << endl;
+        cout << "10. Network Service Load Test" << endl;
+        cout << "11. Session Validation Benchmark" << endl;
+        cout << "12. Bulk Ingest Benchmark" << endl;
+        cout << "13. Members Blocked by Fines" << endl;
+        cout << "14. Title Demand History" << endl;
+        cout << "15. Rank Titles by Copies Needed" << endl;
+        cout << "16. Demand Forecast Benchmark" << endl;
+        cout << "17. Rebuild Recommendations" << endl;
+        cout << "18. Dispatch Benchmark" << endl;
+        cout << "19. Import E-Book Content" << endl;
+        cout << "20. E-Book Delivery Benchmark" << endl;
+        cout << "21. Find Member by Name, Email or Phone" << endl;
+        cout << "22. Member Search Benchmark" << endl;
+        cout << "23. Read Replica Status" << endl;
+        cout << "24. Replication Self-Test" << endl;
+        cout << "25. Check Data Integrity" << endl;
+        cout << "26. Integrity Check Benchmark" << endl;
+        cout << "27. Find Book Despite Typos" << endl;
+        cout << "28. Fuzzy Search Benchmark" << endl;
+        cout << "29. Serials" << endl;
+        cout << "30. Serials Benchmark" << endl;
+        cout << "Enter choice: ";
+        cin >> sub_choice;
+        
+        switch (sub_choice) {
+            case 1:
+                showMetrics();
+                break;
+            case 2:
+                runLoadTest();
+                break;
+            case 3:
+                findSaturationPoint();
+                break;
+            case 4:
+                notifications.displayStats();
+                break;
+            case 5: {
+                int days;
+                cout << "Days to advance: ";
+                cin >> days;
+                if (days > 0) {
+                    advanceDays(days);
+                } else {
+                    cout << "Invalid number of days!" << endl;
+                }
+                break;
+            }
+            case 6:
+                runShardScalingBenchmark();
+                break;
+            case 7:
+                archiveColdHistory();
+                break;
+            case 8:
+                exportCatalogToFile();
+                break;
+            case 9:
+                runSnapshotExportBenchmark();
+                break;
+            case 10:
+                runServiceLoadTest();
+                break;
+            case 11:
+                runSessionBenchmark();
+                break;
+            case 12:
+                runIngestBenchmark();
+                break;
+            case 13:
+                displayBlockedMembers();
+                break;
+            case 14: {
+                int book_id;
+                cout << "Enter Book ID: ";
+                cin >> book_id;
+                displayTitleDemand(book_id);
+                break;
+            }
+            case 15:
+                displayDemandForecast();
+                break;
+            case 16:
+                runDemandForecastBenchmark();
+                break;
+            case 17:
+                runRecommendationRebuild();
+                break;
+            case 18:
+                runDispatchBenchmark();
+                break;
+            case 19:
+                importEBookContent();
+                break;
+            case 20:
+                runEBookDeliveryBenchmark();
+                break;
+            case 21:
+                findMemberByPrefix();
+                break;
+            case 22:
+                runMemberSearchBenchmark();
+                break;
+            case 23:
+                displayReplicationStatus();
+                break;
+            case 24:
+                runReplicationSelfTest();
+                break;
+            case 25:
+                checkDataIntegrity();
+                break;
+            case 26:
+                runIntegrityBenchmark();
+                break;
+            case 27:
+                findBookFuzzy();
+                break;
+            case 28:
+                runFuzzySearchBenchmark();
+                break;
+            case 29:
+                serialsDesk();
+                break;
+            case 30:
+                runSerialsBenchmark();
+                break;
+            default:
+                cout << "Invalid choice!" << endl;
+        }
+    }
+            
+    void addSampleData() {
+        Books* book1 = new Books();
+        book1->book_name = "Introduction to C++";
+        book1->book_Id = 101;
+        book1->author_name = "Bjarne Stroustrup";
+        book1->publisher = "Addison-Wesley";
+        book1->ISBN_no = 1234567890;
+        book1->no_of_copies = 5;
+        book1->no_of_copies_issued = 0;
+        book1->availability = true;
+        addBook(book1);
+        
+        Books* book2 = new Books();
+        book2->book_name = "Data Structures and Algorithms";
+        book2->book_Id = 102;
         book2->author_name = "Thomas Cormen";
         book2->publisher = "MIT Press";
         book2->ISBN_no = 2345678901;
@@ -936,239 +7479,4003 @@ public:
         book2->availability = true;
         addBook(book2);
         
-        EBook* ebook1 = new EBook();
-        ebook1->book_name = "Python for Data Science";
-        ebook1->book_Id = 103;
-        ebook1->author_name = "Jake VanderPlas";
-        ebook1->publisher = "O'Reilly";
-        ebook1->ISBN_no = 3456789012;
-        ebook1->no_of_copies = 10;
-        ebook1->no_of_copies_issued = 0;
-        ebook1->availability = true;
-        ebook1->format = "PDF";
-        ebook1->download_link = "library.com/ebooks/python_ds.pdf";
-        addBook(ebook1);
+        EBook* ebook1 = new EBook();
+        ebook1->book_name = "Python for Data Science";
+        ebook1->book_Id = 103;
+        ebook1->author_name = "Jake VanderPlas";
+        ebook1->publisher = "O'Reilly";
+        ebook1->ISBN_no = 3456789012;
+        ebook1->no_of_copies = 10;
+        ebook1->no_of_copies_issued = 0;
+        ebook1->availability = true;
+        ebook1->format = "PDF";
+        ebook1->download_link = "library.com/ebooks/python_ds.pdf";
+        addBook(ebook1);
+        
+        ResearchJournal* journal1 = new ResearchJournal();
+        journal1->book_name = "Journal of Computer Science";
+        journal1->book_Id = 104;
+        journal1->author_name = "Various";
+        journal1->publisher = "IEEE";
+        journal1->ISBN_no = 1067890123;
+        journal1->no_of_copies = 2;
+        journal1->no_of_copies_issued = 0;
+        journal1->availability = true;
+        journal1->journal_name = "IEEE Transactions on Software Engineering";
+        journal1->volume = 45;
+        journal1->issue = 3;
+        addBook(journal1);
+        
+        Student* student1 = new Student();
+        student1->name = "Prabuddha Saxena";
+        student1->member_id = "S001";
+        student1->contact = "9479979748";
+        student1->email = "jprabuddha02.04@gmail.com";
+        student1->address = "123 Student Ave";
+        student1->department = "Computer Science";
+        student1->year = "1st";
+        addMember(student1);
+        
+        Faculty* faculty1 = new Faculty();
+        faculty1->name = "Dr. Sarah Johnson";
+        faculty1->member_id = "F001";
+        faculty1->contact = "8765432109";
+        faculty1->email = "sarah@example.com";
+        faculty1->address = "456 Faculty Blvd";
+        faculty1->department = "Computer Science";
+        faculty1->designation = "Professor";
+        addMember(faculty1);
+        
+        Librarian* librarian1 = new Librarian();
+        librarian1->name = "Mark Wilson";
+        librarian1->staff_id = 3001;
+        librarian1->email = "mark@library.com";
+        librarian1->setPassword("library123");
+        addLibrarian(librarian1);
+    }
+    
+    void run() {
+        int choice = 0;
+        
+        enableArchive("library_archive", 90);
+        addSampleData();
+        
+        while (true) {
+            if (!checkLibrarianAccess()) {
+                cout << "\n===== LIBRARY MANAGEMENT SYSTEM LOGIN =====" << endl;
+                cout << "1. Login as Librarian" << endl;
+                cout << "2. Exit" << endl;
+                cout << "Enter your choice: ";
+                cin >> choice;
+                
+                switch (choice) {
+                    case 1:
+                        if (librarianLogin()) {
+                            break;
+                        } else {
+                            continue;
+                        }
+                    case 2:
+                        cout << "Thank you for using Library Management System!" << endl;
+                        return;
+                    default:
+                        cout << "Invalid choice! Please try again." << endl;
+                        continue;
+                }
+            }
+            
+            cout << "\n===== SMART LIBRARY MANAGEMENT SYSTEM =====" << endl;
+            cout << "1. Display Books" << endl;
+            cout << "2. Display Members" << endl;
+            cout << "3. Issue Book" << endl;
+            cout << "4. Return Book" << endl;
+            cout << "5. Reserve Book" << endl;
+            cout << "6. Clear Fine" << endl;
+            cout << "7. Transaction History" << endl;
+            cout << "8. Generate Report" << endl;
+            cout << "9. Add New Book/Member" << endl;
+            cout << "10. System Tools" << endl;
+            cout << "11. Logout" << endl;
+            cout << "12. Exit" << endl;
+            cout << "Enter your choice: ";
+            cin >> choice;
+            
+            switch (choice) {
+                case 1:
+                    displayBooks();
+                    break;
+                case 2:
+                    displayMembers();
+                    break;
+                case 3: {
+                    int book_id;
+                    string member_id;
+                    cout << "Enter Book ID: ";
+                    cin >> book_id;
+                    cout << "Enter Member ID: ";
+                    cin >> member_id;
+                    try {
+                        issueBook(book_id, member_id);
+                        showRecommendations(book_id);
+                    } catch (const LibraryException& e) {
+                        cout << "Error: " << e.what() << endl;
+                    }
+                    break;
+                }
+                case 4: {
+                    int book_id;
+                    string member_id;
+                    cout << "Enter Book ID: ";
+                    cin >> book_id;
+                    cout << "Enter Member ID: ";
+                    cin >> member_id;
+                    try {
+                        returnBook(book_id, member_id);
+                    } catch (const LibraryException& e) {
+                        cout << "Error: " << e.what() << endl;
+                    }
+                    break;
+                }
+                case 5: {
+                    int book_id;
+                    cout << "Enter Book ID to reserve: ";
+                    cin >> book_id;
+                    reserveBook(book_id);
+                    break;
+                }
+                case 6: {
+                    string member_id;
+                    cout << "Enter Member ID: ";
+                    cin >> member_id;
+                    clearFine(member_id);
+                    break;
+                }
+                case 7:
+                    transactionHistory();
+                    break;
+                case 8:
+                    generateReport();
+                    break;
+                case 9: {
+                    int sub_choice;
+                    cout << "\n1. Add Book" << endl;
+                    cout << "2. Add E-Book" << endl;
+                    cout << "3. Add Research Journal" << endl;
+                    cout << "4. Add Student" << endl;
+                    cout << "5. Add Faculty" << endl;
+                    cout << "Enter choice: ";
+                    cin >> sub_choice;
+                    
+                    switch (sub_choice) {
+                        case 1: {
+                            Books* new_book = new Books();
+                            new_book->add_book();
+                            try {
+                                addBook(new_book);
+                            } catch (const LibraryException& e) {
+                                cout << "Error: " << e.what() << endl;
+                                delete new_book;
+                            }
+                            break;
+                        }
+                        case 2: {
+                            EBook* new_ebook = new EBook();
+                            new_ebook->addEBook();
+                            try {
+                                addBook(new_ebook);
+                            } catch (const LibraryException& e) {
+                                cout << "Error: " << e.what() << endl;
+                                delete new_ebook;
+                            }
+                            break;
+                        }
+                        case 3: {
+                            ResearchJournal* new_journal = new ResearchJournal();
+                            new_journal->addJournal();
+                            try {
+                                addBook(new_journal);
+                            } catch (const LibraryException& e) {
+                                cout << "Error: " << e.what() << endl;
+                                delete new_journal;
+                            }
+                            break;
+                        }
+                        case 4: {
+                            Student* new_student = new Student();
+                            new_student->inputDetails();
+                            try {
+                                addMember(new_student);
+                            } catch (const LibraryException& e) {
+                                cout << "Error: " << e.what() << endl;
+                                delete new_student;
+                            }
+                            break;
+                        }
+                        case 5: {
+                            Faculty* new_faculty = new Faculty();
+                            new_faculty->inputDetails();
+                            try {
+                                addMember(new_faculty);
+                            } catch (const LibraryException& e) {
+                                cout << "Error: " << e.what() << endl;
+                                delete new_faculty;
+                            }
+                            break;
+                        }
+                        default:
+                            cout << "Invalid choice!" << endl;
+                    }
+                    break;
+                }
+                case 10:
+                    systemTools();
+                    break;
+                case 11:
+                    librarianLogout();
+                    break;
+                case 12:
+                    cout << "Thank you for using Smart Library Management System!" << endl;
+                    return;
+                default:
+                    cout << "Invalid choice! Please try again." << endl;
+            }
+        }
+    }
+};
+
+// Follows a primary's LogShipper and replays its events into a local
+// LibrarySystem, which then serves reads only. Reconnects after a drop and
+// resumes from the last applied sequence if the primary still has the same
+// log. A restarted primary has a new one; the applier then stops and sets
+// resync_needed, and the replica is rebuilt from an empty library.
+class ReplicaApplier {
+public:
+    static const uint64_t ACK_EVERY = 1024;   // events, or ACK_INTERVAL, whichever comes first
+    static constexpr chrono::milliseconds ACK_INTERVAL{20};
+    
+    LibrarySystem& library;
+    string path;
+    atomic<bool> stopping;
+    atomic<bool> connected;
+    thread worker;
+    atomic<uint64_t> applied;        // sequence of the last event applied
+    atomic<uint64_t> primary_head;   // newest sequence the primary has reported
+    atomic<uint64_t> apply_errors;   // events the replay rejected
+    atomic<int64_t> last_contact;    // when the primary was last heard from, ns
+    LatencyHistogram lag;            // primary commit to replica apply, ns
+    uint64_t primary_run;            // run id of the log being followed; 0 before the first connect
+    atomic<bool> resync_needed;
+    function<void()> on_resync;      // called from the applier thread once resync_needed is set
+    atomic<bool> log_gap;            // the primary dropped lines this replica still needs
+    
+    ReplicaApplier(LibrarySystem& l)
+        : library(l), stopping(false), connected(false), applied(0), primary_head(0), apply_errors(0), last_contact(0),
+          primary_run(0), resync_needed(false), log_gap(false) {}
+    
+    ~ReplicaApplier() {
+        stop();
+    }
+    
+    void start(const string& socket_path) {
+        path = socket_path;
+        worker = thread([this] { follow(); });
+    }
+    
+    void stop() {
+        stopping.store(true);
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    
+    uint64_t lagEvents() const {
+        uint64_t head = primary_head.load(), done = applied.load();
+        return head - min(head, done);
+    }
+    
+    // Waits until the given sequence is applied; false on timeout.
+    bool waitFor(uint64_t sequence, chrono::milliseconds timeout) {
+        auto deadline = chrono::steady_clock::now() + timeout;
+        while (applied.load() < sequence) {
+            if (chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        return true;
+    }
+    
+    int connectToPrimary() {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+    
+    void follow() {
+        while (!stopping.load() && !resync_needed.load()) {
+            int fd = connectToPrimary();
+            if (fd < 0) {
+                this_thread::sleep_for(chrono::milliseconds(200));
+                continue;
+            }
+            if (LogShipper::sendAll(fd, "FROM " + to_string(applied.load() + 1) + "\n")) {
+                connected.store(true);
+                stream(fd);
+                connected.store(false);
+            }
+            close(fd);
+            if (log_gap.load()) {
+                // Only a primary restarted with a new log can serve this
+                // replica again; its run ID then triggers the resync.
+                this_thread::sleep_for(chrono::seconds(1));
+            }
+        }
+        if (resync_needed.load() && on_resync) {
+            on_resync();
+        }
+    }
+    
+    void stream(int fd) {
+        string pending;
+        char chunk[65536];
+        uint64_t acked = applied.load();
+        auto acked_at = chrono::steady_clock::now();
+        pollfd input = {fd, POLLIN, 0};
+        while (!stopping.load()) {
+            if (poll(&input, 1, 100) > 0) {
+                ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+                if (n <= 0) {
+                    return;
+                }
+                pending.append(chunk, n);
+                last_contact.store(ReplicationLog::nowNanos());
+            }
+            size_t line_start = 0, line_end;
+            while ((line_end = pending.find('\n', line_start)) != string::npos) {
+                apply(pending.substr(line_start, line_end - line_start));
+                if (resync_needed.load() || log_gap.load()) {
+                    return;
+                }
+                line_start = line_end + 1;
+            }
+            pending.erase(0, line_start);
+            
+            uint64_t done = applied.load();
+            auto now = chrono::steady_clock::now();
+            if (done != acked && (done - acked >= ACK_EVERY || now - acked_at >= ACK_INTERVAL)) {
+                if (!LogShipper::sendAll(fd, "A " + to_string(done) + "\n")) {
+                    return;
+                }
+                acked = done;
+                acked_at = now;
+            }
+        }
+    }
+    
+    void apply(const string& line) {
+        vector<string> fields = ReplicationLog::split(line);
+        if (fields[0] == "E") {
+            uint64_t run = fields.size() >= 2 ? strtoull(fields[1].c_str(), nullptr, 10) : 0;
+            if (primary_run != 0 && run != primary_run) {
+                resync_needed.store(true);
+            }
+            primary_run = run;
+            return;
+        }
+        if (fields[0] == "G") {
+            log_gap.store(true);
+            return;
+        }
+        if (fields[0] == "H") {
+            if (fields.size() >= 2) {
+                primary_head.store(max<uint64_t>(primary_head.load(), strtoull(fields[1].c_str(), nullptr, 10)));
+            }
+            return;
+        }
+        uint64_t sequence = strtoull(fields[0].c_str(), nullptr, 10);
+        if (sequence <= applied.load()) {
+            return;   // already applied before a reconnect
+        }
+        try {
+            library.applyReplicated(fields);
+        } catch (const LibraryException& e) {
+            apply_errors.fetch_add(1);
+        }
+        applied.store(sequence);
+        primary_head.store(max(primary_head.load(), sequence));
+        if (fields.size() >= 4) {
+            int64_t committed = strtoll(fields[3].c_str(), nullptr, 10);
+            lag.recordSingleWriter(max<int64_t>(ReplicationLog::nowNanos() - committed, 0));
+        }
+    }
+    
+    void writePrometheus(ostream& out) {
+        out << "# HELP library_replica_lag_events Mutations the primary has logged and this replica has not applied." << endl;
+        out << "# TYPE library_replica_lag_events gauge" << endl;
+        out << "library_replica_lag_events " << lagEvents() << endl;
+        out << "# HELP library_replica_apply_errors_total Replicated mutations the replay rejected." << endl;
+        out << "# TYPE library_replica_apply_errors_total counter" << endl;
+        out << "library_replica_apply_errors_total " << apply_errors.load() << endl;
+        out << "# HELP library_replica_log_gap Whether the primary dropped log lines this replica still needs." << endl;
+        out << "# TYPE library_replica_log_gap gauge" << endl;
+        out << "library_replica_log_gap " << (log_gap.load() ? 1 : 0) << endl;
+        out << "# HELP library_replica_lag_seconds Time from commit on the primary to apply on this replica." << endl;
+        out << "# TYPE library_replica_lag_seconds summary" << endl;
+        for (double quantile : {0.5, 0.99}) {
+            out << "library_replica_lag_seconds{quantile=\"" << quantile << "\"} " << lag.percentile(quantile) / 1e9 << endl;
+        }
+        out << "library_replica_lag_seconds_count " << lag.count() << endl;
+    }
+    
+    void displayStatus() {
+        cout << "Replica of " << path << ": " << (connected.load() ? "connected" : "disconnected") << ", applied "
+             << applied.load() << " of " << primary_head.load() << " (" << apply_errors.load() << " rejected)" << endl;
+        if (log_gap.load()) {
+            cout << "The primary dropped log lines this replica needs; it resyncs once the primary restarts." << endl;
+        }
+        cout << "Apply lag: p50 " << lag.percentile(0.50) / 1e6 << " ms, p99 " << lag.percentile(0.99) / 1e6
+             << " ms, max " << lag.percentile(1.0) / 1e6 << " ms" << endl;
+    }
+};
+
+// Routing directory stripe: which branch a member belongs to and which
+// branches stock a title. Striped so concurrent routing rarely shares a lock.
+class DirectoryStripe {
+public:
+    shared_mutex stripe_mutex;
+    unordered_map<string, int> member_home;
+    unordered_map<int, vector<int>> book_locations;
+};
+
+// Sharded deployment: every branch is an independent LibrarySystem with its
+// own lock and indexes, so local circulation at different branches never
+// contends. Requests are routed to the member's home branch; when the home
+// branch has no copy, one is transferred from another branch first.
+class LibraryConsortium {
+public:
+    static const int DIRECTORY_STRIPES = 64;
+    
+    vector<unique_ptr<LibrarySystem>> branches;
+    DirectoryStripe directory[DIRECTORY_STRIPES];
+    atomic<uint64_t> local_issues;
+    atomic<uint64_t> transferred_issues;
+    
+    LibraryConsortium(int branch_count) : local_issues(0), transferred_issues(0) {
+        for (int i = 0; i < max(branch_count, 1); i++) {
+            branches.emplace_back(new LibrarySystem());
+            // Keep transaction IDs unique across the consortium.
+            branches.back()->transaction_counter = 1000 + i * 10000000;
+        }
+    }
+    
+    void setQuiet(bool quiet) {
+        for (auto& branch : branches) {
+            branch->setQuiet(quiet);
+        }
+    }
+    
+    DirectoryStripe& stripeFor(const string& member_id) {
+        return directory[hash<string>()(member_id) % DIRECTORY_STRIPES];
+    }
+    
+    DirectoryStripe& stripeFor(int book_id) {
+        return directory[(unsigned)book_id % DIRECTORY_STRIPES];
+    }
+    
+    void recordLocation(int book_id, int branch) {
+        DirectoryStripe& stripe = stripeFor(book_id);
+        unique_lock<shared_mutex> lock(stripe.stripe_mutex);
+        vector<int>& holders = stripe.book_locations[book_id];
+        if (find(holders.begin(), holders.end(), branch) == holders.end()) {
+            holders.push_back(branch);
+        }
+    }
+    
+    vector<int> locationsOf(int book_id) {
+        DirectoryStripe& stripe = stripeFor(book_id);
+        shared_lock<shared_mutex> lock(stripe.stripe_mutex);
+        auto it = stripe.book_locations.find(book_id);
+        return it == stripe.book_locations.end() ? vector<int>() : it->second;
+    }
+    
+    int homeBranch(const string& member_id) {
+        DirectoryStripe& stripe = stripeFor(member_id);
+        shared_lock<shared_mutex> lock(stripe.stripe_mutex);
+        auto it = stripe.member_home.find(member_id);
+        if (it == stripe.member_home.end()) {
+            throw MemberNotFoundException();
+        }
+        return it->second;
+    }
+    
+    void addBook(int branch, Books* book) {
+        branches.at(branch)->addBook(book);
+        recordLocation(book->book_Id, branch);
+    }
+    
+    // Stocks the title at every branch with the given record's copy count.
+    void addBookAtEveryBranch(Books* book) {
+        for (int branch = 1; branch < (int)branches.size(); branch++) {
+            addBook(branch, book->cloneRecord(book->no_of_copies));
+        }
+        addBook(0, book);
+    }
+    
+    void addMember(int branch, Member* member) {
+        {
+            DirectoryStripe& stripe = stripeFor(member->member_id);
+            unique_lock<shared_mutex> lock(stripe.stripe_mutex);
+            if (stripe.member_home.count(member->member_id)) {
+                throw InvalidOperationException("Member with ID " + member->member_id + " already exists!");
+            }
+            stripe.member_home[member->member_id] = branch;
+        }
+        branches.at(branch)->addMember(member);
+    }
+    
+    void addMember(Member* member) {
+        addMember(hash<string>()(member->member_id) % branches.size(), member);
+    }
+    
+    void issueBook(int book_id, const string& member_id) {
+        int home = homeBranch(member_id);
+        LibrarySystem& local = *branches[home];
+        if (local.hasCopyFor(book_id, member_id)) {
+            local.issueBook(book_id, member_id);
+            local_issues.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        
+        local.checkBorrower(member_id);
+        for (int source : locationsOf(book_id)) {
+            if (source == home) {
+                continue;
+            }
+            Books* copy = branches[source]->releaseCopy(book_id, member_id);
+            if (!copy) {
+                continue;
+            }
+            local.receiveCopy(copy, member_id);
+            recordLocation(book_id, home);
+            local.issueBook(book_id, member_id);
+            transferred_issues.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        if (locationsOf(book_id).empty()) {
+            throw BookNotFoundException();
+        }
+        throw BookNotAvailableException();
+    }
+    
+    void returnBook(int book_id, const string& member_id) {
+        branches[homeBranch(member_id)]->returnBook(book_id, member_id);
+    }
+    
+    // Holds are placed at the home branch if it stocks the title, otherwise
+    // at the first branch that does; issueBook fetches a held copy from there.
+    bool reserveBook(int book_id, const string& member_id) {
+        int home = homeBranch(member_id);
+        vector<int> holders = locationsOf(book_id);
+        if (holders.empty()) {
+            throw BookNotFoundException();
+        }
+        bool stocked_at_home = find(holders.begin(), holders.end(), home) != holders.end();
+        int target = stocked_at_home ? home : holders.front();
+        return branches[target]->reserveBook(book_id, member_id, !stocked_at_home);
+    }
+    
+    int payFine(const string& member_id, int amount = INT32_MAX) {
+        return branches[homeBranch(member_id)]->payFine(member_id, amount);
+    }
+};
+
+// Samples ranks 0..n-1 with probability proportional to 1 / (rank + 1)^exponent.
+class ZipfDistribution {
+public:
+    vector<double> cdf;
+    
+    ZipfDistribution(int n, double exponent) : cdf(max(n, 1)) {
+        double total = 0;
+        for (int i = 0; i < (int)cdf.size(); i++) {
+            total += 1.0 / pow(i + 1.0, exponent);
+            cdf[i] = total;
+        }
+        for (auto& value : cdf) {
+            value /= total;
+        }
+    }
+    
+    int operator()(mt19937_64& rng) const {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        int rank = lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        return min(rank, (int)cdf.size() - 1);
+    }
+};
+
+class WorkloadConfig {
+public:
+    int books;
+    int members;
+    double faculty_ratio;
+    double zipf_exponent;
+    int max_copies;
+    int threads;
+    double target_rate;        // operations per second across all threads, 0 = unthrottled
+    long long operations;
+    int issue_weight;
+    int return_weight;
+    int reserve_weight;
+    int pay_fine_weight;
+    int operations_per_day;    // simulated calendar advances one day after this many operations
+    unsigned seed;
+    
+    WorkloadConfig() : books(10000), members(2000), faculty_ratio(0.2), zipf_exponent(0.99), max_copies(5),
+                       threads(4), target_rate(0), operations(200000), issue_weight(45), return_weight(35),
+                       reserve_weight(15), pay_fine_weight(5), operations_per_day(2000), seed(42) {}
+};
+
+enum WorkloadOperation {
+    LOAD_ISSUE,
+    LOAD_RETURN,
+    LOAD_RESERVE,
+    LOAD_PAY_FINE,
+    LOAD_OP_COUNT
+};
+
+class WorkloadResult {
+public:
+    atomic<long long> completed;
+    atomic<long long> rejected;    // calls that ended in a LibraryException
+    double seconds;
+    LatencyHistogram latency[LOAD_OP_COUNT];   // nanoseconds, measured from the scheduled start
+    LatencyHistogram overall;
+    
+    WorkloadResult() : completed(0), rejected(0), seconds(0) {}
+    
+    double throughput() const {
+        return seconds > 0 ? (completed + rejected) / seconds : 0;
+    }
+    
+    void display(const WorkloadConfig& config) const {
+        static const char* names[LOAD_OP_COUNT] = {"issue", "return", "reserve", "pay_fine"};
+        cout << "\n======= LOAD TEST RESULTS =======" << endl;
+        cout << "Threads: " << config.threads << ", Target rate: ";
+        if (config.target_rate > 0) {
+            cout << config.target_rate << " ops/sec" << endl;
+        } else {
+            cout << "unthrottled" << endl;
+        }
+        cout << "Operations: " << (completed + rejected) << " (" << completed << " succeeded, "
+             << rejected << " rejected)" << endl;
+        cout << fixed << setprecision(2);
+        cout << "Elapsed: " << seconds << " s" << endl;
+        cout << "Throughput: " << throughput() << " ops/sec" << endl;
+        cout << left << setw(10) << "Operation" << right << setw(10) << "Count" << setw(12) << "p50(us)"
+             << setw(12) << "p99(us)" << setw(12) << "p999(us)" << endl;
+        for (int op = 0; op <= LOAD_OP_COUNT; op++) {
+            const LatencyHistogram& h = op < LOAD_OP_COUNT ? latency[op] : overall;
+            cout << left << setw(10) << (op < LOAD_OP_COUNT ? names[op] : "all") << right
+                 << setw(10) << h.count()
+                 << setw(12) << h.percentile(0.50) / 1000.0
+                 << setw(12) << h.percentile(0.99) / 1000.0
+                 << setw(12) << h.percentile(0.999) / 1000.0 << endl;
+        }
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+        cout << "=================================" << endl;
+    }
+};
+
+// Builds a synthetic catalog and member base and drives a mixed circulation
+// stream through a LibrarySystem from several threads.
+class WorkloadGenerator {
+public:
+    WorkloadConfig config;
+    vector<int> book_ids;        // index = popularity rank
+    vector<string> member_ids;
+    
+    WorkloadGenerator(const WorkloadConfig& c) : config(c) {}
+    
+    static void stock(LibrarySystem& target, Books* book) {
+        target.addBook(book);
+    }
+    
+    static void stock(LibraryConsortium& target, Books* book) {
+        target.addBookAtEveryBranch(book);
+    }
+    
+    // Target is a LibrarySystem or a LibraryConsortium.
+    template <class Target>
+    void populate(Target& target) {
+        mt19937_64 rng(config.seed);
+        uniform_int_distribution<int> copies(1, max(config.max_copies, 1));
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        
+        book_ids.clear();
+        for (int i = 0; i < config.books; i++) {
+            int id = 100000 + i;
+            string title = "Synthetic Title " + to_string(i);
+            string author = "Author " + to_string(i % 5000);
+            Books* book;
+            if (i % 10 == 0) {
+                book = new EBook(title, id, author, "Synthetic Press", 500000000 + i, copies(rng),
+                                 "PDF", "library.com/ebooks/" + to_string(id) + ".pdf");
+            } else if (i % 10 == 1) {
+                book = new ResearchJournal(title, id, author, "Synthetic Press", 500000000 + i, copies(rng),
+                                           "Journal " + to_string(i % 50), i % 60 + 1, i % 12 + 1);
+            } else {
+                book = new Books(title, id, author, "Synthetic Press", 500000000 + i, copies(rng));
+            }
+            stock(target, book);
+            book_ids.push_back(id);
+        }
+        
+        member_ids.clear();
+        for (int i = 0; i < config.members; i++) {
+            char id[16];
+            snprintf(id, sizeof(id), "M%06d", i);
+            string name = "Member " + to_string(i);
+            string email = "member" + to_string(i) + "@example.com";
+            if (unit(rng) < config.faculty_ratio) {
+                target.addMember(new Faculty(name, id, to_string(9000000000LL + i), email, "Campus", "Science", "Lecturer"));
+            } else {
+                target.addMember(new Student(name, id, to_string(9000000000LL + i), email, "Campus", "Science", "2nd"));
+            }
+            member_ids.push_back(id);
+        }
+    }
+    
+    template <class Target>
+    void run(Target& target, WorkloadResult& result) {
+        ZipfDistribution popularity(book_ids.size(), config.zipf_exponent);
+        atomic<long long> next_operation(0);
+        int threads = max(config.threads, 1);
+        auto start = chrono::steady_clock::now();
+        
+        vector<thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                runWorker(target, t, threads, popularity, next_operation, start, result);
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    
+    // Each worker owns the members with index % threads == thread_index, so it
+    // knows their open loans exactly without reading shared state.
+    template <class Target>
+    void runWorker(Target& target, int thread_index, int threads, const ZipfDistribution& popularity,
+                   atomic<long long>& next_operation, chrono::steady_clock::time_point start, WorkloadResult& result) {
+        mt19937_64 rng(config.seed * 7919 + thread_index);
+        vector<int> own_members;
+        for (int i = thread_index; i < (int)member_ids.size(); i += threads) {
+            own_members.push_back(i);
+        }
+        if (own_members.empty()) {
+            return;
+        }
+        vector<pair<int, int>> loans;   // (book_id, member index)
+        int total_weight = config.issue_weight + config.return_weight + config.reserve_weight + config.pay_fine_weight;
+        uniform_int_distribution<int> pick_weight(0, max(total_weight - 1, 0));
+        uniform_int_distribution<int> pick_member(0, own_members.size() - 1);
+        chrono::nanoseconds interval(config.target_rate > 0 ? (long long)(threads * 1e9 / config.target_rate) : 0);
+        long long issued_by_thread = 0;
+        
+        while (true) {
+            long long n = next_operation.fetch_add(1, memory_order_relaxed);
+            if (n >= config.operations) {
+                break;
+            }
+            if (config.operations_per_day > 0 && n > 0 && n % config.operations_per_day == 0) {
+                LibraryClock::advance(1);
+            }
+            
+            // Latency is measured from the scheduled start so a stalled system is
+            // not hidden by the generator slowing down (coordinated omission).
+            chrono::steady_clock::time_point scheduled;
+            if (interval.count() > 0) {
+                scheduled = start + interval * issued_by_thread++;
+                this_thread::sleep_until(scheduled);
+            } else {
+                scheduled = chrono::steady_clock::now();
+            }
+            
+            int weight = pick_weight(rng);
+            int op;
+            if (weight < config.issue_weight) {
+                op = LOAD_ISSUE;
+            } else if (weight < config.issue_weight + config.return_weight) {
+                op = LOAD_RETURN;
+            } else if (weight < config.issue_weight + config.return_weight + config.reserve_weight) {
+                op = LOAD_RESERVE;
+            } else {
+                op = LOAD_PAY_FINE;
+            }
+            if (op == LOAD_RETURN && loans.empty()) {
+                op = LOAD_ISSUE;
+            }
+            
+            try {
+                if (op == LOAD_ISSUE) {
+                    int member = own_members[pick_member(rng)];
+                    int book_id = book_ids[popularity(rng)];
+                    target.issueBook(book_id, member_ids[member]);
+                    loans.push_back(make_pair(book_id, member));
+                } else if (op == LOAD_RETURN) {
+                    size_t index = uniform_int_distribution<size_t>(0, loans.size() - 1)(rng);
+                    pair<int, int> loan = loans[index];
+                    loans[index] = loans.back();
+                    loans.pop_back();
+                    target.returnBook(loan.first, member_ids[loan.second]);
+                } else if (op == LOAD_RESERVE) {
+                    target.reserveBook(book_ids[popularity(rng)], member_ids[own_members[pick_member(rng)]]);
+                } else {
+                    target.payFine(member_ids[own_members[pick_member(rng)]]);
+                }
+                result.completed.fetch_add(1, memory_order_relaxed);
+            } catch (const LibraryException& e) {
+                result.rejected.fetch_add(1, memory_order_relaxed);
+            }
+            
+            uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - scheduled).count();
+            result.latency[op].record(ns);
+            result.overall.record(ns);
+        }
+    }
+};
+
+// Common frame of the System Tools benchmarks. Owns a quiet target (a
+// LibrarySystem or a LibraryConsortium) and the generator that fills it; on
+// whichever path the benchmark returns, the destructor puts the simulated
+// clock back to the starting day and restores cout's number format.
+template <class Target = LibrarySystem>
+class BenchmarkFixture {
+public:
+    int saved_day;
+    ios::fmtflags saved_flags;
+    streamsize saved_precision;
+    unique_ptr<Target> owned;
+    WorkloadGenerator generator;
+    
+    template <class... Args>
+    BenchmarkFixture(const WorkloadConfig& config = WorkloadConfig(), Args&&... target_args)
+        : saved_day(LibraryClock::today()), saved_flags(cout.flags()), saved_precision(cout.precision()),
+          generator(config) {
+        reset(config, forward<Args>(target_args)...);
+    }
+    
+    ~BenchmarkFixture() {
+        restoreFormat();
+        LibraryClock::set(saved_day);
+    }
+    
+    Target& target() {
+        return *owned;
+    }
+    
+    // Replaces the target with a fresh one for the next run, back on the
+    // starting day; target_args go to the Target constructor.
+    template <class... Args>
+    Target& reset(const WorkloadConfig& config, Args&&... target_args) {
+        LibraryClock::set(saved_day);
+        owned.reset();
+        owned.reset(new Target(forward<Args>(target_args)...));
+        owned->setQuiet(true);
+        generator = WorkloadGenerator(config);
+        return *owned;
+    }
+    
+    Target& populate(const string& banner = "Building synthetic catalog...") {
+        if (!banner.empty()) {
+            cout << banner << endl;
+        }
+        generator.populate(*owned);
+        return *owned;
+    }
+    
+    void restoreFormat() {
+        cout.flags(saved_flags);
+        cout.precision(saved_precision);
+    }
+};
+
+// One parsed HTTP/1.1 request. Parameters come from the query string and,
+// for form posts, from the body.
+class HttpRequest {
+public:
+    static const size_t MAX_HEADER_BYTES = 8192;
+    static const size_t MAX_BODY_BYTES = 65536;
+    
+    string method;
+    string path;
+    map<string, string> params;
+    string bearer_token;       // from "Authorization: Bearer <token>"
+    string client;             // peer address of the connection, set by the service
+    string range;              // "Range" header, e.g. "bytes=0-1023"
+    bool keep_alive;
+    
+    HttpRequest() : keep_alive(true) {}
+    
+    string param(const string& name) const {
+        auto it = params.find(name);
+        return it == params.end() ? string() : it->second;
+    }
+    
+    static int hexValue(char c) {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        c = tolower(c);
+        return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+    }
+    
+    static string urlDecode(const string& text) {
+        string decoded;
+        for (size_t i = 0; i < text.size(); i++) {
+            if (text[i] == '+') {
+                decoded += ' ';
+            } else if (text[i] == '%' && i + 2 < text.size() && hexValue(text[i + 1]) >= 0 && hexValue(text[i + 2]) >= 0) {
+                decoded += (char)(hexValue(text[i + 1]) * 16 + hexValue(text[i + 2]));
+                i += 2;
+            } else {
+                decoded += text[i];
+            }
+        }
+        return decoded;
+    }
+    
+    static void parseParams(const string& text, map<string, string>& out) {
+        size_t start = 0;
+        while (start < text.size()) {
+            size_t end = text.find('&', start);
+            if (end == string::npos) {
+                end = text.size();
+            }
+            size_t equals = text.find('=', start);
+            if (equals != string::npos && equals < end) {
+                out[urlDecode(text.substr(start, equals - start))] = urlDecode(text.substr(equals + 1, end - equals - 1));
+            } else if (end > start) {
+                out[urlDecode(text.substr(start, end - start))] = "";
+            }
+            start = end + 1;
+        }
+    }
+    
+    // Resolves the Range header against a body of the given size into the
+    // inclusive bytes [first, last]. Returns 1 for a satisfiable range, 0 when
+    // the whole body should be sent (no header, or one this service does not
+    // honour, such as several ranges), and -1 when the range lies past the end.
+    int byteRange(off_t size, off_t& first, off_t& last) const {
+        if (range.compare(0, 6, "bytes=") != 0 || range.find(',') != string::npos) {
+            return 0;
+        }
+        size_t dash = range.find('-', 6);
+        if (dash == string::npos) {
+            return 0;
+        }
+        string from = range.substr(6, dash - 6);
+        string to = range.substr(dash + 1);
+        if (from.find_first_not_of("0123456789") != string::npos || to.find_first_not_of("0123456789") != string::npos ||
+            (from.empty() && to.empty())) {
+            return 0;
+        }
+        if (from.empty()) {
+            // Suffix range: the last N bytes.
+            off_t suffix = strtoll(to.c_str(), nullptr, 10);
+            if (suffix == 0 || size == 0) {
+                return -1;
+            }
+            first = max<off_t>(size - suffix, 0);
+            last = size - 1;
+            return 1;
+        }
+        first = strtoll(from.c_str(), nullptr, 10);
+        if (first >= size) {
+            return -1;
+        }
+        last = to.empty() ? size - 1 : min<off_t>(strtoll(to.c_str(), nullptr, 10), size - 1);
+        return last < first ? 0 : 1;
+    }
+    
+    // Parses one request starting at offset. Returns the number of bytes it
+    // occupies, 0 if it has not fully arrived yet, or -1 if it is malformed.
+    static long parse(const string& buffer, size_t offset, HttpRequest& request) {
+        request.bearer_token.clear();
+        request.range.clear();
+        size_t header_end = buffer.find("\r\n\r\n", offset);
+        if (header_end == string::npos) {
+            return buffer.size() - offset > MAX_HEADER_BYTES ? -1 : 0;
+        }
+        size_t line_end = buffer.find("\r\n", offset);
+        string request_line = buffer.substr(offset, line_end - offset);
+        size_t first_space = request_line.find(' ');
+        size_t second_space = request_line.find(' ', first_space + 1);
+        if (first_space == string::npos || second_space == string::npos) {
+            return -1;
+        }
+        request.method = request_line.substr(0, first_space);
+        string target = request_line.substr(first_space + 1, second_space - first_space - 1);
+        string version = request_line.substr(second_space + 1);
+        if (version != "HTTP/1.1" && version != "HTTP/1.0") {
+            return -1;
+        }
+        
+        size_t content_length = 0;
+        string connection;
+        bool form_body = false;
+        size_t line_start = line_end + 2;
+        while (line_start < header_end) {
+            line_end = buffer.find("\r\n", line_start);
+            size_t colon = buffer.find(':', line_start);
+            if (colon == string::npos || colon > line_end) {
+                return -1;
+            }
+            string name = buffer.substr(line_start, colon - line_start);
+            transform(name.begin(), name.end(), name.begin(), ::tolower);
+            size_t value_start = buffer.find_first_not_of(' ', colon + 1);
+            string value = value_start < line_end ? buffer.substr(value_start, line_end - value_start) : string();
+            if (name == "content-length") {
+                content_length = strtoul(value.c_str(), nullptr, 10);
+            } else if (name == "connection") {
+                transform(value.begin(), value.end(), value.begin(), ::tolower);
+                connection = value;
+            } else if (name == "content-type") {
+                form_body = value.find("application/x-www-form-urlencoded") == 0;
+            } else if (name == "authorization" && value.compare(0, 7, "Bearer ") == 0) {
+                request.bearer_token = value.substr(7);
+            } else if (name == "range") {
+                request.range = value;
+            }
+            line_start = line_end + 2;
+        }
+        if (content_length > MAX_BODY_BYTES) {
+            return -1;
+        }
+        size_t total = header_end + 4 + content_length - offset;
+        if (buffer.size() - offset < total) {
+            return 0;
+        }
+        
+        request.params.clear();
+        size_t question = target.find('?');
+        request.path = target.substr(0, question);
+        if (question != string::npos) {
+            parseParams(target.substr(question + 1), request.params);
+        }
+        if (form_body && content_length > 0) {
+            parseParams(buffer.substr(header_end + 4, content_length), request.params);
+        }
+        request.keep_alive = version == "HTTP/1.1" ? connection != "close" : connection == "keep-alive";
+        return total;
+    }
+};
+
+// File bytes that follow the first position bytes of a response buffer.
+// They go from the page cache to the socket with sendfile and never pass
+// through user space.
+class FileSlice {
+public:
+    size_t position;
+    shared_ptr<ContentFile> file;
+    off_t offset;
+    size_t length;
+    
+    FileSlice(size_t p, shared_ptr<ContentFile> f, off_t o, size_t l) : position(p), file(f), offset(o), length(l) {}
+};
+
+class ServiceConnection {
+public:
+    int fd;
+    string input;
+    string output;
+    size_t output_offset;
+    deque<FileSlice> files;    // in output order; positions index into output
+    bool busy;                 // a batch of its requests is with the worker pool
+    bool close_after_write;
+    bool peer_closed;          // peer finished sending; pending requests are still answered
+    bool abandoned;            // socket failed; close as soon as no batch is out
+    uint32_t interest;         // epoll events currently registered
+    string peer;               // client address
+    
+    ServiceConnection() : fd(-1), output_offset(0), busy(false), close_after_write(false), peer_closed(false),
+                          abandoned(false), interest(EPOLLIN) {}
+};
+
+// Bounds what POST /login can cost the service. A staff ID that fails
+// MAX_FAILURES times from one client address within the failure window is
+// refused there without hashing until the window ends; other accounts, and
+// the same account from elsewhere, are not affected. At most hash_slots
+// password hashes (about 16 ms each) run at once, so logins never occupy
+// every worker.
+class LoginThrottle {
+public:
+    static const int MAX_FAILURES = 5;
+    static const size_t MAX_TRACKED = 4096;   // accounts kept before expired ones are pruned
+    
+    mutex throttle_mutex;
+    unordered_map<string, pair<int, chrono::steady_clock::time_point>> failures;   // key() -> count, window start
+    chrono::seconds failure_window;
+    int hash_slots;
+    int hashing;
+    atomic<uint64_t> refused;
+    
+    LoginThrottle(int slots, chrono::seconds window = chrono::seconds(60))
+        : failure_window(window), hash_slots(max(slots, 1)), hashing(0), refused(0) {}
+    
+    static string key(int staff_id, const string& client) {
+        return to_string(staff_id) + "@" + client;
+    }
+    
+    // Takes a hashing slot for the login; false if it must try again later.
+    bool admit(int staff_id, const string& client) {
+        lock_guard<mutex> lock(throttle_mutex);
+        auto found = failures.find(key(staff_id, client));
+        if (found != failures.end() && chrono::steady_clock::now() - found->second.second >= failure_window) {
+            failures.erase(found);
+            found = failures.end();
+        }
+        if ((found != failures.end() && found->second.first >= MAX_FAILURES) || hashing >= hash_slots) {
+            refused.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+        hashing++;
+        return true;
+    }
+    
+    // Returns the slot taken by admit() and counts a failed attempt.
+    void finish(int staff_id, const string& client, bool succeeded) {
+        lock_guard<mutex> lock(throttle_mutex);
+        hashing--;
+        if (succeeded) {
+            failures.erase(key(staff_id, client));
+            return;
+        }
+        auto now = chrono::steady_clock::now();
+        if (failures.size() >= MAX_TRACKED) {
+            for (auto it = failures.begin(); it != failures.end();) {
+                it = now - it->second.second >= failure_window ? failures.erase(it) : next(it);
+            }
+        }
+        auto& entry = failures[key(staff_id, client)];
+        if (entry.first == 0) {
+            entry.second = now;
+        }
+        entry.first++;
+    }
+};
+
+// Requests of one connection handed to a worker together; the worker answers
+// them in order, which is what keeps pipelined responses in sequence.
+class ServiceJob {
+public:
+    int fd;
+    vector<HttpRequest> requests;
+    string responses;
+    vector<FileSlice> files;
+    bool close_connection;
+    
+    ServiceJob() : fd(-1), close_connection(false) {}
+};
+
+// HTTP/JSON front-end for one LibrarySystem. A single epoll event loop owns
+// every socket and does all reads and writes; complete requests are handed to
+// a worker pool, at most one batch per connection at a time, and finished
+// batches come back through an eventfd. Connections are kept alive and may
+// pipeline requests.
+class LibraryHttpService {
+public:
+    static const size_t MAX_BATCH = 64;
+    static const size_t MAX_PENDING_OUTPUT = 1 << 20;
+    static const size_t MAX_PENDING_INPUT = 1 << 20;
+    static const int SNAPSHOT_INTERVAL_MS = 5;      // how far /search and /report may trail the writes
+    
+    LibrarySystem& library;
+    int worker_count;
+    int listen_fd;
+    int epoll_fd;
+    int wake_fd;
+    uint16_t bound_port;
+    atomic<bool> stopping;
+    thread loop_thread;
+    vector<thread> workers;
+    unordered_map<int, ServiceConnection> connections;   // event loop thread only
+    
+    mutex jobs_mutex;
+    condition_variable jobs_ready;
+    deque<ServiceJob*> pending_jobs;
+    mutex finished_mutex;
+    vector<ServiceJob*> finished_jobs;
+    
+    atomic<uint64_t> accepted;
+    atomic<uint64_t> requests_served;
+    atomic<uint64_t> bad_requests;
+    atomic<uint64_t> open_connections;
+    atomic<uint64_t> peak_connections;
+    atomic<uint64_t> content_bytes;     // e-book bytes sent with sendfile
+    LatencyHistogram request_latency;   // time spent in the handler, nanoseconds
+    ReplicaApplier* replica;            // set when serving a read replica; changes are refused
+    LoginThrottle login_throttle;       // half the workers at most are hashing passwords
+    
+    LibraryHttpService(LibrarySystem& system, int worker_threads)
+        : library(system), worker_count(max(worker_threads, 1)), listen_fd(-1), epoll_fd(-1), wake_fd(-1),
+          bound_port(0), stopping(false), accepted(0), requests_served(0), bad_requests(0), open_connections(0),
+          peak_connections(0), content_bytes(0), replica(nullptr), login_throttle(max(worker_threads, 1) / 2) {}
+    
+    ~LibraryHttpService() {
+        stop();
+    }
+    
+    // Raises the open-file soft limit to the hard limit and returns the result.
+    static rlim_t raiseFileLimit() {
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            return 0;
+        }
+        if (limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+            getrlimit(RLIMIT_NOFILE, &limit);
+        }
+        return limit.rlim_cur;
+    }
+    
+    static void setNonBlocking(int fd) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+    
+    // Listens on 127.0.0.1:port (0 picks a free port) and starts the threads.
+    bool start(uint16_t port) {
+        raiseFileLimit();
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0) {
+            cout << "Could not create socket: " << strerror(errno) << endl;
+            return false;
+        }
+        int enable = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        if (::bind(listen_fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+            cout << "Could not listen on port " << port << ": " << strerror(errno) << endl;
+            close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        socklen_t length = sizeof(address);
+        getsockname(listen_fd, (sockaddr*)&address, &length);
+        bound_port = ntohs(address.sin_port);
+        setNonBlocking(listen_fd);
+        
+        epoll_fd = epoll_create1(0);
+        wake_fd = eventfd(0, EFD_NONBLOCK);
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = listen_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+        event.data.fd = wake_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+        
+        library.startSnapshotPublisher(SNAPSHOT_INTERVAL_MS);
+        for (int i = 0; i < worker_count; i++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+        loop_thread = thread([this] { eventLoop(); });
+        return true;
+    }
+    
+    void stop() {
+        if (listen_fd < 0 || stopping.exchange(true)) {
+            return;
+        }
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            // the loop also polls the stop flag on its timeout
+        }
+        {
+            lock_guard<mutex> lock(jobs_mutex);
+        }
+        jobs_ready.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        if (loop_thread.joinable()) {
+            loop_thread.join();
+        }
+        library.stopSnapshotPublisher();
+        for (auto& entry : connections) {
+            close(entry.first);
+        }
+        connections.clear();
+        open_connections.store(0);
+        for (auto job : pending_jobs) {
+            delete job;
+        }
+        pending_jobs.clear();
+        for (auto job : finished_jobs) {
+            delete job;
+        }
+        finished_jobs.clear();
+        close(listen_fd);
+        close(epoll_fd);
+        close(wake_fd);
+        listen_fd = epoll_fd = wake_fd = -1;
+    }
+    
+    void eventLoop() {
+        vector<epoll_event> events(1024);
+        while (!stopping.load()) {
+            int ready = epoll_wait(epoll_fd, events.data(), events.size(), 100);
+            for (int i = 0; i < ready; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listen_fd) {
+                    acceptConnections();
+                } else if (fd == wake_fd) {
+                    uint64_t count;
+                    while (read(wake_fd, &count, sizeof(count)) > 0) {
+                    }
+                    completeJobs();
+                } else {
+                    auto it = connections.find(fd);
+                    if (it == connections.end()) {
+                        continue;
+                    }
+                    ServiceConnection& connection = it->second;
+                    if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                        connection.abandoned = true;   // reset or fully closed; nothing more can be sent
+                        closeConnection(connection);
+                        continue;
+                    }
+                    if ((events[i].events & EPOLLIN) && !readFrom(connection)) {
+                        continue;
+                    }
+                    if (events[i].events & EPOLLOUT) {
+                        flush(connection);
+                    }
+                }
+            }
+        }
+    }
+    
+    void acceptConnections() {
+        while (true) {
+            sockaddr_in address;
+            socklen_t address_length = sizeof(address);
+            int fd = accept4(listen_fd, (sockaddr*)&address, &address_length, SOCK_NONBLOCK);
+            if (fd < 0) {
+                return;   // EAGAIN, or out of descriptors until some close
+            }
+            int enable = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+            ServiceConnection& connection = connections[fd];
+            connection.fd = fd;
+            char peer[INET_ADDRSTRLEN] = "";
+            inet_ntop(AF_INET, &address.sin_addr, peer, sizeof(peer));
+            connection.peer = peer;
+            epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+            accepted.fetch_add(1, memory_order_relaxed);
+            uint64_t open = open_connections.fetch_add(1, memory_order_relaxed) + 1;
+            if (open > peak_connections.load(memory_order_relaxed)) {
+                peak_connections.store(open, memory_order_relaxed);
+            }
+        }
+    }
+    
+    // The connection methods below return false once the connection has been
+    // closed (or is due to close), after which the caller must not touch it.
+    bool readFrom(ServiceConnection& connection) {
+        char chunk[16384];
+        while (true) {
+            ssize_t received = recv(connection.fd, chunk, sizeof(chunk), 0);
+            if (received > 0) {
+                connection.input.append(chunk, received);
+                if (connection.input.size() > MAX_PENDING_INPUT) {
+                    bad_requests.fetch_add(1, memory_order_relaxed);
+                    connection.abandoned = true;
+                    return closeConnection(connection);
+                }
+            } else if (received == 0) {
+                connection.peer_closed = true;
+                updateInterest(connection);
+                break;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else if (errno != EINTR) {
+                connection.abandoned = true;
+                return closeConnection(connection);
+            }
+        }
+        return connection.busy ? true : flush(connection);
+    }
+    
+    // Hands the complete requests buffered on the connection to the workers.
+    bool dispatch(ServiceConnection& connection) {
+        if (connection.busy || connection.close_after_write ||
+            connection.output.size() - connection.output_offset > MAX_PENDING_OUTPUT ||
+            connection.files.size() >= MAX_BATCH) {
+            return true;
+        }
+        ServiceJob* job = nullptr;
+        size_t consumed = 0;
+        while (consumed < connection.input.size()) {
+            HttpRequest request;
+            long length = HttpRequest::parse(connection.input, consumed, request);
+            if (length == 0) {
+                break;
+            }
+            if (length < 0) {
+                if (!job) {
+                    bad_requests.fetch_add(1, memory_order_relaxed);
+                    appendResponse(connection.output, 400, errorJson("Malformed request"), false);
+                    connection.close_after_write = true;
+                    connection.input.clear();
+                    return flush(connection);
+                }
+                break;   // answer the good requests first
+            }
+            consumed += length;
+            if (!job) {
+                job = new ServiceJob();
+                job->fd = connection.fd;
+            }
+            bool keep_alive = request.keep_alive;
+            request.client = connection.peer;
+            job->requests.push_back(move(request));
+            if (!keep_alive) {
+                job->close_connection = true;
+                break;
+            }
+            if (job->requests.size() == MAX_BATCH) {
+                break;
+            }
+        }
+        connection.input.erase(0, consumed);
+        if (!job) {
+            return true;
+        }
+        connection.busy = true;
+        {
+            lock_guard<mutex> lock(jobs_mutex);
+            pending_jobs.push_back(job);
+        }
+        jobs_ready.notify_one();
+        return true;
+    }
+    
+    void completeJobs() {
+        vector<ServiceJob*> done;
+        {
+            lock_guard<mutex> lock(finished_mutex);
+            done.swap(finished_jobs);
+        }
+        for (auto job : done) {
+            auto it = connections.find(job->fd);
+            if (it != connections.end()) {
+                ServiceConnection& connection = it->second;
+                connection.busy = false;
+                if (connection.abandoned) {
+                    closeConnection(connection);
+                } else {
+                    for (auto& slice : job->files) {
+                        slice.position += connection.output.size();
+                        connection.files.push_back(move(slice));
+                    }
+                    connection.output += job->responses;
+                    if (job->close_connection) {
+                        connection.close_after_write = true;
+                    }
+                    flush(connection);
+                }
+            }
+            delete job;
+        }
+    }
+    
+    // Writes as much pending output as the socket takes, then moves on to the
+    // next buffered requests or closes the connection if it is finished.
+    bool flush(ServiceConnection& connection) {
+        while (connection.output_offset < connection.output.size() || !connection.files.empty()) {
+            size_t until = connection.files.empty() ? connection.output.size() : connection.files.front().position;
+            ssize_t sent;
+            if (connection.output_offset < until) {
+                sent = send(connection.fd, connection.output.data() + connection.output_offset,
+                            until - connection.output_offset, MSG_NOSIGNAL);
+                if (sent > 0) {
+                    connection.output_offset += sent;
+                    continue;
+                }
+            } else {
+                FileSlice& slice = connection.files.front();
+                if (slice.length == 0) {
+                    connection.files.pop_front();
+                    continue;
+                }
+                sent = sendfile(connection.fd, slice.file->fd, &slice.offset, min(slice.length, (size_t)1 << 30));
+                if (sent > 0) {
+                    slice.length -= sent;
+                    content_bytes.fetch_add(sent, memory_order_relaxed);
+                    continue;
+                }
+                if (sent == 0) {
+                    errno = EIO;   // the file shrank under us; the response cannot be completed
+                }
+            }
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                updateInterest(connection);
+                return true;
+            } else if (!(sent < 0 && errno == EINTR)) {
+                connection.abandoned = true;
+                return closeConnection(connection);
+            }
+        }
+        connection.output.clear();
+        connection.output_offset = 0;
+        updateInterest(connection);
+        if (connection.busy) {
+            return true;
+        }
+        if (!dispatch(connection)) {
+            return false;
+        }
+        if (!connection.busy && (connection.close_after_write || connection.peer_closed)) {
+            return closeConnection(connection);
+        }
+        return true;
+    }
+    
+    // Reads while the peer is still sending; watches for writability only
+    // while output is waiting.
+    void updateInterest(ServiceConnection& connection) {
+        uint32_t wanted = (connection.peer_closed ? 0 : (uint32_t)EPOLLIN) |
+                          (connection.output_offset < connection.output.size() || !connection.files.empty() ? (uint32_t)EPOLLOUT : 0);
+        if (wanted == connection.interest) {
+            return;
+        }
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = wanted;
+        event.data.fd = connection.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.interest = wanted;
+    }
+    
+    // A connection with a batch in the worker pool is only marked; it is closed
+    // when the batch comes back, so its descriptor cannot be reused meanwhile.
+    bool closeConnection(ServiceConnection& connection) {
+        if (connection.busy) {
+            connection.abandoned = true;
+            if (connection.interest) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection.fd, nullptr);
+                connection.interest = 0;
+            }
+            return false;
+        }
+        int fd = connection.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        connections.erase(fd);
+        open_connections.fetch_sub(1, memory_order_relaxed);
+        return false;
+    }
+    
+    void workerLoop() {
+        while (true) {
+            ServiceJob* job;
+            {
+                unique_lock<mutex> lock(jobs_mutex);
+                jobs_ready.wait(lock, [this] { return stopping.load() || !pending_jobs.empty(); });
+                if (stopping.load()) {
+                    return;
+                }
+                job = pending_jobs.front();
+                pending_jobs.pop_front();
+            }
+            for (size_t i = 0; i < job->requests.size(); i++) {
+                const HttpRequest& request = job->requests[i];
+                bool keep_alive = request.keep_alive && !(job->close_connection && i + 1 == job->requests.size());
+                auto started = chrono::steady_clock::now();
+                handle(request, job->responses, keep_alive, &job->files);
+                request_latency.record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count());
+            }
+            requests_served.fetch_add(job->requests.size(), memory_order_relaxed);
+            bool was_empty;
+            {
+                lock_guard<mutex> lock(finished_mutex);
+                was_empty = finished_jobs.empty();
+                finished_jobs.push_back(job);
+            }
+            if (was_empty) {
+                uint64_t one = 1;
+                if (write(wake_fd, &one, sizeof(one)) < 0) {
+                    // counter saturated; the loop is already due to wake
+                }
+            }
+        }
+    }
+    
+    static const char* statusText(int status) {
+        switch (status) {
+            case 200: return "OK";
+            case 206: return "Partial Content";
+            case 400: return "Bad Request";
+            case 401: return "Unauthorized";
+            case 403: return "Forbidden";
+            case 404: return "Not Found";
+            case 405: return "Method Not Allowed";
+            case 409: return "Conflict";
+            case 416: return "Range Not Satisfiable";
+            case 429: return "Too Many Requests";
+            default: return "Internal Server Error";
+        }
+    }
+    
+    // Status line and headers; extra_headers are whole "Name: value\r\n" lines.
+    static void appendHeaders(string& out, int status, const char* content_type, unsigned long long length,
+                              const string& extra_headers, bool keep_alive) {
+        out += "HTTP/1.1 ";
+        out += to_string(status);
+        out += ' ';
+        out += statusText(status);
+        out += "\r\nContent-Type: ";
+        out += content_type;
+        out += "\r\nContent-Length: ";
+        out += to_string(length);
+        out += "\r\n";
+        out += extra_headers;
+        out += keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    }
+    
+    static void appendResponse(string& out, int status, const string& body, bool keep_alive,
+                               const string& extra_headers = string()) {
+        appendHeaders(out, status, "application/json", body.size(), extra_headers, keep_alive);
+        out += body;
+    }
+    
+    static string jsonString(const string& text) {
+        string quoted = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                quoted += '\\';
+                quoted += c;
+            } else if ((unsigned char)c < 0x20) {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+                quoted += escape;
+            } else {
+                quoted += c;
+            }
+        }
+        return quoted + "\"";
+    }
+    
+    static string bookJson(const Books* book) {
+        const char* type = book->typeName();
+        return "{\"id\":" + to_string(book->book_Id) + ",\"title\":" + jsonString(book->book_name) +
+               ",\"author\":" + jsonString(book->author_name) + ",\"publisher\":" + jsonString(book->publisher) +
+               ",\"isbn\":" + to_string(book->ISBN_no) + ",\"type\":\"" + type + "\",\"copies\":" +
+               to_string(book->no_of_copies) + ",\"available_copies\":" + to_string(max(book->freeCopies(), 0)) +
+               ",\"reservations\":" + to_string(book->reserved_by.size()) + ",\"available\":" +
+               (book->availability ? "true" : "false") + "}";
+    }
+    
+    static string memberJson(const Member* member) {
+        string issued;
+        for (size_t i = 0; i < member->issued_book_ids.size(); i++) {
+            issued += (i ? "," : "") + to_string(member->issued_book_ids[i]);
+        }
+        return "{\"id\":" + jsonString(member->member_id) + ",\"name\":" + jsonString(member->name) +
+               ",\"email\":" + jsonString(member->email) + ",\"phone\":" + jsonString(member->contact.str()) +
+               ",\"type\":\"" +
+               member->typeName() + "\",\"max_books\":" +
+               to_string(member->getMaxBooks()) + ",\"issued\":[" + issued + "],\"fine\":" +
+               to_string(member->fineBalance(LibraryClock::today())) + "}";
+    }
+    
+    static int statusFor(LibraryErrorKind kind) {
+        switch (kind) {
+            case ERR_BOOK_NOT_FOUND:
+            case ERR_MEMBER_NOT_FOUND:
+                return 404;
+            case ERR_BOOK_NOT_AVAILABLE:
+            case ERR_MAX_ISSUE_LIMIT:
+            case ERR_PENDING_FINE:
+            case ERR_INVALID_OPERATION:
+                return 409;
+            case ERR_INVALID_CREDENTIALS:
+                return 401;
+            default:
+                return 400;
+        }
+    }
+    
+    static string errorJson(const string& message) {
+        return "{\"ok\":false,\"error\":" + jsonString(message) + "}";
+    }
+    
+    // Routes one request and appends its response.
+    //   GET  /books?id=        GET /search?q=&limit=      GET /search/fuzzy?q=&limit= tolerates typos
+    //   GET  /serials?journal=&from=&to=&limit= lists a journal's issues in that volume range
+    //   POST /login (staff=, password=) returns a session token; the rest need
+    //   "Authorization: Bearer <token>":
+    //   GET  /members?id=      GET /members/search?q=&by=name|email|phone&limit=      GET /report
+    //   POST /issue, /return, /reserve (book=, member=)      POST /logout
+    //   POST /ebook-token (book=, member=) replaces the access token of an e-book loan
+    //   GET  /replication shows log shipping on a primary and replay progress on a replica
+    //   GET  /content?token= streams the e-book of the loan the token was issued
+    //   for, honouring a single "Range: bytes=" range; the token is the only credential.
+    // File bodies are queued in files and sent by the event loop with sendfile.
+    void handle(const HttpRequest& request, string& out, bool keep_alive, vector<FileSlice>* files) {
+        const string& path = request.path;
+        bool circulation = path == "/issue" || path == "/return" || path == "/reserve";
+        bool post = circulation || path == "/login" || path == "/logout" || path == "/ebook-token";
+        if (post ? request.method != "POST" : request.method != "GET") {
+            appendResponse(out, 405, errorJson("Use " + string(post ? "POST" : "GET") + " for " + path), keep_alive);
+            return;
+        }
+        if (replica && (circulation || path == "/ebook-token")) {
+            appendResponse(out, 409, errorJson("Read-only replica; send changes to the primary"), keep_alive);
+            return;
+        }
+        bool public_endpoint = path == "/books" || path == "/search" || path == "/search/fuzzy" || path == "/serials" ||
+                               path == "/login" || path == "/content";
+        if (!public_endpoint && !library.sessions.validate(request.bearer_token)) {
+            appendResponse(out, 401, errorJson("Login required"), keep_alive);
+            return;
+        }
+        
+        try {
+            if (path == "/login") {
+                int staff_id = atoi(request.param("staff").c_str());
+                if (!login_throttle.admit(staff_id, request.client)) {
+                    appendResponse(out, 429, errorJson("Too many login attempts; try again later"), keep_alive);
+                    return;
+                }
+                string token;
+                try {
+                    token = library.authenticate(staff_id, request.param("password"));
+                } catch (const LibraryException& e) {
+                    login_throttle.finish(staff_id, request.client, false);
+                    throw;
+                }
+                login_throttle.finish(staff_id, request.client, true);
+                appendResponse(out, 200, "{\"token\":\"" + token + "\"}", keep_alive);
+            } else if (path == "/logout") {
+                library.sessions.revoke(request.bearer_token);
+                appendResponse(out, 200, "{\"ok\":true}", keep_alive);
+            } else if (path == "/books") {
+                unique_ptr<Books> book = library.lookupBook(atoi(request.param("id").c_str()));
+                if (!book) {
+                    throw BookNotFoundException();
+                }
+                appendResponse(out, 200, bookJson(book.get()), keep_alive);
+            } else if (path == "/members") {
+                unique_ptr<Member> member = library.lookupMember(request.param("id"));
+                if (!member) {
+                    throw MemberNotFoundException();
+                }
+                appendResponse(out, 200, memberJson(member.get()), keep_alive);
+            } else if (path == "/members/search") {
+                appendResponse(out, 200, memberSearchJson(request.param("q"), request.param("by"),
+                                                          atoi(request.param("limit").c_str())), keep_alive);
+            } else if (path == "/search/fuzzy") {
+                appendResponse(out, 200, fuzzySearchJson(request.param("q"), atoi(request.param("limit").c_str())), keep_alive);
+            } else if (path == "/serials") {
+                int to_volume = atoi(request.param("to").c_str());
+                appendResponse(out, 200, serialsJson(request.param("journal"), atoi(request.param("from").c_str()),
+                                                     to_volume > 0 ? to_volume : INT32_MAX,
+                                                     atoi(request.param("limit").c_str())), keep_alive);
+            } else if (path == "/search") {
+                appendResponse(out, 200, searchJson(request.param("q"), atoi(request.param("limit").c_str())), keep_alive);
+            } else if (path == "/report") {
+                appendResponse(out, 200, reportJson(), keep_alive);
+            } else if (path == "/replication") {
+                appendResponse(out, 200, replicationJson(), keep_alive);
+            } else if (circulation) {
+                int book_id = atoi(request.param("book").c_str());
+                string member_id = request.param("member");
+                bool done = true;
+                string access_token;
+                if (path == "/issue") {
+                    access_token = library.issueBook(book_id, member_id);
+                } else if (path == "/return") {
+                    library.returnBook(book_id, member_id);
+                } else {
+                    done = library.reserveBook(book_id, member_id);
+                }
+                appendResponse(out, 200, string("{\"ok\":") + (done ? "true" : "false") +
+                               (access_token.empty() ? "" : ",\"access_token\":\"" + access_token + "\"") + "}",
+                               keep_alive);
+            } else if (path == "/ebook-token") {
+                string token = library.grantEBookAccess(atoi(request.param("book").c_str()), request.param("member"));
+                appendResponse(out, 200, "{\"access_token\":\"" + token + "\"}", keep_alive);
+            } else if (path == "/content") {
+                streamContent(request, out, keep_alive, files);
+            } else {
+                appendResponse(out, 404, errorJson("Unknown endpoint " + path), keep_alive);
+            }
+        }
+        catch (const LibraryException& e) {
+            appendResponse(out, statusFor(e.kind), errorJson(e.what()), keep_alive);
+        }
+    }
+    
+    string replicationJson() {
+        ostringstream json;
+        if (replica) {
+            json << "{\"role\":\"replica\",\"connected\":" << (replica->connected.load() ? "true" : "false")
+                 << ",\"applied\":" << replica->applied.load() << ",\"primary_head\":" << replica->primary_head.load()
+                 << ",\"lag_events\":" << replica->lagEvents() << ",\"apply_errors\":" << replica->apply_errors.load()
+                 << ",\"log_gap\":" << (replica->log_gap.load() ? "true" : "false")
+                 << ",\"lag_ms\":{\"p50\":" << replica->lag.percentile(0.50) / 1e6 << ",\"p99\":"
+                 << replica->lag.percentile(0.99) / 1e6 << ",\"max\":" << replica->lag.percentile(1.0) / 1e6 << "}}";
+            return json.str();
+        }
+        LogShipper* shipper = library.log_shipper.get();
+        uint64_t head = library.replication_log ? library.replication_log->head() : 0;
+        json << "{\"role\":\"primary\",\"head\":" << head;
+        if (ReplicationLog* log = library.replication_log.get()) {
+            json << ",\"spilling\":" << (log->spilling.load() ? "true" : "false") << ",\"spill_failures\":"
+                 << log->spill_failures.load() << ",\"lost_through\":" << log->lost_through.load();
+        }
+        json << ",\"replicas\":[";
+        if (shipper) {
+            lock_guard<mutex> lock(shipper->links_mutex);
+            for (size_t i = 0; i < shipper->links.size(); i++) {
+                uint64_t acked = shipper->links[i]->acked.load();
+                json << (i ? "," : "") << "{\"connected\":" << (shipper->links[i]->closed.load() ? "false" : "true")
+                     << ",\"applied\":" << acked << ",\"lag_events\":" << head - min(head, acked) << "}";
+            }
+        }
+        json << "]}";
+        return json.str();
+    }
+    
+    void streamContent(const HttpRequest& request, string& out, bool keep_alive, vector<FileSlice>* files) {
+        EBookAccess access;
+        if (!library.ebook_access.validate(request.param("token"), LibraryClock::today(), access)) {
+            appendResponse(out, 403, errorJson("Access token invalid or expired"), keep_alive);
+            return;
+        }
+        shared_ptr<ContentFile> file = library.ebook_content.open(access.book_id, access.format);
+        if (!file) {
+            appendResponse(out, 404, errorJson("No content stored for e-book " + to_string(access.book_id)), keep_alive);
+            return;
+        }
+        off_t first = 0, last = file->size - 1;
+        int range = request.byteRange(file->size, first, last);
+        if (range < 0) {
+            appendResponse(out, 416, errorJson("Range not satisfiable"), keep_alive,
+                           "Content-Range: bytes */" + to_string(file->size) + "\r\n");
+            return;
+        }
+        string headers = "Accept-Ranges: bytes\r\n";
+        if (range > 0) {
+            headers += "Content-Range: bytes " + to_string(first) + "-" + to_string(last) + "/" +
+                       to_string(file->size) + "\r\n";
+        }
+        size_t length = file->size == 0 ? 0 : last - first + 1;
+        appendHeaders(out, range > 0 ? 206 : 200, file->content_type.c_str(), length, headers, keep_alive);
+        files->push_back(FileSlice(out.size(), file, first, length));
+    }
+    
+    string memberSearchJson(const string& query, const string& by, int limit) {
+        MemberDirectory::Field field = by == "name" ? MemberDirectory::BY_NAME
+                                       : by == "email" ? MemberDirectory::BY_EMAIL
+                                       : by == "phone" ? MemberDirectory::BY_PHONE : MemberDirectory::BY_ANY;
+        vector<unique_ptr<Member>> found = library.searchMembers(query, field, limit > 0 ? min(limit, 100) : 10);
+        string body = "{\"results\":[";
+        for (size_t i = 0; i < found.size(); i++) {
+            body += (i ? "," : "") + memberJson(found[i].get());
+        }
+        return body + "]}";
+    }
+    
+    string serialsJson(const string& journal_name, int from_volume, int to_volume, int limit) {
+        string name;
+        bool more = false;
+        vector<unique_ptr<Books>> found = library.serialIssues(journal_name, from_volume, to_volume,
+                                                               limit > 0 ? min(limit, 1000) : 100, name, more);
+        string body = "{\"journal\":" + jsonString(name) + ",\"more\":" + (more ? "true" : "false") + ",\"issues\":[";
+        for (size_t i = 0; i < found.size(); i++) {
+            const ResearchJournal* journal = static_cast<const ResearchJournal*>(found[i].get());
+            body += (i ? "," : "") + string("{\"volume\":") + to_string(journal->volume) + ",\"issue\":" +
+                    to_string(journal->issue) + ",\"book\":" + bookJson(journal) + "}";
+        }
+        return body + "]}";
+    }
+    
+    string fuzzySearchJson(const string& query, int limit) {
+        vector<pair<unique_ptr<Books>, int>> found = library.searchBooksFuzzy(query, limit > 0 ? min(limit, 100) : 10);
+        string body = "{\"results\":[";
+        for (size_t i = 0; i < found.size(); i++) {
+            body += (i ? "," : "") + string("{\"edits\":") + to_string(found[i].second) + ",\"book\":" +
+                    bookJson(found[i].first.get()) + "}";
+        }
+        return body + "]}";
+    }
+    
+    // Case-insensitive substring match over titles and authors of the current snapshot.
+    string searchJson(const string& query, int limit) {
+        if (limit <= 0) {
+            limit = 20;
+        }
+        string needle = query;
+        transform(needle.begin(), needle.end(), needle.begin(), ::tolower);
+        shared_ptr<const CatalogSnapshot> view = library.snapshot();
+        string body = "{\"results\":[";
+        int matches = 0;
+        for (size_t i = 0; i < view->books.size() && matches < limit; i++) {
+            const Books* book = view->books[i];
+            string haystack = book->book_name + "\n" + book->author_name;
+            transform(haystack.begin(), haystack.end(), haystack.begin(), ::tolower);
+            if (haystack.find(needle) != string::npos) {
+                body += (matches++ ? "," : "") + bookJson(book);
+            }
+        }
+        return body + "]}";
+    }
+    
+    string reportJson() {
+        shared_ptr<const CatalogSnapshot> view = library.snapshot();
+        long long issued = 0;
+        for (size_t i = 0; i < view->books.size(); i++) {
+            issued += view->books[i]->no_of_copies_issued;
+        }
+        return "{\"day\":" + to_string(view->day) + ",\"books\":" + to_string(view->books.size()) +
+               ",\"copies_issued\":" + to_string(issued) + ",\"members\":" + to_string(view->members.size()) +
+               ",\"transactions\":" + to_string(view->transactions) + ",\"active_loans\":" +
+               to_string(view->active_loans) + ",\"reservations\":" + to_string(view->reservations) + "}";
+    }
+    
+    void displayStats() {
+        cout << "\n======= NETWORK SERVICE =======" << endl;
+        cout << "Listening on: 127.0.0.1:" << bound_port << " (" << worker_count << " worker threads)" << endl;
+        cout << "Connections accepted: " << accepted.load() << ", open: " << open_connections.load()
+             << ", peak: " << peak_connections.load() << endl;
+        cout << "Requests served: " << requests_served.load() << ", malformed: " << bad_requests.load()
+             << ", logins refused: " << login_throttle.refused.load() << endl;
+        cout << "E-book bytes sent (sendfile): " << content_bytes.load() << endl;
+        cout << fixed << setprecision(2);
+        cout << "Handler latency p50/p99: " << request_latency.percentile(0.50) / 1000.0 << " / "
+             << request_latency.percentile(0.99) / 1000.0 << " us" << endl;
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+        cout << "===============================" << endl;
+    }
+};
+
+// Outcome of a loopback load run; plain data so a child process can pass it
+// back through a pipe.
+class ServiceLoadResult {
+public:
+    int connections;          // established
+    int connect_error;        // errno of the first failed connect, 0 if none
+    long long responses;
+    long long non_success;    // responses other than 2xx
+    double seconds;
+    double p50_us;            // round trip of one pipelined batch
+    double p99_us;
+    double p999_us;
+    
+    ServiceLoadResult() : connections(0), connect_error(0), responses(0), non_success(0), seconds(0),
+                          p50_us(0), p99_us(0), p999_us(0) {}
+};
+
+class ServiceClientConnection {
+public:
+    int fd;
+    string input;
+    string output;
+    size_t output_offset;
+    int outstanding;
+    chrono::steady_clock::time_point sent_at;
+    
+    ServiceClientConnection() : fd(-1), output_offset(0), outstanding(0) {}
+};
+
+// Opens many keep-alive connections to the service from one epoll loop and
+// keeps a batch of pipelined requests in flight on each: 60% book lookups,
+// 20% member lookups, 10% issues and 10% returns over the synthetic catalog.
+// Everything but the book lookups carries the session token.
+class ServiceLoadClient {
+public:
+    uint16_t port;
+    int connections;
+    int depth;
+    double seconds;
+    int books;
+    int members;
+    unsigned seed;
+    int staff_id;              // used to log in once; its token goes on every staff request
+    string password;
+    string token;
+    
+    ServiceLoadClient(uint16_t p, int c, int d, double s, int b, int m, int staff, const string& pass)
+        : port(p), connections(c), depth(max(d, 1)), seconds(s), books(max(b, 1)), members(max(m, 1)), seed(42),
+          staff_id(staff), password(pass) {}
+    
+    string formPost(const string& path, const string& body) const {
+        return "POST " + path + " HTTP/1.1\r\nHost: localhost\r\nAuthorization: Bearer " + token +
+               "\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: " + to_string(body.size()) +
+               "\r\n\r\n" + body;
+    }
+    
+    // Logs in over a blocking connection of its own and keeps the token.
+    bool login(const sockaddr_in& address) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+        string request = formPost("/login", "staff=" + to_string(staff_id) + "&password=" + password);
+        string response;
+        if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) == (ssize_t)request.size()) {
+            char chunk[4096];
+            ssize_t received;
+            while (response.find("}") == string::npos && (received = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+                response.append(chunk, received);
+            }
+        }
+        close(fd);
+        size_t at = response.find("\"token\":\"");
+        if (at == string::npos) {
+            return false;
+        }
+        token = response.substr(at + 9, SessionTable::TOKEN_BYTES * 2);
+        return true;
+    }
+    
+    string nextRequest(mt19937_64& rng, const ZipfDistribution& popularity) {
+        int roll = rng() % 100;
+        char member_id[16];
+        snprintf(member_id, sizeof(member_id), "M%06d", (int)(rng() % members));
+        string book_id = to_string(100000 + popularity(rng));
+        if (roll < 60) {
+            return "GET /books?id=" + book_id + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        } else if (roll < 80) {
+            return "GET /members?id=" + string(member_id) + " HTTP/1.1\r\nHost: localhost\r\nAuthorization: Bearer " +
+                   token + "\r\n\r\n";
+        } else if (roll < 90) {
+            return formPost("/issue", "book=" + book_id + "&member=" + member_id);
+        }
+        return formPost("/return", "book=" + book_id + "&member=" + member_id);
+    }
+    
+    bool flush(int epoll_fd, ServiceClientConnection& connection, uint32_t index) {
+        while (connection.output_offset < connection.output.size()) {
+            ssize_t sent = send(connection.fd, connection.output.data() + connection.output_offset,
+                                connection.output.size() - connection.output_offset, MSG_NOSIGNAL);
+            if (sent > 0) {
+                connection.output_offset += sent;
+            } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                epoll_event event;
+                memset(&event, 0, sizeof(event));
+                event.events = EPOLLIN | EPOLLOUT;
+                event.data.u32 = index;
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+                return true;
+            } else if (!(sent < 0 && errno == EINTR)) {
+                return false;
+            }
+        }
+        connection.output.clear();
+        connection.output_offset = 0;
+        return true;
+    }
+    
+    // Counts the complete responses at the front of the connection's input.
+    int consumeResponses(ServiceClientConnection& connection, long long& non_success) {
+        int complete = 0;
+        size_t offset = 0;
+        while (true) {
+            size_t header_end = connection.input.find("\r\n\r\n", offset);
+            if (header_end == string::npos) {
+                break;
+            }
+            size_t length_at = connection.input.find("Content-Length: ", offset);
+            size_t body = (length_at != string::npos && length_at < header_end)
+                              ? strtoul(connection.input.c_str() + length_at + 16, nullptr, 10) : 0;
+            if (connection.input.size() < header_end + 4 + body) {
+                break;
+            }
+            if (connection.input.compare(offset + 9, 1, "2") != 0) {
+                non_success++;
+            }
+            offset = header_end + 4 + body;
+            complete++;
+        }
+        connection.input.erase(0, offset);
+        return complete;
+    }
+    
+    ServiceLoadResult run() {
+        ServiceLoadResult result;
+        LibraryHttpService::raiseFileLimit();
+        mt19937_64 rng(seed);
+        ZipfDistribution popularity(books, 0.99);
+        int epoll_fd = epoll_create1(0);
+        vector<ServiceClientConnection> pool(connections);
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        if (!login(address)) {
+            result.connect_error = errno ? errno : EACCES;
+            close(epoll_fd);
+            return result;
+        }
+        for (int i = 0; i < connections; i++) {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+                result.connect_error = errno;
+                if (fd >= 0) {
+                    close(fd);
+                }
+                break;
+            }
+            int enable = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+            LibraryHttpService::setNonBlocking(fd);
+            epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.u32 = i;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+            pool[i].fd = fd;
+            result.connections++;
+        }
+        pool.resize(result.connections);
+        
+        LatencyHistogram round_trip;
+        auto start = chrono::steady_clock::now();
+        auto deadline = start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+        auto last_response = start;
+        int in_flight = 0;
+        auto sendBatch = [&](uint32_t index) {
+            ServiceClientConnection& connection = pool[index];
+            for (int r = 0; r < depth; r++) {
+                connection.output += nextRequest(rng, popularity);
+            }
+            connection.outstanding = depth;
+            connection.sent_at = chrono::steady_clock::now();
+            in_flight++;
+            return flush(epoll_fd, connection, index);
+        };
+        for (uint32_t i = 0; i < pool.size(); i++) {
+            sendBatch(i);
+        }
         
-        ResearchJournal* journal1 = new ResearchJournal();
-        journal1->book_name = "Journal of Computer Science";
-        journal1->book_Id = 104;
-        journal1->author_name = "Various";
-        journal1->publisher = "IEEE";
-        journal1->ISBN_no = 1067890123;
-        journal1->no_of_copies = 2;
-        journal1->no_of_copies_issued = 0;
-        journal1->availability = true;
-        journal1->journal_name = "IEEE Transactions on Software Engineering";
-        journal1->volume = 45;
-        journal1->issue = 3;
-        addBook(journal1);
+        vector<epoll_event> events(1024);
+        char chunk[16384];
+        while (in_flight > 0) {
+            auto now = chrono::steady_clock::now();
+            if (now > deadline + chrono::seconds(5)) {
+                break;   // stragglers; whatever is still outstanding is not counted
+            }
+            int ready = epoll_wait(epoll_fd, events.data(), events.size(), 50);
+            for (int e = 0; e < ready; e++) {
+                uint32_t index = events[e].data.u32;
+                ServiceClientConnection& connection = pool[index];
+                if (connection.outstanding == 0 && connection.output.empty()) {
+                    continue;
+                }
+                if (events[e].events & EPOLLOUT) {
+                    flush(epoll_fd, connection, index);
+                }
+                bool lost = false;
+                while (true) {
+                    ssize_t received = recv(connection.fd, chunk, sizeof(chunk), 0);
+                    if (received > 0) {
+                        connection.input.append(chunk, received);
+                    } else if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                        break;
+                    } else if (!(received < 0 && errno == EINTR)) {
+                        lost = true;
+                        break;
+                    }
+                }
+                connection.outstanding -= consumeResponses(connection, result.non_success);
+                if (connection.outstanding <= 0 || lost) {
+                    auto done = chrono::steady_clock::now();
+                    if (connection.outstanding <= 0) {
+                        result.responses += depth;
+                        round_trip.record(chrono::duration_cast<chrono::nanoseconds>(done - connection.sent_at).count());
+                        last_response = done;
+                    }
+                    connection.outstanding = 0;
+                    in_flight--;
+                    if (lost) {
+                        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection.fd, nullptr);
+                    } else if (done < deadline) {
+                        sendBatch(index);
+                    }
+                }
+            }
+        }
+        result.seconds = chrono::duration<double>(last_response - start).count();
+        result.p50_us = round_trip.percentile(0.50) / 1000.0;
+        result.p99_us = round_trip.percentile(0.99) / 1000.0;
+        result.p999_us = round_trip.percentile(0.999) / 1000.0;
+        for (auto& connection : pool) {
+            close(connection.fd);
+        }
+        close(epoll_fd);
+        return result;
+    }
+};
+
+// Outcome of an e-book download run; plain data so a child process can pass
+// it back through a pipe.
+class EBookDownloadResult {
+public:
+    int connections;
+    int connect_error;
+    long long responses;
+    long long failures;        // responses other than 206, or bodies with the wrong bytes
+    long long bytes;
+    double seconds;
+    
+    EBookDownloadResult() : connections(0), connect_error(0), responses(0), failures(0), bytes(0), seconds(0) {}
+};
+
+class EBookReaderConnection {
+public:
+    int fd;
+    off_t next_offset;         // start of the range requested next
+    off_t body_offset;         // file offset of the next body byte to arrive
+    long long body_remaining;  // -1 while the response headers are still arriving
+    string header;
+    
+    EBookReaderConnection() : fd(-1), next_offset(0), body_offset(0), body_remaining(-1) {}
+};
+
+// Readers downloading one e-book at the same time, each on its own
+// connection with its own access token, in Range requests of a fixed size
+// with one request in flight. The first and last byte of every chunk that
+// arrives are checked against the pattern the benchmark wrote into the file.
+class EBookReaderClient {
+public:
+    uint16_t port;
+    vector<string> tokens;
+    off_t file_size;
+    size_t range_bytes;
+    
+    EBookReaderClient(uint16_t p, const vector<string>& t, off_t size, size_t range)
+        : port(p), tokens(t), file_size(size), range_bytes(max(range, (size_t)1)) {}
+    
+    static uint8_t patternByte(off_t offset) {
+        return (uint8_t)((offset >> 12) ^ offset ^ 0x5a);
+    }
+    
+    bool requestNext(EBookReaderConnection& reader, const string& token) {
+        off_t last = min<off_t>(reader.next_offset + range_bytes, file_size) - 1;
+        string request = "GET /content?token=" + token + " HTTP/1.1\r\nHost: localhost\r\nRange: bytes=" +
+                         to_string(reader.next_offset) + "-" + to_string(last) + "\r\n\r\n";
+        reader.body_offset = reader.next_offset;
+        reader.body_remaining = -1;
+        reader.header.clear();
+        return send(reader.fd, request.data(), request.size(), MSG_NOSIGNAL) == (ssize_t)request.size();
+    }
+    
+    // Consumes received bytes; returns the number of responses they completed.
+    int consume(EBookReaderConnection& reader, const char* data, size_t length, EBookDownloadResult& result) {
+        int completed = 0;
+        while (length > 0) {
+            if (reader.body_remaining < 0) {
+                size_t before = reader.header.size();
+                reader.header.append(data, length);
+                size_t header_end = reader.header.find("\r\n\r\n");
+                if (header_end == string::npos) {
+                    return completed;
+                }
+                size_t used = header_end + 4 - before;
+                data += used;
+                length -= used;
+                size_t length_at = reader.header.find("Content-Length: ");
+                reader.body_remaining = length_at < header_end ? strtoll(reader.header.c_str() + length_at + 16, nullptr, 10) : 0;
+                if (reader.header.compare(9, 3, "206") != 0) {
+                    result.failures++;
+                }
+            }
+            size_t take = min((size_t)reader.body_remaining, length);
+            if (take > 0) {
+                if ((uint8_t)data[0] != patternByte(reader.body_offset) ||
+                    (uint8_t)data[take - 1] != patternByte(reader.body_offset + take - 1)) {
+                    result.failures++;
+                }
+                reader.body_offset += take;
+                reader.body_remaining -= take;
+                result.bytes += take;
+                data += take;
+                length -= take;
+            }
+            if (reader.body_remaining == 0) {
+                completed++;
+                reader.next_offset = reader.body_offset;
+                reader.body_remaining = -1;
+                reader.header.clear();
+            }
+        }
+        return completed;
+    }
+    
+    EBookDownloadResult run() {
+        EBookDownloadResult result;
+        LibraryHttpService::raiseFileLimit();
+        int epoll_fd = epoll_create1(0);
+        vector<EBookReaderConnection> readers(tokens.size());
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        for (size_t i = 0; i < readers.size(); i++) {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+                result.connect_error = errno;
+                if (fd >= 0) {
+                    close(fd);
+                }
+                break;
+            }
+            LibraryHttpService::setNonBlocking(fd);
+            epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.u32 = i;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+            readers[i].fd = fd;
+            result.connections++;
+        }
+        readers.resize(result.connections);
         
-        Student* student1 = new Student();
-        student1->name = "Prabuddha Saxena";
-        student1->member_id = "S001";
-        student1->contact = 9479979748;
-        student1->email = "jprabuddha02.04@gmail.com";
-        student1->address = "123 Student Ave";
-        student1->department = "Computer Science";
-        student1->year = "1st";
-        student1->fine = false;
-        student1->fine_amount = 0;
-        addMember(student1);
+        auto start = chrono::steady_clock::now();
+        int active = 0;
+        for (size_t i = 0; i < readers.size(); i++) {
+            active += requestNext(readers[i], tokens[i]);
+        }
+        vector<epoll_event> events(1024);
+        vector<char> chunk(1 << 18);
+        while (active > 0) {
+            int ready = epoll_wait(epoll_fd, events.data(), events.size(), 1000);
+            if (ready == 0) {
+                break;   // the service stopped answering
+            }
+            for (int e = 0; e < ready; e++) {
+                uint32_t index = events[e].data.u32;
+                EBookReaderConnection& reader = readers[index];
+                bool finished = false;
+                while (!finished) {
+                    ssize_t received = recv(reader.fd, chunk.data(), chunk.size(), 0);
+                    if (received > 0) {
+                        if (consume(reader, chunk.data(), received, result) > 0) {
+                            result.responses++;
+                            if (reader.next_offset >= file_size) {
+                                finished = true;
+                            } else if (!requestNext(reader, tokens[index])) {
+                                result.failures++;
+                                finished = true;
+                            }
+                        }
+                    } else if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                        break;
+                    } else if (!(received < 0 && errno == EINTR)) {
+                        result.failures++;
+                        finished = true;
+                    }
+                }
+                if (finished) {
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, reader.fd, nullptr);
+                    active--;
+                }
+            }
+        }
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        for (auto& reader : readers) {
+            close(reader.fd);
+        }
+        close(epoll_fd);
+        return result;
+    }
+};
+
+void LibrarySystem::runLoadTest() {
+    WorkloadConfig config;
+    cout << "Number of books: ";
+    cin >> config.books;
+    cout << "Number of members: ";
+    cin >> config.members;
+    cout << "Faculty ratio (0-1): ";
+    cin >> config.faculty_ratio;
+    cout << "Worker threads: ";
+    cin >> config.threads;
+    cout << "Target rate (ops/sec, 0 = unthrottled): ";
+    cin >> config.target_rate;
+    cout << "Total operations: ";
+    cin >> config.operations;
+    
+    BenchmarkFixture<> bench(config);
+    LibrarySystem& target = bench.populate();
+    InMemoryNotificationSink* sink = new InMemoryNotificationSink();
+    target.notifications.setSink(unique_ptr<NotificationSink>(sink));
+    WorkloadResult result;
+    bench.generator.run(target, result);
+    result.display(config);
+    
+    // Every notification is either rejected by a full queue or delivered.
+    target.notifications.flush();
+    uint64_t enqueued = target.notifications.enqueued.load(), rejected = target.notifications.rejected.load();
+    uint64_t delivered = target.notifications.delivered.load();
+    bool accounted = delivered == enqueued && sink->count() == delivered;
+    cout << "Notifications: " << enqueued << " enqueued, " << rejected << " rejected (queue full), " << sink->count()
+         << " received by the sink - " << (accounted ? "all accounted for" : "MISMATCH") << endl;
+}
+
+// Raises the offered rate step by step until the instance stops keeping up
+// (achieved < 90% of offered) or p99 exceeds the latency budget.
+void LibrarySystem::findSaturationPoint() {
+    WorkloadConfig config;
+    double p99_budget_ms;
+    cout << "Number of books: ";
+    cin >> config.books;
+    cout << "Number of members: ";
+    cin >> config.members;
+    cout << "Worker threads: ";
+    cin >> config.threads;
+    cout << "p99 latency budget (ms): ";
+    cin >> p99_budget_ms;
+    
+    BenchmarkFixture<> bench(config);
+    LibrarySystem& target = bench.populate();
+    WorkloadGenerator& generator = bench.generator;
+    
+    cout << fixed << setprecision(1);
+    cout << right << setw(14) << "Offered/s" << setw(14) << "Achieved/s" << setw(12) << "p99(us)" << endl;
+    double saturation = 0;
+    for (double rate = 1000; rate <= 64e6; rate *= 2) {
+        generator.config.target_rate = rate;
+        generator.config.operations = max((long long)(rate / 2), 1000LL);   // about half a second per step
+        WorkloadResult result;
+        generator.run(target, result);
+        double p99_us = result.overall.percentile(0.99) / 1000.0;
+        cout << setw(14) << rate << setw(14) << result.throughput() << setw(12) << p99_us << endl;
+        saturation = max(saturation, result.throughput());
+        if (result.throughput() < 0.9 * rate || p99_us > p99_budget_ms * 1000) {
+            break;
+        }
+    }
+    cout << "Saturation point: ~" << saturation << " ops/sec" << endl;
+}
+
+// Runs the same workload against consortia of 1, 2, 4, ... branches with one
+// worker thread per branch and reports how throughput scales.
+void LibrarySystem::runShardScalingBenchmark() {
+    WorkloadConfig config;
+    int max_branches;
+    cout << "Maximum number of branches: ";
+    cin >> max_branches;
+    cout << "Number of titles: ";
+    cin >> config.books;
+    cout << "Members per branch: ";
+    cin >> config.members;
+    cout << "Operations per branch: ";
+    cin >> config.operations;
+    
+    BenchmarkFixture<LibraryConsortium> bench(config, 1);
+    double baseline = 0;
+    cout << fixed << setprecision(1);
+    cout << right << setw(10) << "Branches" << setw(14) << "Ops/sec" << setw(10) << "Speedup"
+         << setw(12) << "p99(us)" << setw(12) << "Local" << setw(12) << "Transfers" << endl;
+    for (int branches = 1; branches <= max_branches; branches *= 2) {
+        WorkloadConfig step = config;
+        step.threads = branches;
+        step.members = config.members * branches;
+        step.operations = config.operations * branches;
+        bench.reset(step, branches);
+        LibraryConsortium& consortium = bench.populate("");
+        WorkloadResult result;
+        bench.generator.run(consortium, result);
+        if (branches == 1) {
+            baseline = result.throughput();
+        }
+        cout << setw(10) << branches << setw(14) << result.throughput()
+             << setw(10) << (baseline > 0 ? result.throughput() / baseline : 0)
+             << setw(12) << result.overall.percentile(0.99) / 1000.0
+             << setw(12) << consortium.local_issues.load() << setw(12) << consortium.transferred_issues.load() << endl;
+    }
+    cout << "Hardware threads available: " << thread::hardware_concurrency() << endl;
+}
+
+// Measures checkout latency while a full-catalog export runs continuously in
+// another thread, first with no export, then with an export that walks the
+// live records under the circulation lock, then with the snapshot export.
+void LibrarySystem::runSnapshotExportBenchmark() {
+    WorkloadConfig config;
+    cout << "Number of books: ";
+    cin >> config.books;
+    cout << "Number of members: ";
+    cin >> config.members;
+    cout << "Worker threads: ";
+    cin >> config.threads;
+    cout << "Operations per run: ";
+    cin >> config.operations;
+    
+    BenchmarkFixture<> bench(config);
+    LibrarySystem& target = bench.populate();
+    
+    static const char* modes[3] = {"no export", "locked walk", "snapshot"};
+    cout << fixed << setprecision(2);
+    cout << left << setw(14) << "Export" << right << setw(10) << "Exports" << setw(14) << "Ops/sec"
+         << setw(14) << "issue p50(us)" << setw(14) << "issue p99(us)" << setw(15) << "issue p999(us)" << endl;
+    for (int mode = 0; mode < 3; mode++) {
+        atomic<bool> done(false);
+        atomic<long long> exports(0);
+        thread exporter;
+        if (mode == 2) {
+            target.startSnapshotPublisher(LibraryHttpService::SNAPSHOT_INTERVAL_MS);
+        }
+        if (mode > 0) {
+            exporter = thread([&, mode] {
+                ostringstream out;
+                while (!done.load(memory_order_relaxed)) {
+                    out.str("");
+                    if (mode == 1) {
+                        lock_guard<mutex> lock(target.circulation_mutex);
+                        for (const auto& book : target.book_collection) {
+                            writeCatalogRow(out, book);
+                        }
+                    } else {
+                        exportCatalog(out, *target.snapshot());
+                    }
+                    exports.fetch_add(1, memory_order_relaxed);
+                }
+            });
+        }
+        WorkloadResult result;
+        bench.generator.run(target, result);
+        done = true;
+        if (exporter.joinable()) {
+            exporter.join();
+        }
+        target.stopSnapshotPublisher();
+        const LatencyHistogram& issue = result.latency[LOAD_ISSUE];
+        cout << left << setw(14) << modes[mode] << right << setw(10) << exports.load() << setw(14) << result.throughput()
+             << setw(14) << issue.percentile(0.50) / 1000.0 << setw(14) << issue.percentile(0.99) / 1000.0
+             << setw(15) << issue.percentile(0.999) / 1000.0 << endl;
+    }
+    cout << "Hardware threads available: " << thread::hardware_concurrency() << endl;
+}
+
+// Descriptor on which a child started by spawnSelf() writes its result.
+const int CHILD_RESULT_FD = 3;
+
+// Starts this program again as a child process with the given arguments
+// (args[0] is the mode). The benchmarks that need a second process call this
+// after their own threads are running, so the child execs straight after
+// fork() and only async-signal-safe calls run in between. input_fd becomes
+// the child's standard input when it is not -1, and result_fd becomes its
+// CHILD_RESULT_FD. Returns the child's pid, or -1.
+pid_t spawnSelf(const vector<string>& args, int input_fd, int result_fd) {
+    vector<char*> argv;
+    string program = "/proc/self/exe";
+    argv.push_back(&program[0]);
+    for (const auto& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    cout.flush();
+    pid_t child = fork();
+    if (child == 0) {
+        if (input_fd >= 0 && dup2(input_fd, STDIN_FILENO) < 0) {
+            _exit(127);
+        }
+        if (result_fd == CHILD_RESULT_FD ? fcntl(result_fd, F_SETFD, 0) < 0 : dup2(result_fd, CHILD_RESULT_FD) < 0) {
+            _exit(127);
+        }
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    return child;
+}
+
+// Writes a child's result to CHILD_RESULT_FD; the exit status for main().
+template <typename Result>
+int reportToParent(const Result& result) {
+    ssize_t written = write(CHILD_RESULT_FD, &result, sizeof(result));
+    return written == (ssize_t)sizeof(result) ? 0 : 1;
+}
+
+// The client side of runServiceLoadTest, run by main() in the child:
+// --service-load-client <port> <connections> <depth> <seconds> <books> <members>
+int runServiceLoadClient(int argc, char* argv[]) {
+    if (argc < 8) {
+        return 1;
+    }
+    ServiceLoadClient client(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]), atof(argv[5]), atoi(argv[6]), atoi(argv[7]),
+                             1, "load-test");
+    return reportToParent(client.run());
+}
+
+// Serves a synthetic catalog over loopback HTTP and drives it from a client
+// process, so each side gets its own descriptor table for the sockets.
+void LibrarySystem::runServiceLoadTest() {
+    WorkloadConfig config;
+    int connections, depth, workers;
+    double seconds;
+    cout << "Concurrent connections: ";
+    cin >> connections;
+    cout << "Pipelined requests per connection: ";
+    cin >> depth;
+    cout << "Duration (seconds): ";
+    cin >> seconds;
+    cout << "Service worker threads: ";
+    cin >> workers;
+    
+    BenchmarkFixture<> bench(config);
+    LibrarySystem& target = bench.populate();
+    target.addLibrarian(new Librarian("Load Test Desk", 1, "desk@library.com", "load-test"));
+    LibraryHttpService service(target, workers);
+    if (!service.start(0)) {
+        return;
+    }
+    cout << "Open file limit: " << LibraryHttpService::raiseFileLimit() << endl;
+    cout << "Running " << connections << " connections x " << depth << " pipelined requests for " << seconds << " s..." << endl;
+    
+    int channel[2];
+    if (pipe2(channel, O_CLOEXEC) != 0) {
+        cout << "Could not create pipe: " << strerror(errno) << endl;
+        return;
+    }
+    pid_t child = spawnSelf({"--service-load-client", to_string(service.bound_port), to_string(connections),
+                             to_string(depth), to_string(seconds), to_string(config.books), to_string(config.members)},
+                            -1, channel[1]);
+    close(channel[1]);
+    if (child < 0) {
+        cout << "Could not start the client process: " << strerror(errno) << endl;
+        close(channel[0]);
+        return;
+    }
+    ServiceLoadResult result;
+    bool received = read(channel[0], &result, sizeof(result)) == (ssize_t)sizeof(result);
+    close(channel[0]);
+    waitpid(child, nullptr, 0);
+    service.stop();
+    
+    if (!received) {
+        cout << "The client process did not report a result!" << endl;
+        return;
+    }
+    cout << "\n======= SERVICE LOAD TEST =======" << endl;
+    cout << "Connections established: " << result.connections << " of " << connections << endl;
+    if (result.connect_error) {
+        cout << "First connect failure: " << strerror(result.connect_error) << endl;
+    }
+    cout << fixed << setprecision(2);
+    cout << "Responses: " << result.responses << " (" << result.non_success << " non-2xx) in " << result.seconds << " s" << endl;
+    cout << "Requests/sec: " << (result.seconds > 0 ? result.responses / result.seconds : 0) << endl;
+    cout << "Batch round trip p50/p99/p999: " << result.p50_us << " / " << result.p99_us << " / " << result.p999_us << " us" << endl;
+    bench.restoreFormat();
+    cout << "=================================" << endl;
+    service.displayStats();
+}
+
+// Cost of a password check at login, and of validating a session token on a
+// request with one shard (a single lock) versus the sharded table.
+void LibrarySystem::runSessionBenchmark() {
+    int session_count, threads;
+    long long validations;
+    cout << "Open sessions: ";
+    cin >> session_count;
+    cout << "Validating threads: ";
+    cin >> threads;
+    cout << "Validations per thread: ";
+    cin >> validations;
+    threads = max(threads, 1);
+    
+    BenchmarkFixture<> bench;
+    auto hash_start = chrono::steady_clock::now();
+    PasswordHash hash = PasswordHash::create("benchmark-password");
+    bool verified = hash.verify("benchmark-password");
+    double login_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - hash_start).count() / 2;
+    cout << fixed << setprecision(2);
+    cout << "Password hash: PBKDF2-HMAC-SHA256, " << hash.iterations << " iterations, " << login_ms
+         << " ms per check" << (verified ? "" : " (verification FAILED)") << endl;
+    
+    cout << right << setw(8) << "Shards" << setw(20) << "ns/validation(1T)" << setw(24)
+         << ("validations/sec(" + to_string(threads) + "T)") << endl;
+    for (size_t shard_count : {(size_t)1, (size_t)64}) {
+        SessionTable table(shard_count);
+        vector<string> tokens;
+        for (int i = 0; i < max(session_count, 1); i++) {
+            tokens.push_back(table.open(1000 + i, "Desk " + to_string(i)));
+        }
+        atomic<long long> valid(0);
+        auto validate = [&](int thread_index) {
+            mt19937_64 rng(thread_index + 1);
+            long long ok = 0;
+            for (long long i = 0; i < validations; i++) {
+                ok += table.validate(tokens[rng() % tokens.size()]);
+            }
+            valid.fetch_add(ok);
+        };
         
-        Faculty* faculty1 = new Faculty();
-        faculty1->name = "Dr. Sarah Johnson";
-        faculty1->member_id = "F001";
-        faculty1->contact = 8765432109;
-        faculty1->email = "sarah@example.com";
-        faculty1->address = "456 Faculty Blvd";
-        faculty1->department = "Computer Science";
-        faculty1->designation = "Professor";
-        faculty1->fine = false;
-        faculty1->fine_amount = 0;
-        addMember(faculty1);
+        auto start = chrono::steady_clock::now();
+        validate(0);
+        double single_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
         
-        Librarian* librarian1 = new Librarian();
-        librarian1->name = "Mark Wilson";
-        librarian1->staff_id = 3001;
-        librarian1->email = "mark@library.com";
-        librarian1->password = "library123";
-        addLibrarian(librarian1);
+        start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back(validate, t);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        long long total = validations * (threads + 1);
+        cout << setw(8) << shard_count << setw(20) << single_seconds * 1e9 / max(validations, 1LL)
+             << setw(24) << validations * threads / max(seconds, 1e-9)
+             << (valid.load() == total ? "" : "  (rejected tokens!)") << endl;
+    }
+    cout << "Hardware threads available: " << thread::hardware_concurrency() << endl;
+}
+
+// Merges a batch with a share of duplicate IDs into an existing catalog,
+// once with exact index lookups only and once behind the Bloom prefilters.
+// The duplicate check is also timed on its own, since insertion dominates
+// the full merge.
+void LibrarySystem::runIngestBenchmark() {
+    int existing, incoming;
+    double duplicate_percent;
+    cout << "Books already in the catalog: ";
+    cin >> existing;
+    cout << "Books in the incoming batch: ";
+    cin >> incoming;
+    cout << "Duplicate share of the batch (%): ";
+    cin >> duplicate_percent;
+    existing = max(existing, 1);
+    incoming = max(incoming, 1);
+    
+    // Batch records in random ID order; the duplicate share reuses existing
+    // IDs. Members follow the books at one per five.
+    auto makeBatch = [&](int count, int id_base, bool with_duplicates, vector<Books*>& books, vector<Member*>& members) {
+        mt19937_64 rng(7);
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        vector<int> ids;
+        for (int i = 0; i < count; i++) {
+            bool duplicate = with_duplicates && unit(rng) * 100 < duplicate_percent;
+            ids.push_back(duplicate ? 100000 + (int)(rng() % existing) : id_base + i);
+        }
+        shuffle(ids.begin(), ids.end(), rng);
+        for (size_t i = 0; i < ids.size(); i++) {
+            int id = ids[i];
+            books.push_back(new Books("Title " + to_string(id), id, "Author", "Press", 400000000 + id, 1));
+            if (i % 5 == 0) {
+                char member_id[16];
+                snprintf(member_id, sizeof(member_id), "M%07d", id - 100000);
+                members.push_back(new Student("Member", member_id, "", "member@example.com", "Campus", "Science", "1st"));
+            }
+        }
+    };
+    
+    static const char* modes[2] = {"exact only", "prefiltered"};
+    double book_ns[2] = {0, 0}, member_ns[2] = {0, 0}, merge_ms[2] = {0, 0};
+    BenchmarkFixture<> bench;
+    cout << fixed << setprecision(2);
+    cout << left << setw(14) << "Checks" << right << setw(12) << "book ns" << setw(12) << "member ns"
+         << setw(12) << "merge ms" << setw(10) << "Added" << setw(12) << "Duplicates" << setw(14) << "Index probes" << endl;
+    for (int mode = 0; mode < 2; mode++) {
+        LibrarySystem& target = bench.reset(WorkloadConfig());
+        target.use_prefilter = mode == 1;
+        vector<Books*> books;
+        vector<Member*> members;
+        makeBatch(existing, 100000, false, books, members);
+        target.mergeCatalog(books, members);
+        books.clear();
+        members.clear();
+        makeBatch(incoming, 100000 + existing, true, books, members);
+        
+        {
+            lock_guard<mutex> lock(target.circulation_mutex);
+            auto start = chrono::steady_clock::now();
+            for (Books* book : books) {
+                if (!target.bookIdTaken(book->book_Id)) {
+                    target.isbnTaken(book->ISBN_no);
+                }
+            }
+            auto books_done = chrono::steady_clock::now();
+            for (Member* member : members) {
+                target.memberIdTaken(member->member_id);
+            }
+            book_ns[mode] = chrono::duration<double, nano>(books_done - start).count() / books.size();
+            member_ns[mode] = chrono::duration<double, nano>(chrono::steady_clock::now() - books_done).count() /
+                              max(members.size(), (size_t)1);
+        }
+        
+        auto start = chrono::steady_clock::now();
+        IngestResult result = target.mergeCatalog(books, members);
+        merge_ms[mode] = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << left << setw(14) << modes[mode] << right << setw(12) << book_ns[mode] << setw(12) << member_ns[mode]
+             << setw(12) << merge_ms[mode] << setw(10) << result.added_books + result.added_members
+             << setw(12) << result.duplicate_books + result.duplicate_members << setw(14) << result.exact_lookups << endl;
+        if (mode == 1) {
+            cout << endl;
+            target.displayPrefilterStats();
+        }
+    }
+    cout << fixed << setprecision(2);
+    cout << "\nSpeedup with prefilters: book checks " << book_ns[0] / max(book_ns[1], 1e-9) << "x, member checks "
+         << member_ns[0] / max(member_ns[1], 1e-9) << "x, whole merge " << merge_ms[0] / max(merge_ms[1], 1e-9) << "x" << endl;
+}
+
+// Builds a circulation history with the workload generator, then times the
+// copies-needed ranking over all of it at 1, 2, 4, ... worker threads.
+void LibrarySystem::runDemandForecastBenchmark() {
+    WorkloadConfig config;
+    int max_threads;
+    cout << "Number of books: ";
+    cin >> config.books;
+    cout << "Number of members: ";
+    cin >> config.members;
+    cout << "Operations to generate history: ";
+    cin >> config.operations;
+    cout << "Maximum forecast threads: ";
+    cin >> max_threads;
+    config.operations_per_day = 20000;
+    
+    BenchmarkFixture<> bench(config);
+    LibrarySystem& target = bench.populate("Building synthetic catalog and history...");
+    WorkloadResult result;
+    bench.generator.run(target, result);
+    int window_days = LibraryClock::today() - bench.saved_day + 1;
+    
+    cout << fixed << setprecision(3);
+    cout << right << setw(8) << "Threads" << setw(14) << "Rows" << setw(12) << "Seconds" << setw(16) << "Rows/sec"
+         << setw(10) << "Titles" << setw(12) << "Top title" << endl;
+    for (int threads = 1; threads <= max(max_threads, 1); threads *= 2) {
+        long long rows = 0;
+        auto start = chrono::steady_clock::now();
+        vector<TitleForecast> forecasts = target.forecastCopiesNeeded(window_days, threads, &rows);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << setw(8) << threads << setw(14) << rows << setw(12) << seconds << setw(16) << setprecision(0)
+             << rows / max(seconds, 1e-9) << setw(10) << forecasts.size() << setw(12)
+             << (forecasts.empty() ? 0 : forecasts[0].book_id) << setprecision(3) << endl;
+    }
+    cout << "Hardware threads available: " << thread::hardware_concurrency() << endl;
+}
+
+// Rebuilds the co-borrowing model of this library, or of a generated
+// history, and times the rebuild and neighbour lookups.
+void LibrarySystem::runRecommendationRebuild() {
+    int threads;
+    long long operations;
+    cout << "Worker threads: ";
+    cin >> threads;
+    cout << "Synthetic operations (0 = rebuild this library): ";
+    cin >> operations;
+    
+    WorkloadConfig config;
+    config.books = 20000;
+    config.members = 5000;
+    config.operations = operations;
+    BenchmarkFixture<> bench(config);
+    LibrarySystem* target = this;
+    if (operations > 0) {
+        target = &bench.populate("Building synthetic catalog and history...");
+        WorkloadResult result;
+        bench.generator.run(*target, result);
+    }
+    
+    // Neighbour lists kept up by the issues so far, to compare with the rebuild.
+    unordered_map<int, vector<Neighbor>> incremental;
+    {
+        shared_lock<shared_mutex> lock(target->recommendations.model_mutex);
+        incremental = target->recommendations.neighbors;
+    }
+    
+    auto start = chrono::steady_clock::now();
+    size_t pairs;
+    try {
+        pairs = target->rebuildRecommendations(threads);
+    } catch (const LibraryException& e) {
+        cout << "Error: " << e.what() << endl;
+        return;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    vector<int> titles;
+    size_t same_top = 0, suggested = 0;
+    {
+        shared_lock<shared_mutex> lock(target->recommendations.model_mutex);
+        for (const auto& entry : target->recommendations.neighbors) {
+            titles.push_back(entry.first);
+            auto before = incremental.find(entry.first);
+            size_t shown = min(entry.second.size(), (size_t)5);
+            for (size_t i = 0; before != incremental.end() && i < shown; i++) {
+                for (size_t j = 0; j < min(before->second.size(), (size_t)5); j++) {
+                    same_top += before->second[j].book_id == entry.second[i].book_id;
+                }
+            }
+            suggested += shown;
+        }
+    }
+    cout << fixed << setprecision(3);
+    cout << "Rebuilt " << pairs << " title pairs for " << titles.size() << " titles in " << seconds << " s on "
+         << max(threads, 1) << " thread(s)" << endl;
+    if (!titles.empty()) {
+        cout << "Top-5 suggestions already made by the incremental model: " << setprecision(1)
+             << 100.0 * same_top / max(suggested, (size_t)1) << "%" << endl;
+        const long long LOOKUPS = 1000000;
+        mt19937_64 rng(5);
+        size_t found = 0;
+        start = chrono::steady_clock::now();
+        for (long long i = 0; i < LOOKUPS; i++) {
+            found += target->recommendations.lookup(titles[rng() % titles.size()], 5).size();
+        }
+        double lookup_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / LOOKUPS;
+        cout << "Lookup: " << setprecision(0) << lookup_ns << " ns for up to 5 suggestions (" << setprecision(2)
+             << (double)found / LOOKUPS << " on average)" << endl;
+    }
+}
+
+// Virtual dispatch through the mixed catalog, virtual dispatch over the same
+// records grouped by type, and the CRTP layer over one concrete type at a
+// time, on the loan-limit check issueBook makes and on rendering details.
+void LibrarySystem::runDispatchBenchmark() {
+    int records;
+    cout << "Records per type: ";
+    cin >> records;
+    if (records <= 0) {
+        cout << "Invalid number of records!" << endl;
+        return;
+    }
+    
+    BenchmarkFixture<> bench;
+    vector<EBook> ebooks;
+    vector<ResearchJournal> journals;
+    vector<Student> students;
+    vector<Faculty> faculty;
+    ebooks.reserve(records);
+    journals.reserve(records);
+    students.reserve(records);
+    faculty.reserve(records);
+    mt19937 rng(40);
+    for (int i = 0; i < records; i++) {
+        ebooks.emplace_back("E-Book " + to_string(i), 2 * i, "Author", "Publisher", i, 3, "PDF",
+                            "https://library.example/e/" + to_string(i));
+        journals.emplace_back("Journal " + to_string(i), 2 * i + 1, "Author", "Publisher", i, 2,
+                              "Journal of Tests", i % 40, i % 12);
+        students.emplace_back("Student " + to_string(i), "S" + to_string(i), to_string(5550000 + i), "s@library.example",
+                              "Campus", "CS", "2");
+        faculty.emplace_back("Faculty " + to_string(i), "F" + to_string(i), to_string(5560000 + i), "f@library.example",
+                             "Campus", "CS", "Professor");
+        for (int j = (int)(rng() % 6); j > 0; j--) {
+            students.back().addIssuedBook(j);
+            faculty.back().addIssuedBook(j);
+        }
+    }
+    // The catalog view: both types interleaved, as the library stores them.
+    vector<Books*> all_books;
+    vector<Member*> all_members;
+    vector<EBook*> ebook_ptrs;
+    vector<ResearchJournal*> journal_ptrs;
+    vector<Student*> student_ptrs;
+    vector<Faculty*> faculty_ptrs;
+    for (int i = 0; i < records; i++) {
+        all_books.push_back(&ebooks[i]);
+        all_books.push_back(&journals[i]);
+        all_members.push_back(&students[i]);
+        all_members.push_back(&faculty[i]);
+        ebook_ptrs.push_back(&ebooks[i]);
+        journal_ptrs.push_back(&journals[i]);
+        student_ptrs.push_back(&students[i]);
+        faculty_ptrs.push_back(&faculty[i]);
+    }
+    // The same records grouped by type and in order, still through the base
+    // classes, so the grouped loops differ from the static ones only in dispatch.
+    vector<Books*> grouped_books(all_books);
+    vector<Member*> grouped_members(all_members);
+    shuffle(all_books.begin(), all_books.end(), rng);
+    shuffle(all_members.begin(), all_members.end(), rng);
+    stable_partition(grouped_books.begin(), grouped_books.end(),
+                     [](const Books* b) { return strcmp(b->typeName(), EBook::TYPE_NAME) == 0; });
+    stable_partition(grouped_members.begin(), grouped_members.end(),
+                     [](const Member* m) { return strcmp(m->typeName(), Student::TYPE_NAME) == 0; });
+    
+    // Issue path: limit check, then issue and return the copy.
+    const int ISSUE_ROUNDS = max(1, 20000000 / (2 * records));
+    long long granted_virtual = 0, granted_grouped = 0, granted_static = 0;
+    auto start = chrono::steady_clock::now();
+    for (int round = 0; round < ISSUE_ROUNDS; round++) {
+        for (size_t i = 0; i < all_members.size(); i++) {
+            Member* member = all_members[i];
+            Books* book = all_books[i];
+            if ((int)member->issued_book_ids.size() < member->getMaxBooks() && book->issueBook()) {
+                book->returnBook();
+                granted_virtual++;
+            }
+        }
+    }
+    double issue_virtual = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for (int round = 0; round < ISSUE_ROUNDS; round++) {
+        for (size_t i = 0; i < grouped_members.size(); i++) {
+            Member* member = grouped_members[i];
+            Books* book = grouped_books[i];
+            if ((int)member->issued_book_ids.size() < member->getMaxBooks() && book->issueBook()) {
+                book->returnBook();
+                granted_grouped++;
+            }
+        }
+    }
+    double issue_grouped = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for (int round = 0; round < ISSUE_ROUNDS; round++) {
+        for (int i = 0; i < records; i++) {
+            if (student_ptrs[i]->withinLoanLimit() && ebook_ptrs[i]->issueBook()) {
+                ebook_ptrs[i]->returnBook();
+                granted_static++;
+            }
+        }
+        for (int i = 0; i < records; i++) {
+            if (faculty_ptrs[i]->withinLoanLimit() && journal_ptrs[i]->issueBook()) {
+                journal_ptrs[i]->returnBook();
+                granted_static++;
+            }
+        }
+    }
+    double issue_static = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    
+    // Display path: full record details rendered into a buffer.
+    const int DISPLAY_ROUNDS = max(1, 400000 / (4 * records));
+    size_t bytes_virtual = 0, bytes_grouped = 0, bytes_static = 0;
+    ostringstream out;
+    start = chrono::steady_clock::now();
+    for (int round = 0; round < DISPLAY_ROUNDS; round++) {
+        out.str("");
+        for (const Books* book : all_books) {
+            book->writeDetails(out);
+        }
+        for (const Member* member : all_members) {
+            member->writeDetails(out);
+        }
+        bytes_virtual += out.tellp();
+    }
+    double display_virtual = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for (int round = 0; round < DISPLAY_ROUNDS; round++) {
+        out.str("");
+        for (const Books* book : grouped_books) {
+            book->writeDetails(out);
+        }
+        for (const Member* member : grouped_members) {
+            member->writeDetails(out);
+        }
+        bytes_grouped += out.tellp();
+    }
+    double display_grouped = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for (int round = 0; round < DISPLAY_ROUNDS; round++) {
+        out.str("");
+        renderAll(out, ebook_ptrs);
+        renderAll(out, journal_ptrs);
+        renderAll(out, student_ptrs);
+        renderAll(out, faculty_ptrs);
+        bytes_static += out.tellp();
+    }
+    double display_static = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    
+    double issue_checks = (double)ISSUE_ROUNDS * 2 * records;
+    double rendered = (double)DISPLAY_ROUNDS * 4 * records;
+    cout << fixed << setprecision(2);
+    // Mixed against grouped virtual is the memory layout; grouped virtual
+    // against static is the dispatch alone.
+    cout << "Issue path (" << (long long)issue_checks << " checks, " << granted_virtual << "/" << granted_grouped << "/"
+         << granted_static << " granted):" << endl;
+    cout << "  virtual, mixed:   " << issue_virtual / issue_checks << " ns per check" << endl;
+    cout << "  virtual, grouped: " << issue_grouped / issue_checks << " ns per check" << endl;
+    cout << "  static:           " << issue_static / issue_checks << " ns per check (dispatch "
+         << issue_grouped / issue_static << "x, layout " << issue_virtual / issue_grouped << "x)" << endl;
+    cout << "Display path (" << (long long)rendered << " records, " << bytes_virtual << "/" << bytes_grouped << "/"
+         << bytes_static << " bytes):" << endl;
+    cout << "  virtual, mixed:   " << display_virtual / rendered << " ns per record" << endl;
+    cout << "  virtual, grouped: " << display_grouped / rendered << " ns per record" << endl;
+    cout << "  static:           " << display_static / rendered << " ns per record (dispatch "
+         << display_grouped / display_static << "x, layout " << display_virtual / display_grouped << "x)" << endl;
+}
+
+static long residentBytes() {
+    long pages = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// The client side of runEBookDeliveryBenchmark, run by main() in the child:
+// --ebook-client <port> <file bytes> <range bytes>, with one access token per
+// line on standard input.
+int runEBookClient(int argc, char* argv[]) {
+    if (argc < 5) {
+        return 1;
+    }
+    vector<string> tokens;
+    string token;
+    while (getline(cin, token)) {
+        tokens.push_back(token);
+    }
+    EBookReaderClient client(atoi(argv[2]), tokens, (off_t)atoll(argv[3]), (size_t)atoll(argv[4]));
+    return reportToParent(client.run());
+}
+
+// Many members reading one large e-book at once through the service: a
+// child process downloads it on one connection per reader in Range
+// requests while this process samples its own resident memory.
+void LibrarySystem::runEBookDeliveryBenchmark() {
+    int readers, file_mb, range_kb, workers;
+    cout << "Concurrent readers: ";
+    cin >> readers;
+    cout << "E-book size (MB): ";
+    cin >> file_mb;
+    cout << "Range size per request (KB): ";
+    cin >> range_kb;
+    cout << "Service worker threads: ";
+    cin >> workers;
+    if (readers <= 0 || file_mb <= 0 || range_kb <= 0) {
+        cout << "Invalid benchmark parameters!" << endl;
+        return;
+    }
+    
+    char directory[] = "/tmp/library_content_XXXXXX";
+    if (!mkdtemp(directory)) {
+        cout << "Could not create a content directory: " << strerror(errno) << endl;
+        return;
+    }
+    BenchmarkFixture<> bench;
+    LibrarySystem& target = bench.target();
+    target.ebook_content.directory = directory;
+    const int BOOK_ID = 900000;
+    target.addBook(new EBook("Benchmark Reader", BOOK_ID, "Author", "Publisher", 0, readers, "PDF", ""));
+    string path = target.ebook_content.pathFor(BOOK_ID, "PDF");
+    off_t file_size = (off_t)file_mb << 20;
+    {
+        ofstream out(path, ios::binary);
+        vector<char> block(1 << 20);
+        for (off_t at = 0; at < file_size && out; at += block.size()) {
+            for (size_t i = 0; i < block.size(); i++) {
+                block[i] = EBookReaderClient::patternByte(at + i);
+            }
+            out.write(block.data(), block.size());
+        }
+    }
+    
+    vector<string> tokens;
+    for (int i = 0; i <= readers; i++) {
+        char member_id[16];
+        snprintf(member_id, sizeof(member_id), "R%06d", i);
+        target.addMember(new Student("Reader " + to_string(i), member_id, "", "", "", "", ""));
+        try {
+            tokens.push_back(target.issueBook(BOOK_ID, member_id));
+        } catch (const BookNotAvailableException& e) {
+            cout << "Reader " << readers + 1 << " refused, all " << readers << " copies on loan: " << e.what() << endl;
+        }
+    }
+    
+    LibraryHttpService service(target, workers);
+    if (!service.start(0)) {
+        unlink(path.c_str());
+        rmdir(directory);
+        return;
+    }
+    cout << "Running " << tokens.size() << " readers over a " << file_mb << " MB e-book in " << range_kb
+         << " KB ranges..." << endl;
+    int channel[2], token_channel[2];
+    // The tokens go over a socket pair so a failed child cannot raise SIGPIPE here.
+    if (pipe2(channel, O_CLOEXEC) != 0 || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, token_channel) != 0) {
+        cout << "Could not create pipe: " << strerror(errno) << endl;
+        return;
+    }
+    long baseline = residentBytes();
+    pid_t child = spawnSelf({"--ebook-client", to_string(service.bound_port), to_string((long long)file_size),
+                             to_string((size_t)range_kb << 10)},
+                            token_channel[0], channel[1]);
+    close(channel[1]);
+    close(token_channel[0]);
+    if (child < 0) {
+        cout << "Could not start the client process: " << strerror(errno) << endl;
+        close(channel[0]);
+        close(token_channel[1]);
+        return;
+    }
+    string token_lines;
+    for (const auto& token : tokens) {
+        token_lines += token + '\n';
+    }
+    bool sent = LogShipper::sendAll(token_channel[1], token_lines);
+    close(token_channel[1]);
+    long peak = baseline;
+    pollfd waiting = {channel[0], POLLIN, 0};
+    while (poll(&waiting, 1, 20) == 0) {
+        peak = max(peak, residentBytes());
+    }
+    EBookDownloadResult result;
+    bool received = sent && read(channel[0], &result, sizeof(result)) == (ssize_t)sizeof(result);
+    close(channel[0]);
+    waitpid(child, nullptr, 0);
+    service.stop();
+    unlink(path.c_str());
+    rmdir(directory);
+    
+    if (!received) {
+        cout << "The client process did not report a result!" << endl;
+        return;
+    }
+    cout << "\n======= E-BOOK DELIVERY =======" << endl;
+    cout << "Readers connected: " << result.connections << " of " << tokens.size() << endl;
+    if (result.connect_error) {
+        cout << "First connect failure: " << strerror(result.connect_error) << endl;
+    }
+    cout << fixed << setprecision(2);
+    cout << "Ranges served: " << result.responses << " (" << result.failures << " failed) in " << result.seconds << " s" << endl;
+    cout << "Throughput: " << (result.seconds > 0 ? result.bytes / result.seconds / (1 << 20) : 0) << " MB/s ("
+         << result.bytes << " bytes, " << service.content_bytes.load() << " sent with sendfile)" << endl;
+    cout << "Service resident memory: " << baseline / 1048576.0 << " MB before, " << peak / 1048576.0
+         << " MB peak (" << (peak - baseline) / 1024.0 / max(result.connections, 1) << " KB per reader)" << endl;
+    cout << "===============================" << endl;
+}
+
+// Builds a directory of synthetic members through addMember and times
+// type-ahead queries on it, against a scan of every member as the desk
+// would otherwise have to do.
+void LibrarySystem::runMemberSearchBenchmark() {
+    int member_count;
+    cout << "Number of members: ";
+    cin >> member_count;
+    if (member_count <= 0) {
+        cout << "Invalid number of members!" << endl;
+        return;
+    }
+    static const char* first_names[] = {"James", "Mary", "Robert", "Patricia", "John", "Jennifer", "Michael", "Linda",
+                                        "David", "Elizabeth", "William", "Barbara", "Richard", "Susan", "Joseph",
+                                        "Jessica", "Thomas", "Sarah", "Charles", "Karen", "Priya", "Arjun", "Wei",
+                                        "Mei", "Omar", "Fatima", "Lucas", "Sofia", "Mateo", "Aisha"};
+    static const char* syllables[] = {"an", "ber", "cor", "dan", "el", "fer", "gar", "hol", "is", "jen", "kal", "lor",
+                                      "man", "nor", "ol", "per", "quin", "ros", "sal", "tor", "ul", "ven", "wes", "yar"};
+    mt19937_64 rng(42);
+    BenchmarkFixture<> bench;
+    LibrarySystem& target = bench.target();
+    vector<Member*> added;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < member_count; i++) {
+        string surname;
+        for (int s = 2 + rng() % 2; s > 0; s--) {
+            surname += syllables[rng() % 24];
+        }
+        surname[0] = toupper(surname[0]);
+        string first = first_names[rng() % 30];
+        char id[16];
+        snprintf(id, sizeof(id), "D%07d", i);
+        string email = first + "." + surname + to_string(i % 97) + "@example.com";
+        string phone = "+1 (" + to_string(200 + rng() % 800) + ") " + to_string(100 + rng() % 900) + "-" +
+                       to_string(1000 + rng() % 9000);
+        Member* member = new Student(first + " " + surname, id, phone, email, "Campus", "Science", "1st");
+        target.addMember(member);
+        added.push_back(member);
+    }
+    double add_us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / member_count;
+    
+    // Queries typed at the desk: the first letters of a first name or
+    // surname, of an email, or the leading digits of a phone number.
+    const int QUERIES = 20000;
+    vector<pair<string, MemberDirectory::Field>> queries;
+    for (int i = 0; i < QUERIES; i++) {
+        const Member* member = added[rng() % added.size()];
+        int kind = i % 3;
+        if (kind == 0) {
+            string word = rng() % 2 ? member->name.substr(member->name.find(' ') + 1) : member->name;
+            queries.push_back(make_pair(word.substr(0, 2 + rng() % 4), MemberDirectory::BY_NAME));
+        } else if (kind == 1) {
+            queries.push_back(make_pair(member->email.substr(0, 3 + rng() % 6), MemberDirectory::BY_EMAIL));
+        } else {
+            queries.push_back(make_pair(member->contact.digits.substr(0, 4 + rng() % 5), MemberDirectory::BY_PHONE));
+        }
+    }
+    const size_t LIMIT = 10;
+    LatencyHistogram latency;
+    size_t returned = 0;
+    {
+        lock_guard<mutex> lock(target.circulation_mutex);
+        for (const auto& query : queries) {
+            auto began = chrono::steady_clock::now();
+            returned += target.directory.search(query.first, query.second, LIMIT).size();
+            latency.recordSingleWriter(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - began).count());
+        }
     }
     
-    void run() {
-        int choice = 0;
-        
-        addSampleData();
-        
-        while (true) {
-            if (!isLibrarianLoggedIn) {
-                cout << "\n===== LIBRARY MANAGEMENT SYSTEM LOGIN =====" << endl;
-                cout << "1. Login as Librarian" << endl;
-                cout << "2. Exit" << endl;
-                cout << "Enter your choice: ";
-                cin >> choice;
-                
-                switch (choice) {
-                    case 1:
-                        if (librarianLogin()) {
-                            break;
-                        } else {
-                            continue;
-                        }
-                    case 2:
-                        cout << "Thank you for using Library Management System!" << endl;
-                        return;
-                    default:
-                        cout << "Invalid choice! Please try again." << endl;
-                        continue;
+    // The same queries as a scan over every member, for a sample of them.
+    const int SCANNED = 30;
+    start = chrono::steady_clock::now();
+    size_t scan_matches = 0;
+    for (int i = 0; i < SCANNED; i++) {
+        const auto& query = queries[i];
+        string prefix = query.second == MemberDirectory::BY_NAME ? MemberDirectory::normalizeText(query.first)
+                        : query.second == MemberDirectory::BY_EMAIL ? MemberDirectory::normalizeEmail(query.first)
+                                                                    : PhoneNumber(query.first).digits;
+        size_t found = 0;
+        for (const Member* member : target.members) {
+            if (found == LIMIT) {
+                break;
+            }
+            string name = MemberDirectory::normalizeText(member->name);
+            bool match = query.second == MemberDirectory::BY_NAME
+                             ? name.compare(0, prefix.size(), prefix) == 0 ||
+                                   name.find(" " + prefix) != string::npos
+                         : query.second == MemberDirectory::BY_EMAIL
+                             ? MemberDirectory::normalizeEmail(member->email).compare(0, prefix.size(), prefix) == 0
+                             : member->contact.digits.compare(0, prefix.size(), prefix) == 0;
+            found += match;
+        }
+        scan_matches += found;
+    }
+    double scan_us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / SCANNED;
+    
+    cout << fixed << setprecision(2);
+    cout << "\n======= MEMBER SEARCH =======" << endl;
+    cout << "Members: " << member_count << ", addMember: " << add_us << " us each (directory included)" << endl;
+    cout << "Directory: " << target.directory.names.keys + target.directory.emails.keys + target.directory.phones.keys
+         << " keys, " << target.directory.names.nodes.size() + target.directory.emails.nodes.size() +
+                             target.directory.phones.nodes.size()
+         << " trie nodes, " << target.directory.memoryBytes() / 1048576.0 << " MB" << endl;
+    cout << "Top-" << LIMIT << " prefix query: p50 " << latency.percentile(0.50) / 1000.0 << " us, p99 "
+         << latency.percentile(0.99) / 1000.0 << " us, max " << latency.percentile(1.0) / 1000.0 << " us ("
+         << (double)returned / QUERIES << " results on average)" << endl;
+    cout << "Full scan for the same queries: " << scan_us << " us each" << endl;
+    cout << "=============================" << endl;
+}
+
+// Builds a catalog of synthetic titles and authors over a Zipf-distributed
+// vocabulary, then times misspelled queries through the fuzzy index and,
+// for a sample, a scan that runs the edit-distance kernel over every book.
+void LibrarySystem::runFuzzySearchBenchmark() {
+    int book_count;
+    cout << "Number of books: ";
+    cin >> book_count;
+    book_count = max(book_count, 1);
+    
+    mt19937_64 rng(42);
+    auto pseudoWord = [&rng](int min_length, int max_length) {
+        static const char consonants[] = "bcdfghjklmnprstvwz";
+        static const char vowels[] = "aeiou";
+        int length = min_length + rng() % (max_length - min_length + 1);
+        string word;
+        for (int i = 0; i < length; i++) {
+            word += i % 2 ? vowels[rng() % 5] : consonants[rng() % 18];
+        }
+        return word;
+    };
+    vector<string> vocabulary = {"introduction", "algorithms", "data", "structures", "programming", "systems",
+                                 "theory", "analysis", "design", "networks", "learning", "computer", "principles",
+                                 "modern", "applied", "engineering", "database", "operating", "distributed",
+                                 "compilers", "mathematics", "statistics", "software", "security", "graphics",
+                                 "machine", "quantum", "economics", "advanced", "handbook", "foundations", "methods"};
+    while (vocabulary.size() < 30000) {
+        vocabulary.push_back(pseudoWord(4, 11));
+    }
+    vector<string> surnames = {"Stroustrup", "Knuth", "Cormen", "Tanenbaum", "Silberschatz", "Sedgewick", "Kernighan"};
+    while (surnames.size() < 20000) {
+        string surname = pseudoWord(5, 10);
+        surname[0] = toupper(surname[0]);
+        surnames.push_back(surname);
+    }
+    vector<string> first_names;
+    while (first_names.size() < 2000) {
+        string first = pseudoWord(3, 7);
+        first[0] = toupper(first[0]);
+        first_names.push_back(first);
+    }
+    static const char* joiners[] = {"of", "and", "in", "the", "for", "with"};
+    ZipfDistribution word_rank(vocabulary.size(), 1.0), surname_rank(surnames.size(), 0.8);
+    
+    BenchmarkFixture<> bench;
+    LibrarySystem& target = bench.target();
+    cout << "Building " << book_count << " synthetic titles..." << endl;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < book_count; i++) {
+        string title;
+        int words = 2 + rng() % 5;
+        for (int w = 0; w < words; w++) {
+            string word = vocabulary[word_rank(rng)];
+            word[0] = toupper(word[0]);
+            title += (w ? " " : "") + word;
+            if (w + 1 < words && rng() % 4 == 0) {
+                title += string(" ") + joiners[rng() % 6];
+            }
+        }
+        string author = first_names[rng() % first_names.size()] + " " + surnames[surname_rank(rng)];
+        target.addBook(new Books(title, i + 1, author, "Synthetic Press", 0, 1));
+    }
+    double add_us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / book_count;
+    
+    // Queries of one to three words from a random book, each word of five or
+    // more letters with one typo (substitution, deletion or insertion), two
+    // for words of eleven or more.
+    const int QUERIES = 2000;
+    vector<pair<string, int>> queries;   // (query, source book id)
+    while ((int)queries.size() < QUERIES) {
+        Books* source = target.findBook(1 + rng() % book_count);
+        vector<string> candidates = FuzzyTitleIndex::splitWords(
+            MemberDirectory::normalizeText(source->book_name + " " + source->author_name));
+        shuffle(candidates.begin(), candidates.end(), rng);
+        string query;
+        int taken = 0, wanted = 1 + rng() % 3;
+        for (string word : candidates) {
+            if (word.size() < 5 || taken == wanted) {
+                continue;
+            }
+            for (int typo = 0; typo < (word.size() >= 11 ? 2 : 1); typo++) {
+                size_t at = rng() % word.size();
+                int kind = rng() % 3;
+                if (kind == 0) {
+                    word[at] = 'a' + (word[at] - 'a' + 1 + rng() % 25) % 26;
+                } else if (kind == 1) {
+                    word.erase(at, 1);
+                } else {
+                    word.insert(at, 1, (char)('a' + rng() % 26));
                 }
             }
-            
-            cout << "\n===== SMART LIBRARY MANAGEMENT SYSTEM =====" << endl;
-            cout << "1. Display Books" << endl;
-            cout << "2. Display Members" << endl;
-            cout << "3. Issue Book" << endl;
-            cout << "4. Return Book" << endl;
-            cout << "5. Reserve Book" << endl;
-            cout << "6. Clear Fine" << endl;
-            cout << "7. Display Transactions" << endl;
-            cout << "8. Generate Report" << endl;
-            cout << "9. Add New Book/Member" << endl;
-            cout << "10. Logout" << endl;
-            cout << "11. Exit" << endl;
-            cout << "Enter your choice: ";
-            cin >> choice;
-            
-            switch (choice) {
+            query += (taken++ ? " " : "") + word;
+        }
+        if (taken > 0) {
+            queries.push_back(make_pair(query, source->book_Id));
+        }
+    }
+    
+    // Queries through the desk's path while another thread issues and
+    // returns a book every 200 us, to see whether searching holds up
+    // circulation.
+    const size_t LIMIT = 10;
+    LatencyHistogram latency, circulation;
+    size_t returned = 0, source_found = 0;
+    target.addMember(new Student("Reader", "FUZZY-READER", "", "", "", "", ""));
+    atomic<bool> searching(true);
+    thread desk([&] {
+        while (searching.load()) {
+            auto began = chrono::steady_clock::now();
+            target.issueBook(1, "FUZZY-READER");
+            target.returnBook(1, "FUZZY-READER");
+            circulation.record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - began).count());
+            this_thread::sleep_for(chrono::microseconds(200));
+        }
+    });
+    for (const auto& query : queries) {
+        auto began = chrono::steady_clock::now();
+        vector<pair<unique_ptr<Books>, int>> found = target.searchBooksFuzzy(query.first, LIMIT);
+        latency.recordSingleWriter(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - began).count());
+        returned += found.size();
+    }
+    searching = false;
+    desk.join();
+    {
+        lock_guard<mutex> lock(target.circulation_mutex);
+        // Whether the misspelled book is among all matches, not just the top ten.
+        for (size_t i = 0; i < 200; i++) {
+            for (const auto& match : target.title_index.search(queries[i].first, SIZE_MAX)) {
+                if (match.first->book_Id == queries[i].second) {
+                    source_found++;
+                    break;
+                }
+            }
+        }
+    }
+    
+    // A scan with the same kernel and budgets: every query word against the
+    // best-matching stretch of every book's text. Looser than the index, which
+    // matches whole words, so it finds more books.
+    const int SCANNED = 10;
+    vector<string> texts;
+    texts.reserve(book_count);
+    for (Books* book : target.book_collection) {
+        texts.push_back(MemberDirectory::normalizeText(book->book_name + " " + book->author_name));
+    }
+    start = chrono::steady_clock::now();
+    size_t scan_matches = 0;
+    for (int q = 0; q < SCANNED; q++) {
+        vector<string> query_words = FuzzyTitleIndex::splitWords(MemberDirectory::normalizeText(queries[q].first));
+        vector<EditDistanceMatcher> matchers;
+        for (const auto& word : query_words) {
+            matchers.emplace_back(word);
+        }
+        for (const string& text : texts) {
+            bool all = true;
+            for (size_t w = 0; w < matchers.size() && all; w++) {
+                int budget = FuzzyTitleIndex::maxErrors(query_words[w].size());
+                all = matchers[w].distance(text.data(), text.size(), false, budget) <= budget;
+            }
+            scan_matches += all;
+        }
+    }
+    double scan_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / SCANNED;
+    
+    cout << fixed << setprecision(2);
+    cout << "\n======= FUZZY TITLE SEARCH =======" << endl;
+    cout << "Books: " << book_count << ", addBook: " << add_us << " us each (index included)" << endl;
+    cout << "Index: " << target.title_index.words.size() << " distinct words, " << target.title_index.trigram_words.size()
+         << " trigrams, " << target.title_index.memoryBytes() / 1048576.0 << " MB" << endl;
+    cout << "Top-" << LIMIT << " query: p50 " << latency.percentile(0.50) / 1000.0 << " us, p99 "
+         << latency.percentile(0.99) / 1000.0 << " us, max " << latency.percentile(1.0) / 1000.0 << " us ("
+         << (double)returned / QUERIES << " results on average)" << endl;
+    cout << "Issue and return meanwhile: p50 " << circulation.percentile(0.50) / 1000.0 << " us, p99 "
+         << circulation.percentile(0.99) / 1000.0 << " us, max " << circulation.percentile(1.0) / 1000.0 << " us" << endl;
+    cout << "Misspelled book among the matches: " << source_found << " of 200" << endl;
+    cout << "Scan of every book with the same kernel: " << scan_ms << " ms per query ("
+         << (double)scan_matches / SCANNED << " matches on average)" << endl;
+    cout << "==================================" << endl;
+}
+
+// Back-files every journal's volumes, subscribes members, checks in one
+// month's delivery, then times volume-range queries against a scan of the
+// catalog, which is what finding a journal's issues took before.
+void LibrarySystem::runSerialsBenchmark() {
+    int journal_count;
+    cout << "Number of journals: ";
+    cin >> journal_count;
+    journal_count = max(journal_count, 1);
+    const int VOLUMES = 50, ISSUES = 12, COPIES = 2, MEMBERS = 20000;
+    
+    mt19937_64 rng(7);
+    BenchmarkFixture<> bench;
+    LibrarySystem& target = bench.target();
+    for (int i = 0; i < MEMBERS; i++) {
+        target.addMember(new Student("Reader " + to_string(i), "S" + to_string(i), "", "", "", "", ""));
+    }
+    vector<string> names;
+    for (int j = 0; j < journal_count; j++) {
+        names.push_back("Transactions on Topic " + to_string(j));
+    }
+    
+    cout << "Back-filing " << journal_count * (VOLUMES - 1) * ISSUES << " issues..." << endl;
+    int next_id = 1;
+    auto delivery = [&](int journal, int volume, int first_issue, int last_issue) {
+        vector<ResearchJournal*> issues;
+        for (int issue = first_issue; issue <= last_issue; issue++) {
+            issues.push_back(new ResearchJournal(names[journal] + " Vol. " + to_string(volume) + " No. " + to_string(issue),
+                                                 next_id++, "Various", "Synthetic Press", 0, COPIES, names[journal], volume, issue));
+        }
+        return issues;
+    };
+    auto start = chrono::steady_clock::now();
+    size_t back_filed = 0;
+    for (int j = 0; j < journal_count; j++) {
+        for (int volume = 1; volume < VOLUMES; volume++) {
+            back_filed += target.checkInIssues(delivery(j, volume, 1, ISSUES)).checked_in;
+        }
+    }
+    double back_fill_us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / back_filed;
+    
+    size_t subscriptions = 0;
+    for (int j = 0; j < journal_count; j++) {
+        int count = rng() % 31;
+        for (int k = 0; k < count; k++) {
+            subscriptions += target.subscribeToSerial(names[j], "S" + to_string(rng() % MEMBERS), true);
+        }
+    }
+    
+    // This month's delivery: the next issue of every journal, in one batch,
+    // plus one repeat that must be skipped.
+    vector<ResearchJournal*> month;
+    for (int j = 0; j < journal_count; j++) {
+        vector<ResearchJournal*> issue = delivery(j, VOLUMES, 1, 1);
+        month.insert(month.end(), issue.begin(), issue.end());
+    }
+    vector<ResearchJournal*> repeat = delivery(0, VOLUMES - 1, ISSUES, ISSUES);
+    month.push_back(repeat[0]);
+    start = chrono::steady_clock::now();
+    SerialCheckIn monthly = target.checkInIssues(month);
+    double month_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    
+    // "Volumes 40-45" style queries against random journals.
+    const int QUERIES = 5000;
+    LatencyHistogram latency;
+    size_t returned = 0;
+    vector<pair<int, int>> queries;   // (journal, first volume)
+    for (int q = 0; q < QUERIES; q++) {
+        queries.push_back(make_pair(rng() % journal_count, 1 + rng() % (VOLUMES - 5)));
+    }
+    for (const auto& query : queries) {
+        string name;
+        bool more;
+        auto began = chrono::steady_clock::now();
+        returned += target.serialIssues(names[query.first], query.second, query.second + 5, 100, name, more).size();
+        latency.recordSingleWriter(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - began).count());
+    }
+    
+    const int SCANNED = 20;
+    size_t scan_returned = 0, index_returned = 0;
+    start = chrono::steady_clock::now();
+    for (int q = 0; q < SCANNED; q++) {
+        lock_guard<mutex> lock(target.circulation_mutex);
+        const string& name = names[queries[q].first];
+        vector<ResearchJournal*> found;
+        for (Books* book : target.book_collection) {
+            ResearchJournal* journal = dynamic_cast<ResearchJournal*>(book);
+            if (journal && journal->journal_name == name && journal->volume >= queries[q].second &&
+                journal->volume <= queries[q].second + 5) {
+                found.push_back(journal);
+            }
+        }
+        sort(found.begin(), found.end(), [](const ResearchJournal* a, const ResearchJournal* b) {
+            return make_pair(a->volume, a->issue) < make_pair(b->volume, b->issue);
+        });
+        scan_returned += found.size();
+    }
+    double scan_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / SCANNED;
+    for (int q = 0; q < SCANNED; q++) {
+        index_returned += target.serials.find(names[queries[q].first])->volumes(queries[q].second, queries[q].second + 5).size();
+    }
+    
+    cout << fixed << setprecision(2);
+    cout << "\n========= SERIALS INDEX =========" << endl;
+    cout << "Journals: " << journal_count << ", issues: " << target.book_collection.size() << ", members: " << MEMBERS << endl;
+    cout << "Back-file check-in: " << back_fill_us << " us per issue (catalog, indexes and serial index)" << endl;
+    cout << "Subscriptions: " << subscriptions << endl;
+    cout << "Monthly delivery: " << monthly.checked_in << " issues in " << month_ms << " ms, " << monthly.duplicates
+         << " duplicate skipped, " << monthly.holds_placed << " holds placed, " << monthly.queue_places << " queued" << endl;
+    cout << "Volumes v..v+5 of one journal: p50 " << latency.percentile(0.50) / 1000.0 << " us, p99 "
+         << latency.percentile(0.99) / 1000.0 << " us (" << (double)returned / QUERIES << " issues on average)" << endl;
+    cout << "Catalog scan for the same query: " << scan_ms << " ms ("
+         << (scan_returned == index_returned ? "same issues" : "DIFFERENT issues") << ")" << endl;
+    cout << "=================================" << endl;
+}
+
+// Builds a library with a long returned history and live circulation,
+// damages a sample of records, then times the check at each thread count,
+// the repair, and a re-check of the repaired state.
+void LibrarySystem::runIntegrityBenchmark() {
+    long long history;
+    int max_threads, damaged;
+    cout << "Returned transactions in history: ";
+    cin >> history;
+    cout << "Maximum worker threads: ";
+    cin >> max_threads;
+    cout << "Records to damage: ";
+    cin >> damaged;
+    
+    WorkloadConfig config;
+    config.operations_per_day = 20000;
+    config.return_weight = 15;   // leaves most members with loans open
+    BenchmarkFixture<> bench(config);
+    LibrarySystem& target = bench.populate("Building synthetic catalog and history...");
+    WorkloadGenerator& generator = bench.generator;
+    int saved_day = bench.saved_day;
+    mt19937_64 rng(config.seed);
+    const long long PER_DAY = 20000;
+    {
+        lock_guard<mutex> lock(target.circulation_mutex);
+        for (long long i = 0; i < history; i++) {
+            Books* book = target.findBook(generator.book_ids[rng() % generator.book_ids.size()]);
+            const string& member_id = generator.member_ids[rng() % generator.member_ids.size()];
+            Transaction* transaction = new Transaction(target.transaction_counter++, book->book_Id, member_id, book->book_name);
+            transaction->issue_date = saved_day + (int)(i / PER_DAY);
+            transaction->due_date = transaction->issue_date + 14;
+            transaction->return_date = transaction->issue_date + rng() % 21;
+            transaction->is_returned = true;
+            target.transactions.push_back(transaction);
+            target.indexTransaction(transaction);
+        }
+    }
+    LibraryClock::set(saved_day + (int)(history / PER_DAY) + 1);
+    WorkloadResult result;
+    generator.run(target, result);
+    
+    // One damaged record of each kind in turn.
+    int applied = 0;
+    {
+        lock_guard<mutex> lock(target.circulation_mutex);
+        vector<Books*> books(target.book_collection.begin(), target.book_collection.end());
+        vector<Member*> members(target.members.begin(), target.members.end());
+        for (int i = 0; i < damaged * 4 && applied < damaged; i++) {
+            Books* book = books[rng() % books.size()];
+            Member* member = members[rng() % members.size()];
+            switch (i % 8) {
+                case 0:
+                    book->no_of_copies_issued++;
+                    break;
                 case 1:
-                    displayBooks();
+                    book->availability = !book->availability;
                     break;
                 case 2:
-                    displayMembers();
+                    if (member->issued_book_ids.empty()) {
+                        member->issued_book_ids.push_back(book->book_Id);
+                    } else {
+                        member->issued_book_ids.pop_back();
+                    }
                     break;
-                case 3: {
-                    int book_id;
-                    string member_id;
-                    cout << "Enter Book ID: ";
-                    cin >> book_id;
-                    cout << "Enter Member ID: ";
-                    cin >> member_id;
-                    try {
-                        issueBook(book_id, member_id);
-                    } catch (const LibraryException& e) {
-                        cout << "Error: " << e.what() << endl;
+                case 3:
+                    if (target.open_loans.empty()) {
+                        continue;
                     }
+                    target.open_loans.erase(next(target.open_loans.begin(), rng() % target.open_loans.size()));
                     break;
-                }
-                case 4: {
-                    int book_id;
-                    string member_id;
-                    cout << "Enter Book ID: ";
-                    cin >> book_id;
-                    cout << "Enter Member ID: ";
-                    cin >> member_id;
-                    try {
-                        returnBook(book_id, member_id);
-                    } catch (const LibraryException& e) {
-                        cout << "Error: " << e.what() << endl;
+                case 4:
+                    if (book->reserved_by.empty()) {
+                        continue;
                     }
+                    book->reserved_by.push_back(book->reserved_by.front());
                     break;
-                }
-                case 5: {
-                    int book_id;
-                    cout << "Enter Book ID to reserve: ";
-                    cin >> book_id;
-                    reserveBook(book_id);
+                case 5:
+                    if (member->fines.open_loans.empty()) {
+                        continue;
+                    }
+                    member->fines.open_loans.pop_back();
                     break;
-                }
                 case 6: {
-                    string member_id;
-                    cout << "Enter Member ID: ";
-                    cin >> member_id;
-                    clearFine(member_id);
-                    break;
-                }
-                case 7:
-                    displayTransactions();
-                    break;
-                case 8:
-                    generateReport();
-                    break;
-                case 9: {
-                    int sub_choice;
-                    cout << "\n1. Add Book" << endl;
-                    cout << "2. Add E-Book" << endl;
-                    cout << "3. Add Research Journal" << endl;
-                    cout << "4. Add Student" << endl;
-                    cout << "5. Add Faculty" << endl;
-                    cout << "Enter choice: ";
-                    cin >> sub_choice;
-                    
-                    switch (sub_choice) {
-                        case 1: {
-                            Books* new_book = new Books();
-                            new_book->add_book();
-                            try {
-                                addBook(new_book);
-                            } catch (const LibraryException& e) {
-                                cout << "Error: " << e.what() << endl;
-                                delete new_book;
-                            }
-                            break;
-                        }
-                        case 2: {
-                            EBook* new_ebook = new EBook();
-                            new_ebook->addEBook();
-                            try {
-                                addBook(new_ebook);
-                            } catch (const LibraryException& e) {
-                                cout << "Error: " << e.what() << endl;
-                                delete new_ebook;
-                            }
-                            break;
-                        }
-                        case 3: {
-                            ResearchJournal* new_journal = new ResearchJournal();
-                            new_journal->addJournal();
-                            try {
-                                addBook(new_journal);
-                            } catch (const LibraryException& e) {
-                                cout << "Error: " << e.what() << endl;
-                                delete new_journal;
-                            }
-                            break;
-                        }
-                        case 4: {
-                            Student* new_student = new Student();
-                            new_student->inputDetails();
-                            addMember(new_student);
-                            break;
-                        }
-                        case 5: {
-                            Faculty* new_faculty = new Faculty();
-                            new_faculty->inputDetails();
-                            addMember(new_faculty);
-                            break;
-                        }
-                        default:
-                            cout << "Invalid choice!" << endl;
+                    auto filed = target.transactions_by_member.find(member->member_id);
+                    if (filed == target.transactions_by_member.end() || filed->second.empty()) {
+                        continue;
                     }
+                    filed->second.pop_back();
                     break;
                 }
-                case 10:
-                    librarianLogout();
-                    break;
-                case 11:
-                    cout << "Thank you for using Smart Library Management System!" << endl;
-                    return;
                 default:
-                    cout << "Invalid choice! Please try again." << endl;
+                    if (target.reservation_queue.empty()) {
+                        continue;
+                    }
+                    target.reservation_queue.pop();
             }
+            applied++;
         }
     }
+    cout << "Damaged " << applied << " record(s)" << endl;
+    
+    cout << fixed << setprecision(3);
+    cout << right << setw(8) << "Threads" << setw(14) << "Seconds" << setw(18) << "Transactions/sec" << setw(12)
+         << "Violations" << endl;
+    for (int threads = 1; threads <= max(max_threads, 1); threads *= 2) {
+        IntegrityReport report = target.checkIntegrity(threads, false);
+        cout << setw(8) << threads << setw(14) << report.seconds << setw(18) << setprecision(0)
+             << report.transactions_checked / max(report.seconds, 1e-9) << setw(12) << report.violations.size()
+             << setprecision(3) << endl;
+    }
+    bench.restoreFormat();
+    cout << "\nRepair:" << endl;
+    target.checkIntegrity(max(max_threads, 1), true).display(10);
+    cout << "\nRe-check:" << endl;
+    target.checkIntegrity(max(max_threads, 1), false).display(10);
+    cout << "Hardware threads available: " << thread::hardware_concurrency() << endl;
+}
+
+// Result of the replica side of the self-test, passed back over a pipe.
+class ReplicaCheck {
+public:
+    uint64_t applied;
+    uint64_t apply_errors;
+    uint64_t digest;
+    double catch_up_ms;      // from the primary finishing to the replica holding every event
+    double lag_p50_ms;
+    double lag_p99_ms;
+    double lag_max_ms;
 };
 
-int main() {
+// The replica side of runReplicationSelfTest, run by main() in the child:
+// --replica-check <socket path>. Follows the primary until it has applied
+// the head the parent sends on standard input once its workload is done.
+int runReplicaCheck(int argc, char* argv[]) {
+    if (argc < 3) {
+        return 1;
+    }
+    LibrarySystem replica;
+    replica.setQuiet(true);
+    ReplicaApplier applier(replica);
+    applier.start(argv[2]);
+    uint64_t head = 0;
+    bool told = read(STDIN_FILENO, &head, sizeof(head)) == (ssize_t)sizeof(head);
+    auto start = chrono::steady_clock::now();
+    told = told && applier.waitFor(head, chrono::seconds(120));
+    ReplicaCheck check;
+    check.catch_up_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    applier.stop();
+    check.applied = applier.applied.load();
+    check.apply_errors = applier.apply_errors.load();
+    check.digest = replica.stateDigest();
+    check.lag_p50_ms = applier.lag.percentile(0.50) / 1e6;
+    check.lag_p99_ms = applier.lag.percentile(0.99) / 1e6;
+    check.lag_max_ms = applier.lag.percentile(1.0) / 1e6;
+    return told ? reportToParent(check) : 1;
+}
+
+// Runs a synthetic workload on a primary that ships its log to a replica in
+// a child process, then compares the two states.
+void LibrarySystem::runReplicationSelfTest() {
+    WorkloadConfig config;
+    cout << "Operations on the primary: ";
+    cin >> config.operations;
+    config.threads = 1;   // the generator moves the clock itself; one thread keeps that in log order
+    config.target_rate = 0;
+    
+    string socket_path = "/tmp/library-replica-test-" + to_string(getpid()) + ".sock";
+    BenchmarkFixture<> bench(config);
+    LibrarySystem& primary = bench.target();
+    if (!primary.startLogShipping(socket_path)) {
+        return;
+    }
+    // The head goes over a socket pair so a failed child cannot raise SIGPIPE here.
+    int channel[2], finished[2];
+    if (pipe2(channel, O_CLOEXEC) != 0 || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, finished) != 0) {
+        cout << "Could not create pipe: " << strerror(errno) << endl;
+        return;
+    }
+    pid_t child = spawnSelf({"--replica-check", socket_path}, finished[0], channel[1]);
+    close(channel[1]);
+    close(finished[0]);
+    if (child < 0) {
+        cout << "Could not start the replica process: " << strerror(errno) << endl;
+        close(channel[0]);
+        close(finished[1]);
+        return;
+    }
+    
+    cout << "Replica process " << child << " following " << socket_path << endl;
+    WorkloadResult result;
+    auto start = chrono::steady_clock::now();
+    bench.populate("");
+    primary.addLibrarian(new Librarian("Replica Test Desk", 1, "desk@library.com", "replica-test"));
+    bench.generator.run(primary, result);
+    primary.advanceDays(0);   // the generator moved the clock directly; log where it ended
+    double primary_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    uint64_t head = primary.replication_log->head();
+    ssize_t written = send(finished[1], &head, sizeof(head), MSG_NOSIGNAL);
+    close(finished[1]);
+    
+    ReplicaCheck check;
+    bool received = written == (ssize_t)sizeof(head) && read(channel[0], &check, sizeof(check)) == (ssize_t)sizeof(check);
+    close(channel[0]);
+    waitpid(child, nullptr, 0);
+    uint64_t digest = primary.stateDigest();
+    primary.log_shipper->stop();
+    primary.replication_log->removeSegments();
+    rmdir(primary.replication_log->directory.c_str());
+    
+    if (!received) {
+        cout << "The replica process did not report a result!" << endl;
+        return;
+    }
+    cout << fixed << setprecision(2);
+    cout << "\n======= REPLICATION SELF-TEST =======" << endl;
+    cout << "Primary: " << config.books << " books, " << config.members << " members, " << result.completed.load()
+         << " operations completed (" << result.rejected.load() << " rejected) in " << primary_seconds << " s" << endl;
+    cout << "Log: " << head << " events, " << primary.replication_log->bytes.load() / 1048576.0 << " MB" << endl;
+    cout << "Replica applied: " << check.applied << " (" << check.apply_errors << " rejected by the replay)" << endl;
+    cout << "State digest: primary " << hex << digest << ", replica " << check.digest << dec
+         << (digest == check.digest ? " (match)" : " (MISMATCH)") << endl;
+    cout << "Commit-to-apply lag: p50 " << check.lag_p50_ms << " ms, p99 " << check.lag_p99_ms << " ms, max "
+         << check.lag_max_ms << " ms" << endl;
+    cout << "Replica caught up " << check.catch_up_ms << " ms after the primary finished" << endl;
+    cout << "=====================================" << endl;
+}
+
+// Runs the HTTP service over the sample library until SIGINT or SIGTERM,
+// shipping its log on replica_socket when one is given.
+int LibrarySystem::serve(uint16_t port, const sigset_t& stop_signals, const string& replica_socket) {
+    console.rdbuf(nullptr);
+    // Per port, so the desk and other services in this directory keep their own segments.
+    enableArchive("library_archive_" + to_string(port), 90);
+    if (!replica_socket.empty()) {
+        if (!startLogShipping(replica_socket)) {
+            return 1;
+        }
+        cout << "Shipping the change log on " << replica_socket << endl;
+    }
+    addSampleData();
+    LibraryHttpService service(*this, max(2, (int)thread::hardware_concurrency()));
+    if (!service.start(port)) {
+        return 1;
+    }
+    cout << "Serving on http://127.0.0.1:" << service.bound_port << " (Ctrl+C to stop)" << endl;
+    int received;
+    sigwait(&stop_signals, &received);
+    service.stop();
+    service.displayStats();
+    if (log_shipper) {
+        log_shipper->displayStatus();
+        log_shipper->stop();
+    }
+    return 0;
+}
+
+// Serves reads from a replica of the primary shipping on primary_socket.
+// Returns REPLICA_RESYNC if the primary restarted with a new log; the caller
+// then serves again from a new, empty LibrarySystem.
+int LibrarySystem::serveReplica(const string& primary_socket, uint16_t port, const sigset_t& stop_signals) {
+    setQuiet(true);
+    enableArchive("library_replica_archive_" + to_string(port), 90);
+    ReplicaApplier applier(*this);
+    applier.on_resync = [] { kill(getpid(), SIGTERM); };   // wakes the sigwait below
+    applier.start(primary_socket);
+    LibraryHttpService service(*this, max(2, (int)thread::hardware_concurrency()));
+    service.replica = &applier;
+    if (!service.start(port)) {
+        return 1;
+    }
+    cout << "Read replica of " << primary_socket << " serving on http://127.0.0.1:" << service.bound_port
+         << " (Ctrl+C to stop)" << endl;
+    int received;
+    sigwait(&stop_signals, &received);
+    service.stop();
+    applier.stop();
+    service.displayStats();
+    applier.displayStatus();
+    if (applier.resync_needed.load()) {
+        cout << "The primary restarted with a new log; rebuilding this replica from its start." << endl;
+        return REPLICA_RESYNC;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    string mode = argc > 1 ? argv[1] : "";
+    // Child processes of the benchmarks, started by spawnSelf().
+    if (mode == "--service-load-client") {
+        return runServiceLoadClient(argc, argv);
+    }
+    if (mode == "--ebook-client") {
+        return runEBookClient(argc, argv);
+    }
+    if (mode == "--replica-check") {
+        return runReplicaCheck(argc, argv);
+    }
+    if (mode == "--serve" || mode == "--primary" || mode == "--replica") {
+        // Blocked before any thread starts so every thread inherits the mask
+        // and the signals are left for sigwait() in serve().
+        sigset_t stop_signals;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+        if (mode == "--serve") {
+            LibrarySystem library;
+            return library.serve(argc > 2 ? atoi(argv[2]) : 8080, stop_signals);
+        }
+        if (argc < 3) {
+            cout << "Usage: " << argv[0] << " " << mode << " <socket path> [port]" << endl;
+            return 1;
+        }
+        if (mode == "--primary") {
+            LibrarySystem library;
+            return library.serve(argc > 3 ? atoi(argv[3]) : 8080, stop_signals, argv[2]);
+        }
+        int status;
+        do {
+            LibrarySystem replica;
+            status = replica.serveReplica(argv[2], argc > 3 ? atoi(argv[3]) : 8081, stop_signals);
+        } while (status == LibrarySystem::REPLICA_RESYNC);
+        return status;
+    }
+    
     LibrarySystem library;
     library.run();
     return 0;